@@ -21,6 +21,9 @@
 
 #define SECTOR_SIZE 512
 
+/* Returns the byte offset on the volume where the file data starts */
+typedef ARC_STATUS (*FS_GET_FILE_LOCATION)(ULONG FileId, PULONGLONG Location);
+
 typedef struct tagDEVVTBL
 {
     ARC_CLOSE Close;
@@ -29,6 +32,7 @@ typedef struct tagDEVVTBL
     ARC_READ Read;
     ARC_SEEK Seek;
     PCWSTR ServiceName;
+    FS_GET_FILE_LOCATION GetFileLocation; // Optional
 } DEVVTBL;
 
 #define MAX_FDS 60
@@ -62,6 +66,7 @@ FsRegisterDevice(
     _In_ const DEVVTBL* FuncTable);
 
 PCWSTR FsGetServiceName(ULONG FileId);
+ARC_STATUS FsGetFileLocation(ULONG FileId, PULONGLONG Location);
 VOID  FsSetDeviceSpecific(ULONG FileId, PVOID Specific);
 PVOID FsGetDeviceSpecific(ULONG FileId);
 ULONG FsGetDeviceId(ULONG FileId);
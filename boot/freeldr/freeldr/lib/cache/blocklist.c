@@ -22,14 +22,44 @@
 #include <debug.h>
 DBG_DEFAULT_CHANNEL(CACHE);
 
+static PLIST_ENTRY CacheInternalHashBucket(PCACHE_DRIVE CacheDrive, ULONG BlockNumber)
+{
+    // Neighbouring blocks go to neighbouring buckets
+    return &CacheDrive->CacheBlockHash[BlockNumber & (CACHE_HASH_SIZE - 1)];
+}
+
+static PCACHE_BLOCK CacheInternalLookupBlock(PCACHE_DRIVE CacheDrive, ULONG BlockNumber)
+{
+    PLIST_ENTRY        Bucket;
+    PLIST_ENTRY        Entry;
+    PCACHE_BLOCK    CacheBlock;
+
+    Bucket = CacheInternalHashBucket(CacheDrive, BlockNumber);
+    for (Entry = Bucket->Flink; Entry != Bucket; Entry = Entry->Flink)
+    {
+        CacheBlock = CONTAINING_RECORD(Entry, CACHE_BLOCK, HashEntry);
+        if (CacheBlock->BlockNumber == BlockNumber)
+        {
+            return CacheBlock;
+        }
+    }
+
+    return NULL;
+}
+
 // Returns a pointer to a CACHE_BLOCK structure
 // Adds the block to the cache manager block list
-// in cache memory if it isn't already there
-PCACHE_BLOCK CacheInternalGetBlockPointer(PCACHE_DRIVE CacheDrive, ULONG BlockNumber)
+// in cache memory if it isn't already there. On a miss
+// the uncached blocks that follow it, up to LastBlock,
+// are read in with the same transfer.
+PCACHE_BLOCK CacheInternalGetBlockPointer(PCACHE_DRIVE CacheDrive, ULONG BlockNumber, ULONG LastBlock)
 {
     PCACHE_BLOCK    CacheBlock = NULL;
+    SIZE_T            BlockBytes;
+    ULONG            MaxBlockCount;
+    ULONG            BlockCount;
 
-    TRACE("CacheInternalGetBlockPointer() BlockNumber = %d\n", BlockNumber);
+    TRACE("CacheInternalGetBlockPointer() BlockNumber = %d LastBlock = %d\n", BlockNumber, LastBlock);
 
     CacheBlock = CacheInternalFindBlock(CacheDrive, BlockNumber);
 
@@ -37,12 +67,36 @@ PCACHE_BLOCK CacheInternalGetBlockPointer(PCACHE_DRIVE CacheDrive, ULONG BlockNu
     {
         TRACE("Cache hit! BlockNumber: %d CacheBlock->BlockNumber: %d\n", BlockNumber, CacheBlock->BlockNumber);
 
+        // Optimize the block list so it has a LRU structure
+        CacheInternalOptimizeBlockList(CacheDrive, CacheBlock);
+
         return CacheBlock;
     }
 
     TRACE("Cache miss! BlockNumber: %d\n", BlockNumber);
 
-    CacheBlock = CacheInternalAddBlockToCache(CacheDrive, BlockNumber);
+    // A single transfer goes through DiskReadBuffer, so that bounds how many
+    // blocks we can read at once. Also don't let one miss push more than half
+    // of the cache out.
+    BlockBytes = CacheDrive->BlockSize * CacheDrive->BytesPerSector;
+    MaxBlockCount = (ULONG)min(DiskReadBufferSize / BlockBytes, CacheSizeLimit / BlockBytes / 2);
+    MaxBlockCount = max(MaxBlockCount, 1);
+
+    // Coalesce the run of uncached blocks that follows this one
+    BlockCount = 1;
+    while ((BlockCount < MaxBlockCount) &&
+           (BlockNumber + BlockCount > BlockNumber) &&
+           (BlockNumber + BlockCount <= LastBlock) &&
+           (CacheInternalLookupBlock(CacheDrive, BlockNumber + BlockCount) == NULL))
+    {
+        BlockCount++;
+    }
+
+    CacheBlock = CacheInternalAddBlockToCache(CacheDrive, BlockNumber, BlockCount);
+    if (CacheBlock == NULL)
+    {
+        return NULL;
+    }
 
     // Optimize the block list so it has a LRU structure
     CacheInternalOptimizeBlockList(CacheDrive, CacheBlock);
@@ -52,91 +106,99 @@ PCACHE_BLOCK CacheInternalGetBlockPointer(PCACHE_DRIVE CacheDrive, ULONG BlockNu
 
 PCACHE_BLOCK CacheInternalFindBlock(PCACHE_DRIVE CacheDrive, ULONG BlockNumber)
 {
-    PCACHE_BLOCK    CacheBlock = NULL;
+    PCACHE_BLOCK    CacheBlock;
 
     TRACE("CacheInternalFindBlock() BlockNumber = %d\n", BlockNumber);
 
-    //
-    // Make sure the block list has entries before I start searching it.
-    //
-    if (!IsListEmpty(&CacheDrive->CacheBlockHead))
+    CacheBlock = CacheInternalLookupBlock(CacheDrive, BlockNumber);
+    if (CacheBlock != NULL)
     {
         //
-        // Search the list and find the BIOS drive number
+        // Increment the blocks access count
         //
-        CacheBlock = CONTAINING_RECORD(CacheDrive->CacheBlockHead.Flink, CACHE_BLOCK, ListEntry);
-
-        while (&CacheBlock->ListEntry != &CacheDrive->CacheBlockHead)
-        {
-            //
-            // We found the block, so return it
-            //
-            if (CacheBlock->BlockNumber == BlockNumber)
-            {
-                //
-                // Increment the blocks access count
-                //
-                CacheBlock->AccessCount++;
-
-                return CacheBlock;
-            }
-
-            CacheBlock = CONTAINING_RECORD(CacheBlock->ListEntry.Flink, CACHE_BLOCK, ListEntry);
-        }
+        CacheBlock->AccessCount++;
     }
 
-    return NULL;
+    return CacheBlock;
 }
 
-PCACHE_BLOCK CacheInternalAddBlockToCache(PCACHE_DRIVE CacheDrive, ULONG BlockNumber)
+PCACHE_BLOCK CacheInternalAddBlockToCache(PCACHE_DRIVE CacheDrive, ULONG BlockNumber, ULONG BlockCount)
 {
-    PCACHE_BLOCK    CacheBlock = NULL;
+    PCACHE_BLOCK    CacheBlock;
+    PCACHE_BLOCK    FirstCacheBlock = NULL;
+    SIZE_T            BlockBytes;
+    ULONG            Idx;
 
-    TRACE("CacheInternalAddBlockToCache() BlockNumber = %d\n", BlockNumber);
+    TRACE("CacheInternalAddBlockToCache() BlockNumber = %d BlockCount = %d\n", BlockNumber, BlockCount);
 
-    // Check the size of the cache so we don't exceed our limits
-    CacheInternalCheckCacheSizeLimits(CacheDrive);
+    BlockBytes = CacheDrive->BlockSize * CacheDrive->BytesPerSector;
 
-    // We will need to add the block to the
-    // drive's list of cached blocks. So allocate
-    // the block memory.
-    CacheBlock = FrLdrTempAlloc(sizeof(CACHE_BLOCK), TAG_CACHE_BLOCK);
-    if (CacheBlock == NULL)
+    // Now try to read in the blocks with a single transfer. The blocks
+    // read ahead may lie past the end of the disk, so if that fails
+    // fall back to reading just the block that was asked for.
+    if (!MachDiskReadLogicalSectors(CacheDrive->DriveNumber,
+                                    (ULONGLONG)BlockNumber * CacheDrive->BlockSize,
+                                    BlockCount * CacheDrive->BlockSize,
+                                    DiskReadBuffer))
     {
-        return NULL;
-    }
+        if (BlockCount == 1)
+        {
+            return NULL;
+        }
 
-    // Now initialize the structure and
-    // allocate room for the block data
-    RtlZeroMemory(CacheBlock, sizeof(CACHE_BLOCK));
-    CacheBlock->BlockNumber = BlockNumber;
-    CacheBlock->BlockData = FrLdrTempAlloc(CacheDrive->BlockSize * CacheDrive->BytesPerSector,
-                                           TAG_CACHE_DATA);
-    if (CacheBlock->BlockData ==NULL)
-    {
-        FrLdrTempFree(CacheBlock, TAG_CACHE_BLOCK);
-        return NULL;
+        BlockCount = 1;
+        if (!MachDiskReadLogicalSectors(CacheDrive->DriveNumber,
+                                        (ULONGLONG)BlockNumber * CacheDrive->BlockSize,
+                                        CacheDrive->BlockSize,
+                                        DiskReadBuffer))
+        {
+            return NULL;
+        }
     }
 
-    // Now try to read in the block
-    if (!MachDiskReadLogicalSectors(CacheDrive->DriveNumber, (BlockNumber * CacheDrive->BlockSize), CacheDrive->BlockSize, DiskReadBuffer))
+    for (Idx = 0; Idx < BlockCount; Idx++)
     {
-        FrLdrTempFree(CacheBlock->BlockData, TAG_CACHE_DATA);
-        FrLdrTempFree(CacheBlock, TAG_CACHE_BLOCK);
-        return NULL;
-    }
-    RtlCopyMemory(CacheBlock->BlockData, DiskReadBuffer, CacheDrive->BlockSize * CacheDrive->BytesPerSector);
+        // Check the size of the cache so we don't exceed our limits
+        CacheInternalCheckCacheSizeLimits(CacheDrive);
+
+        // We will need to add the block to the
+        // drive's list of cached blocks. So allocate
+        // the block memory.
+        CacheBlock = FrLdrTempAlloc(sizeof(CACHE_BLOCK), TAG_CACHE_BLOCK);
+        if (CacheBlock == NULL)
+        {
+            break;
+        }
 
-    // Add it to our list of blocks managed by the cache
-    InsertTailList(&CacheDrive->CacheBlockHead, &CacheBlock->ListEntry);
+        // Now initialize the structure and
+        // allocate room for the block data
+        RtlZeroMemory(CacheBlock, sizeof(CACHE_BLOCK));
+        CacheBlock->BlockNumber = BlockNumber + Idx;
+        CacheBlock->BlockData = FrLdrTempAlloc(BlockBytes, TAG_CACHE_DATA);
+        if (CacheBlock->BlockData == NULL)
+        {
+            FrLdrTempFree(CacheBlock, TAG_CACHE_BLOCK);
+            break;
+        }
+        RtlCopyMemory(CacheBlock->BlockData, (PUCHAR)DiskReadBuffer + Idx * BlockBytes, BlockBytes);
 
-    // Update the cache data
-    CacheBlockCount++;
-    CacheSizeCurrent = CacheBlockCount * (CacheDrive->BlockSize * CacheDrive->BytesPerSector);
+        // Add it to our list of blocks managed by the cache
+        InsertHeadList(&CacheDrive->CacheBlockHead, &CacheBlock->ListEntry);
+        InsertHeadList(CacheInternalHashBucket(CacheDrive, CacheBlock->BlockNumber), &CacheBlock->HashEntry);
+
+        // Update the cache data
+        CacheBlockCount++;
+        CacheSizeCurrent = CacheBlockCount * BlockBytes;
+
+        if (FirstCacheBlock == NULL)
+        {
+            FirstCacheBlock = CacheBlock;
+        }
+    }
 
     CacheInternalDumpBlockList(CacheDrive);
 
-    return CacheBlock;
+    return FirstCacheBlock;
 }
 
 BOOLEAN CacheInternalFreeBlock(PCACHE_DRIVE CacheDrive)
@@ -156,12 +218,13 @@ BOOLEAN CacheInternalFreeBlock(PCACHE_DRIVE CacheDrive)
 
     // No blocks left in cache that can be freed
     // so just return
-    if (IsListEmpty(&CacheDrive->CacheBlockHead))
+    if (&CacheBlockToFree->ListEntry == &CacheDrive->CacheBlockHead)
     {
         return FALSE;
     }
 
     RemoveEntryList(&CacheBlockToFree->ListEntry);
+    RemoveEntryList(&CacheBlockToFree->HashEntry);
 
     // Free the block memory and the block structure
     FrLdrTempFree(CacheBlockToFree->BlockData, TAG_CACHE_DATA);
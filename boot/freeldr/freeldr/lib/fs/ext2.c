@@ -1213,6 +1213,18 @@ ARC_STATUS Ext2GetFileInformation(ULONG FileId, FILEINFORMATION* Information)
     return ESUCCESS;
 }
 
+static ARC_STATUS Ext2GetFileLocation(ULONG FileId, PULONGLONG Location)
+{
+    PEXT2_FILE_INFO FileHandle = FsGetDeviceSpecific(FileId);
+
+    /* Fast symlinks and empty files have no data blocks */
+    if (FileHandle->FileBlockList == NULL || FileHandle->FileBlockList[0] == 0)
+        return EINVAL;
+
+    *Location = (ULONGLONG)FileHandle->FileBlockList[0] * FileHandle->Volume->BlockSizeInBytes;
+    return ESUCCESS;
+}
+
 ARC_STATUS Ext2Open(CHAR* Path, OPENMODE OpenMode, ULONG* FileId)
 {
     PEXT2_VOLUME_INFO Volume;
@@ -1293,6 +1305,7 @@ const DEVVTBL Ext2FuncTable =
     Ext2Read,
     Ext2Seek,
     L"ext2fs",
+    Ext2GetFileLocation,
 };
 
 const DEVVTBL* Ext2Mount(ULONG DeviceId)
@@ -1417,6 +1417,20 @@ ARC_STATUS FatGetFileInformation(ULONG FileId, FILEINFORMATION* Information)
     return ESUCCESS;
 }
 
+static ARC_STATUS FatGetFileLocation(ULONG FileId, PULONGLONG Location)
+{
+    PFAT_FILE_INFO FileHandle = FsGetDeviceSpecific(FileId);
+    PFAT_VOLUME_INFO Volume = FileHandle->Volume;
+
+    /* Empty files have no cluster */
+    if (FileHandle->StartCluster < 2)
+        return EINVAL;
+
+    *Location = ((ULONGLONG)(FileHandle->StartCluster - 2) * Volume->SectorsPerCluster +
+                 Volume->DataSectorStart) * Volume->BytesPerSector;
+    return ESUCCESS;
+}
+
 ARC_STATUS FatOpen(CHAR* Path, OPENMODE OpenMode, ULONG* FileId)
 {
     PFAT_VOLUME_INFO FatVolume;
@@ -1548,6 +1562,7 @@ const DEVVTBL FatFuncTable =
     FatRead,
     FatSeek,
     L"fastfat",
+    FatGetFileLocation,
 };
 
 const DEVVTBL FatXFuncTable =
@@ -1558,6 +1573,7 @@ const DEVVTBL FatXFuncTable =
     FatRead,
     FatSeek,
     L"vfatfs",
+    FatGetFileLocation,
 };
 
 const DEVVTBL* FatMount(ULONG DeviceId)
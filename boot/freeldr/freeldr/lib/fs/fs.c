@@ -622,6 +622,15 @@ PCWSTR FsGetServiceName(ULONG FileId)
     return FileData[FileId].FuncTable->ServiceName;
 }
 
+ARC_STATUS FsGetFileLocation(ULONG FileId, PULONGLONG Location)
+{
+    if (!IS_VALID_FILEID(FileId))
+        return EBADF;
+    if (!FileData[FileId].FuncTable->GetFileLocation)
+        return EINVAL;
+    return FileData[FileId].FuncTable->GetFileLocation(FileId, Location);
+}
+
 VOID FsSetDeviceSpecific(ULONG FileId, PVOID Specific)
 {
     if (!IS_VALID_FILEID(FileId))
@@ -376,64 +376,158 @@ WinLdrLoadDeviceDriver(PLIST_ENTRY LoadOrderListHead,
     return TRUE;
 }
 
+#define TAG_BOOT_DRIVER_ORDER 'oDtB'
+
+typedef struct _BOOT_DRIVER_LOCATION
+{
+    PBOOT_DRIVER_NODE DriverNode;
+    ULONGLONG Location;
+} BOOT_DRIVER_LOCATION, *PBOOT_DRIVER_LOCATION;
+
+static ULONGLONG
+WinLdrGetBootDriverLocation(PCSTR BootPath,
+                            PUNICODE_STRING FilePath)
+{
+    CHAR FullPath[1024];
+    ULONGLONG Location;
+    ULONG FileId;
+
+    RtlStringCbPrintfA(FullPath, sizeof(FullPath), "%s%wZ", BootPath, FilePath);
+    if (ArcOpen(FullPath, OpenReadOnly, &FileId) != ESUCCESS)
+        return MAXULONGLONG;
+
+    /* File systems that can't tell sort last */
+    if (FsGetFileLocation(FileId, &Location) != ESUCCESS)
+        Location = MAXULONGLONG;
+
+    ArcClose(FileId);
+    return Location;
+}
+
+static BOOLEAN
+WinLdrLoadBootDriver(PLOADER_PARAMETER_BLOCK LoaderBlock,
+                     PCSTR BootPath,
+                     PBOOT_DRIVER_NODE DriverNode)
+{
+    PBOOT_DRIVER_LIST_ENTRY BootDriver = &DriverNode->ListEntry;
+    BOOLEAN Success;
+
+    TRACE("BootDriver %wZ DTE %08X RegPath: %wZ\n",
+          &BootDriver->FilePath, BootDriver->LdrEntry,
+          &BootDriver->RegistryPath);
+
+    // Paths are relative (FIXME: Are they always relative?)
+
+    /* Load it */
+    UiIndicateProgress();
+    Success = WinLdrLoadDeviceDriver(&LoaderBlock->LoadOrderListHead,
+                                     BootPath,
+                                     &BootDriver->FilePath,
+                                     0,
+                                     &BootDriver->LdrEntry);
+    if (Success)
+    {
+        /* Convert the addresses to VA since we are not going to use them anymore */
+        BootDriver->RegistryPath.Buffer = PaToVa(BootDriver->RegistryPath.Buffer);
+        BootDriver->FilePath.Buffer = PaToVa(BootDriver->FilePath.Buffer);
+        BootDriver->LdrEntry = PaToVa(BootDriver->LdrEntry);
+
+        if (DriverNode->Group.Buffer)
+            DriverNode->Group.Buffer = PaToVa(DriverNode->Group.Buffer);
+        DriverNode->Name.Buffer = PaToVa(DriverNode->Name.Buffer);
+    }
+    else
+    {
+        /* Loading failed: cry loudly */
+        ERR("Cannot load boot driver '%wZ'!\n", &BootDriver->FilePath);
+        UiMessageBox("Cannot load boot driver '%wZ'!", &BootDriver->FilePath);
+
+        /* Remove it from the list and try to continue */
+        RemoveEntryList(&BootDriver->Link);
+    }
+
+    return Success;
+}
+
 BOOLEAN
 WinLdrLoadBootDrivers(PLOADER_PARAMETER_BLOCK LoaderBlock,
                       PCSTR BootPath)
 {
     PLIST_ENTRY NextBd;
     PBOOT_DRIVER_NODE DriverNode;
-    PBOOT_DRIVER_LIST_ENTRY BootDriver;
-    BOOLEAN Success;
+    PBOOT_DRIVER_LOCATION Drivers;
+    BOOT_DRIVER_LOCATION Current;
+    ULONG DriverCount = 0;
+    ULONG i, j;
     BOOLEAN ret = TRUE;
 
-    /* Walk through the boot drivers list */
-    NextBd = LoaderBlock->BootDriverListHead.Flink;
-    while (NextBd != &LoaderBlock->BootDriverListHead)
+    for (NextBd = LoaderBlock->BootDriverListHead.Flink;
+         NextBd != &LoaderBlock->BootDriverListHead;
+         NextBd = NextBd->Flink)
     {
-        DriverNode = CONTAINING_RECORD(NextBd,
-                                       BOOT_DRIVER_NODE,
-                                       ListEntry.Link);
-        BootDriver = &DriverNode->ListEntry;
+        DriverCount++;
+    }
 
-        /* Get the next list entry as we may remove the current one on failure */
-        NextBd = BootDriver->Link.Flink;
+    Drivers = NULL;
+    if (DriverCount > 0)
+        Drivers = FrLdrTempAlloc(DriverCount * sizeof(BOOT_DRIVER_LOCATION), TAG_BOOT_DRIVER_ORDER);
 
-        TRACE("BootDriver %wZ DTE %08X RegPath: %wZ\n",
-              &BootDriver->FilePath, BootDriver->LdrEntry,
-              &BootDriver->RegistryPath);
+    if (!Drivers)
+    {
+        /* Walk through the boot drivers list */
+        NextBd = LoaderBlock->BootDriverListHead.Flink;
+        while (NextBd != &LoaderBlock->BootDriverListHead)
+        {
+            DriverNode = CONTAINING_RECORD(NextBd,
+                                           BOOT_DRIVER_NODE,
+                                           ListEntry.Link);
 
-        // Paths are relative (FIXME: Are they always relative?)
+            /* Get the next list entry as we may remove the current one on failure */
+            NextBd = NextBd->Flink;
 
-        /* Load it */
-        UiIndicateProgress();
-        Success = WinLdrLoadDeviceDriver(&LoaderBlock->LoadOrderListHead,
-                                         BootPath,
-                                         &BootDriver->FilePath,
-                                         0,
-                                         &BootDriver->LdrEntry);
-        if (Success)
-        {
-            /* Convert the addresses to VA since we are not going to use them anymore */
-            BootDriver->RegistryPath.Buffer = PaToVa(BootDriver->RegistryPath.Buffer);
-            BootDriver->FilePath.Buffer = PaToVa(BootDriver->FilePath.Buffer);
-            BootDriver->LdrEntry = PaToVa(BootDriver->LdrEntry);
-
-            if (DriverNode->Group.Buffer)
-                DriverNode->Group.Buffer = PaToVa(DriverNode->Group.Buffer);
-            DriverNode->Name.Buffer = PaToVa(DriverNode->Name.Buffer);
+            if (!WinLdrLoadBootDriver(LoaderBlock, BootPath, DriverNode))
+                ret = FALSE;
         }
-        else
-        {
-            /* Loading failed: cry loudly */
-            ERR("Cannot load boot driver '%wZ'!\n", &BootDriver->FilePath);
-            UiMessageBox("Cannot load boot driver '%wZ'!", &BootDriver->FilePath);
-            ret = FALSE;
 
-            /* Remove it from the list and try to continue */
-            RemoveEntryList(&BootDriver->Link);
-        }
+        return ret;
+    }
+
+    /*
+     * Read the drivers in the order their files lie on the volume, so that
+     * the disk cache can coalesce them instead of seeking back and forth.
+     * The list itself keeps its order, the kernel initializes the drivers
+     * in that order. Drivers at the same (or an unknown) location keep
+     * their relative order.
+     */
+    i = 0;
+    for (NextBd = LoaderBlock->BootDriverListHead.Flink;
+         NextBd != &LoaderBlock->BootDriverListHead;
+         NextBd = NextBd->Flink)
+    {
+        DriverNode = CONTAINING_RECORD(NextBd,
+                                       BOOT_DRIVER_NODE,
+                                       ListEntry.Link);
+        Current.DriverNode = DriverNode;
+        Current.Location = WinLdrGetBootDriverLocation(BootPath,
+                                                       &DriverNode->ListEntry.FilePath);
+
+        /* Insertion sort, stable */
+        for (j = i; j > 0 && Drivers[j - 1].Location > Current.Location; j--)
+            Drivers[j] = Drivers[j - 1];
+        Drivers[j] = Current;
+        i++;
+    }
+
+    for (i = 0; i < DriverCount; i++)
+    {
+        TRACE("Loading boot driver %wZ at 0x%I64x\n",
+              &Drivers[i].DriverNode->ListEntry.FilePath, Drivers[i].Location);
+
+        if (!WinLdrLoadBootDriver(LoaderBlock, BootPath, Drivers[i].DriverNode))
+            ret = FALSE;
     }
 
+    FrLdrTempFree(Drivers, TAG_BOOT_DRIVER_ORDER);
     return ret;
 }
 
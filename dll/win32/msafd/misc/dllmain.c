@@ -862,6 +862,7 @@ WSPBind(SOCKET Handle,
        if (lpErrno) *lpErrno = WSAENOTSOCK;
        return SOCKET_ERROR;
     }
+    SockUpdateReusedSocket(Socket);
     if (Socket->SharedData->State != SocketOpen)
     {
        if (lpErrno) *lpErrno = WSAEINVAL;
@@ -2490,6 +2491,7 @@ WSPIoctl(IN  SOCKET Handle,
                 GUID ConnectExGUID = WSAID_CONNECTEX;
                 GUID DisconnectExGUID = WSAID_DISCONNECTEX;
                 GUID GetAcceptExSockaddrsGUID = WSAID_GETACCEPTEXSOCKADDRS;
+                GUID TransmitFileGUID = WSAID_TRANSMITFILE;
 
                 if (IsEqualGUID(&AcceptExGUID, lpvInBuffer))
                 {
@@ -2517,12 +2519,14 @@ WSPIoctl(IN  SOCKET Handle,
                     *((PVOID *)lpvOutBuffer) = WSPGetAcceptExSockaddrs;
                     cbRet = sizeof(PVOID);
                     Errno = NO_ERROR;
-                    /* See CORE-14966 and associated commits.
-                     * Original line below was 'Ret = NO_ERROR:'.
-                     * This caused winetest ws2_32:sock to hang.
-                     * This new Ret value allows the test to complete. */
-                    ERR("SIO_GET_EXTENSION_FUNCTION_POINTER UNIMPLEMENTED\n");
-                    Ret = SOCKET_ERROR;
+                    Ret = NO_ERROR;
+                }
+                else if (IsEqualGUID(&TransmitFileGUID, lpvInBuffer))
+                {
+                    *((PVOID *)lpvOutBuffer) = WSPTransmitFile;
+                    cbRet = sizeof(PVOID);
+                    Errno = NO_ERROR;
+                    Ret = NO_ERROR;
                 }
                 else
                 {
@@ -2792,6 +2796,7 @@ WSPSetSockOpt(
 {
     PSOCKET_INFORMATION Socket;
     INT Errno;
+    ULONG BufferSize;
 
     /* Get the Socket Structure associate to this Socket*/
     Socket = GetSocketStructure(s);
@@ -2890,6 +2895,16 @@ WSPSetSockOpt(
                                    NULL,
                                    NULL);
 
+              /* Let the transport size its buffers as well */
+              Socket->HelperData->WSHSetSocketInformation(Socket->HelperContext,
+                                                          s,
+                                                          Socket->TdiAddressHandle,
+                                                          Socket->TdiConnectionHandle,
+                                                          level,
+                                                          optname,
+                                                          (PCHAR)optval,
+                                                          optlen);
+
               return NO_ERROR;
 
            case SO_RCVBUF:
@@ -2899,6 +2914,9 @@ WSPSetSockOpt(
                   return SOCKET_ERROR;
               }
 
+              /* The transport gets the size that was asked for */
+              BufferSize = *(PULONG)optval;
+
               /* FIXME: We should not have to limit the packet receive buffer size like this. workaround for CORE-15804 */
               if (*(PULONG)optval > 0x2000)
                   *(PULONG)optval = 0x2000;
@@ -2918,6 +2936,15 @@ WSPSetSockOpt(
                                    NULL,
                                    NULL);
 
+              Socket->HelperData->WSHSetSocketInformation(Socket->HelperContext,
+                                                          s,
+                                                          Socket->TdiAddressHandle,
+                                                          Socket->TdiConnectionHandle,
+                                                          level,
+                                                          optname,
+                                                          (PCHAR)&BufferSize,
+                                                          sizeof(BufferSize));
+
               return NO_ERROR;
 
            case SO_ERROR:
@@ -2956,6 +2983,34 @@ WSPSetSockOpt(
                             sizeof(DWORD));
               return NO_ERROR;
 
+           case SO_UPDATE_ACCEPT_CONTEXT:
+           {
+              PSOCKET_INFORMATION ListenSocket;
+
+              if (optlen < sizeof(SOCKET))
+              {
+                  if (lpErrno) *lpErrno = WSAEFAULT;
+                  return SOCKET_ERROR;
+              }
+              ListenSocket = GetSocketStructure(*(SOCKET*)optval);
+              if (ListenSocket == NULL)
+              {
+                  if (lpErrno) *lpErrno = WSAENOTSOCK;
+                  return SOCKET_ERROR;
+              }
+              /* The socket was connected by AcceptEx */
+              Socket->SharedData->State = SocketConnected;
+              Socket->SharedData->ConnectTime = GetCurrentTimeInSeconds();
+              Socket->SharedData->NonBlocking = ListenSocket->SharedData->NonBlocking;
+              return NO_ERROR;
+           }
+
+           case SO_UPDATE_CONNECT_CONTEXT:
+              /* The socket was connected by ConnectEx */
+              Socket->SharedData->State = SocketConnected;
+              Socket->SharedData->ConnectTime = GetCurrentTimeInSeconds();
+              return NO_ERROR;
+
            case SO_KEEPALIVE:
            case SO_DONTROUTE:
               /* These go directly to the helper dll */
@@ -0,0 +1,487 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS Ancillary Function Driver DLL
+ * FILE:        dll/win32/msafd/misc/extensions.c
+ * PURPOSE:     Microsoft specific extension functions
+ *              (AcceptEx, ConnectEx, DisconnectEx, TransmitFile)
+ */
+
+#include <msafd.h>
+
+/*
+ * Each extension is a single AFD request, so that its completion is
+ * reported through the OVERLAPPED (event, completion port) exactly like
+ * an overlapped WSPRecv or WSPSend. Without an OVERLAPPED the call waits.
+ */
+static
+NTSTATUS
+SockExtensionRequest(
+    IN PSOCKET_INFORMATION Socket,
+    IN ULONG IoControlCode,
+    IN PVOID InputBuffer,
+    IN ULONG InputBufferLength,
+    IN LPOVERLAPPED lpOverlapped,
+    OUT PULONG_PTR Information)
+{
+    IO_STATUS_BLOCK DummyIOSB;
+    PIO_STATUS_BLOCK IOSB;
+    HANDLE SockEvent = NULL;
+    HANDLE Event;
+    PVOID APCContext;
+    NTSTATUS Status;
+
+    *Information = 0;
+
+    if (lpOverlapped == NULL)
+    {
+        Status = NtCreateEvent(&SockEvent,
+                               EVENT_ALL_ACCESS,
+                               NULL,
+                               SynchronizationEvent,
+                               FALSE);
+        if (!NT_SUCCESS(Status))
+            return Status;
+
+        Event = SockEvent;
+        APCContext = NULL;
+        IOSB = &DummyIOSB;
+    }
+    else
+    {
+        Event = lpOverlapped->hEvent;
+        APCContext = lpOverlapped;
+        IOSB = (PIO_STATUS_BLOCK)&lpOverlapped->Internal;
+    }
+
+    IOSB->Status = STATUS_PENDING;
+
+    Status = NtDeviceIoControlFile((HANDLE)Socket->Handle,
+                                   Event,
+                                   NULL,
+                                   APCContext,
+                                   IOSB,
+                                   IoControlCode,
+                                   InputBuffer,
+                                   InputBufferLength,
+                                   NULL,
+                                   0);
+
+    if (lpOverlapped == NULL)
+    {
+        /* Wait for return */
+        if (Status == STATUS_PENDING)
+        {
+            WaitForSingleObject(SockEvent, INFINITE);
+            Status = IOSB->Status;
+        }
+
+        NtClose(SockEvent);
+    }
+
+    if (Status != STATUS_PENDING)
+        *Information = IOSB->Information;
+
+    TRACE("Status %x Information %d\n", Status, *Information);
+
+    return Status;
+}
+
+static
+BOOL
+SockExtensionReturn(
+    IN PSOCKET_INFORMATION Socket,
+    IN NTSTATUS Status)
+{
+    INT Errno;
+
+    if (Status == STATUS_SUCCESS)
+        return TRUE;
+
+    Errno = TranslateNtStatusError(Status);
+    if (Status != STATUS_PENDING && Socket)
+        Socket->SharedData->SocketLastError = Errno;
+
+    SetLastError(Errno);
+    return FALSE;
+}
+
+/*
+ * A TF_REUSE_SOCKET disconnect that went pending completes through the
+ * caller's OVERLAPPED, we never see it. AFD knows when it put the socket
+ * back into its created state, so ask it before the socket is used again.
+ */
+VOID
+SockUpdateReusedSocket(
+    IN PSOCKET_INFORMATION Socket)
+{
+    BOOLEAN Reused;
+
+    if (!Socket->ReusePending)
+        return;
+
+    if (GetSocketInformation(Socket,
+                             AFD_INFO_SOCKET_REUSED,
+                             &Reused,
+                             NULL,
+                             NULL,
+                             NULL,
+                             NULL) == NO_ERROR && Reused)
+    {
+        Socket->SharedData->State = SocketOpen;
+        Socket->ReusePending = FALSE;
+    }
+}
+
+/* Only a disconnect that is done changes the state, see SockUpdateReusedSocket */
+static
+VOID
+SockDisconnectReturn(
+    IN PSOCKET_INFORMATION Socket,
+    IN NTSTATUS Status,
+    IN BOOLEAN Reuse)
+{
+    if (Status == STATUS_SUCCESS)
+        Socket->SharedData->State = Reuse ? SocketOpen : SocketClosed;
+    else if (Status == STATUS_PENDING && Reuse)
+        Socket->ReusePending = TRUE;
+}
+
+BOOL
+WSPAPI
+WSPAcceptEx(
+    IN SOCKET sListenSocket,
+    IN SOCKET sAcceptSocket,
+    OUT PVOID lpOutputBuffer,
+    IN DWORD dwReceiveDataLength,
+    IN DWORD dwLocalAddressLength,
+    IN DWORD dwRemoteAddressLength,
+    OUT LPDWORD lpdwBytesReceived,
+    IN OUT LPOVERLAPPED lpOverlapped)
+{
+    PSOCKET_INFORMATION Socket, AcceptSocket;
+    AFD_SUPER_ACCEPT_INFO AcceptInfo;
+    AFD_WSABUF RecvBuffer;
+    ULONG_PTR Information;
+    NTSTATUS Status;
+
+    TRACE("Called (%lx, %lx)\n", sListenSocket, sAcceptSocket);
+
+    Socket = GetSocketStructure(sListenSocket);
+    AcceptSocket = GetSocketStructure(sAcceptSocket);
+    if (!Socket || !AcceptSocket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return FALSE;
+    }
+
+    if (!Socket->SharedData->Listening)
+    {
+        SetLastError(WSAEINVAL);
+        return FALSE;
+    }
+
+    if (!lpOverlapped)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    /* Each address is stored as an INT length followed by the SOCKADDR */
+    if (!lpOutputBuffer ||
+        dwLocalAddressLength < sizeof(INT) + sizeof(SOCKADDR) ||
+        dwRemoteAddressLength < sizeof(INT) + sizeof(SOCKADDR))
+    {
+        SetLastError(WSAEFAULT);
+        return FALSE;
+    }
+
+    /* AFD also refuses a socket another AcceptEx is pending on */
+    SockUpdateReusedSocket(AcceptSocket);
+    if (AcceptSocket->SharedData->State != SocketOpen)
+    {
+        SetLastError(WSAEINVAL);
+        return FALSE;
+    }
+
+    RecvBuffer.len = dwReceiveDataLength;
+    RecvBuffer.buf = lpOutputBuffer;
+
+    AcceptInfo.Recv.BufferArray = &RecvBuffer;
+    AcceptInfo.Recv.BufferCount = dwReceiveDataLength ? 1 : 0;
+    AcceptInfo.Recv.AfdFlags = AFD_OVERLAPPED;
+    AcceptInfo.Recv.TdiFlags = TDI_RECEIVE_NORMAL;
+    AcceptInfo.AcceptHandle = (HANDLE)sAcceptSocket;
+    AcceptInfo.AddressBuffer = (PCHAR)lpOutputBuffer + dwReceiveDataLength;
+    AcceptInfo.LocalAddressLength = dwLocalAddressLength;
+    AcceptInfo.RemoteAddressLength = dwRemoteAddressLength;
+
+    Status = SockExtensionRequest(Socket,
+                                  IOCTL_AFD_SUPER_ACCEPT,
+                                  &AcceptInfo,
+                                  sizeof(AcceptInfo),
+                                  lpOverlapped,
+                                  &Information);
+
+    if (Status == STATUS_SUCCESS)
+    {
+        /* Otherwise this is left to SO_UPDATE_ACCEPT_CONTEXT */
+        AcceptSocket->SharedData->State = SocketConnected;
+        AcceptSocket->SharedData->ConnectTime = GetCurrentTimeInSeconds();
+        if (lpdwBytesReceived)
+            *lpdwBytesReceived = (DWORD)Information;
+    }
+
+    return SockExtensionReturn(Socket, Status);
+}
+
+BOOL
+WSPAPI
+WSPConnectEx(
+    IN SOCKET s,
+    IN const struct sockaddr *name,
+    IN int namelen,
+    IN PVOID lpSendBuffer,
+    IN DWORD dwSendDataLength,
+    OUT LPDWORD lpdwBytesSent,
+    IN OUT LPOVERLAPPED lpOverlapped)
+{
+    PSOCKET_INFORMATION Socket;
+    PAFD_SUPER_CONNECT_INFO ConnectInfo;
+    AFD_WSABUF SendBuffer;
+    ULONG_PTR Information;
+    NTSTATUS Status;
+    int SocketDataLength;
+    ULONG ConnectInfoLength;
+
+    TRACE("Called (%lx)\n", s);
+
+    Socket = GetSocketStructure(s);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return FALSE;
+    }
+
+    /* ConnectEx wants a bound, unconnected stream socket */
+    if (!name || namelen < (int)sizeof(SOCKADDR) || !lpOverlapped ||
+        Socket->SharedData->SocketType != SOCK_STREAM)
+    {
+        SetLastError(WSAEINVAL);
+        return FALSE;
+    }
+
+    SockUpdateReusedSocket(Socket);
+    if (Socket->SharedData->State != SocketBound)
+    {
+        SetLastError(Socket->SharedData->State == SocketConnected ?
+                     WSAEISCONN : WSAEINVAL);
+        return FALSE;
+    }
+
+    /* Calculate the size of name->sa_data */
+    SocketDataLength = namelen - FIELD_OFFSET(struct sockaddr, sa_data);
+
+    ConnectInfoLength = FIELD_OFFSET(AFD_SUPER_CONNECT_INFO,
+                                     Connect.RemoteAddress.Address[0].Address[SocketDataLength]);
+    ConnectInfo = HeapAlloc(GetProcessHeap(), 0, ConnectInfoLength);
+    if (!ConnectInfo)
+    {
+        SetLastError(WSAENOBUFS);
+        return FALSE;
+    }
+
+    SendBuffer.len = dwSendDataLength;
+    SendBuffer.buf = lpSendBuffer;
+
+    ConnectInfo->Send.BufferArray = &SendBuffer;
+    ConnectInfo->Send.BufferCount = (lpSendBuffer && dwSendDataLength) ? 1 : 0;
+    ConnectInfo->Send.AfdFlags = AFD_OVERLAPPED;
+    ConnectInfo->Send.TdiFlags = 0;
+
+    /* Set up Address in TDI Format */
+    ConnectInfo->Connect.Root = 0;
+    ConnectInfo->Connect.UseSAN = FALSE;
+    ConnectInfo->Connect.Unknown = 0;
+    ConnectInfo->Connect.RemoteAddress.TAAddressCount = 1;
+    ConnectInfo->Connect.RemoteAddress.Address[0].AddressLength = SocketDataLength;
+    ConnectInfo->Connect.RemoteAddress.Address[0].AddressType = name->sa_family;
+    RtlCopyMemory(ConnectInfo->Connect.RemoteAddress.Address[0].Address,
+                  name->sa_data,
+                  SocketDataLength);
+
+    /* AFD keeps its own copy of the request, the heap one can go right away */
+    Status = SockExtensionRequest(Socket,
+                                  IOCTL_AFD_SUPER_CONNECT,
+                                  ConnectInfo,
+                                  ConnectInfoLength,
+                                  lpOverlapped,
+                                  &Information);
+
+    HeapFree(GetProcessHeap(), 0, ConnectInfo);
+
+    if (Status == STATUS_SUCCESS)
+    {
+        /* Otherwise this is left to SO_UPDATE_CONNECT_CONTEXT */
+        Socket->SharedData->State = SocketConnected;
+        Socket->SharedData->ConnectTime = GetCurrentTimeInSeconds();
+        if (lpdwBytesSent)
+            *lpdwBytesSent = (DWORD)Information;
+    }
+
+    return SockExtensionReturn(Socket, Status);
+}
+
+BOOL
+WSPAPI
+WSPDisconnectEx(
+  IN SOCKET hSocket,
+  IN LPOVERLAPPED lpOverlapped,
+  IN DWORD dwFlags,
+  IN DWORD reserved)
+{
+    PSOCKET_INFORMATION Socket;
+    AFD_DISCONNECT_INFO DisconnectInfo;
+    ULONG_PTR Information;
+    NTSTATUS Status;
+
+    TRACE("Called (%lx, %lx)\n", hSocket, dwFlags);
+
+    Socket = GetSocketStructure(hSocket);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return FALSE;
+    }
+
+    if (reserved != 0 || (dwFlags & ~TF_REUSE_SOCKET) != 0)
+    {
+        SetLastError(WSAEINVAL);
+        return FALSE;
+    }
+
+    DisconnectInfo.DisconnectType = AFD_DISCONNECT_SEND;
+    if (dwFlags & TF_REUSE_SOCKET)
+        DisconnectInfo.DisconnectType |= AFD_DISCONNECT_REUSE;
+    DisconnectInfo.Timeout = RtlConvertLongToLargeInteger(-1000000);
+
+    Status = SockExtensionRequest(Socket,
+                                  IOCTL_AFD_DISCONNECT,
+                                  &DisconnectInfo,
+                                  sizeof(DisconnectInfo),
+                                  lpOverlapped,
+                                  &Information);
+
+    /* AFD puts a reused socket back into its freshly created state */
+    SockDisconnectReturn(Socket, Status, (dwFlags & TF_REUSE_SOCKET) != 0);
+
+    return SockExtensionReturn(Socket, Status);
+}
+
+BOOL
+WSPAPI
+WSPTransmitFile(
+    IN SOCKET hSocket,
+    IN HANDLE hFile,
+    IN DWORD nNumberOfBytesToWrite,
+    IN DWORD nNumberOfBytesPerSend,
+    IN OUT LPOVERLAPPED lpOverlapped,
+    IN LPTRANSMIT_FILE_BUFFERS lpTransmitBuffers,
+    IN DWORD dwFlags)
+{
+    PSOCKET_INFORMATION Socket;
+    AFD_TRANSMIT_FILE_INFO TransmitInfo;
+    LARGE_INTEGER Zero;
+    ULONG_PTR Information;
+    NTSTATUS Status;
+
+    TRACE("Called (%lx, %p, %lu)\n", hSocket, hFile, nNumberOfBytesToWrite);
+
+    Socket = GetSocketStructure(hSocket);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return FALSE;
+    }
+
+    if ((dwFlags & TF_REUSE_SOCKET) && !(dwFlags & TF_DISCONNECT))
+    {
+        SetLastError(WSAEINVAL);
+        return FALSE;
+    }
+
+    RtlZeroMemory(&TransmitInfo, sizeof(TransmitInfo));
+
+    TransmitInfo.FileHandle = hFile;
+    if (hFile)
+    {
+        /* Overlapped handles carry the offset, the others their file pointer */
+        if (lpOverlapped)
+        {
+            TransmitInfo.Offset.LowPart = lpOverlapped->Offset;
+            TransmitInfo.Offset.HighPart = lpOverlapped->OffsetHigh;
+        }
+        else
+        {
+            Zero.QuadPart = 0;
+            if (!SetFilePointerEx(hFile, Zero, &TransmitInfo.Offset, FILE_CURRENT))
+            {
+                SetLastError(WSAEINVAL);
+                return FALSE;
+            }
+        }
+    }
+    TransmitInfo.WriteLength.QuadPart = nNumberOfBytesToWrite;
+    TransmitInfo.SendPacketLength = nNumberOfBytesPerSend;
+
+    if (lpTransmitBuffers)
+    {
+        TransmitInfo.Head.buf = lpTransmitBuffers->Head;
+        TransmitInfo.Head.len = lpTransmitBuffers->Head ? lpTransmitBuffers->HeadLength : 0;
+        TransmitInfo.Tail.buf = lpTransmitBuffers->Tail;
+        TransmitInfo.Tail.len = lpTransmitBuffers->Tail ? lpTransmitBuffers->TailLength : 0;
+    }
+
+    if (dwFlags & TF_DISCONNECT)
+        TransmitInfo.Flags |= AFD_TF_DISCONNECT;
+    if (dwFlags & TF_REUSE_SOCKET)
+        TransmitInfo.Flags |= AFD_TF_REUSE_SOCKET;
+
+    Status = SockExtensionRequest(Socket,
+                                  IOCTL_AFD_TRANSMIT_FILE,
+                                  &TransmitInfo,
+                                  sizeof(TransmitInfo),
+                                  lpOverlapped,
+                                  &Information);
+
+    if (dwFlags & TF_DISCONNECT)
+        SockDisconnectReturn(Socket, Status, (dwFlags & TF_REUSE_SOCKET) != 0);
+
+    return SockExtensionReturn(Socket, Status);
+}
+
+VOID
+WSPAPI
+WSPGetAcceptExSockaddrs(
+    IN PVOID lpOutputBuffer,
+    IN DWORD dwReceiveDataLength,
+    IN DWORD dwLocalAddressLength,
+    IN DWORD dwRemoteAddressLength,
+    OUT struct sockaddr **LocalSockaddr,
+    OUT LPINT LocalSockaddrLength,
+    OUT struct sockaddr **RemoteSockaddr,
+    OUT LPINT RemoteSockaddrLength)
+{
+    PCHAR Buffer = (PCHAR)lpOutputBuffer + dwReceiveDataLength;
+
+    UNREFERENCED_PARAMETER(dwRemoteAddressLength);
+
+    /* Laid out by AFD as the length followed by the address, local first */
+    *LocalSockaddrLength = *(PINT)Buffer;
+    *LocalSockaddr = (struct sockaddr *)(Buffer + sizeof(INT));
+
+    Buffer += dwLocalAddressLength;
+    *RemoteSockaddrLength = *(PINT)Buffer;
+    *RemoteSockaddr = (struct sockaddr *)(Buffer + sizeof(INT));
+}
+
+/* EOF */
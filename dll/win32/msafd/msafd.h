@@ -113,6 +113,7 @@ typedef struct _SOCKET_INFORMATION {
 	PVOID SanData;
 	BOOL TrySAN;
 	WSAPROTOCOL_INFOW ProtocolInfo;
+	BOOLEAN ReusePending; /* A TF_REUSE_SOCKET disconnect is in progress */
 	struct _SOCKET_INFORMATION *NextSocket;
 } SOCKET_INFORMATION, *PSOCKET_INFORMATION;
 
@@ -457,6 +458,17 @@ WSPDisconnectEx(
     IN DWORD dwFlags,
     IN DWORD reserved);
 
+BOOL
+WSPAPI
+WSPTransmitFile(
+    IN SOCKET hSocket,
+    IN HANDLE hFile,
+    IN DWORD nNumberOfBytesToWrite,
+    IN DWORD nNumberOfBytesPerSend,
+    IN OUT LPOVERLAPPED lpOverlapped,
+    IN LPTRANSMIT_FILE_BUFFERS lpTransmitBuffers,
+    IN DWORD dwFlags);
+
 VOID
 WSPAPI
 WSPGetAcceptExSockaddrs(
@@ -475,6 +487,10 @@ PSOCKET_INFORMATION GetSocketStructure(
 
 INT TranslateNtStatusError( NTSTATUS Status );
 
+DWORD GetCurrentTimeInSeconds( VOID );
+
+VOID SockUpdateReusedSocket( PSOCKET_INFORMATION Socket );
+
 VOID DeleteSocketStructure( SOCKET Handle );
 
 int GetSocketInformation(
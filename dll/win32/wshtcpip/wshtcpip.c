@@ -174,6 +174,14 @@ GetTdiTypeId(
                 /* FIXME: Return proper option */
                 ASSERT(FALSE);
                 break;
+             case SO_RCVBUF:
+                *TdiType = INFO_TYPE_CONNECTION;
+                *TdiId = TCP_SOCKET_WINDOW;
+                return;
+             case SO_SNDBUF:
+                *TdiType = INFO_TYPE_CONNECTION;
+                *TdiId = TCP_SOCKET_SNDBUF;
+                return;
              default:
                 break;
           }
@@ -694,6 +702,18 @@ WSHSetSocketInformation(
                     DPRINT1("Set: SO_KEEPALIVE not yet supported\n");
                     return 0;
 
+                case SO_RCVBUF:
+                case SO_SNDBUF:
+                    /* AFD keeps its own buffers, this sizes the TCP ones */
+                    if (Context->Protocol != IPPROTO_TCP)
+                        return 0;
+                    if (OptionLength < sizeof(ULONG))
+                    {
+                        return WSAEFAULT;
+                    }
+                    /* Send these to TCPIP */
+                    break;
+
                 default:
                     /* Invalid option */
                     DPRINT1("Set: Received unexpected SOL_SOCKET option %d\n", OptionName);
@@ -287,6 +287,7 @@ AddFileName(PFILE_RECORD_HEADER FileRecord,
 
         FirstEntry = 0;
         Status = NtfsFindMftRecord(DeviceExt,
+                                   NULL,
                                    CurrentMFTIndex,
                                    &Current,
                                    &FirstEntry,
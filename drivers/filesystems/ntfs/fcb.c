@@ -109,6 +109,7 @@ NtfsCreateFCB(PCWSTR FileName,
     }
 
     ExInitializeResourceLite(&Fcb->MainResource);
+    ExInitializeResourceLite(&Fcb->UnitCacheResource);
 
     Fcb->RFCB.Resource = &(Fcb->MainResource);
 
@@ -124,6 +125,10 @@ NtfsDestroyFCB(PNTFS_FCB Fcb)
 
     ExDeleteResourceLite(&Fcb->MainResource);
 
+    NtfsFlushIndexCache(Fcb);
+    NtfsFlushUnitCache(Fcb);
+    ExDeleteResourceLite(&Fcb->UnitCacheResource);
+
     ExFreeToNPagedLookasideList(&NtfsGlobalData->FcbLookasideList, Fcb);
 }
 
@@ -194,6 +199,8 @@ NtfsReleaseFCB(PNTFS_VCB Vcb,
     if (Fcb->RefCount <= 0 && !NtfsFCBIsDirectory(Fcb))
     {
         RemoveEntryList(&Fcb->FcbListEntry);
+        RemoveEntryList(&Fcb->FcbHashEntry);
+        Vcb->FcbCount--;
         KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
         CcUninitializeCacheMap(Fcb->FileObject, NULL, NULL);
         NtfsDestroyFCB(Fcb);
@@ -205,15 +212,39 @@ NtfsReleaseFCB(PNTFS_VCB Vcb,
 }
 
 
+/*
+ * Case insensitive hash of a path, paths differing only in case have
+ * to land in the same bucket of the FCB table.
+ */
+static
+ULONG
+NtfsHashPathName(PCWSTR PathName)
+{
+    ULONG Hash = 0;
+
+    while (*PathName != 0)
+    {
+        Hash = Hash * 31 + RtlUpcaseUnicodeChar(*PathName);
+        PathName++;
+    }
+
+    return Hash;
+}
+
+
 VOID
 NtfsAddFCBToTable(PNTFS_VCB Vcb,
                   PNTFS_FCB Fcb)
 {
     KIRQL oldIrql;
 
+    Fcb->PathHash = NtfsHashPathName(Fcb->PathName);
+
     KeAcquireSpinLock(&Vcb->FcbListLock, &oldIrql);
     Fcb->Vcb = Vcb;
     InsertTailList(&Vcb->FcbListHead, &Fcb->FcbListEntry);
+    InsertHeadList(&Vcb->FcbHashTable[Fcb->PathHash % NTFS_FCB_HASH_BUCKETS], &Fcb->FcbHashEntry);
+    Vcb->FcbCount++;
     KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
 }
 
@@ -225,6 +256,13 @@ NtfsGrabFCBFromTable(PNTFS_VCB Vcb,
     KIRQL oldIrql;
     PNTFS_FCB Fcb;
     PLIST_ENTRY current_entry;
+    PLIST_ENTRY bucket;
+    ULONG hash = 0;
+
+    if (FileName != NULL && *FileName != 0)
+    {
+        hash = NtfsHashPathName(FileName);
+    }
 
     KeAcquireSpinLock(&Vcb->FcbListLock, &oldIrql);
 
@@ -237,15 +275,17 @@ NtfsGrabFCBFromTable(PNTFS_VCB Vcb,
         return Fcb;
     }
 
-    current_entry = Vcb->FcbListHead.Flink;
-    while (current_entry != &Vcb->FcbListHead)
+    bucket = &Vcb->FcbHashTable[hash % NTFS_FCB_HASH_BUCKETS];
+    current_entry = bucket->Flink;
+    while (current_entry != bucket)
     {
-        Fcb = CONTAINING_RECORD(current_entry, NTFS_FCB, FcbListEntry);
+        Fcb = CONTAINING_RECORD(current_entry, NTFS_FCB, FcbHashEntry);
 
         DPRINT("Comparing '%S' and '%S'\n", FileName, Fcb->PathName);
-        if (_wcsicmp(FileName, Fcb->PathName) == 0)
+        if (Fcb->PathHash == hash && _wcsicmp(FileName, Fcb->PathName) == 0)
         {
             Fcb->RefCount++;
+            Vcb->FcbTableHits++;
             KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
             return Fcb;
         }
@@ -255,12 +295,62 @@ NtfsGrabFCBFromTable(PNTFS_VCB Vcb,
         current_entry = current_entry->Flink;
     }
 
+    Vcb->FcbTableMisses++;
     KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
 
     return NULL;
 }
 
 
+VOID
+NtfsFlushIndexCache(PNTFS_FCB Fcb)
+{
+    ULONG i;
+
+    for (i = 0; i < NTFS_INDEX_CACHE_ENTRIES; i++)
+    {
+        if (Fcb->IndexCache[i].Buffer != NULL)
+        {
+            ExFreePoolWithTag(Fcb->IndexCache[i].Buffer, TAG_NTFS);
+            Fcb->IndexCache[i].Buffer = NULL;
+        }
+    }
+}
+
+
+/*
+ * Drops the cached index buffers of every FCB opened on the given
+ * directory, once its index is about to change.
+ */
+VOID
+NtfsInvalidateIndexCache(PNTFS_VCB Vcb,
+                         ULONGLONG DirectoryMftIndex)
+{
+    KIRQL oldIrql;
+    PNTFS_FCB Fcb;
+    PLIST_ENTRY current_entry;
+
+    DirectoryMftIndex &= NTFS_MFT_MASK;
+
+    KeAcquireSpinLock(&Vcb->FcbListLock, &oldIrql);
+
+    current_entry = Vcb->FcbListHead.Flink;
+    while (current_entry != &Vcb->FcbListHead)
+    {
+        Fcb = CONTAINING_RECORD(current_entry, NTFS_FCB, FcbListEntry);
+
+        if ((Fcb->MFTIndex & NTFS_MFT_MASK) == DirectoryMftIndex)
+        {
+            NtfsFlushIndexCache(Fcb);
+        }
+
+        current_entry = current_entry->Flink;
+    }
+
+    KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
+}
+
+
 NTSTATUS
 NtfsFCBInitializeCache(PNTFS_VCB Vcb,
                        PNTFS_FCB Fcb)
@@ -566,7 +656,7 @@ NtfsDirFindFile(PNTFS_VCB Vcb,
         DPRINT1("Will now look for file '%wZ' with stream '%S'\n", &File, Colon);
     }
 
-    Status = NtfsLookupFileAt(Vcb, &File, CaseSensitive, &FileRecord, &MFTIndex, CurrentDir);
+    Status = NtfsLookupFileAt(Vcb, &File, CaseSensitive, &FileRecord, &MFTIndex, CurrentDir, DirectoryFcb);
     if (!NT_SUCCESS(Status))
     {
         return Status;
@@ -424,6 +424,7 @@ NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
     PNTFS_VCB Vcb = NULL;
     NTSTATUS Status;
     BOOLEAN Lookaside = FALSE;
+    ULONG i;
 
     DPRINT("NtfsMountVolume() called\n");
 
@@ -459,6 +460,8 @@ NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
     Vcb->Identifier.Type = NTFS_TYPE_VCB;
     Vcb->Identifier.Size = sizeof(NTFS_TYPE_VCB);
 
+    NtfsInitializeMftCache(Vcb);
+
     Status = NtfsGetVolumeData(DeviceToMount,
                                Vcb);
     if (!NT_SUCCESS(Status))
@@ -479,6 +482,10 @@ NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
                                                      Vcb->StorageDevice);
 
     InitializeListHead(&Vcb->FcbListHead);
+    for (i = 0; i < NTFS_FCB_HASH_BUCKETS; i++)
+    {
+        InitializeListHead(&Vcb->FcbHashTable[i]);
+    }
 
     Fcb = NtfsCreateFCB(NULL, NULL, Vcb);
     if (Fcb == NULL)
@@ -564,6 +571,9 @@ ByeBye:
         if (Ccb)
             ExFreePool(Ccb);
 
+        if (Vcb)
+            NtfsFlushMftCache(Vcb);
+
         if (Lookaside)
             ExDeleteNPagedLookasideList(&Vcb->FileRecLookasideList);
 
@@ -846,6 +856,44 @@ GetVolumeBitmap(PDEVICE_EXTENSION DeviceExt,
 }
 
 
+static
+NTSTATUS
+GetCacheStatistics(PDEVICE_EXTENSION DeviceExt,
+                   PIRP Irp)
+{
+    PIO_STACK_LOCATION Stack;
+    PNTFS_CACHE_STATISTICS Statistics;
+    KIRQL OldIrql;
+
+    DPRINT("GetCacheStatistics(%p, %p)\n", DeviceExt, Irp);
+
+    Stack = IoGetCurrentIrpStackLocation(Irp);
+    if (Stack->Parameters.FileSystemControl.OutputBufferLength < sizeof(NTFS_CACHE_STATISTICS) ||
+        Irp->AssociatedIrp.SystemBuffer == NULL)
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    Statistics = Irp->AssociatedIrp.SystemBuffer;
+
+    ExAcquireFastMutex(&DeviceExt->MftCache.Lock);
+    Statistics->MftCacheHits = DeviceExt->MftCache.Hits;
+    Statistics->MftCacheMisses = DeviceExt->MftCache.Misses;
+    Statistics->MftCacheInvalidations = DeviceExt->MftCache.Invalidations;
+    ExReleaseFastMutex(&DeviceExt->MftCache.Lock);
+
+    KeAcquireSpinLock(&DeviceExt->FcbListLock, &OldIrql);
+    Statistics->FcbTableHits = DeviceExt->FcbTableHits;
+    Statistics->FcbTableMisses = DeviceExt->FcbTableMisses;
+    Statistics->FcbTableCount = DeviceExt->FcbCount;
+    KeReleaseSpinLock(&DeviceExt->FcbListLock, OldIrql);
+
+    Irp->IoStatus.Information = sizeof(NTFS_CACHE_STATISTICS);
+
+    return STATUS_SUCCESS;
+}
+
+
 static
 NTSTATUS
 LockOrUnlockVolume(PDEVICE_EXTENSION DeviceExt,
@@ -949,6 +997,10 @@ NtfsUserFsRequest(PDEVICE_OBJECT DeviceObject,
             Status = GetVolumeBitmap(DeviceExt, Irp);
             break;
 
+        case FSCTL_NTFS_QUERY_CACHE_STATISTICS:
+            Status = GetCacheStatistics(DeviceExt, Irp);
+            break;
+
         default:
             DPRINT("Invalid user request: %x\n", Stack->Parameters.FileSystemControl.FsControlCode);
             Status = STATUS_INVALID_DEVICE_REQUEST;
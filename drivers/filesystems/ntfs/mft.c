@@ -1627,15 +1627,175 @@ Cleanup:
     return Status;
 }
 
+VOID
+NtfsInitializeMftCache(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_MFT_CACHE Cache = &Vcb->MftCache;
+    ULONG i;
+
+    ExInitializeFastMutex(&Cache->Lock);
+    InitializeListHead(&Cache->LruList);
+
+    for (i = 0; i < NTFS_MFT_CACHE_BUCKETS; i++)
+    {
+        InitializeListHead(&Cache->Buckets[i]);
+    }
+
+    // Unused entries sit at the tail of the LRU list and in no bucket
+    for (i = 0; i < NTFS_MFT_CACHE_ENTRIES; i++)
+    {
+        InitializeListHead(&Cache->Entries[i].HashEntry);
+        InsertTailList(&Cache->LruList, &Cache->Entries[i].LruEntry);
+    }
+}
+
+VOID
+NtfsFlushMftCache(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_MFT_CACHE Cache = &Vcb->MftCache;
+    ULONG i;
+
+    for (i = 0; i < NTFS_MFT_CACHE_ENTRIES; i++)
+    {
+        RemoveEntryList(&Cache->Entries[i].HashEntry);
+        InitializeListHead(&Cache->Entries[i].HashEntry);
+
+        if (Cache->Entries[i].Record != NULL)
+        {
+            ExFreePoolWithTag(Cache->Entries[i].Record, TAG_FILE_REC);
+            Cache->Entries[i].Record = NULL;
+        }
+    }
+}
+
+static
+PNTFS_MFT_CACHE_ENTRY
+LookupMftCacheEntry(PNTFS_MFT_CACHE Cache,
+                    ULONGLONG MftIndex)
+{
+    PLIST_ENTRY Bucket = &Cache->Buckets[MftIndex % NTFS_MFT_CACHE_BUCKETS];
+    PLIST_ENTRY Current;
+    PNTFS_MFT_CACHE_ENTRY Entry;
+
+    for (Current = Bucket->Flink; Current != Bucket; Current = Current->Flink)
+    {
+        Entry = CONTAINING_RECORD(Current, NTFS_MFT_CACHE_ENTRY, HashEntry);
+        if (Entry->MftIndex == MftIndex)
+            return Entry;
+    }
+
+    return NULL;
+}
+
+/**
+* @name InvalidateMftCacheEntry
+* @implemented
+*
+* Drops a file record from the MFT record cache once it was rewritten.
+* Readers which went to the disk while the cache lock wasn't held won't
+* insert what they read afterwards, since the generation changed.
+*
+* @param Vcb
+* Pointer to the target DEVICE_EXTENSION describing the volume.
+*
+* @param MftIndex
+* Index of the file record in the master file table.
+*/
+static
+VOID
+InvalidateMftCacheEntry(PDEVICE_EXTENSION Vcb,
+                        ULONGLONG MftIndex)
+{
+    PNTFS_MFT_CACHE Cache = &Vcb->MftCache;
+    PNTFS_MFT_CACHE_ENTRY Entry;
+
+    ExAcquireFastMutex(&Cache->Lock);
+
+    Cache->Generation++;
+    Cache->Invalidations++;
+
+    Entry = LookupMftCacheEntry(Cache, MftIndex);
+    if (Entry != NULL)
+    {
+        RemoveEntryList(&Entry->HashEntry);
+        InitializeListHead(&Entry->HashEntry);
+        RemoveEntryList(&Entry->LruEntry);
+        InsertTailList(&Cache->LruList, &Entry->LruEntry);
+    }
+
+    ExReleaseFastMutex(&Cache->Lock);
+}
+
+static
+VOID
+InsertMftCacheEntry(PDEVICE_EXTENSION Vcb,
+                    ULONGLONG MftIndex,
+                    PFILE_RECORD_HEADER FileRecord,
+                    ULONG Generation)
+{
+    PNTFS_MFT_CACHE Cache = &Vcb->MftCache;
+    PNTFS_MFT_CACHE_ENTRY Entry;
+
+    ExAcquireFastMutex(&Cache->Lock);
+
+    if (Cache->Generation != Generation ||
+        LookupMftCacheEntry(Cache, MftIndex) != NULL)
+    {
+        ExReleaseFastMutex(&Cache->Lock);
+        return;
+    }
+
+    // Recycle the least recently used entry
+    Entry = CONTAINING_RECORD(Cache->LruList.Blink, NTFS_MFT_CACHE_ENTRY, LruEntry);
+    if (Entry->Record == NULL)
+    {
+        Entry->Record = ExAllocatePoolWithTag(NonPagedPool, Vcb->NtfsInfo.BytesPerFileRecord, TAG_FILE_REC);
+        if (Entry->Record == NULL)
+        {
+            ExReleaseFastMutex(&Cache->Lock);
+            return;
+        }
+    }
+
+    RemoveEntryList(&Entry->HashEntry);
+    InsertHeadList(&Cache->Buckets[MftIndex % NTFS_MFT_CACHE_BUCKETS], &Entry->HashEntry);
+    RemoveEntryList(&Entry->LruEntry);
+    InsertHeadList(&Cache->LruList, &Entry->LruEntry);
+
+    Entry->MftIndex = MftIndex;
+    RtlCopyMemory(Entry->Record, FileRecord, Vcb->NtfsInfo.BytesPerFileRecord);
+
+    ExReleaseFastMutex(&Cache->Lock);
+}
+
 NTSTATUS
 ReadFileRecord(PDEVICE_EXTENSION Vcb,
                ULONGLONG index,
                PFILE_RECORD_HEADER file)
 {
+    PNTFS_MFT_CACHE Cache = &Vcb->MftCache;
+    PNTFS_MFT_CACHE_ENTRY Entry;
     ULONGLONG BytesRead;
+    ULONG Generation;
+    NTSTATUS Status;
 
     DPRINT("ReadFileRecord(%p, %I64x, %p)\n", Vcb, index, file);
 
+    ExAcquireFastMutex(&Cache->Lock);
+    Entry = LookupMftCacheEntry(Cache, index);
+    if (Entry != NULL)
+    {
+        RtlCopyMemory(file, Entry->Record, Vcb->NtfsInfo.BytesPerFileRecord);
+        RemoveEntryList(&Entry->LruEntry);
+        InsertHeadList(&Cache->LruList, &Entry->LruEntry);
+        Cache->Hits++;
+        ExReleaseFastMutex(&Cache->Lock);
+        return STATUS_SUCCESS;
+    }
+    Cache->Misses++;
+    Generation = Cache->Generation;
+    ExReleaseFastMutex(&Cache->Lock);
+
     BytesRead = ReadAttribute(Vcb, Vcb->MFTContext, index * Vcb->NtfsInfo.BytesPerFileRecord, (PCHAR)file, Vcb->NtfsInfo.BytesPerFileRecord);
     if (BytesRead != Vcb->NtfsInfo.BytesPerFileRecord)
     {
@@ -1645,7 +1805,13 @@ ReadFileRecord(PDEVICE_EXTENSION Vcb,
 
     /* Apply update sequence array fixups. */
     DPRINT("Sequence number: %u\n", file->SequenceNumber);
-    return FixupUpdateSequenceArray(Vcb, &file->Ntfs);
+    Status = FixupUpdateSequenceArray(Vcb, &file->Ntfs);
+    if (NT_SUCCESS(Status))
+    {
+        InsertMftCacheEntry(Vcb, index, file, Generation);
+    }
+
+    return Status;
 }
 
 
@@ -1949,6 +2115,9 @@ UpdateFileRecord(PDEVICE_EXTENSION Vcb,
                             &BytesWritten,
                             FileRecord);
 
+    // Whatever got written, the cached copy is outdated now
+    InvalidateMftCacheEntry(Vcb, MftIndex);
+
     if (!NT_SUCCESS(Status))
     {
         DPRINT1("UpdateFileRecord failed: %lu written, %lu expected\n", BytesWritten, Vcb->NtfsInfo.BytesPerFileRecord);
@@ -2214,6 +2383,9 @@ NtfsAddFilenameToDirectory(PDEVICE_EXTENSION DeviceExt,
     ULONG NewMaxIndexRootSize;
     ULONG NodeSize;
 
+    // The index buffers of the directory are about to change
+    NtfsInvalidateIndexCache(DeviceExt, DirectoryMftIndex);
+
     // Allocate memory for the parent directory
     ParentFileRecord = ExAllocateFromNPagedLookasideList(&DeviceExt->FileRecLookasideList);
     if (!ParentFileRecord)
@@ -3142,8 +3314,329 @@ BrowseIndexEntries(PDEVICE_EXTENSION Vcb,
     return STATUS_OBJECT_PATH_NOT_FOUND;
 }
 
+/**
+* @name ReadIndexBuffer
+* @implemented
+*
+* Reads and fixes up the index buffer of a directory at the given VCN.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param DirectoryFcb
+* Optional FCB of the directory. When given, the buffer is taken from (or added to) its
+* small cache of recently used index buffers.
+*
+* @param IndexAllocationContext
+* Context of the $I30 index allocation attribute of the directory.
+*
+* @param VCN
+* VCN of the index buffer.
+*
+* @param IndexBlockSize
+* Size of an index buffer, in bytes.
+*
+* @param Scratch
+* Buffer of IndexBlockSize bytes, used when there is no directory FCB.
+*
+* @param IndexBuffer
+* Receives a pointer to the index buffer. It stays valid until the next call for the same FCB.
+*
+* @return
+* STATUS_SUCCESS on success, an error code otherwise.
+*/
+static
+NTSTATUS
+ReadIndexBuffer(PDEVICE_EXTENSION Vcb,
+                PNTFS_FCB DirectoryFcb,
+                PNTFS_ATTR_CONTEXT IndexAllocationContext,
+                ULONGLONG VCN,
+                ULONG IndexBlockSize,
+                PINDEX_BUFFER Scratch,
+                PINDEX_BUFFER *IndexBuffer)
+{
+    PNTFS_INDEX_CACHE_ENTRY Entry = NULL;
+    PINDEX_BUFFER Buffer = Scratch;
+    ULONG BytesRead;
+    ULONG i;
+    NTSTATUS Status;
+
+    if (DirectoryFcb != NULL)
+    {
+        // Look for the buffer, or for the least recently used entry
+        for (i = 0; i < NTFS_INDEX_CACHE_ENTRIES; i++)
+        {
+            PNTFS_INDEX_CACHE_ENTRY Current = &DirectoryFcb->IndexCache[i];
+
+            if (Current->Buffer != NULL &&
+                Current->Vcn == VCN &&
+                Current->Size == IndexBlockSize)
+            {
+                Current->LastUse = ++DirectoryFcb->IndexCacheTick;
+                *IndexBuffer = Current->Buffer;
+                return STATUS_SUCCESS;
+            }
+
+            if (Entry == NULL ||
+                (Entry->Buffer != NULL && (Current->Buffer == NULL || Current->LastUse < Entry->LastUse)))
+            {
+                Entry = Current;
+            }
+        }
+
+        if (Entry->Buffer != NULL && Entry->Size != IndexBlockSize)
+        {
+            ExFreePoolWithTag(Entry->Buffer, TAG_NTFS);
+            Entry->Buffer = NULL;
+        }
+        if (Entry->Buffer == NULL)
+        {
+            Entry->Buffer = ExAllocatePoolWithTag(NonPagedPool, IndexBlockSize, TAG_NTFS);
+            if (Entry->Buffer == NULL)
+            {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+        }
+        Buffer = Entry->Buffer;
+    }
+
+    BytesRead = ReadAttribute(Vcb,
+                              IndexAllocationContext,
+                              VCN * Vcb->NtfsInfo.BytesPerCluster,
+                              (PCHAR)Buffer,
+                              IndexBlockSize);
+    if (BytesRead != IndexBlockSize || Buffer->Ntfs.Type != NRH_INDX_TYPE)
+    {
+        DPRINT1("Unable to read index record at VCN %I64u!\n", VCN);
+        Status = STATUS_DATA_ERROR;
+    }
+    else
+    {
+        Status = FixupUpdateSequenceArray(Vcb, &((PFILE_RECORD_HEADER)Buffer)->Ntfs);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        if (Entry != NULL)
+        {
+            ExFreePoolWithTag(Entry->Buffer, TAG_NTFS);
+            Entry->Buffer = NULL;
+        }
+        return Status;
+    }
+
+    if (Entry != NULL)
+    {
+        Entry->Vcn = VCN;
+        Entry->Size = IndexBlockSize;
+        Entry->LastUse = ++DirectoryFcb->IndexCacheTick;
+    }
+
+    *IndexBuffer = Buffer;
+    return STATUS_SUCCESS;
+}
+
+/**
+* @name SearchIndexEntries
+* @implemented
+*
+* Looks up a file name in a directory index by descending its B-Tree. Only the index buffers
+* on the path from the root to the key are read.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param DirectoryFcb
+* Optional FCB of the directory, whose index buffer cache will be used.
+*
+* @param MftRecord
+* File record of the directory.
+*
+* @param IndexRoot
+* Copy of the $I30 index root attribute of the directory.
+*
+* @param FileName
+* Name to look for. The lookup is case-insensitive, which is the order of the index.
+*
+* @param OutMFTIndex
+* Receives the MFT index of the file on success.
+*
+* @return
+* STATUS_SUCCESS if the file was found, STATUS_OBJECT_PATH_NOT_FOUND if it wasn't, or an
+* error code.
+*
+* @remarks
+* Like BrowseIndexEntries(), this doesn't return system files nor DOS names.
+*/
+static
+NTSTATUS
+SearchIndexEntries(PDEVICE_EXTENSION Vcb,
+                   PNTFS_FCB DirectoryFcb,
+                   PFILE_RECORD_HEADER MftRecord,
+                   PINDEX_ROOT_ATTRIBUTE IndexRoot,
+                   PUNICODE_STRING FileName,
+                   ULONGLONG *OutMFTIndex)
+{
+    PNTFS_ATTR_CONTEXT IndexAllocationContext = NULL;
+    PINDEX_ENTRY_ATTRIBUTE SearchEntry;
+    PINDEX_ENTRY_ATTRIBUTE IndexEntry;
+    PINDEX_ENTRY_ATTRIBUTE LastEntry;
+    PINDEX_BUFFER Scratch = NULL;
+    PINDEX_BUFFER IndexBuffer;
+    B_TREE_KEY SearchKey, CurrentKey;
+    BOOLEAN HasChildren;
+    ULONG IndexBlockSize = IndexRoot->SizeOfEntry;
+    ULONG Depth = 0;
+    LONG Comparison;
+    NTSTATUS Status;
+
+    DPRINT("SearchIndexEntries(%p, %p, %p, %p, %wZ, %p)\n",
+           Vcb,
+           DirectoryFcb,
+           MftRecord,
+           IndexRoot,
+           FileName,
+           OutMFTIndex);
+
+    // Build an index entry holding the name, so it can be compared with CompareTreeKeys()
+    SearchEntry = ExAllocatePoolWithTag(NonPagedPool,
+                                        FIELD_OFFSET(INDEX_ENTRY_ATTRIBUTE, FileName.Name) + FileName->Length,
+                                        TAG_NTFS);
+    if (!SearchEntry)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlZeroMemory(SearchEntry, FIELD_OFFSET(INDEX_ENTRY_ATTRIBUTE, FileName.Name));
+    SearchEntry->FileName.NameLength = FileName->Length / sizeof(WCHAR);
+    RtlCopyMemory(SearchEntry->FileName.Name, FileName->Buffer, FileName->Length);
+
+    RtlZeroMemory(&SearchKey, sizeof(B_TREE_KEY));
+    SearchKey.IndexEntry = SearchEntry;
+    RtlZeroMemory(&CurrentKey, sizeof(B_TREE_KEY));
+    // Only the dummy key has no NextKey; CurrentKey is never the dummy key
+    CurrentKey.NextKey = &CurrentKey;
+
+    IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)&IndexRoot->Header + IndexRoot->Header.FirstEntryOffset);
+    LastEntry = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)&IndexRoot->Header + IndexRoot->Header.TotalSizeOfEntries);
+    HasChildren = (IndexRoot->Header.Flags & INDEX_ROOT_LARGE) != 0;
+
+    while (TRUE)
+    {
+        // Find the first key of the node which isn't lower than the name
+        while (TRUE)
+        {
+            if (IndexEntry >= LastEntry ||
+                IndexEntry->Length < sizeof(INDEX_ENTRY_ATTRIBUTE) ||
+                (PCHAR)IndexEntry + IndexEntry->Length > (PCHAR)LastEntry)
+            {
+                DPRINT1("Filesystem corruption detected!\n");
+                Status = STATUS_DATA_ERROR;
+                goto Cleanup;
+            }
+
+            if (IndexEntry->Flags & NTFS_INDEX_ENTRY_END)
+            {
+                Comparison = -1;
+            }
+            else
+            {
+                CurrentKey.IndexEntry = IndexEntry;
+                Comparison = CompareTreeKeys(&SearchKey, &CurrentKey, FALSE);
+            }
+
+            if (Comparison <= 0)
+                break;
+
+            IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)IndexEntry + IndexEntry->Length);
+        }
+
+        if (Comparison == 0)
+        {
+            if ((IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK) >= NTFS_FILE_FIRST_USER_FILE &&
+                IndexEntry->FileName.NameType != NTFS_FILE_NAME_DOS)
+            {
+                *OutMFTIndex = (IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK);
+                Status = STATUS_SUCCESS;
+            }
+            else
+            {
+                Status = STATUS_OBJECT_PATH_NOT_FOUND;
+            }
+            goto Cleanup;
+        }
+
+        // The name can only be in the sub-node on the left of that key
+        if (!(IndexEntry->Flags & NTFS_INDEX_ENTRY_NODE))
+        {
+            Status = STATUS_OBJECT_PATH_NOT_FOUND;
+            goto Cleanup;
+        }
+
+        if (!HasChildren || ++Depth > 32)
+        {
+            DPRINT1("Filesystem corruption detected!\n");
+            Status = STATUS_DATA_ERROR;
+            goto Cleanup;
+        }
+
+        if (!IndexAllocationContext)
+        {
+            Status = FindAttribute(Vcb, MftRecord, AttributeIndexAllocation, L"$I30", 4, &IndexAllocationContext, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT1("Filesystem corruption detected!\n");
+                IndexAllocationContext = NULL;
+                goto Cleanup;
+            }
+
+            if (!DirectoryFcb)
+            {
+                Scratch = ExAllocatePoolWithTag(NonPagedPool, IndexBlockSize, TAG_NTFS);
+                if (!Scratch)
+                {
+                    Status = STATUS_INSUFFICIENT_RESOURCES;
+                    goto Cleanup;
+                }
+            }
+        }
+
+        Status = ReadIndexBuffer(Vcb,
+                                 DirectoryFcb,
+                                 IndexAllocationContext,
+                                 GetIndexEntryVCN(IndexEntry),
+                                 IndexBlockSize,
+                                 Scratch,
+                                 &IndexBuffer);
+        if (!NT_SUCCESS(Status))
+        {
+            goto Cleanup;
+        }
+
+        if (IndexBuffer->Header.TotalSizeOfEntries + FIELD_OFFSET(INDEX_BUFFER, Header) > IndexBlockSize)
+        {
+            DPRINT1("Filesystem corruption detected!\n");
+            Status = STATUS_DATA_ERROR;
+            goto Cleanup;
+        }
+
+        IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)&IndexBuffer->Header + IndexBuffer->Header.FirstEntryOffset);
+        LastEntry = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)&IndexBuffer->Header + IndexBuffer->Header.TotalSizeOfEntries);
+        HasChildren = (IndexBuffer->Header.Flags & INDEX_NODE_LARGE) != 0;
+    }
+
+Cleanup:
+    if (Scratch)
+        ExFreePoolWithTag(Scratch, TAG_NTFS);
+    if (IndexAllocationContext)
+        ReleaseAttributeContext(IndexAllocationContext);
+    ExFreePoolWithTag(SearchEntry, TAG_NTFS);
+
+    return Status;
+}
+
 NTSTATUS
 NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
+                  PNTFS_FCB DirectoryFcb,
                   ULONGLONG MFTIndex,
                   PUNICODE_STRING FileName,
                   PULONG FirstEntry,
@@ -3159,8 +3652,9 @@ NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
     NTSTATUS Status;
     ULONG CurrentEntry = 0;
 
-    DPRINT("NtfsFindMftRecord(%p, %I64d, %wZ, %lu, %s, %s, %p)\n",
+    DPRINT("NtfsFindMftRecord(%p, %p, %I64d, %wZ, %lu, %s, %s, %p)\n",
            Vcb,
+           DirectoryFcb,
            MFTIndex,
            FileName,
            *FirstEntry,
@@ -3206,6 +3700,25 @@ NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
 
     DPRINT("IndexRecordSize: %x IndexBlockSize: %x\n", Vcb->NtfsInfo.BytesPerIndexRecord, IndexRoot->SizeOfEntry);
 
+    if (!DirSearch && !CaseSensitive && *FirstEntry == 0)
+    {
+        // A plain name lookup can follow the sorted keys down the tree
+        if (DirectoryFcb && (DirectoryFcb->MFTIndex & NTFS_MFT_MASK) != (MFTIndex & NTFS_MFT_MASK))
+            DirectoryFcb = NULL;
+
+        Status = SearchIndexEntries(Vcb,
+                                    DirectoryFcb,
+                                    MftRecord,
+                                    IndexRoot,
+                                    FileName,
+                                    OutMFTIndex);
+
+        ExFreePoolWithTag(IndexRecord, TAG_NTFS);
+        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, MftRecord);
+
+        return Status;
+    }
+
     Status = BrowseIndexEntries(Vcb,
                                 MftRecord,
                                 (PINDEX_ROOT_ATTRIBUTE)IndexRecord,
@@ -3231,19 +3744,21 @@ NtfsLookupFileAt(PDEVICE_EXTENSION Vcb,
                  BOOLEAN CaseSensitive,
                  PFILE_RECORD_HEADER *FileRecord,
                  PULONGLONG MFTIndex,
-                 ULONGLONG CurrentMFTIndex)
+                 ULONGLONG CurrentMFTIndex,
+                 PNTFS_FCB DirectoryFcb)
 {
     UNICODE_STRING Current, Remaining;
     NTSTATUS Status;
     ULONG FirstEntry = 0;
 
-    DPRINT("NtfsLookupFileAt(%p, %wZ, %s, %p, %p, %I64x)\n",
+    DPRINT("NtfsLookupFileAt(%p, %wZ, %s, %p, %p, %I64x, %p)\n",
            Vcb,
            PathName,
            CaseSensitive ? "TRUE" : "FALSE",
            FileRecord,
            MFTIndex,
-           CurrentMFTIndex);
+           CurrentMFTIndex,
+           DirectoryFcb);
 
     FsRtlDissectName(*PathName, &Current, &Remaining);
 
@@ -3251,12 +3766,15 @@ NtfsLookupFileAt(PDEVICE_EXTENSION Vcb,
     {
         DPRINT("Current: %wZ\n", &Current);
 
-        Status = NtfsFindMftRecord(Vcb, CurrentMFTIndex, &Current, &FirstEntry, FALSE, CaseSensitive, &CurrentMFTIndex);
+        Status = NtfsFindMftRecord(Vcb, DirectoryFcb, CurrentMFTIndex, &Current, &FirstEntry, FALSE, CaseSensitive, &CurrentMFTIndex);
         if (!NT_SUCCESS(Status))
         {
             return Status;
         }
 
+        // The FCB only describes the first directory
+        DirectoryFcb = NULL;
+
         if (Remaining.Length == 0)
             break;
 
@@ -3290,7 +3808,7 @@ NtfsLookupFile(PDEVICE_EXTENSION Vcb,
                PFILE_RECORD_HEADER *FileRecord,
                PULONGLONG MFTIndex)
 {
-    return NtfsLookupFileAt(Vcb, PathName, CaseSensitive, FileRecord, MFTIndex, NTFS_FILE_ROOT);
+    return NtfsLookupFileAt(Vcb, PathName, CaseSensitive, FileRecord, MFTIndex, NTFS_FILE_ROOT, NULL);
 }
 
 void
@@ -3371,7 +3889,7 @@ NtfsFindFileAt(PDEVICE_EXTENSION Vcb,
            CurrentMFTIndex,
            (CaseSensitive ? "TRUE" : "FALSE"));
 
-    Status = NtfsFindMftRecord(Vcb, CurrentMFTIndex, SearchPattern, FirstEntry, TRUE, CaseSensitive, &CurrentMFTIndex);
+    Status = NtfsFindMftRecord(Vcb, NULL, CurrentMFTIndex, SearchPattern, FirstEntry, TRUE, CaseSensitive, &CurrentMFTIndex);
     if (!NT_SUCCESS(Status))
     {
         DPRINT("NtfsFindFileAt: NtfsFindMftRecord() failed with status 0x%08lx\n", Status);
@@ -96,6 +96,45 @@ typedef struct
     ULONG Size;
 } NTFSIDENTIFIER, *PNTFSIDENTIFIER;
 
+#define NTFS_MFT_CACHE_ENTRIES 64
+#define NTFS_MFT_CACHE_BUCKETS 64
+
+typedef struct _NTFS_MFT_CACHE_ENTRY
+{
+    LIST_ENTRY HashEntry;
+    LIST_ENTRY LruEntry;
+    ULONGLONG MftIndex;
+    struct _FILE_RECORD_HEADER* Record;     /* fixed up */
+} NTFS_MFT_CACHE_ENTRY, *PNTFS_MFT_CACHE_ENTRY;
+
+typedef struct _NTFS_MFT_CACHE
+{
+    FAST_MUTEX Lock;
+    ULONG Generation;       /* bumped on every invalidation */
+    LIST_ENTRY LruList;     /* most recently used first */
+    LIST_ENTRY Buckets[NTFS_MFT_CACHE_BUCKETS];
+    NTFS_MFT_CACHE_ENTRY Entries[NTFS_MFT_CACHE_ENTRIES];
+    ULONG Hits;
+    ULONG Misses;
+    ULONG Invalidations;
+} NTFS_MFT_CACHE, *PNTFS_MFT_CACHE;
+
+#define NTFS_FCB_HASH_BUCKETS 256
+
+/* Private debugging request, returns a NTFS_CACHE_STATISTICS */
+#define FSCTL_NTFS_QUERY_CACHE_STATISTICS \
+    CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+typedef struct _NTFS_CACHE_STATISTICS
+{
+    ULONG MftCacheHits;
+    ULONG MftCacheMisses;
+    ULONG MftCacheInvalidations;
+    ULONG FcbTableHits;
+    ULONG FcbTableMisses;
+    ULONG FcbTableCount;
+} NTFS_CACHE_STATISTICS, *PNTFS_CACHE_STATISTICS;
+
 typedef struct
 {
     NTFSIDENTIFIER Identifier;
@@ -105,6 +144,11 @@ typedef struct
 
     KSPIN_LOCK FcbListLock;
     LIST_ENTRY FcbListHead;
+    /* FCBs hashed by path name, protected by FcbListLock */
+    LIST_ENTRY FcbHashTable[NTFS_FCB_HASH_BUCKETS];
+    ULONG FcbCount;
+    ULONG FcbTableHits;
+    ULONG FcbTableMisses;
 
     PVPB Vpb;
     PDEVICE_OBJECT StorageDevice;
@@ -117,6 +161,7 @@ typedef struct
     NTFS_INFO NtfsInfo;
 
     NPAGED_LOOKASIDE_LIST FileRecLookasideList;
+    NTFS_MFT_CACHE MftCache;
 
     ULONG MftDataOffset;
     ULONG Flags;
@@ -304,6 +349,11 @@ typedef struct
     };
 } NTFS_ATTR_RECORD, *PNTFS_ATTR_RECORD;
 
+/* NTFS_ATTR_RECORD.Flags */
+#define NTFS_ATTR_COMPRESSED    0x0001
+#define NTFS_ATTR_ENCRYPTED     0x4000
+#define NTFS_ATTR_SPARSE        0x8000
+
 typedef struct
 {
     ULONG Type;
@@ -510,6 +560,27 @@ typedef struct _NTFS_ATTR_CONTEXT
 #define FCB_IS_VOLUME           0x0004
 #define MAX_PATH                260
 
+/* Recently used $I30 index buffers of a directory, see mft.c */
+#define NTFS_INDEX_CACHE_ENTRIES 4
+
+typedef struct _NTFS_INDEX_CACHE_ENTRY
+{
+    ULONGLONG Vcn;
+    ULONG Size;
+    ULONG LastUse;
+    PINDEX_BUFFER Buffer;   /* Fixed up, NULL if the entry is unused */
+} NTFS_INDEX_CACHE_ENTRY, *PNTFS_INDEX_CACHE_ENTRY;
+
+/* Decompressed compression units of a compressed stream, see rw.c */
+#define NTFS_UNIT_CACHE_ENTRIES 4
+
+typedef struct _NTFS_UNIT_CACHE_ENTRY
+{
+    ULONGLONG Unit;
+    ULONG LastUse;
+    PUCHAR Buffer;          /* NULL if the entry is unused */
+} NTFS_UNIT_CACHE_ENTRY, *PNTFS_UNIT_CACHE_ENTRY;
+
 typedef struct _FCB
 {
     NTFSIDENTIFIER Identifier;
@@ -528,6 +599,8 @@ typedef struct _FCB
     ERESOURCE MainResource;
 
     LIST_ENTRY FcbListEntry;
+    LIST_ENTRY FcbHashEntry;
+    ULONG PathHash;
     struct _FCB* ParentFcb;
 
     ULONG DirIndex;
@@ -541,6 +614,18 @@ typedef struct _FCB
 
     FILENAME_ATTRIBUTE Entry;
 
+    /* Protected by the DirResource of the volume */
+    ULONG IndexCacheTick;
+    NTFS_INDEX_CACHE_ENTRY IndexCache[NTFS_INDEX_CACHE_ENTRIES];
+
+    /* Protects the fields below */
+    ERESOURCE UnitCacheResource;
+    ULONG UnitSize;
+    ULONG UnitCacheTick;
+    ULONGLONG LastReadEnd;
+    BOOLEAN ReadAheadPending;
+    NTFS_UNIT_CACHE_ENTRY UnitCache[NTFS_UNIT_CACHE_ENTRIES];
+
 } NTFS_FCB, *PNTFS_FCB;
 
 typedef struct _FIND_ATTR_CONTXT
@@ -957,6 +1042,13 @@ PNTFS_FCB
 NtfsGrabFCBFromTable(PNTFS_VCB Vcb,
                      PCWSTR FileName);
 
+VOID
+NtfsFlushIndexCache(PNTFS_FCB Fcb);
+
+VOID
+NtfsInvalidateIndexCache(PNTFS_VCB Vcb,
+                         ULONGLONG DirectoryMftIndex);
+
 NTSTATUS
 NtfsFCBInitializeCache(PNTFS_VCB Vcb,
                        PNTFS_FCB Fcb);
@@ -1118,6 +1210,12 @@ ReadFileRecord(PDEVICE_EXTENSION Vcb,
                ULONGLONG index,
                PFILE_RECORD_HEADER file);
 
+VOID
+NtfsInitializeMftCache(PDEVICE_EXTENSION Vcb);
+
+VOID
+NtfsFlushMftCache(PDEVICE_EXTENSION Vcb);
+
 NTSTATUS
 UpdateIndexEntryFileNameSize(PDEVICE_EXTENSION Vcb,
                              PFILE_RECORD_HEADER MftRecord,
@@ -1196,7 +1294,8 @@ NtfsLookupFileAt(PDEVICE_EXTENSION Vcb,
                  BOOLEAN CaseSensitive,
                  PFILE_RECORD_HEADER *FileRecord,
                  PULONGLONG MFTIndex,
-                 ULONGLONG CurrentMFTIndex);
+                 ULONGLONG CurrentMFTIndex,
+                 PNTFS_FCB DirectoryFcb);
 
 VOID
 NtfsDumpFileRecord(PDEVICE_EXTENSION Vcb,
@@ -1213,6 +1312,7 @@ NtfsFindFileAt(PDEVICE_EXTENSION Vcb,
 
 NTSTATUS
 NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
+                  PNTFS_FCB DirectoryFcb,
                   ULONGLONG MFTIndex,
                   PUNICODE_STRING FileName,
                   PULONG FirstEntry,
@@ -1261,6 +1361,9 @@ NtfsRead(PNTFS_IRP_CONTEXT IrpContext);
 NTSTATUS
 NtfsWrite(PNTFS_IRP_CONTEXT IrpContext);
 
+VOID
+NtfsFlushUnitCache(PNTFS_FCB Fcb);
+
 
 /* volinfo.c */
 
@@ -35,6 +35,309 @@
 
 /* FUNCTIONS ****************************************************************/
 
+typedef struct _NTFS_READ_AHEAD_CONTEXT
+{
+    WORK_QUEUE_ITEM WorkItem;
+    PDEVICE_EXTENSION DeviceExt;
+    PNTFS_FCB Fcb;
+    ULONGLONG Unit;
+} NTFS_READ_AHEAD_CONTEXT, *PNTFS_READ_AHEAD_CONTEXT;
+
+static
+BOOLEAN
+NtfsIsCompressedAttribute(PNTFS_ATTR_CONTEXT Context)
+{
+    return Context->pRecord->IsNonResident &&
+           (Context->pRecord->Flags & NTFS_ATTR_COMPRESSED) &&
+           Context->pRecord->NonResident.CompressionUnit != 0;
+}
+
+/*
+ * FUNCTION: Reads and decompresses one compression unit of a stream.
+ *           The clusters holding compressed data come first in the unit,
+ *           the rest of it is sparse. A fully allocated unit isn't
+ *           compressed and a fully sparse one is zeroes.
+ */
+static
+NTSTATUS
+NtfsReadCompressionUnit(PDEVICE_EXTENSION DeviceExt,
+                        PNTFS_ATTR_CONTEXT DataContext,
+                        ULONGLONG Unit,
+                        PUCHAR Buffer)
+{
+    ULONG ClustersPerUnit = 1 << DataContext->pRecord->NonResident.CompressionUnit;
+    ULONG BytesPerCluster = DeviceExt->NtfsInfo.BytesPerCluster;
+    ULONG UnitSize = ClustersPerUnit * BytesPerCluster;
+    ULONGLONG Vcn = Unit * ClustersPerUnit;
+    ULONG Allocated = 0;
+    LONGLONG Lcn, Count;
+    PUCHAR CompressedBuffer;
+    ULONG FinalSize;
+    NTSTATUS Status;
+
+    CompressedBuffer = ExAllocatePoolWithTag(NonPagedPool, UnitSize, TAG_NTFS);
+    if (CompressedBuffer == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    while (Allocated < ClustersPerUnit)
+    {
+        if (!FsRtlLookupLargeMcbEntry(&DataContext->DataRunsMCB, Vcn + Allocated, &Lcn, &Count, NULL, NULL, NULL) ||
+            Lcn == -1)
+        {
+            break;
+        }
+
+        if (Count > ClustersPerUnit - Allocated)
+            Count = ClustersPerUnit - Allocated;
+
+        Status = ReadLCN(DeviceExt, Lcn, (ULONG)Count, CompressedBuffer + Allocated * BytesPerCluster);
+        if (!NT_SUCCESS(Status))
+        {
+            ExFreePoolWithTag(CompressedBuffer, TAG_NTFS);
+            return Status;
+        }
+        Allocated += (ULONG)Count;
+    }
+
+    if (Allocated == ClustersPerUnit)
+    {
+        RtlCopyMemory(Buffer, CompressedBuffer, UnitSize);
+        Status = STATUS_SUCCESS;
+    }
+    else if (Allocated == 0)
+    {
+        RtlZeroMemory(Buffer, UnitSize);
+        Status = STATUS_SUCCESS;
+    }
+    else
+    {
+        Status = RtlDecompressBuffer(COMPRESSION_FORMAT_LZNT1,
+                                     Buffer,
+                                     UnitSize,
+                                     CompressedBuffer,
+                                     Allocated * BytesPerCluster,
+                                     &FinalSize);
+        if (NT_SUCCESS(Status))
+        {
+            // A unit which ends with zeroes decompresses to less data
+            RtlZeroMemory(Buffer + FinalSize, UnitSize - FinalSize);
+        }
+        else
+        {
+            DPRINT1("Failed to decompress unit %I64u: 0x%08lx\n", Unit, Status);
+        }
+    }
+
+    ExFreePoolWithTag(CompressedBuffer, TAG_NTFS);
+    return Status;
+}
+
+/*
+ * FUNCTION: Returns the decompressed data of a unit, from the FCB cache
+ *           or after decompressing it into the least recently used entry.
+ *           The caller holds the UnitCacheResource exclusively.
+ */
+static
+NTSTATUS
+NtfsGetCompressionUnit(PDEVICE_EXTENSION DeviceExt,
+                       PNTFS_FCB Fcb,
+                       PNTFS_ATTR_CONTEXT DataContext,
+                       ULONGLONG Unit,
+                       PUCHAR *Data)
+{
+    PNTFS_UNIT_CACHE_ENTRY Entry = NULL;
+    ULONG UnitSize;
+    ULONG i;
+    NTSTATUS Status;
+
+    UnitSize = DeviceExt->NtfsInfo.BytesPerCluster << DataContext->pRecord->NonResident.CompressionUnit;
+    if (Fcb->UnitSize != UnitSize)
+    {
+        NtfsFlushUnitCache(Fcb);
+        Fcb->UnitSize = UnitSize;
+    }
+
+    for (i = 0; i < NTFS_UNIT_CACHE_ENTRIES; i++)
+    {
+        PNTFS_UNIT_CACHE_ENTRY Current = &Fcb->UnitCache[i];
+
+        if (Current->Buffer != NULL && Current->Unit == Unit)
+        {
+            Current->LastUse = ++Fcb->UnitCacheTick;
+            *Data = Current->Buffer;
+            return STATUS_SUCCESS;
+        }
+
+        if (Entry == NULL ||
+            (Entry->Buffer != NULL && (Current->Buffer == NULL || Current->LastUse < Entry->LastUse)))
+        {
+            Entry = Current;
+        }
+    }
+
+    if (Entry->Buffer == NULL)
+    {
+        Entry->Buffer = ExAllocatePoolWithTag(NonPagedPool, UnitSize, TAG_NTFS);
+        if (Entry->Buffer == NULL)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    Status = NtfsReadCompressionUnit(DeviceExt, DataContext, Unit, Entry->Buffer);
+    if (!NT_SUCCESS(Status))
+    {
+        ExFreePoolWithTag(Entry->Buffer, TAG_NTFS);
+        Entry->Buffer = NULL;
+        return Status;
+    }
+
+    Entry->Unit = Unit;
+    Entry->LastUse = ++Fcb->UnitCacheTick;
+    *Data = Entry->Buffer;
+    return STATUS_SUCCESS;
+}
+
+VOID
+NtfsFlushUnitCache(PNTFS_FCB Fcb)
+{
+    ULONG i;
+
+    for (i = 0; i < NTFS_UNIT_CACHE_ENTRIES; i++)
+    {
+        if (Fcb->UnitCache[i].Buffer != NULL)
+        {
+            ExFreePoolWithTag(Fcb->UnitCache[i].Buffer, TAG_NTFS);
+            Fcb->UnitCache[i].Buffer = NULL;
+        }
+    }
+}
+
+/*
+ * FUNCTION: Decompresses the unit following a sequential read in the
+ *           background, so that the next read finds it in the cache
+ */
+static
+VOID
+NTAPI
+NtfsReadAheadWorker(PVOID Parameter)
+{
+    PNTFS_READ_AHEAD_CONTEXT Context = Parameter;
+    PDEVICE_EXTENSION DeviceExt = Context->DeviceExt;
+    PNTFS_FCB Fcb = Context->Fcb;
+    PFILE_RECORD_HEADER FileRecord;
+    PNTFS_ATTR_CONTEXT DataContext = NULL;
+    PUCHAR Data;
+    NTSTATUS Status;
+
+    FileRecord = ExAllocateFromNPagedLookasideList(&DeviceExt->FileRecLookasideList);
+    if (FileRecord != NULL)
+    {
+        Status = ReadFileRecord(DeviceExt, Fcb->MFTIndex, FileRecord);
+        if (NT_SUCCESS(Status))
+        {
+            Status = FindAttribute(DeviceExt, FileRecord, AttributeData, Fcb->Stream, wcslen(Fcb->Stream), &DataContext, NULL);
+            if (!NT_SUCCESS(Status))
+                DataContext = NULL;
+        }
+    }
+
+    // The flag is cleared under the lock, so that no reader queues another
+    // read-ahead before this one is done
+    KeEnterCriticalRegion();
+    ExAcquireResourceExclusiveLite(&Fcb->UnitCacheResource, TRUE);
+    if (DataContext != NULL && NtfsIsCompressedAttribute(DataContext))
+    {
+        NtfsGetCompressionUnit(DeviceExt, Fcb, DataContext, Context->Unit, &Data);
+    }
+    Fcb->ReadAheadPending = FALSE;
+    ExReleaseResourceLite(&Fcb->UnitCacheResource);
+    KeLeaveCriticalRegion();
+
+    if (DataContext != NULL)
+        ReleaseAttributeContext(DataContext);
+    if (FileRecord != NULL)
+        ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, FileRecord);
+
+    NtfsReleaseFCB(DeviceExt, Fcb);
+    ExFreePoolWithTag(Context, TAG_NTFS);
+}
+
+/*
+ * FUNCTION: Reads data from a compressed stream, one compression unit
+ *           at a time
+ */
+static
+NTSTATUS
+NtfsReadCompressedFile(PDEVICE_EXTENSION DeviceExt,
+                       PNTFS_FCB Fcb,
+                       PNTFS_ATTR_CONTEXT DataContext,
+                       PUCHAR Buffer,
+                       ULONG Length,
+                       ULONG ReadOffset)
+{
+    ULONG UnitSize = DeviceExt->NtfsInfo.BytesPerCluster << DataContext->pRecord->NonResident.CompressionUnit;
+    ULONGLONG StreamSize = AttributeDataLength(DataContext->pRecord);
+    ULONGLONG Offset = ReadOffset;
+    ULONGLONG End = (ULONGLONG)ReadOffset + Length;
+    ULONGLONG NextUnit;
+    PNTFS_READ_AHEAD_CONTEXT ReadAhead = NULL;
+    BOOLEAN Sequential;
+    PUCHAR Data;
+    ULONG InUnit, Chunk;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    KeEnterCriticalRegion();
+    ExAcquireResourceExclusiveLite(&Fcb->UnitCacheResource, TRUE);
+
+    Sequential = (Fcb->LastReadEnd == ReadOffset);
+
+    while (Offset < End)
+    {
+        Status = NtfsGetCompressionUnit(DeviceExt, Fcb, DataContext, Offset / UnitSize, &Data);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        InUnit = (ULONG)(Offset % UnitSize);
+        Chunk = min(UnitSize - InUnit, (ULONG)(End - Offset));
+        RtlCopyMemory(Buffer, Data + InUnit, Chunk);
+
+        Buffer += Chunk;
+        Offset += Chunk;
+    }
+
+    Fcb->LastReadEnd = End;
+
+    // Streaming reads get the next unit decompressed while they consume this one
+    NextUnit = (End + UnitSize - 1) / UnitSize;
+    if (NT_SUCCESS(Status) && Sequential && !Fcb->ReadAheadPending &&
+        NextUnit * UnitSize < StreamSize)
+    {
+        ReadAhead = ExAllocatePoolWithTag(NonPagedPool, sizeof(NTFS_READ_AHEAD_CONTEXT), TAG_NTFS);
+        if (ReadAhead != NULL)
+        {
+            Fcb->ReadAheadPending = TRUE;
+        }
+    }
+
+    ExReleaseResourceLite(&Fcb->UnitCacheResource);
+    KeLeaveCriticalRegion();
+
+    if (ReadAhead != NULL)
+    {
+        ReadAhead->DeviceExt = DeviceExt;
+        ReadAhead->Fcb = Fcb;
+        ReadAhead->Unit = NextUnit;
+        NtfsGrabFCB(DeviceExt, Fcb);
+        ExInitializeWorkItem(&ReadAhead->WorkItem, NtfsReadAheadWorker, ReadAhead);
+        ExQueueWorkItem(&ReadAhead->WorkItem, DelayedWorkQueue);
+    }
+
+    return Status;
+}
+
 /*
  * FUNCTION: Reads data from a file
  */
@@ -72,13 +375,6 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
 
     Fcb = (PNTFS_FCB)FileObject->FsContext;
 
-    if (NtfsFCBIsCompressed(Fcb))
-    {
-        DPRINT1("Compressed file!\n");
-        UNIMPLEMENTED;
-        return STATUS_NOT_IMPLEMENTED;
-    }
-
     if (NtfsFCBIsEncrypted(Fcb))
     {
         DPRINT1("Encrypted file!\n");
@@ -146,6 +442,26 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
     if (ReadOffset + Length > StreamSize)
         ToRead = StreamSize - ReadOffset;
 
+    if (NtfsIsCompressedAttribute(DataContext))
+    {
+        Status = NtfsReadCompressedFile(DeviceExt, Fcb, DataContext, Buffer, ToRead, ReadOffset);
+
+        ReleaseAttributeContext(DataContext);
+        ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, FileRecord);
+
+        if (!NT_SUCCESS(Status))
+        {
+            return Status;
+        }
+
+        *LengthRead = ToRead;
+        if (ToRead != Length)
+        {
+            RtlZeroMemory(Buffer + ToRead, Length - ToRead);
+        }
+        return STATUS_SUCCESS;
+    }
+
     RealReadOffset = ReadOffset;
     RealLength = ToRead;
 
@@ -160,6 +160,18 @@ FindFile(
         }
     }
 
+    /* A lookup from the start of a large directory can use its name cache */
+    if (WildCard == FALSE && First && DirContext->DirIndex == 0 &&
+        vfatNameCacheLookup(DeviceExt, Parent, FileToFindU, DirContext, &Status))
+    {
+        if (Status == STATUS_OBJECT_NAME_NOT_FOUND)
+        {
+            Status = STATUS_NO_MORE_ENTRIES;
+        }
+        ExFreePoolWithTag(PathNameBuffer, TAG_NAME);
+        return Status;
+    }
+
     /* FsRtlIsNameInExpression need the searched string to be upcase,
     * even if IgnoreCase is specified */
     Status = RtlUpcaseUnicodeString(&FileToFindUpcase, FileToFindU, TRUE);
@@ -0,0 +1,459 @@
+/*
+ * PROJECT:     VFAT Filesystem
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Hashed name lookup for large directories
+ */
+
+/*  -------------------------------------------------------  INCLUDES  */
+
+#include "vfat.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/*  --------------------------------------------------------  DEFINES  */
+
+/* Directories smaller than this (in bytes) are simply scanned */
+#define VFAT_NAME_CACHE_MIN_SIZE    (16 * 1024)
+
+#define VFAT_NAME_CACHE_NIL         0xffffffff
+
+typedef struct _VFAT_NAME_CACHE_ENTRY
+{
+    /* Next entry of the bucket, or VFAT_NAME_CACHE_NIL */
+    ULONG Next;
+    /* Hash of the upcased name */
+    ULONG Hash;
+    /* Index to pass to VfatGetNextDirEntry, or VFAT_NAME_CACHE_NIL if free */
+    ULONG DirIndex;
+} VFAT_NAME_CACHE_ENTRY, *PVFAT_NAME_CACHE_ENTRY;
+
+/*
+ * The cache knows every long and short name of the directory, so a miss
+ * is a definitive answer. Entries live in a single array and are chained
+ * by index, which keeps the whole cache in two allocations.
+ */
+struct _VFAT_NAME_CACHE
+{
+    ULONG BucketMask;
+    PULONG Buckets;
+    ULONG MaxEntries;
+    ULONG EntryCount;
+    ULONG FreeList;
+    PVFAT_NAME_CACHE_ENTRY Entries;
+};
+
+/*  --------------------------------------------------------  PRIVATES  */
+
+static
+ULONG
+vfatNameCacheHash(
+    PUNICODE_STRING NameU)
+{
+    PWCHAR curr = NameU->Buffer;
+    PWCHAR last = NameU->Buffer + NameU->Length / sizeof(WCHAR);
+    ULONG hash = 0;
+    WCHAR c;
+
+    while (curr < last)
+    {
+        c = RtlUpcaseUnicodeChar(*curr++);
+        hash = (hash + (c << 4) + (c >> 4)) * 11;
+    }
+    return hash;
+}
+
+/*
+ * FUNCTION: Translate the directory index stored in an FCB into the index
+ *           used to iterate its parent directory
+ */
+static
+ULONG
+vfatNameCacheIndexFromFcb(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb)
+{
+    if (vfatVolumeIsFatX(DeviceExt) && !vfatFCBIsRoot(Fcb->parentFcb))
+    {
+        /* The '.' and '..' entries are not on disk */
+        return Fcb->dirIndex + 2;
+    }
+    return Fcb->dirIndex;
+}
+
+static
+VOID
+vfatNameCacheFree(
+    PVFAT_NAME_CACHE Cache)
+{
+    ExFreePoolWithTag(Cache->Entries, TAG_NAMECACHE);
+    ExFreePoolWithTag(Cache->Buckets, TAG_NAMECACHE);
+    ExFreePoolWithTag(Cache, TAG_NAMECACHE);
+}
+
+static
+PVFAT_NAME_CACHE
+vfatNameCacheAllocate(
+    ULONG MaxEntries)
+{
+    PVFAT_NAME_CACHE Cache;
+    ULONG BucketCount, i;
+
+    /* About one entry per bucket when full */
+    BucketCount = 64;
+    while (BucketCount < MaxEntries && BucketCount < 0x100000)
+    {
+        BucketCount <<= 1;
+    }
+
+    Cache = ExAllocatePoolWithTag(PagedPool, sizeof(*Cache), TAG_NAMECACHE);
+    if (Cache == NULL)
+    {
+        return NULL;
+    }
+    Cache->Buckets = ExAllocatePoolWithTag(PagedPool, BucketCount * sizeof(ULONG), TAG_NAMECACHE);
+    Cache->Entries = ExAllocatePoolWithTag(PagedPool, MaxEntries * sizeof(VFAT_NAME_CACHE_ENTRY), TAG_NAMECACHE);
+    if (Cache->Buckets == NULL || Cache->Entries == NULL)
+    {
+        if (Cache->Buckets != NULL)
+            ExFreePoolWithTag(Cache->Buckets, TAG_NAMECACHE);
+        if (Cache->Entries != NULL)
+            ExFreePoolWithTag(Cache->Entries, TAG_NAMECACHE);
+        ExFreePoolWithTag(Cache, TAG_NAMECACHE);
+        return NULL;
+    }
+
+    for (i = 0; i < BucketCount; i++)
+    {
+        Cache->Buckets[i] = VFAT_NAME_CACHE_NIL;
+    }
+    Cache->BucketMask = BucketCount - 1;
+    Cache->MaxEntries = MaxEntries;
+    Cache->EntryCount = 0;
+    Cache->FreeList = VFAT_NAME_CACHE_NIL;
+    return Cache;
+}
+
+/*
+ * FUNCTION: Move the entries of a full cache into a cache twice as large
+ */
+static
+PVFAT_NAME_CACHE
+vfatNameCacheGrow(
+    PVFAT_NAME_CACHE Cache)
+{
+    PVFAT_NAME_CACHE NewCache;
+    PVFAT_NAME_CACHE_ENTRY Entry;
+    ULONG i, Bucket;
+
+    NewCache = vfatNameCacheAllocate(Cache->MaxEntries * 2);
+    if (NewCache == NULL)
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < Cache->EntryCount; i++)
+    {
+        if (Cache->Entries[i].DirIndex == VFAT_NAME_CACHE_NIL)
+            continue;
+
+        Entry = &NewCache->Entries[NewCache->EntryCount];
+        Entry->Hash = Cache->Entries[i].Hash;
+        Entry->DirIndex = Cache->Entries[i].DirIndex;
+        Bucket = Entry->Hash & NewCache->BucketMask;
+        Entry->Next = NewCache->Buckets[Bucket];
+        NewCache->Buckets[Bucket] = NewCache->EntryCount++;
+    }
+
+    vfatNameCacheFree(Cache);
+    return NewCache;
+}
+
+static
+BOOLEAN
+vfatNameCacheAddName(
+    PVFATFCB DirFcb,
+    PUNICODE_STRING NameU,
+    ULONG DirIndex)
+{
+    PVFAT_NAME_CACHE Cache = DirFcb->NameCache;
+    PVFAT_NAME_CACHE_ENTRY Entry;
+    ULONG Index, Bucket;
+
+    if (NameU->Length == 0)
+    {
+        return TRUE;
+    }
+
+    if (Cache->FreeList != VFAT_NAME_CACHE_NIL)
+    {
+        Index = Cache->FreeList;
+        Cache->FreeList = Cache->Entries[Index].Next;
+    }
+    else
+    {
+        if (Cache->EntryCount == Cache->MaxEntries)
+        {
+            Cache = vfatNameCacheGrow(Cache);
+            if (Cache == NULL)
+            {
+                return FALSE;
+            }
+            DirFcb->NameCache = Cache;
+        }
+        Index = Cache->EntryCount++;
+    }
+
+    Entry = &Cache->Entries[Index];
+    Entry->Hash = vfatNameCacheHash(NameU);
+    Entry->DirIndex = DirIndex;
+    Bucket = Entry->Hash & Cache->BucketMask;
+    Entry->Next = Cache->Buckets[Bucket];
+    Cache->Buckets[Bucket] = Index;
+    return TRUE;
+}
+
+static
+VOID
+vfatNameCacheRemoveName(
+    PVFAT_NAME_CACHE Cache,
+    PUNICODE_STRING NameU,
+    ULONG DirIndex)
+{
+    PULONG Link;
+    ULONG Index;
+
+    if (NameU->Length == 0)
+    {
+        return;
+    }
+
+    Link = &Cache->Buckets[vfatNameCacheHash(NameU) & Cache->BucketMask];
+    while (*Link != VFAT_NAME_CACHE_NIL)
+    {
+        Index = *Link;
+        if (Cache->Entries[Index].DirIndex == DirIndex)
+        {
+            *Link = Cache->Entries[Index].Next;
+            Cache->Entries[Index].DirIndex = VFAT_NAME_CACHE_NIL;
+            Cache->Entries[Index].Next = Cache->FreeList;
+            Cache->FreeList = Index;
+        }
+        else
+        {
+            Link = &Cache->Entries[Index].Next;
+        }
+    }
+}
+
+/*
+ * FUNCTION: Scan the whole directory once and hash the names of its entries
+ */
+static
+NTSTATUS
+vfatNameCacheBuild(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb)
+{
+    NTSTATUS Status;
+    PVOID Context = NULL;
+    PVOID Page = NULL;
+    BOOLEAN First = TRUE;
+    VFAT_DIRENTRY_CONTEXT DirContext;
+    WCHAR LongNameBuffer[260];
+    WCHAR ShortNameBuffer[13];
+    BOOLEAN IsFatX = vfatVolumeIsFatX(DeviceExt);
+    ULONG Slots;
+
+    /* Most entries have both a long and a short name */
+    Slots = DirFcb->RFCB.FileSize.u.LowPart /
+            (IsFatX ? sizeof(FATX_DIR_ENTRY) : sizeof(FAT_DIR_ENTRY));
+    DirFcb->NameCache = vfatNameCacheAllocate(Slots + 2);
+    if (DirFcb->NameCache == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    DirContext.DirIndex = 0;
+    DirContext.LongNameU.Buffer = LongNameBuffer;
+    DirContext.LongNameU.Length = 0;
+    DirContext.LongNameU.MaximumLength = sizeof(LongNameBuffer);
+    DirContext.ShortNameU.Buffer = ShortNameBuffer;
+    DirContext.ShortNameU.Length = 0;
+    DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
+    DirContext.DeviceExt = DeviceExt;
+
+    while (TRUE)
+    {
+        Status = VfatGetNextDirEntry(DeviceExt, &Context, &Page, DirFcb, &DirContext, First);
+        First = FALSE;
+        if (Status == STATUS_NO_MORE_ENTRIES)
+        {
+            Status = STATUS_SUCCESS;
+            break;
+        }
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
+
+        /* Skip what the linear lookups skip too */
+        if (!ENTRY_VOLUME(IsFatX, &DirContext.DirEntry) &&
+            DirContext.LongNameU.Length != 0 &&
+            DirContext.ShortNameU.Length != 0)
+        {
+            if (!vfatNameCacheAddName(DirFcb, &DirContext.LongNameU, DirContext.DirIndex) ||
+                !vfatNameCacheAddName(DirFcb, &DirContext.ShortNameU, DirContext.DirIndex))
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+        }
+        DirContext.DirIndex++;
+    }
+
+    if (Context != NULL)
+    {
+        CcUnpinData(Context);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        vfatInvalidateNameCache(DirFcb);
+    }
+    return Status;
+}
+
+/*  --------------------------------------------------------  PUBLICS  */
+
+/*
+ * FUNCTION: Look up a name in a directory through its name cache
+ * ARGUMENTS:
+ *     DirContext = Receives the entry, name buffers must be provided
+ *     Status = STATUS_SUCCESS if found, STATUS_OBJECT_NAME_NOT_FOUND if not
+ * RETURNS: FALSE if the cache cannot be used and the caller must scan
+ *          the directory itself
+ * NOTE: The caller must hold the DirResource of the volume exclusively
+ */
+BOOLEAN
+vfatNameCacheLookup(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext,
+    NTSTATUS *Status)
+{
+    PVFAT_NAME_CACHE Cache;
+    PVOID Context;
+    PVOID Page;
+    ULONG Hash, Index;
+
+    if (DirFcb->NameCache == NULL)
+    {
+        if (DirFcb->RFCB.FileSize.u.LowPart < VFAT_NAME_CACHE_MIN_SIZE)
+        {
+            return FALSE;
+        }
+        if (!NT_SUCCESS(vfatNameCacheBuild(DeviceExt, DirFcb)))
+        {
+            return FALSE;
+        }
+    }
+
+    Cache = DirFcb->NameCache;
+    Hash = vfatNameCacheHash(FileToFindU);
+    for (Index = Cache->Buckets[Hash & Cache->BucketMask];
+         Index != VFAT_NAME_CACHE_NIL;
+         Index = Cache->Entries[Index].Next)
+    {
+        if (Cache->Entries[Index].Hash != Hash)
+            continue;
+
+        /* Re-read the entry, FIRST makes FAT go back to its long name */
+        Context = NULL;
+        DirContext->DirIndex = Cache->Entries[Index].DirIndex;
+        *Status = VfatGetNextDirEntry(DeviceExt, &Context, &Page, DirFcb, DirContext, TRUE);
+        if (Context != NULL)
+        {
+            CcUnpinData(Context);
+        }
+        if (!NT_SUCCESS(*Status) ||
+            DirContext->DirIndex != Cache->Entries[Index].DirIndex)
+        {
+            /* Stale, let the caller scan and rebuild next time */
+            DPRINT1("Stale name cache entry %u in %wZ\n",
+                    Cache->Entries[Index].DirIndex, &DirFcb->PathNameU);
+            vfatInvalidateNameCache(DirFcb);
+            DirContext->DirIndex = 0;
+            return FALSE;
+        }
+
+        if (RtlEqualUnicodeString(FileToFindU, &DirContext->LongNameU, TRUE) ||
+            RtlEqualUnicodeString(FileToFindU, &DirContext->ShortNameU, TRUE))
+        {
+            *Status = STATUS_SUCCESS;
+            return TRUE;
+        }
+    }
+
+    *Status = STATUS_OBJECT_NAME_NOT_FOUND;
+    return TRUE;
+}
+
+/*
+ * FUNCTION: Add the names of a new entry to the cache of its parent
+ */
+VOID
+vfatNameCacheInsert(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb)
+{
+    PVFATFCB DirFcb = Fcb->parentFcb;
+    ULONG DirIndex;
+
+    if (DirFcb == NULL || DirFcb->NameCache == NULL)
+    {
+        return;
+    }
+
+    DirIndex = vfatNameCacheIndexFromFcb(DeviceExt, Fcb);
+    if (!vfatNameCacheAddName(DirFcb, &Fcb->LongNameU, DirIndex) ||
+        !vfatNameCacheAddName(DirFcb, &Fcb->ShortNameU, DirIndex))
+    {
+        vfatInvalidateNameCache(DirFcb);
+    }
+}
+
+/*
+ * FUNCTION: Remove the names of a deleted entry from the cache of its parent
+ */
+VOID
+vfatNameCacheRemove(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb)
+{
+    PVFATFCB DirFcb = Fcb->parentFcb;
+    ULONG DirIndex;
+
+    if (DirFcb == NULL || DirFcb->NameCache == NULL)
+    {
+        return;
+    }
+
+    DirIndex = vfatNameCacheIndexFromFcb(DeviceExt, Fcb);
+    vfatNameCacheRemoveName(DirFcb->NameCache, &Fcb->LongNameU, DirIndex);
+    vfatNameCacheRemoveName(DirFcb->NameCache, &Fcb->ShortNameU, DirIndex);
+}
+
+VOID
+vfatInvalidateNameCache(
+    PVFATFCB DirFcb)
+{
+    if (DirFcb->NameCache != NULL)
+    {
+        vfatNameCacheFree(DirFcb->NameCache);
+        DirFcb->NameCache = NULL;
+    }
+}
+
+/* EOF */
@@ -200,6 +200,9 @@ vfatRenameEntry(
     {
         VFAT_DIRENTRY_CONTEXT DirContext;
 
+        /* The name changes in place */
+        vfatInvalidateNameCache(pFcb->parentFcb);
+
         /* Open associated dir entry */
         StartIndex = pFcb->startIndex;
         Offset.u.HighPart = 0;
@@ -779,6 +782,8 @@ FATAddEntry(
     DPRINT("new : entry=%11.11s\n", (*Fcb)->entry.Fat.Filename);
     DPRINT("new : entry=%11.11s\n", DirContext.DirEntry.Fat.Filename);
 
+    vfatNameCacheInsert(DeviceExt, *Fcb);
+
     if (IsDirectory)
     {
         Status = vfatFCBInitializeCacheFromVolume(DeviceExt, (*Fcb));
@@ -933,6 +938,9 @@ FATXAddEntry(
     CcSetDirtyPinnedData(Context, NULL);
     CcUnpinData(Context);
 
+    /* The new FCB is not always available below */
+    vfatInvalidateNameCache(ParentFcb);
+
     if (MoveContext != NULL)
     {
         /* We're modifying an existing FCB - likely rename/move */
@@ -1005,6 +1013,8 @@ FATDelEntry(
         }
     }
 
+    vfatNameCacheRemove(DeviceExt, pFcb);
+
     /* In case of moving, save properties */
     if (MoveContext != NULL)
     {
@@ -1024,6 +1034,7 @@ FATDelEntry(
     /* In case of moving, don't delete data */
     if (MoveContext == NULL)
     {
+        vfatFcbTruncateExtentMap(pFcb, 0);
         while (CurrentCluster && CurrentCluster != 0xffffffff)
         {
             GetNextCluster(DeviceExt, CurrentCluster, &NextCluster);
@@ -1087,6 +1098,7 @@ FATXDelEntry(
     pDirEntry->FilenameLength = 0xe5;
     CurrentCluster = vfatDirEntryGetFirstCluster(DeviceExt,
                                                  (PDIR_ENTRY)pDirEntry);
+    vfatNameCacheRemove(DeviceExt, pFcb);
 
     /* In case of moving, save properties */
     if (MoveContext != NULL)
@@ -1103,6 +1115,7 @@ FATXDelEntry(
     /* In case of moving, don't delete data */
     if (MoveContext == NULL)
     {
+        vfatFcbTruncateExtentMap(pFcb, 0);
         while (CurrentCluster && CurrentCluster != 0xffffffff)
         {
             GetNextCluster(DeviceExt, CurrentCluster, &NextCluster);
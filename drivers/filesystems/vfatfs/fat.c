@@ -417,6 +417,8 @@ FAT12CountAvailableClusters(
 
         if (Entry == 0)
             ulCount++;
+        else if (DeviceExt->FreeClusterMap.Buffer != NULL)
+            RtlSetBit(&DeviceExt->FreeClusterMap, i);
     }
 
     CcUnpinData(Context);
@@ -468,6 +470,8 @@ FAT16CountAvailableClusters(
         {
             if (*Block == 0)
                 ulCount++;
+            else if (DeviceExt->FreeClusterMap.Buffer != NULL)
+                RtlSetBit(&DeviceExt->FreeClusterMap, i);
             Block++;
             i++;
         }
@@ -524,6 +528,8 @@ FAT32CountAvailableClusters(
         {
             if ((*Block & 0x0fffffff) == 0)
                 ulCount++;
+            else if (DeviceExt->FreeClusterMap.Buffer != NULL)
+                RtlSetBit(&DeviceExt->FreeClusterMap, i);
             Block++;
             i++;
         }
@@ -537,6 +543,43 @@ FAT32CountAvailableClusters(
     return STATUS_SUCCESS;
 }
 
+/*
+ * FUNCTION: Allocates the free cluster bitmap of a volume. It is filled in
+ *           by the first call to CountAvailableClusters. Without it (if the
+ *           allocation fails), clusters are found by scanning the FAT.
+ */
+VOID
+InitFreeClusterMap(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    ULONG MapSize;
+    PULONG Buffer;
+
+    MapSize = DeviceExt->FatInfo.NumberOfClusters + 2;
+    Buffer = ExAllocatePoolWithTag(PagedPool,
+                                   ROUND_UP(MapSize, 32) / 8,
+                                   TAG_BITMAP);
+    if (Buffer == NULL)
+    {
+        DPRINT1("No memory for the free cluster bitmap of %u clusters\n", MapSize);
+        RtlZeroMemory(&DeviceExt->FreeClusterMap, sizeof(RTL_BITMAP));
+        return;
+    }
+
+    RtlInitializeBitMap(&DeviceExt->FreeClusterMap, Buffer, MapSize);
+}
+
+VOID
+UninitFreeClusterMap(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    if (DeviceExt->FreeClusterMap.Buffer != NULL)
+    {
+        ExFreePoolWithTag(DeviceExt->FreeClusterMap.Buffer, TAG_BITMAP);
+        DeviceExt->FreeClusterMap.Buffer = NULL;
+    }
+}
+
 NTSTATUS
 CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt,
@@ -546,12 +589,28 @@ CountAvailableClusters(
     ExAcquireResourceExclusiveLite (&DeviceExt->FatResource, TRUE);
     if (!DeviceExt->AvailableClustersValid)
     {
+        /* The count functions set the bits of the clusters in use.
+           Clusters 0 and 1 don't exist */
+        if (DeviceExt->FreeClusterMap.Buffer != NULL)
+        {
+            RtlClearAllBits(&DeviceExt->FreeClusterMap);
+            RtlSetBits(&DeviceExt->FreeClusterMap, 0, 2);
+        }
+
         if (DeviceExt->FatInfo.FatType == FAT12)
             Status = FAT12CountAvailableClusters(DeviceExt);
         else if (DeviceExt->FatInfo.FatType == FAT16 || DeviceExt->FatInfo.FatType == FATX16)
             Status = FAT16CountAvailableClusters(DeviceExt);
         else
             Status = FAT32CountAvailableClusters(DeviceExt);
+
+        /* The clusters the scan didn't reach would read as free, don't
+           allocate from the bitmap: fall back to scanning the FAT */
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Counting the free clusters failed (%lx), dropping the bitmap\n", Status);
+            UninitFreeClusterMap(DeviceExt);
+        }
     }
     if (Clusters != NULL)
     {
@@ -719,6 +778,220 @@ WriteCluster(
         else if (OldValue == 0 && NewValue)
             InterlockedDecrement((PLONG)&DeviceExt->AvailableClusters);
     }
+    if (NT_SUCCESS(Status) && DeviceExt->FreeClusterMap.Buffer != NULL)
+    {
+        if (NewValue == 0)
+            RtlClearBit(&DeviceExt->FreeClusterMap, ClusterToWrite);
+        else
+            RtlSetBit(&DeviceExt->FreeClusterMap, ClusterToWrite);
+    }
+    ExReleaseResourceLite(&DeviceExt->FatResource);
+    return Status;
+}
+
+/*
+ * FUNCTION: Finds a free cluster, preferably at or after Hint, and marks it
+ *           as end of chain. The caller holds FatResource exclusively.
+ */
+static
+NTSTATUS
+FindAndMarkAvailableCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG Hint,
+    PULONG Cluster)
+{
+    NTSTATUS Status;
+    ULONG OldValue;
+
+    /* The bitmap is only complete once the FAT was counted */
+    if (DeviceExt->FreeClusterMap.Buffer == NULL || !DeviceExt->AvailableClustersValid)
+    {
+        return DeviceExt->FindAndMarkAvailableCluster(DeviceExt, Cluster);
+    }
+
+    *Cluster = RtlFindClearBits(&DeviceExt->FreeClusterMap, 1, Hint);
+    if (*Cluster == MAXULONG)
+    {
+        *Cluster = 0;
+        return STATUS_DISK_FULL;
+    }
+
+    Status = DeviceExt->WriteCluster(DeviceExt, *Cluster, 0xffffffff, &OldValue);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    ASSERT(OldValue == 0);
+    RtlSetBit(&DeviceExt->FreeClusterMap, *Cluster);
+    DeviceExt->LastAvailableCluster = *Cluster;
+    if (DeviceExt->AvailableClustersValid)
+        InterlockedDecrement((PLONG)&DeviceExt->AvailableClusters);
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * FUNCTION: Links the clusters FirstCluster to FirstCluster + Count - 1 to
+ *           each other and writes LastValue into the last one. Every FAT
+ *           page is pinned only once. The caller holds FatResource
+ *           exclusively.
+ */
+static
+NTSTATUS
+WriteClusterRun(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG FirstCluster,
+    ULONG Count,
+    ULONG LastValue)
+{
+    ULONG i, EndCluster, Value, EntrySize, ChunkSize, OldValue;
+    PVOID BaseAddress;
+    PVOID Context;
+    LARGE_INTEGER Offset;
+    PUCHAR Entry;
+    NTSTATUS Status;
+
+    EndCluster = FirstCluster + Count;
+
+    /* The whole FAT12 is pinned by every write anyway */
+    if (DeviceExt->FatInfo.FatType == FAT12)
+    {
+        for (i = FirstCluster; i < EndCluster; i++)
+        {
+            Value = (i + 1 < EndCluster) ? i + 1 : LastValue;
+            Status = DeviceExt->WriteCluster(DeviceExt, i, Value, &OldValue);
+            if (!NT_SUCCESS(Status))
+                return Status;
+        }
+        return STATUS_SUCCESS;
+    }
+
+    ChunkSize = CACHEPAGESIZE(DeviceExt);
+    if (DeviceExt->FatInfo.FatType == FAT16 || DeviceExt->FatInfo.FatType == FATX16)
+        EntrySize = 2;
+    else
+        EntrySize = 4;
+
+    for (i = FirstCluster; i < EndCluster; )
+    {
+        Offset.QuadPart = ROUND_DOWN(i * EntrySize, ChunkSize);
+        _SEH2_TRY
+        {
+            CcPinRead(DeviceExt->FATFileObject, &Offset, ChunkSize, PIN_WAIT, &Context, &BaseAddress);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            DPRINT1("CcPinRead(Offset %x, Length %u) failed\n", (ULONG)Offset.QuadPart, ChunkSize);
+            _SEH2_YIELD(return _SEH2_GetExceptionCode());
+        }
+        _SEH2_END;
+
+        /* Now process the whole block */
+        for (; i < EndCluster && i * EntrySize < Offset.u.LowPart + ChunkSize; i++)
+        {
+            Value = (i + 1 < EndCluster) ? i + 1 : LastValue;
+            Entry = (PUCHAR)BaseAddress + (i * EntrySize) % ChunkSize;
+            if (EntrySize == 2)
+                *(PUSHORT)Entry = (USHORT)Value;
+            else
+                *(PULONG)Entry = (*(PULONG)Entry & 0xf0000000) | (Value & 0x0fffffff);
+        }
+
+        CcSetDirtyPinnedData(Context, NULL);
+        CcUnpinData(Context);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * FUNCTION: Appends ClusterCount new clusters to the chain ending with
+ *           LastCluster. They are taken from as few runs of free clusters
+ *           as possible, preferably right after LastCluster. If Fcb is
+ *           given, the new runs are added to its extent map starting at Vcn.
+ *           On failure, the clusters appended so far stay in the chain.
+ */
+NTSTATUS
+ExtendClusterChain(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG LastCluster,
+    ULONG ClusterCount,
+    PVFATFCB Fcb,
+    ULONG Vcn,
+    PULONG NewLastCluster)
+{
+    ULONG RunStart, RunLength, OldValue;
+    NTSTATUS Status = STATUS_SUCCESS;
+    BOOLEAN UseMap;
+
+    ASSERT(LastCluster >= 2);
+
+    ExAcquireResourceExclusiveLite(&DeviceExt->FatResource, TRUE);
+
+    /* The bitmap is only complete once the FAT was counted */
+    UseMap = (DeviceExt->FreeClusterMap.Buffer != NULL && DeviceExt->AvailableClustersValid);
+
+    if (UseMap && DeviceExt->AvailableClusters < ClusterCount)
+    {
+        Status = STATUS_DISK_FULL;
+    }
+
+    while (NT_SUCCESS(Status) && ClusterCount > 0)
+    {
+        if (!UseMap)
+        {
+            Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &RunStart);
+            RunLength = 1;
+        }
+        else
+        {
+            RunLength = ClusterCount;
+            RunStart = RtlFindClearBits(&DeviceExt->FreeClusterMap, RunLength, LastCluster + 1);
+            if (RunStart == MAXULONG)
+            {
+                /* No run is large enough, take the longest one */
+                RunLength = RtlFindLongestRunClear(&DeviceExt->FreeClusterMap, &RunStart);
+            }
+
+            if (RunLength == 0)
+            {
+                Status = STATUS_DISK_FULL;
+            }
+            else
+            {
+                Status = WriteClusterRun(DeviceExt, RunStart, RunLength, 0xffffffff);
+            }
+
+            if (NT_SUCCESS(Status))
+            {
+                RtlSetBits(&DeviceExt->FreeClusterMap, RunStart, RunLength);
+                DeviceExt->LastAvailableCluster = RunStart + RunLength - 1;
+                if (DeviceExt->AvailableClustersValid)
+                    DeviceExt->AvailableClusters -= RunLength;
+            }
+        }
+
+        if (!NT_SUCCESS(Status))
+            break;
+
+        /* Link the run to the chain */
+        Status = DeviceExt->WriteCluster(DeviceExt, LastCluster, RunStart, &OldValue);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        if (Fcb != NULL && !vfatFcbMapRun(Fcb, Vcn, RunStart, RunLength))
+        {
+            /* The map can't be extended, leave it short */
+            Fcb = NULL;
+        }
+
+        Vcn += RunLength;
+        LastCluster = RunStart + RunLength - 1;
+        ClusterCount -= RunLength;
+    }
+
+    *NewLastCluster = LastCluster;
     ExReleaseResourceLite(&DeviceExt->FatResource);
     return Status;
 }
@@ -788,7 +1061,7 @@ GetNextClusterExtend(
      */
     if (CurrentCluster == 0)
     {
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        Status = FindAndMarkAvailableCluster(DeviceExt, DeviceExt->LastAvailableCluster, &NewCluster);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
@@ -807,7 +1080,7 @@ GetNextClusterExtend(
         /* We are after last existing cluster, we must add one to file */
         /* Firstly, find the next available open allocation unit and
            mark it as end of file */
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        Status = FindAndMarkAvailableCluster(DeviceExt, CurrentCluster + 1, &NewCluster);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
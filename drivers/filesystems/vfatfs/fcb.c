@@ -150,7 +150,8 @@ vfatNewFCB(
     ExInitializeResourceLite(&rcFCB->PagingIoResource);
     ExInitializeResourceLite(&rcFCB->MainResource);
     FsRtlInitializeFileLock(&rcFCB->FileLock, NULL, NULL);
-    ExInitializeFastMutex(&rcFCB->LastMutex);
+    ExInitializeFastMutex(&rcFCB->ExtentMapMutex);
+    FsRtlInitializeLargeMcb(&rcFCB->ExtentMap, PagedPool);
     rcFCB->RFCB.PagingIoResource = &rcFCB->PagingIoResource;
     rcFCB->RFCB.Resource = &rcFCB->MainResource;
     rcFCB->RFCB.IsFastIoPossible = FastIoIsNotPossible;
@@ -276,6 +277,8 @@ vfatDestroyFCB(
 #endif
 
     FsRtlUninitializeFileLock(&pFCB->FileLock);
+    FsRtlUninitializeLargeMcb(&pFCB->ExtentMap);
+    vfatInvalidateNameCache(pFCB);
 
     if (!vfatFCBIsRoot(pFCB) &&
         !BooleanFlagOn(pFCB->Flags, FCB_IS_FAT) && !BooleanFlagOn(pFCB->Flags, FCB_IS_VOLUME))
@@ -823,6 +826,18 @@ vfatDirFindFile(
     DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
     DirContext.DeviceExt = pDeviceExt;
 
+    if (vfatNameCacheLookup(pDeviceExt, pDirectoryFCB, FileToFindU, &DirContext, &status))
+    {
+        if (!NT_SUCCESS(status))
+        {
+            return status;
+        }
+        return vfatMakeFCBFromDirEntry(pDeviceExt,
+            pDirectoryFCB,
+            &DirContext,
+            pFoundFCB);
+    }
+
     while (TRUE)
     {
         status = VfatGetNextDirEntry(pDeviceExt,
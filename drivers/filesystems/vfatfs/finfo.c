@@ -1248,7 +1248,6 @@ VfatSetAllocationSizeInformation(
         AllocSizeChanged = TRUE;
         if (FirstCluster == 0)
         {
-            Fcb->LastCluster = Fcb->LastOffset = 0;
             Status = NextCluster(DeviceExt, FirstCluster, &FirstCluster, TRUE);
             if (!NT_SUCCESS(Status))
             {
@@ -1261,12 +1260,14 @@ VfatSetAllocationSizeInformation(
                 return STATUS_DISK_FULL;
             }
 
-            Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                     ROUND_DOWN(NewSize - 1, ClusterSize),
-                                     &NCluster, TRUE);
+            vfatFcbTruncateExtentMap(Fcb, 0);
+            Status = vfatFcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                            ROUND_DOWN(NewSize - 1, ClusterSize),
+                                            &NCluster, TRUE);
             if (NCluster == 0xffffffff || !NT_SUCCESS(Status))
             {
                 /* disk is full */
+                vfatFcbTruncateExtentMap(Fcb, 0);
                 NCluster = Cluster = FirstCluster;
                 Status = STATUS_SUCCESS;
                 while (NT_SUCCESS(Status) && Cluster != 0xffffffff && Cluster > 1)
@@ -1298,43 +1299,25 @@ VfatSetAllocationSizeInformation(
         }
         else
         {
-            if (Fcb->LastCluster > 0)
-            {
-                if (Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize == Fcb->LastOffset)
-                {
-                    Cluster = Fcb->LastCluster;
-                    Status = STATUS_SUCCESS;
-                }
-                else
-                {
-                    Status = OffsetToCluster(DeviceExt, Fcb->LastCluster,
-                                             Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize - Fcb->LastOffset,
-                                             &Cluster, FALSE);
-                }
-            }
-            else
-            {
-                Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                         Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize,
-                                         &Cluster, FALSE);
-            }
-
+            Status = vfatFcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                            Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize,
+                                            &Cluster, FALSE);
             if (!NT_SUCCESS(Status))
             {
                 return Status;
             }
 
-            Fcb->LastCluster = Cluster;
-            Fcb->LastOffset = Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize;
-
             /* FIXME: Check status */
-            /* Cluster points now to the last cluster within the chain */
-            Status = OffsetToCluster(DeviceExt, Cluster,
-                                     ROUND_DOWN(NewSize - 1, ClusterSize) - Fcb->LastOffset,
-                                     &NCluster, TRUE);
+            /* The extent map now ends with the last cluster within the chain,
+             * extend the chain from there */
+            Status = vfatFcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                            ROUND_DOWN(NewSize - 1, ClusterSize),
+                                            &NCluster, TRUE);
             if (NCluster == 0xffffffff || !NT_SUCCESS(Status))
             {
                 /* disk is full */
+                vfatFcbTruncateExtentMap(Fcb,
+                                         Fcb->RFCB.AllocationSize.u.LowPart / ClusterSize);
                 NCluster = Cluster;
                 Status = NextCluster(DeviceExt, FirstCluster, &NCluster, FALSE);
                 WriteCluster(DeviceExt, Cluster, 0xffffffff);
@@ -1362,14 +1345,14 @@ VfatSetAllocationSizeInformation(
         DPRINT("Can set file size\n");
 
         AllocSizeChanged = TRUE;
-        /* FIXME: Use the cached cluster/offset better way. */
-        Fcb->LastCluster = Fcb->LastOffset = 0;
         UpdateFileSize(FileObject, Fcb, NewSize, ClusterSize, vfatVolumeIsFatX(DeviceExt));
         if (NewSize > 0)
         {
-            Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                     ROUND_DOWN(NewSize - 1, ClusterSize),
-                                     &Cluster, FALSE);
+            Status = vfatFcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                            ROUND_DOWN(NewSize - 1, ClusterSize),
+                                            &Cluster, FALSE);
+            vfatFcbTruncateExtentMap(Fcb,
+                                     ROUND_DOWN(NewSize - 1, ClusterSize) / ClusterSize + 1);
 
             NCluster = Cluster;
             Status = NextCluster(DeviceExt, FirstCluster, &NCluster, FALSE);
@@ -1395,6 +1378,7 @@ VfatSetAllocationSizeInformation(
                 }
             }
 
+            vfatFcbTruncateExtentMap(Fcb, 0);
             NCluster = Cluster = FirstCluster;
             Status = STATUS_SUCCESS;
         }
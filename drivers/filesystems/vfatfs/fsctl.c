@@ -721,8 +721,9 @@ VfatMount(
     _SEH2_END;
 
     DeviceExt->LastAvailableCluster = 2;
-    CountAvailableClusters(DeviceExt, NULL);
     ExInitializeResourceLite(&DeviceExt->FatResource);
+    InitFreeClusterMap(DeviceExt);
+    CountAvailableClusters(DeviceExt, NULL);
 
     InitializeListHead(&DeviceExt->FcbListHead);
 
@@ -813,6 +814,8 @@ ByeBye:
             ExFreePoolWithTag(DeviceExt->SpareVPB, TAG_VPB);
         if (DeviceExt && DeviceExt->Statistics)
             ExFreePoolWithTag(DeviceExt->Statistics, TAG_STATS);
+        if (DeviceExt)
+            UninitFreeClusterMap(DeviceExt);
         if (DeviceObject)
             IoDeleteDevice(DeviceObject);
     }
@@ -978,9 +981,9 @@ VfatGetRetrievalPointers(
     }
 
     CurrentCluster = FirstCluster = vfatDirEntryGetFirstCluster(DeviceExt, &Fcb->entry);
-    Status = OffsetToCluster(DeviceExt, FirstCluster,
-                             Vcn.u.LowPart * DeviceExt->FatInfo.BytesPerCluster,
-                             &CurrentCluster, FALSE);
+    Status = vfatFcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                    Vcn.u.LowPart * DeviceExt->FatInfo.BytesPerCluster,
+                                    &CurrentCluster, FALSE);
     if (!NT_SUCCESS(Status))
     {
         goto ByeBye;
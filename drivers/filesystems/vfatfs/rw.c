@@ -111,6 +111,152 @@ OffsetToCluster(
    }
 }
 
+/*
+ * Add ClusterCount clusters starting at Cluster to the extent map of Fcb at
+ * Vcn. The map must not get holes: the run is only added right after its end
+ * (or where it is already mapped the same way). Returns FALSE if the caller
+ * should stop recording.
+ */
+BOOLEAN
+vfatFcbMapRun(
+    PVFATFCB Fcb,
+    ULONG Vcn,
+    ULONG Cluster,
+    ULONG ClusterCount)
+{
+    LONGLONG LastVcn, Lcn;
+    BOOLEAN Mapped;
+
+    ExAcquireFastMutex(&Fcb->ExtentMapMutex);
+
+    if (FsRtlLookupLargeMcbEntry(&Fcb->ExtentMap, Vcn, &Lcn, NULL, NULL, NULL, NULL) &&
+        Lcn != -1)
+    {
+        /* Another reader got here first */
+        Mapped = (Lcn == Cluster);
+    }
+    else if (Vcn == 0 ||
+             (FsRtlLookupLastLargeMcbEntry(&Fcb->ExtentMap, &LastVcn, &Lcn) &&
+              LastVcn + 1 == Vcn))
+    {
+        Mapped = FsRtlAddLargeMcbEntry(&Fcb->ExtentMap, Vcn, Cluster, ClusterCount);
+        if (!Mapped)
+        {
+            FsRtlTruncateLargeMcb(&Fcb->ExtentMap, Vcn);
+        }
+    }
+    else
+    {
+        /* The map was truncated meanwhile */
+        Mapped = FALSE;
+    }
+
+    ExReleaseFastMutex(&Fcb->ExtentMapMutex);
+    return Mapped;
+}
+
+VOID
+vfatFcbTruncateExtentMap(
+    PVFATFCB Fcb,
+    ULONG Vcn)
+{
+    ExAcquireFastMutex(&Fcb->ExtentMapMutex);
+    FsRtlTruncateLargeMcb(&Fcb->ExtentMap, Vcn);
+    ExReleaseFastMutex(&Fcb->ExtentMapMutex);
+}
+
+/*
+ * Return the cluster at FileOffset in the cluster chain of Fcb, which
+ * starts at FirstCluster. Unlike OffsetToCluster, the chain is followed only
+ * past the end of the extent map of the FCB, and every cluster found on the
+ * way is added to the map. Contiguous clusters are merged into one run by
+ * the MCB package, so a lookup in a file that was already walked costs
+ * O(log runs) instead of one FAT access per cluster. If Extend is set and
+ * the chain is too short, the missing clusters are appended all at once.
+ * The FAT is read without holding ExtentMapMutex, so that the mutex is
+ * never held while the FAT resource is acquired.
+ */
+NTSTATUS
+vfatFcbOffsetToCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FirstCluster,
+    ULONG FileOffset,
+    PULONG Cluster,
+    BOOLEAN Extend)
+{
+    LONGLONG Vcn, Lcn;
+    ULONG TargetVcn;
+    ULONG CurrentCluster, NextCluster;
+    BOOLEAN AddToMap = TRUE;
+    NTSTATUS Status;
+
+    if (FirstCluster == 1)
+    {
+        return OffsetToCluster(DeviceExt, FirstCluster, FileOffset, Cluster, Extend);
+    }
+
+    TargetVcn = FileOffset / DeviceExt->FatInfo.BytesPerCluster;
+
+    ExAcquireFastMutex(&Fcb->ExtentMapMutex);
+
+    if (FsRtlLookupLargeMcbEntry(&Fcb->ExtentMap, TargetVcn, &Lcn, NULL, NULL, NULL, NULL) &&
+        Lcn != -1)
+    {
+        ExReleaseFastMutex(&Fcb->ExtentMapMutex);
+        *Cluster = (ULONG)Lcn;
+        return STATUS_SUCCESS;
+    }
+
+    /* The map always covers the beginning of the chain, continue where it ends */
+    if (!FsRtlLookupLastLargeMcbEntry(&Fcb->ExtentMap, &Vcn, &Lcn) || Vcn >= TargetVcn)
+    {
+        FsRtlTruncateLargeMcb(&Fcb->ExtentMap, 0);
+        Vcn = 0;
+        Lcn = FirstCluster;
+        AddToMap = FsRtlAddLargeMcbEntry(&Fcb->ExtentMap, 0, FirstCluster, 1);
+    }
+    CurrentCluster = (ULONG)Lcn;
+
+    ExReleaseFastMutex(&Fcb->ExtentMapMutex);
+
+    while (Vcn < TargetVcn)
+    {
+        Status = GetNextCluster(DeviceExt, CurrentCluster, &NextCluster);
+        if (!NT_SUCCESS(Status))
+            return Status;
+
+        if (NextCluster == 0xffffffff)
+        {
+            if (!Extend)
+            {
+                CurrentCluster = NextCluster;
+                break;
+            }
+
+            /* Allocate all the missing clusters at once, so that they can
+             * be taken from a single run of free clusters */
+            Status = ExtendClusterChain(DeviceExt, CurrentCluster, (ULONG)(TargetVcn - Vcn),
+                                        AddToMap ? Fcb : NULL, (ULONG)Vcn + 1,
+                                        &CurrentCluster);
+            if (!NT_SUCCESS(Status))
+                return Status;
+            break;
+        }
+
+        CurrentCluster = NextCluster;
+
+        Vcn++;
+        if (AddToMap)
+        {
+            AddToMap = vfatFcbMapRun(Fcb, (ULONG)Vcn, CurrentCluster, 1);
+        }
+    }
+
+    *Cluster = CurrentCluster;
+    return STATUS_SUCCESS;
+}
+
 /*
  * FUNCTION: Reads data from a file
  */
@@ -134,8 +280,6 @@ VfatReadFileData(
     ULONG BytesDone;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -213,47 +357,28 @@ VfatReadFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     /* Find the cluster to start the read from */
-    if (LastCluster > 0 && ReadOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
+    Status = vfatFcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                    ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
+                                    &CurrentCluster, FALSE);
 #ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
+    /* DEBUG VERIFICATION */
+    if (NT_SUCCESS(Status))
     {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
+        ULONG CorrectCluster;
+        OffsetToCluster(DeviceExt, FirstCluster,
+                        ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
+                        &CorrectCluster, FALSE);
+        if (CorrectCluster != CurrentCluster)
+            KeBugCheck(FAT_FILE_SYSTEM);
     }
+#endif
 
     if (!NT_SUCCESS(Status))
     {
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (ReadOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     KeInitializeEvent(&IrpContext->Event, NotificationEvent, FALSE);
     IrpContext->RefCount = 1;
 
@@ -290,11 +415,6 @@ VfatReadFileData(
         DPRINT("start %08x, next %08x, count %u\n",
                StartCluster, CurrentCluster, ClusterCount);
 
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
-
         /* Fire up the read command */
         Status = VfatReadDiskPartial (IrpContext, &StartOffset, BytesDone, *LengthRead, FALSE);
         if (!NT_SUCCESS(Status) && Status != STATUS_PENDING)
@@ -347,8 +467,6 @@ VfatWriteFileData(
     ULONG BytesPerCluster;
     LARGE_INTEGER StartOffset;
     ULONG BufferOffset;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -426,49 +544,30 @@ VfatWriteFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     /*
      * Find the cluster to start the write from
      */
-    if (LastCluster > 0 && WriteOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
+    Status = vfatFcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                    ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
+                                    &CurrentCluster, FALSE);
 #ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
+    /* DEBUG VERIFICATION */
+    if (NT_SUCCESS(Status))
     {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
+        ULONG CorrectCluster;
+        OffsetToCluster(DeviceExt, FirstCluster,
+                        ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
+                        &CorrectCluster, FALSE);
+        if (CorrectCluster != CurrentCluster)
+            KeBugCheck(FAT_FILE_SYSTEM);
     }
+#endif
 
     if (!NT_SUCCESS(Status))
     {
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (WriteOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     IrpContext->RefCount = 1;
     BufferOffset = 0;
 
@@ -505,11 +604,6 @@ VfatWriteFileData(
         DPRINT("start %08x, next %08x, count %u\n",
                StartCluster, CurrentCluster, ClusterCount);
 
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
-
         // Fire up the write command
         Status = VfatWriteDiskPartial (IrpContext, &StartOffset, BytesDone, BufferOffset, FALSE);
         if (!NT_SUCCESS(Status) && Status != STATUS_PENDING)
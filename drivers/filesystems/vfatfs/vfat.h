@@ -325,6 +325,9 @@ typedef struct DEVICE_EXTENSION
     ULONG LastAvailableCluster;
     ULONG AvailableClusters;
     BOOLEAN AvailableClustersValid;
+    /* Set bits are clusters in use, protected by FatResource.
+       Its buffer is NULL if it couldn't be allocated */
+    RTL_BITMAP FreeClusterMap;
     ULONG Flags;
     struct _VFATFCB *VolumeFcb;
     struct _VFATFCB *RootFcb;
@@ -520,13 +523,17 @@ typedef struct _VFATFCB
     FILE_LOCK FileLock;
 
     /*
-     * Optimization: caching of last read/write cluster+offset pair. Can't
-     * be in VFATCCB because it must be reset everytime the allocated clusters
-     * change.
+     * Cluster runs of the file (in cluster units), from the first cluster up
+     * to where the chain was followed so far. Truncated whenever clusters
+     * are released or the first cluster changes. Readers only hold the FCB
+     * shared and extend the map concurrently, so every update goes through
+     * ExtentMapMutex.
      */
-    FAST_MUTEX LastMutex;
-    ULONG LastCluster;
-    ULONG LastOffset;
+    FAST_MUTEX ExtentMapMutex;
+    LARGE_MCB ExtentMap;
+
+    /* Hashed names of the entries of a large directory, see dircache.c */
+    struct _VFAT_NAME_CACHE * NameCache;
 
     struct _VFAT_CLOSE_CONTEXT * CloseContext;
 } VFATFCB, *PVFATFCB;
@@ -553,6 +560,8 @@ typedef struct _VFATCCB
 #define TAG_NAME 'ntaF'
 #define TAG_SEARCH 'LtaF'
 #define TAG_DIRENT 'DtaF'
+#define TAG_BITMAP 'BtaF'
+#define TAG_NAMECACHE 'HtaF'
 
 #define ENTRIES_PER_SECTOR (BLOCKSIZE / sizeof(FATDirEntry))
 
@@ -774,6 +783,32 @@ FsdSystemTimeToDosDateTime(
     USHORT *pDosDate,
     USHORT *pDosTime);
 
+/* dircache.c */
+
+typedef struct _VFAT_NAME_CACHE *PVFAT_NAME_CACHE;
+
+BOOLEAN
+vfatNameCacheLookup(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext,
+    NTSTATUS *Status);
+
+VOID
+vfatNameCacheInsert(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb);
+
+VOID
+vfatNameCacheRemove(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb);
+
+VOID
+vfatInvalidateNameCache(
+    PVFATFCB DirFcb);
+
 /* direntry.c */
 
 ULONG
@@ -904,6 +939,27 @@ OffsetToCluster(
     PULONG Cluster,
     BOOLEAN Extend);
 
+NTSTATUS
+vfatFcbOffsetToCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FirstCluster,
+    ULONG FileOffset,
+    PULONG Cluster,
+    BOOLEAN Extend);
+
+BOOLEAN
+vfatFcbMapRun(
+    PVFATFCB Fcb,
+    ULONG Vcn,
+    ULONG Cluster,
+    ULONG ClusterCount);
+
+VOID
+vfatFcbTruncateExtentMap(
+    PVFATFCB Fcb,
+    ULONG Vcn);
+
 ULONGLONG
 ClusterToSector(
     PDEVICE_EXTENSION DeviceExt,
@@ -921,6 +977,23 @@ GetNextClusterExtend(
     ULONG CurrentCluster,
     PULONG NextCluster);
 
+NTSTATUS
+ExtendClusterChain(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG LastCluster,
+    ULONG ClusterCount,
+    PVFATFCB Fcb,
+    ULONG Vcn,
+    PULONG NewLastCluster);
+
+VOID
+InitFreeClusterMap(
+    PDEVICE_EXTENSION DeviceExt);
+
+VOID
+UninitFreeClusterMap(
+    PDEVICE_EXTENSION DeviceExt);
+
 NTSTATUS
 CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt,
@@ -86,6 +86,12 @@ AfdBindSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     AFD_DbgPrint(MID_TRACE,("Called\n"));
 
     if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    /* Reserved for a pending AcceptEx */
+    if( FCB->SuperAcceptTarget )
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER,
+                                       Irp, 0 );
+
     if( !(BindReq = LockRequest( Irp, IrpSp, FALSE, NULL )) )
         return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY,
                                        Irp, 0 );
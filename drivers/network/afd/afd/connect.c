@@ -327,6 +327,9 @@ StreamSocketConnectComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     PAFD_FCB FCB = (PAFD_FCB)Context;
     PLIST_ENTRY NextIrpEntry;
     PIRP NextIrp;
+    PIO_STACK_LOCATION NextIrpSp;
+    PAFD_SUPER_CONNECT_INFO SuperConnectReq;
+    LIST_ENTRY SuperConnects;
 
     AFD_DbgPrint(MID_TRACE,("Called: FCB %p, FO %p\n",
                             Context, FCB->FileObject));
@@ -347,6 +350,12 @@ StreamSocketConnectComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_CONNECT] ) ) {
                NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_CONNECT]);
                NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
+               NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
+               if( NextIrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_CONNECT ) {
+                   SuperConnectReq = GetLockedData( NextIrp, NextIrpSp );
+                   UnlockBuffers( SuperConnectReq->Send.BufferArray,
+                                  SuperConnectReq->Send.BufferCount, FALSE );
+               }
                NextIrp->IoStatus.Status = STATUS_FILE_CLOSED;
                NextIrp->IoStatus.Information = 0;
                if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, IoGetCurrentIrpStackLocation( NextIrp ) );
@@ -366,12 +375,28 @@ StreamSocketConnectComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     }
 
     /* Succeed pending irps on the FUNCTION_CONNECT list */
+    InitializeListHead( &SuperConnects );
     while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_CONNECT] ) ) {
         NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_CONNECT]);
         NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
+        NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
+        if( NextIrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_CONNECT ) {
+            SuperConnectReq = GetLockedData( NextIrp, NextIrpSp );
+
+            /* Its data goes out once the connection is set up */
+            if( NT_SUCCESS(Status) && SuperConnectReq->Send.BufferCount ) {
+                InsertTailList( &SuperConnects, &NextIrp->Tail.Overlay.ListEntry );
+                continue;
+            }
+
+            UnlockBuffers( SuperConnectReq->Send.BufferArray,
+                           SuperConnectReq->Send.BufferCount, FALSE );
+            NextIrp->IoStatus.Information = 0;
+        } else {
+            NextIrp->IoStatus.Information = NT_SUCCESS(Status) ? ((ULONG_PTR)FCB->Connection.Handle) : 0;
+        }
         AFD_DbgPrint(MID_TRACE,("Completing connect %p\n", NextIrp));
         NextIrp->IoStatus.Status = Status;
-        NextIrp->IoStatus.Information = NT_SUCCESS(Status) ? ((ULONG_PTR)FCB->Connection.Handle) : 0;
         if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, IoGetCurrentIrpStackLocation( NextIrp ) );
         (void)IoSetCancelRoutine(NextIrp, NULL);
         IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
@@ -380,6 +405,27 @@ StreamSocketConnectComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     if( NT_SUCCESS(Status) ) {
         Status = MakeSocketIntoConnection( FCB );
 
+        while( !IsListEmpty( &SuperConnects ) ) {
+            NextIrpEntry = RemoveHeadList( &SuperConnects );
+            NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
+
+            if( NT_SUCCESS(Status) ) {
+                AFD_DbgPrint(MID_TRACE,("Sending the data of connect %p\n", NextIrp));
+                QueueLockedSend( FCB, NextIrp );
+                continue;
+            }
+
+            NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
+            SuperConnectReq = GetLockedData( NextIrp, NextIrpSp );
+            UnlockBuffers( SuperConnectReq->Send.BufferArray,
+                           SuperConnectReq->Send.BufferCount, FALSE );
+            NextIrp->IoStatus.Status = Status;
+            NextIrp->IoStatus.Information = 0;
+            if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, NextIrpSp );
+            (void)IoSetCancelRoutine(NextIrp, NULL);
+            IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
+        }
+
         if( !NT_SUCCESS(Status) ) {
             SocketStateUnlock( FCB );
             return Status;
@@ -434,15 +480,49 @@ AfdStreamSocketConnect(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     PFILE_OBJECT FileObject = IrpSp->FileObject;
     PAFD_FCB FCB = FileObject->FsContext;
     PAFD_CONNECT_INFO ConnectReq;
+    PAFD_SUPER_CONNECT_INFO SuperConnectReq = NULL;
+    KPROCESSOR_MODE LockMode;
     AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
 
     UNREFERENCED_PARAMETER(DeviceObject);
 
     if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
-    if( !(ConnectReq = LockRequest( Irp, IrpSp, FALSE, NULL )) )
+
+    /* Reserved for a pending AcceptEx */
+    if( FCB->SuperAcceptTarget )
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER,
+                                       Irp, 0 );
+
+    if( !(ConnectReq = LockRequest( Irp, IrpSp, FALSE, &LockMode )) )
         return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp,
                                        0 );
 
+    if( IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_CONNECT ) {
+        SuperConnectReq = (PAFD_SUPER_CONNECT_INFO)ConnectReq;
+        ConnectReq = &SuperConnectReq->Connect;
+
+        /* Only an unconnected stream socket can take it */
+        if( (FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS) ||
+            (FCB->State != SOCKET_STATE_CREATED && FCB->State != SOCKET_STATE_BOUND) ||
+            SuperConnectReq->Send.BufferCount > 1 ) {
+            AFD_DbgPrint(MIN_TRACE,("Invalid super connect (s%x)\n", FCB->State));
+            return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+        }
+
+        if( SuperConnectReq->Send.BufferCount ) {
+            SuperConnectReq->Send.BufferArray =
+                LockBuffers( SuperConnectReq->Send.BufferArray,
+                             SuperConnectReq->Send.BufferCount,
+                             NULL, NULL,
+                             FALSE, FALSE, LockMode );
+
+            if( !SuperConnectReq->Send.BufferArray )
+                return UnlockAndMaybeComplete( FCB, STATUS_ACCESS_VIOLATION,
+                                               Irp, 0 );
+        } else
+            SuperConnectReq->Send.BufferArray = NULL;
+    }
+
     AFD_DbgPrint(MID_TRACE,("Connect request:\n"));
 #if 0
     OskitDumpBuffer
@@ -491,10 +571,11 @@ AfdStreamSocketConnect(PDEVICE_OBJECT DeviceObject, PIRP Irp,
             if( NT_SUCCESS(Status) )
                 FCB->State = SOCKET_STATE_BOUND;
             else
-                return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
-        } else
-            return UnlockAndMaybeComplete
-                ( FCB, STATUS_NO_MEMORY, Irp, 0 );
+                break;
+        } else {
+            Status = STATUS_NO_MEMORY;
+            break;
+        }
 
     /* Drop through to SOCKET_STATE_BOUND */
 
@@ -574,5 +655,9 @@ AfdStreamSocketConnect(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         break;
     }
 
+    if( SuperConnectReq )
+        UnlockBuffers( SuperConnectReq->Send.BufferArray,
+                       SuperConnectReq->Send.BufferCount, FALSE );
+
     return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
 }
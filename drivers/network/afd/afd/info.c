@@ -55,7 +55,12 @@ AfdGetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
         break;
 
     case AFD_INFO_RECEIVE_CONTENT_SIZE:
-        InfoReq->Information.Ulong = FCB->Recv.Content - FCB->Recv.BytesUsed;
+        InfoReq->Information.Ulong = FCB->Recv.Content;
+        break;
+
+    case AFD_INFO_SOCKET_REUSED:
+        /* A disconnect with AFD_DISCONNECT_REUSE puts it back there */
+        InfoReq->Information.Boolean = FCB->State == SOCKET_STATE_CREATED;
         break;
 
         case AFD_INFO_SENDS_IN_PROGRESS:
@@ -106,6 +111,7 @@ AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
     PFILE_OBJECT FileObject = IrpSp->FileObject;
     PAFD_FCB FCB = FileObject->FsContext;
     PCHAR NewBuffer;
+    UINT FirstPart;
 
     UNREFERENCED_PARAMETER(DeviceObject);
 
@@ -142,13 +148,21 @@ AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 
                             if (FCB->Recv.Window)
                             {
+                                /* Unwrap the buffered data */
+                                FirstPart = MIN(FCB->Recv.Content,
+                                                FCB->Recv.Size - FCB->Recv.BytesUsed);
                                 RtlCopyMemory(NewBuffer,
+                                              FCB->Recv.Window + FCB->Recv.BytesUsed,
+                                              FirstPart);
+                                RtlCopyMemory(NewBuffer + FirstPart,
                                               FCB->Recv.Window,
-                                              FCB->Recv.Content);
+                                              FCB->Recv.Content - FirstPart);
 
                                 ExFreePoolWithTag(FCB->Recv.Window, TAG_AFD_DATA_BUFFER);
                             }
 
+                            FCB->Recv.BytesUsed = 0;
+
                             FCB->Recv.Size = InfoReq->Information.Ulong;
                             FCB->Recv.Window = NewBuffer;
 
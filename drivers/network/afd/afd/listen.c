@@ -10,21 +10,11 @@
 
 #include "afd.h"
 
-static NTSTATUS SatisfyAccept( PAFD_DEVICE_EXTENSION DeviceExt,
-                               PIRP Irp,
-                               PFILE_OBJECT NewFileObject,
-                               PAFD_TDI_OBJECT_QELT Qelt ) {
-    PAFD_FCB FCB = NewFileObject->FsContext;
+/* Transfer the connection to the new socket, launch the opening read.
+ * Called with the new socket locked. */
+static NTSTATUS TakeOverConnection( PAFD_FCB FCB, PAFD_TDI_OBJECT_QELT Qelt ) {
     NTSTATUS Status;
 
-    UNREFERENCED_PARAMETER(DeviceExt);
-
-    if( !SocketAcquireStateLock( FCB ) )
-        return LostSocket( Irp );
-
-    /* Transfer the connection to the new socket, launch the opening read */
-    AFD_DbgPrint(MID_TRACE,("Completing a real accept (FCB %p)\n", FCB));
-
     FCB->Connection = Qelt->Object;
 
     if (FCB->RemoteAddress)
@@ -46,9 +36,144 @@ static NTSTATUS SatisfyAccept( PAFD_DEVICE_EXTENSION DeviceExt,
     if (NT_SUCCESS(Status))
         Status = TdiBuildConnectionInfo(&FCB->ConnectReturnInfo, FCB->RemoteAddress);
 
+    return Status;
+}
+
+static NTSTATUS SatisfyAccept( PAFD_DEVICE_EXTENSION DeviceExt,
+                               PIRP Irp,
+                               PFILE_OBJECT NewFileObject,
+                               PAFD_TDI_OBJECT_QELT Qelt ) {
+    PAFD_FCB FCB = NewFileObject->FsContext;
+    NTSTATUS Status;
+
+    UNREFERENCED_PARAMETER(DeviceExt);
+
+    if( !SocketAcquireStateLock( FCB ) )
+        return LostSocket( Irp );
+
+    AFD_DbgPrint(MID_TRACE,("Completing a real accept (FCB %p)\n", FCB));
+
+    Status = TakeOverConnection( FCB, Qelt );
+
     return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
 }
 
+/* AcceptEx wants each address as an INT length followed by a SOCKADDR */
+static VOID StoreAcceptAddress( PCHAR Area, ULONG AreaLength,
+                                PTRANSPORT_ADDRESS Address ) {
+    PTA_ADDRESS TaAddress = &Address->Address[0];
+    INT Length;
+
+    if( AreaLength < sizeof(INT) ) return;
+
+    /* A TA_ADDRESS holds a SOCKADDR from its AddressType on */
+    Length = (INT)MIN( sizeof(TaAddress->AddressType) + TaAddress->AddressLength,
+                       AreaLength - sizeof(INT) );
+
+    RtlCopyMemory( Area, &Length, sizeof(INT) );
+    RtlCopyMemory( Area + sizeof(INT), &TaAddress->AddressType, Length );
+}
+
+/* Hand the accept socket back, it can be connected, bound or given to
+ * another super accept again */
+static VOID DropSuperAcceptTarget( PFILE_OBJECT NewFileObject ) {
+    PAFD_FCB FCB = NewFileObject->FsContext;
+
+    if( SocketAcquireStateLock( FCB ) ) {
+        FCB->SuperAcceptTarget = FALSE;
+        SocketStateUnlock( FCB );
+    }
+
+    ObDereferenceObject( NewFileObject );
+}
+
+/* Drop what a super accept holds while it waits for a connection */
+VOID ReleaseSuperAccept( PIRP Irp ) {
+    PMDL AddressMdl = Irp->Tail.Overlay.DriverContext[3];
+
+    if( !AddressMdl ) return;
+
+    MmUnlockPages( AddressMdl );
+    IoFreeMdl( AddressMdl );
+    Irp->Tail.Overlay.DriverContext[3] = NULL;
+
+    /* The pointer is kept, it tells the cancel routine which socket the
+     * request then waits on */
+    DropSuperAcceptTarget( Irp->Tail.Overlay.DriverContext[2] );
+}
+
+/* Give the oldest pending connection to a super accept, which is no longer
+ * queued on the listening socket. Called with the listening socket locked.
+ * When first data was asked for, the request goes on as a receive on the
+ * accepted socket. */
+static NTSTATUS SatisfySuperAccept( PAFD_FCB ListenFCB, PIRP Irp ) {
+    PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation( Irp );
+    PAFD_SUPER_ACCEPT_INFO AcceptReq = GetLockedData( Irp, IrpSp );
+    PFILE_OBJECT NewFileObject = Irp->Tail.Overlay.DriverContext[2];
+    PAFD_FCB FCB = NewFileObject->FsContext;
+    PAFD_TDI_OBJECT_QELT Qelt =
+        CONTAINING_RECORD( ListenFCB->PendingConnections.Flink,
+                           AFD_TDI_OBJECT_QELT, ListEntry );
+    PCHAR AddressBuffer;
+    NTSTATUS Status;
+
+    /* Keep the new socket around until we are done with it */
+    ObReferenceObject( NewFileObject );
+
+    if( !SocketAcquireStateLock( FCB ) ) {
+        ReleaseSuperAccept( Irp );
+        UnlockBuffers( AcceptReq->Recv.BufferArray,
+                       AcceptReq->Recv.BufferCount, FALSE );
+        (void)IoSetCancelRoutine( Irp, NULL );
+        Status = LostSocket( Irp );
+        ObDereferenceObject( NewFileObject );
+        return Status;
+    }
+
+    AFD_DbgPrint(MID_TRACE,("Completing a super accept (FCB %p)\n", FCB));
+
+    if( FCB->State != SOCKET_STATE_CREATED ||
+        (NewFileObject->Flags & FO_CLEANUP_COMPLETE) ) {
+        /* The socket was used for something else or closed meanwhile */
+        Status = STATUS_INVALID_PARAMETER;
+    } else {
+        RemoveEntryList( &Qelt->ListEntry );
+        Status = TakeOverConnection( FCB, Qelt );
+        ExFreePoolWithTag(Qelt, TAG_AFD_ACCEPT_QUEUE);
+    }
+
+    if( NT_SUCCESS(Status) ) {
+        AddressBuffer =
+            MmGetSystemAddressForMdlSafe( Irp->Tail.Overlay.DriverContext[3],
+                                          NormalPagePriority );
+        if( AddressBuffer ) {
+            StoreAcceptAddress( AddressBuffer,
+                                AcceptReq->LocalAddressLength,
+                                ListenFCB->LocalAddress );
+            StoreAcceptAddress( AddressBuffer + AcceptReq->LocalAddressLength,
+                                AcceptReq->RemoteAddressLength,
+                                FCB->RemoteAddress );
+        } else
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    ReleaseSuperAccept( Irp );
+
+    if( !NT_SUCCESS(Status) || !AcceptReq->Recv.BufferCount ) {
+        UnlockBuffers( AcceptReq->Recv.BufferArray,
+                       AcceptReq->Recv.BufferCount, FALSE );
+        Status = UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    } else {
+        AFD_DbgPrint(MID_TRACE,("Waiting for the first data\n"));
+        QueueLockedReceive( FCB, Irp );
+        SocketStateUnlock( FCB );
+        Status = STATUS_PENDING;
+    }
+
+    ObDereferenceObject( NewFileObject );
+    return Status;
+}
+
 static NTSTATUS SatisfyPreAccept( PIRP Irp, PAFD_TDI_OBJECT_QELT Qelt ) {
     PAFD_RECEIVED_ACCEPT_DATA ListenReceive =
         (PAFD_RECEIVED_ACCEPT_DATA)Irp->AssociatedIrp.SystemBuffer;
@@ -172,6 +297,16 @@ static NTSTATUS NTAPI ListenComplete( PDEVICE_OBJECT DeviceObject,
         }
     }
 
+    /* Super accepts take the connections first */
+    while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_ACCEPT] ) &&
+           !IsListEmpty( &FCB->PendingConnections ) ) {
+        PLIST_ENTRY PendingIrp =
+            RemoveHeadList( &FCB->PendingIrpList[FUNCTION_ACCEPT] );
+        SatisfySuperAccept
+            ( FCB, CONTAINING_RECORD( PendingIrp, IRP,
+                                      Tail.Overlay.ListEntry ) );
+    }
+
     /* Satisfy a pre-accept request if one is available */
     if( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_PREACCEPT] ) &&
         !IsListEmpty( &FCB->PendingConnections ) ) {
@@ -404,3 +539,135 @@ NTSTATUS AfdAccept( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 
     return UnlockAndMaybeComplete( FCB, STATUS_UNSUCCESSFUL, Irp, 0 );
 }
+
+NTSTATUS AfdSuperAccept( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                         PIO_STACK_LOCATION IrpSp ) {
+    NTSTATUS Status = STATUS_SUCCESS;
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext, NewFCB;
+    PAFD_SUPER_ACCEPT_INFO AcceptReq;
+    PFILE_OBJECT NewFileObject = NULL;
+    PMDL AddressMdl;
+    ULONG AddressLength;
+    KPROCESSOR_MODE LockMode;
+
+    AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    FCB->EventSelectDisabled &= ~AFD_EVENT_ACCEPT;
+
+    if( FCB->State != SOCKET_STATE_LISTENING ||
+        IrpSp->Parameters.DeviceIoControl.InputBufferLength < sizeof(*AcceptReq) ) {
+        AFD_DbgPrint(MIN_TRACE,("Super accept on a socket that is not listening\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+    }
+
+    if( !(AcceptReq = LockRequest( Irp, IrpSp, FALSE, &LockMode )) )
+        return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+
+    AddressLength = AcceptReq->LocalAddressLength + AcceptReq->RemoteAddressLength;
+    if( AcceptReq->Recv.BufferCount > 1 ||
+        !AcceptReq->LocalAddressLength || !AcceptReq->RemoteAddressLength ||
+        AddressLength < AcceptReq->LocalAddressLength ) {
+        AFD_DbgPrint(MIN_TRACE,("Invalid super accept request\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+    }
+
+    Status = ObReferenceObjectByHandle
+        ( AcceptReq->AcceptHandle,
+          FILE_ALL_ACCESS,
+          *IoFileObjectType,
+          Irp->RequestorMode,
+          (PVOID *)&NewFileObject,
+          NULL );
+
+    if( !NT_SUCCESS(Status) ) return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+
+    /* The connection goes to a fresh stream socket of ours */
+    NewFCB = NewFileObject->FsContext;
+    if( NewFileObject->DeviceObject != DeviceObject || NewFCB == FCB ||
+        !SocketAcquireStateLock( NewFCB ) ) {
+        ObDereferenceObject( NewFileObject );
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_HANDLE, Irp, 0 );
+    }
+
+    /* Like on Windows, the socket is reserved for this request until it
+     * completes: connecting, binding or another AcceptEx on it fail */
+    if( NewFCB->State != SOCKET_STATE_CREATED ||
+        (NewFCB->Flags & AFD_ENDPOINT_CONNECTIONLESS) ||
+        NewFCB->SuperAcceptTarget )
+        Status = STATUS_INVALID_PARAMETER;
+    else
+        NewFCB->SuperAcceptTarget = TRUE;
+
+    SocketStateUnlock( NewFCB );
+
+    if( !NT_SUCCESS(Status) ) {
+        AFD_DbgPrint(MIN_TRACE,("Cannot accept into socket %p\n", NewFCB));
+        ObDereferenceObject( NewFileObject );
+        return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+
+    /* The addresses are written from the completion path */
+    AddressMdl = IoAllocateMdl( AcceptReq->AddressBuffer,
+                                AddressLength,
+                                FALSE,
+                                FALSE,
+                                NULL );
+    if( !AddressMdl ) {
+        DropSuperAcceptTarget( NewFileObject );
+        return UnlockAndMaybeComplete( FCB, STATUS_INSUFFICIENT_RESOURCES, Irp, 0 );
+    }
+
+    _SEH2_TRY {
+        MmProbeAndLockPages( AddressMdl, Irp->RequestorMode, IoWriteAccess );
+    } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+        AFD_DbgPrint(MIN_TRACE, ("MmProbeAndLockPages() failed.\n"));
+        Status = _SEH2_GetExceptionCode();
+    } _SEH2_END;
+
+    if( !NT_SUCCESS(Status) ) {
+        IoFreeMdl( AddressMdl );
+        DropSuperAcceptTarget( NewFileObject );
+        return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+
+    if( AcceptReq->Recv.BufferCount ) {
+        AcceptReq->Recv.BufferArray = LockBuffers( AcceptReq->Recv.BufferArray,
+                                                   AcceptReq->Recv.BufferCount,
+                                                   NULL, NULL,
+                                                   TRUE, FALSE, LockMode );
+
+        if( !AcceptReq->Recv.BufferArray ) {
+            MmUnlockPages( AddressMdl );
+            IoFreeMdl( AddressMdl );
+            DropSuperAcceptTarget( NewFileObject );
+            return UnlockAndMaybeComplete( FCB, STATUS_ACCESS_VIOLATION, Irp, 0 );
+        }
+    } else
+        AcceptReq->Recv.BufferArray = NULL;
+
+    Irp->Tail.Overlay.DriverContext[2] = NewFileObject;
+    Irp->Tail.Overlay.DriverContext[3] = AddressMdl;
+
+    Status = QueueUserModeIrp( FCB, Irp, FUNCTION_ACCEPT );
+
+    if( Status == STATUS_PENDING && !IsListEmpty( &FCB->PendingConnections ) ) {
+        /* We have a pending connection ... take it right away */
+        RemoveEntryList( &Irp->Tail.Overlay.ListEntry );
+        SatisfySuperAccept( FCB, Irp );
+
+        if( !IsListEmpty( &FCB->PendingConnections ) )
+        {
+            FCB->PollState |= AFD_EVENT_ACCEPT;
+            FCB->PollStatus[FD_ACCEPT_BIT] = STATUS_SUCCESS;
+            PollReeval( FCB->DeviceExt, FCB->FileObject );
+        } else
+            FCB->PollState &= ~AFD_EVENT_ACCEPT;
+    }
+
+    SocketStateUnlock( FCB );
+
+    return Status;
+}
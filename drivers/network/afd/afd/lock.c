@@ -92,10 +92,11 @@ PVOID LockRequest( PIRP Irp,
                     Irp->Tail.Overlay.DriverContext[1] = NULL;
                 }
 
-                /* We're using a user-mode buffer directly */
+                /* The buffers belong to the caller, which is user mode
+                 * unless AFD sends a request to itself */
                 if (LockMode != NULL)
                 {
-                    *LockMode = UserMode;
+                    *LockMode = Irp->RequestorMode;
                 }
             }
             else return NULL;
@@ -593,6 +593,103 @@ AfdCloseSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     return STATUS_SUCCESS;
 }
 
+/* A graceful disconnect with AFD_DISCONNECT_REUSE gives the socket back in
+ * its initial state, for another AcceptEx or ConnectEx. The transport
+ * objects are released, so there must be no request left on them. */
+static
+NTSTATUS
+ReuseSocket(PAFD_FCB FCB)
+{
+    /* Whatever still arrives is of no interest */
+    FCB->TdiReceiveClosed = TRUE;
+    if (FCB->ReceiveIrp.InFlightRequest)
+        IoCancelIrp(FCB->ReceiveIrp.InFlightRequest);
+
+    if (FCB->ReceiveIrp.InFlightRequest || FCB->SendIrp.InFlightRequest ||
+        FCB->ConnectIrp.InFlightRequest || FCB->ListenIrp.InFlightRequest ||
+        !IsListEmpty(&FCB->PendingIrpList[FUNCTION_CONNECT]) ||
+        !IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]) ||
+        !IsListEmpty(&FCB->PendingIrpList[FUNCTION_RECV]))
+    {
+        AFD_DbgPrint(MIN_TRACE,("Socket %p is still busy, cannot reuse it\n", FCB));
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (FCB->Connection.Object)
+    {
+        TdiDisassociateAddressFile(FCB->Connection.Object);
+        ObDereferenceObject(FCB->Connection.Object);
+        FCB->Connection.Object = NULL;
+    }
+
+    if (FCB->Connection.Handle != INVALID_HANDLE_VALUE)
+    {
+        ZwClose(FCB->Connection.Handle);
+        FCB->Connection.Handle = INVALID_HANDLE_VALUE;
+    }
+
+    if (FCB->AddressFile.Object)
+    {
+        ObDereferenceObject(FCB->AddressFile.Object);
+        FCB->AddressFile.Object = NULL;
+    }
+
+    if (FCB->AddressFile.Handle != INVALID_HANDLE_VALUE)
+    {
+        ZwClose(FCB->AddressFile.Handle);
+        FCB->AddressFile.Handle = INVALID_HANDLE_VALUE;
+    }
+
+    if (FCB->LocalAddress)
+    {
+        ExFreePoolWithTag(FCB->LocalAddress, TAG_AFD_TRANSPORT_ADDRESS);
+        FCB->LocalAddress = NULL;
+    }
+
+    if (FCB->RemoteAddress)
+    {
+        ExFreePoolWithTag(FCB->RemoteAddress, TAG_AFD_TRANSPORT_ADDRESS);
+        FCB->RemoteAddress = NULL;
+    }
+
+    if (FCB->ConnectCallInfo)
+    {
+        ExFreePoolWithTag(FCB->ConnectCallInfo, TAG_AFD_TDI_CONNECTION_INFORMATION);
+        FCB->ConnectCallInfo = NULL;
+    }
+
+    if (FCB->ConnectReturnInfo)
+    {
+        ExFreePoolWithTag(FCB->ConnectReturnInfo, TAG_AFD_TDI_CONNECTION_INFORMATION);
+        FCB->ConnectReturnInfo = NULL;
+    }
+
+    /* MakeSocketIntoConnection allocates them again */
+    if (FCB->Recv.Window)
+    {
+        ExFreePoolWithTag(FCB->Recv.Window, TAG_AFD_DATA_BUFFER);
+        FCB->Recv.Window = NULL;
+    }
+
+    if (FCB->Send.Window)
+    {
+        ExFreePoolWithTag(FCB->Send.Window, TAG_AFD_DATA_BUFFER);
+        FCB->Send.Window = NULL;
+    }
+
+    FCB->Recv.BytesUsed = FCB->Recv.Content = 0;
+    FCB->Send.BytesUsed = FCB->Send.Content = 0;
+    FCB->TdiReceiveClosed = FALSE;
+    FCB->SendClosed = FALSE;
+    FCB->LastReceiveStatus = STATUS_SUCCESS;
+    FCB->PollState = 0;
+    FCB->State = SOCKET_STATE_CREATED;
+
+    AFD_DbgPrint(MID_TRACE,("Socket %p is ready for reuse\n", FCB));
+
+    return STATUS_SUCCESS;
+}
+
 static IO_COMPLETION_ROUTINE DisconnectComplete;
 static
 NTSTATUS
@@ -604,6 +701,7 @@ DisconnectComplete(PDEVICE_OBJECT DeviceObject,
     PAFD_FCB FCB = Context;
     PIRP CurrentIrp;
     PLIST_ENTRY CurrentEntry;
+    NTSTATUS Status = Irp->IoStatus.Status;
 
     UNREFERENCED_PARAMETER(DeviceObject);
 
@@ -638,11 +736,15 @@ DisconnectComplete(PDEVICE_OBJECT DeviceObject,
 
     FCB->DisconnectPending = FALSE;
 
+    if (NT_SUCCESS(Status) && FCB->DisconnectReuse)
+        Status = ReuseSocket(FCB);
+    FCB->DisconnectReuse = FALSE;
+
     while (!IsListEmpty(&FCB->PendingIrpList[FUNCTION_DISCONNECT]))
     {
         CurrentEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_DISCONNECT]);
         CurrentIrp = CONTAINING_RECORD(CurrentEntry, IRP, Tail.Overlay.ListEntry);
-        CurrentIrp->IoStatus.Status = Irp->IoStatus.Status;
+        CurrentIrp->IoStatus.Status = Status;
         CurrentIrp->IoStatus.Information = 0;
         UnlockRequest(CurrentIrp, IoGetCurrentIrpStackLocation(CurrentIrp));
         (void)IoSetCancelRoutine(CurrentIrp, NULL);
@@ -803,6 +905,7 @@ AfdDisconnect(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         }
 
         FCB->DisconnectFlags = Flags;
+        FCB->DisconnectReuse = (DisReq->DisconnectType & AFD_DISCONNECT_REUSE) != 0;
         FCB->DisconnectTimeout = DisReq->Timeout;
         FCB->DisconnectPending = TRUE;
         FCB->SendClosed = TRUE;
@@ -999,6 +1102,15 @@ AfdDispatch(PDEVICE_OBJECT DeviceObject, PIRP Irp)
         case IOCTL_AFD_ACCEPT:
             return AfdAccept( DeviceObject, Irp, IrpSp );
 
+        case IOCTL_AFD_SUPER_ACCEPT:
+            return AfdSuperAccept( DeviceObject, Irp, IrpSp );
+
+        case IOCTL_AFD_SUPER_CONNECT:
+            return AfdStreamSocketConnect( DeviceObject, Irp, IrpSp );
+
+        case IOCTL_AFD_TRANSMIT_FILE:
+            return AfdTransmitFile( DeviceObject, Irp, IrpSp );
+
         case IOCTL_AFD_DISCONNECT:
             return AfdDisconnect( DeviceObject, Irp, IrpSp );
 
@@ -1140,6 +1252,8 @@ CleanupPendingIrp(PAFD_FCB FCB, PIRP Irp, PIO_STACK_LOCATION IrpSp, PAFD_ACTIVE_
     PAFD_RECV_INFO RecvReq;
     PAFD_SEND_INFO SendReq;
     PAFD_POLL_INFO PollReq;
+    PAFD_SUPER_ACCEPT_INFO AcceptReq;
+    PAFD_SUPER_CONNECT_INFO SuperConnectReq;
 
     if (IrpSp->MajorFunction == IRP_MJ_READ)
     {
@@ -1173,6 +1287,17 @@ CleanupPendingIrp(PAFD_FCB FCB, PIRP Irp, PIO_STACK_LOCATION IrpSp, PAFD_ACTIVE_
             ZeroEvents(PollReq->Handles, PollReq->HandleCount);
             SignalSocket(Poll, NULL, PollReq, STATUS_CANCELLED);
         }
+        else if (IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_ACCEPT)
+        {
+            AcceptReq = GetLockedData(Irp, IrpSp);
+            UnlockBuffers(AcceptReq->Recv.BufferArray, AcceptReq->Recv.BufferCount, FALSE);
+            ReleaseSuperAccept(Irp);
+        }
+        else if (IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_CONNECT)
+        {
+            SuperConnectReq = GetLockedData(Irp, IrpSp);
+            UnlockBuffers(SuperConnectReq->Send.BufferArray, SuperConnectReq->Send.BufferCount, FALSE);
+        }
     }
 }
 
@@ -1236,6 +1361,26 @@ AfdCancelHandler(PDEVICE_OBJECT DeviceObject,
             Function = FUNCTION_PREACCEPT;
             break;
 
+        case IOCTL_AFD_SUPER_ACCEPT:
+            if (Irp->Tail.Overlay.DriverContext[3])
+            {
+                Function = FUNCTION_ACCEPT;
+                break;
+            }
+
+            /* It got its connection and waits for data on the new socket */
+            SocketStateUnlock(FCB);
+            FCB = ((PFILE_OBJECT)Irp->Tail.Overlay.DriverContext[2])->FsContext;
+            if (!SocketAcquireStateLock(FCB))
+                return;
+            Function = FUNCTION_RECV;
+            break;
+
+        case IOCTL_AFD_SUPER_CONNECT:
+            /* Once connected it waits for its data to be sent */
+            Function = (FCB->State == SOCKET_STATE_CONNECTING) ? FUNCTION_CONNECT : FUNCTION_SEND;
+            break;
+
         case IOCTL_AFD_SELECT:
             KeAcquireSpinLock(&DeviceExt->Lock, &OldIrql);
 
@@ -1274,6 +1419,15 @@ AfdCancelHandler(PDEVICE_OBJECT DeviceObject,
             return;
     }
 
+    /* The transport is receiving into this request. Cancel the transport's
+     * receive instead, its completion completes this request. */
+    if (Function == FUNCTION_RECV && Irp == FCB->DirectRecvIrp)
+    {
+        IoCancelIrp(FCB->ReceiveIrp.InFlightRequest);
+        SocketStateUnlock(FCB);
+        return;
+    }
+
     CurrentEntry = FCB->PendingIrpList[Function].Flink;
     while (CurrentEntry != &FCB->PendingIrpList[Function])
     {
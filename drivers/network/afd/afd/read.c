@@ -10,33 +10,102 @@
 
 #include "afd.h"
 
+/* Offset in the ring where the next received byte goes and the room from
+ * there up to the oldest byte or to the end of the window */
+static UINT RecvWindowFreeSpan( PAFD_FCB FCB, PUINT Offset )
+{
+    UINT Tail;
+
+    /* Start over at the beginning when empty to get the largest span */
+    if (FCB->Recv.Content == 0)
+        FCB->Recv.BytesUsed = 0;
+
+    Tail = FCB->Recv.BytesUsed + FCB->Recv.Content;
+    if (Tail >= FCB->Recv.Size)
+    {
+        /* The data wraps around, the free space is in front of it */
+        *Offset = Tail - FCB->Recv.Size;
+        return FCB->Recv.BytesUsed - *Offset;
+    }
+
+    *Offset = Tail;
+    return FCB->Recv.Size - Tail;
+}
+
+/* The oldest pending receive can be handed to the transport when nothing is
+ * buffered ahead of it. The transport only fills the first MDL of a request,
+ * so this is limited to single buffer receives. The request must already be
+ * marked pending, as the transport may complete it right away. */
+static PIRP GetDirectRecvCandidate( PAFD_FCB FCB, PAFD_RECV_INFO *RecvReq )
+{
+    PIRP Irp;
+    PIO_STACK_LOCATION IrpSp;
+    PAFD_MAPBUF Map;
+
+    if (FCB->Recv.Content || IsListEmpty(&FCB->PendingIrpList[FUNCTION_RECV]))
+        return NULL;
+
+    Irp = CONTAINING_RECORD(FCB->PendingIrpList[FUNCTION_RECV].Flink,
+                            IRP, Tail.Overlay.ListEntry);
+    IrpSp = IoGetCurrentIrpStackLocation(Irp);
+    if (Irp->Cancel || !(IrpSp->Control & SL_PENDING_RETURNED))
+        return NULL;
+
+    *RecvReq = GetLockedData(Irp, IrpSp);
+    if ((*RecvReq)->BufferCount != 1 ||
+        !(*RecvReq)->BufferArray[0].len ||
+        ((*RecvReq)->TdiFlags & TDI_RECEIVE_PEEK))
+        return NULL;
+
+    Map = (PAFD_MAPBUF)((*RecvReq)->BufferArray + (*RecvReq)->BufferCount);
+    if (!Map[0].Mdl)
+        return NULL;
+
+    return Irp;
+}
+
 static VOID RefillSocketBuffer( PAFD_FCB FCB )
 {
+    PIRP Irp;
+    PAFD_RECV_INFO RecvReq;
+    PAFD_MAPBUF Map;
+    UINT Offset, Span;
+    NTSTATUS Status;
+
     /* Make sure nothing's in flight first */
     if (FCB->ReceiveIrp.InFlightRequest) return;
 
     /* Now ensure that receive is still allowed */
     if (FCB->TdiReceiveClosed) return;
 
-    /* Check if the buffer is full */
-    if (FCB->Recv.Content == FCB->Recv.Size)
+    /* Let the transport copy straight into a waiting user buffer */
+    Irp = GetDirectRecvCandidate(FCB, &RecvReq);
+    if (Irp)
     {
-        /* If there are bytes used, we can solve this problem */
-        if (FCB->Recv.BytesUsed != 0)
-        {
-            /* Reposition the unused portion to the beginning of the receive window */
-            RtlMoveMemory(FCB->Recv.Window,
-                          FCB->Recv.Window + FCB->Recv.BytesUsed,
-                          FCB->Recv.Content - FCB->Recv.BytesUsed);
+        AFD_DbgPrint(MID_TRACE,("Receiving directly into %p\n", Irp));
+
+        Map = (PAFD_MAPBUF)(RecvReq->BufferArray + RecvReq->BufferCount);
+
+        /* Set before the call, the receive may complete immediately */
+        FCB->DirectRecvIrp = Irp;
+        Status = TdiReceiveMdl( &FCB->ReceiveIrp.InFlightRequest,
+                                FCB->Connection.Object,
+                                TDI_RECEIVE_NORMAL,
+                                Map[0].Mdl,
+                                RecvReq->BufferArray[0].len,
+                                ReceiveComplete,
+                                FCB );
+        if (Status == STATUS_PENDING) return;
+
+        FCB->DirectRecvIrp = NULL;
+    }
 
-            FCB->Recv.Content -= FCB->Recv.BytesUsed;
-            FCB->Recv.BytesUsed = 0;
-        }
-        else
-        {
-            /* No space in the buffer to receive */
-            return;
-        }
+    /* Otherwise buffer whatever arrives */
+    Span = RecvWindowFreeSpan(FCB, &Offset);
+    if (!Span)
+    {
+        /* No space in the buffer to receive */
+        return;
     }
 
     AFD_DbgPrint(MID_TRACE,("Replenishing buffer\n"));
@@ -44,12 +113,33 @@ static VOID RefillSocketBuffer( PAFD_FCB FCB )
     TdiReceive( &FCB->ReceiveIrp.InFlightRequest,
                 FCB->Connection.Object,
                 TDI_RECEIVE_NORMAL,
-                FCB->Recv.Window + FCB->Recv.Content,
-                FCB->Recv.Size - FCB->Recv.Content,
+                FCB->Recv.Window + Offset,
+                Span,
                 ReceiveComplete,
                 FCB );
 }
 
+/* Called once a receive is left pending. A window receive that has not got
+ * any data yet is cancelled, so that the transport fills the user buffer
+ * instead. */
+static VOID StartDirectReceive( PAFD_FCB FCB )
+{
+    PAFD_RECV_INFO RecvReq;
+
+    if (!GetDirectRecvCandidate(FCB, &RecvReq)) return;
+
+    if (!FCB->ReceiveIrp.InFlightRequest)
+    {
+        RefillSocketBuffer(FCB);
+    }
+    else if (!FCB->DirectRecvIrp && !FCB->RecvRepost)
+    {
+        /* If data is already on its way this does nothing */
+        FCB->RecvRepost = TRUE;
+        IoCancelIrp(FCB->ReceiveIrp.InFlightRequest);
+    }
+}
+
 static VOID HandleReceiveComplete( PAFD_FCB FCB, NTSTATUS Status, ULONG_PTR Information )
 {
     FCB->LastReceiveStatus = Status;
@@ -85,8 +175,35 @@ static VOID HandleReceiveComplete( PAFD_FCB FCB, NTSTATUS Status, ULONG_PTR Info
     }
 }
 
+static VOID HandleDirectReceiveComplete( PAFD_FCB FCB, PIRP Irp, NTSTATUS Status, ULONG_PTR Information )
+{
+    PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation(Irp);
+    PAFD_RECV_INFO RecvReq = GetLockedData(Irp, IrpSp);
+
+    /* A closure is recorded as usual, the request is then completed with
+     * the others by ReceiveActivity. Nothing is added to the window. */
+    if (!Information && (Status != STATUS_CANCELLED || FCB->TdiReceiveClosed))
+    {
+        HandleReceiveComplete(FCB, Status, 0);
+        return;
+    }
+
+    /* Either the data is in the user buffer or the request was cancelled */
+    AFD_DbgPrint(MID_TRACE,("Completing direct recv %p (%u)\n", Irp,
+                            (UINT)Information));
+    RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
+    UnlockBuffers( RecvReq->BufferArray, RecvReq->BufferCount, FALSE );
+    Irp->IoStatus.Status = Information ? STATUS_SUCCESS : STATUS_CANCELLED;
+    Irp->IoStatus.Information = Information;
+    if( Irp->MdlAddress ) UnlockRequest( Irp, IrpSp );
+    (void)IoSetCancelRoutine(Irp, NULL);
+    IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+
+    RefillSocketBuffer(FCB);
+}
+
 static BOOLEAN CantReadMore( PAFD_FCB FCB ) {
-    UINT BytesAvailable = FCB->Recv.Content - FCB->Recv.BytesUsed;
+    UINT BytesAvailable = FCB->Recv.Content;
 
     return !BytesAvailable && FCB->TdiReceiveClosed;
 }
@@ -94,9 +211,8 @@ static BOOLEAN CantReadMore( PAFD_FCB FCB ) {
 static NTSTATUS TryToSatisfyRecvRequestFromBuffer( PAFD_FCB FCB,
                                                    PAFD_RECV_INFO RecvReq,
                                                    PUINT TotalBytesCopied ) {
-    UINT i, BytesToCopy = 0, FcbBytesCopied = FCB->Recv.BytesUsed,
-        BytesAvailable =
-        FCB->Recv.Content - FCB->Recv.BytesUsed;
+    UINT i, BytesToCopy = 0, FirstPart, Offset = FCB->Recv.BytesUsed,
+        BytesAvailable = FCB->Recv.Content;
     PAFD_MAPBUF Map;
     *TotalBytesCopied = 0;
 
@@ -127,18 +243,26 @@ static NTSTATUS TryToSatisfyRecvRequestFromBuffer( PAFD_FCB FCB,
                                     Map[i].BufferAddress,
                                     BytesToCopy));
 
+            /* The data may wrap around the end of the window */
+            FirstPart = MIN( BytesToCopy, FCB->Recv.Size - Offset );
             RtlCopyMemory( Map[i].BufferAddress,
-                           FCB->Recv.Window + FcbBytesCopied,
-                           BytesToCopy );
+                           FCB->Recv.Window + Offset,
+                           FirstPart );
+            RtlCopyMemory( (PCHAR)Map[i].BufferAddress + FirstPart,
+                           FCB->Recv.Window,
+                           BytesToCopy - FirstPart );
 
             MmUnmapLockedPages( Map[i].BufferAddress, Map[i].Mdl );
 
             *TotalBytesCopied += BytesToCopy;
-            FcbBytesCopied += BytesToCopy;
+            Offset = (Offset + BytesToCopy) % FCB->Recv.Size;
             BytesAvailable -= BytesToCopy;
 
             if (!(RecvReq->TdiFlags & TDI_RECEIVE_PEEK))
-                FCB->Recv.BytesUsed += BytesToCopy;
+            {
+                FCB->Recv.BytesUsed = Offset;
+                FCB->Recv.Content -= BytesToCopy;
+            }
         }
     }
 
@@ -168,6 +292,14 @@ static NTSTATUS ReceiveActivity( PAFD_FCB FCB, PIRP Irp ) {
         while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_RECV] ) ) {
             NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_RECV]);
             NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
+
+            /* The transport still owns the buffer of this one */
+            if( NextIrp == FCB->DirectRecvIrp ) {
+                InsertHeadList(&FCB->PendingIrpList[FUNCTION_RECV],
+                               &NextIrp->Tail.Overlay.ListEntry);
+                break;
+            }
+
             NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
             RecvReq = GetLockedData(NextIrp, NextIrpSp);
 
@@ -228,7 +360,7 @@ static NTSTATUS ReceiveActivity( PAFD_FCB FCB, PIRP Irp ) {
         }
     }
 
-    if( FCB->Recv.Content - FCB->Recv.BytesUsed &&
+    if( FCB->Recv.Content &&
         IsListEmpty(&FCB->PendingIrpList[FUNCTION_RECV]) ) {
         FCB->PollState |= AFD_EVENT_RECEIVE;
         FCB->PollStatus[FD_READ_BIT] = STATUS_SUCCESS;
@@ -265,9 +397,10 @@ NTSTATUS NTAPI ReceiveComplete
   PVOID Context ) {
     PAFD_FCB FCB = (PAFD_FCB)Context;
     PLIST_ENTRY NextIrpEntry;
-    PIRP NextIrp;
+    PIRP NextIrp, DirectIrp;
     PAFD_RECV_INFO RecvReq;
     PIO_STACK_LOCATION NextIrpSp;
+    BOOLEAN Repost;
 
     UNREFERENCED_PARAMETER(DeviceObject);
 
@@ -279,6 +412,15 @@ NTSTATUS NTAPI ReceiveComplete
     ASSERT(FCB->ReceiveIrp.InFlightRequest == Irp);
     FCB->ReceiveIrp.InFlightRequest = NULL;
 
+    /* The MDL of a direct receive belongs to the user request, keep the
+     * I/O manager from freeing it */
+    DirectIrp = FCB->DirectRecvIrp;
+    FCB->DirectRecvIrp = NULL;
+    if( DirectIrp ) Irp->MdlAddress = NULL;
+
+    Repost = FCB->RecvRepost;
+    FCB->RecvRepost = FALSE;
+
     if( FCB->State == SOCKET_STATE_CLOSED ) {
         /* Cleanup our IRP queue because the FCB is being destroyed */
         while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_RECV] ) ) {
@@ -301,7 +443,16 @@ NTSTATUS NTAPI ReceiveComplete
         return STATUS_INVALID_PARAMETER;
     }
 
-    HandleReceiveComplete( FCB, Irp->IoStatus.Status, Irp->IoStatus.Information );
+    if( DirectIrp ) {
+        HandleDirectReceiveComplete( FCB, DirectIrp, Irp->IoStatus.Status,
+                                     Irp->IoStatus.Information );
+    } else if( Repost && Irp->IoStatus.Status == STATUS_CANCELLED &&
+               !FCB->TdiReceiveClosed ) {
+        /* We cancelled it for StartDirectReceive, nothing was received */
+        RefillSocketBuffer( FCB );
+    } else {
+        HandleReceiveComplete( FCB, Irp->IoStatus.Status, Irp->IoStatus.Information );
+    }
 
     ReceiveActivity( FCB, NULL );
 
@@ -525,6 +676,7 @@ AfdConnectedSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         AFD_DbgPrint(MID_TRACE,("Leaving read irp\n"));
         IoMarkIrpPending( Irp );
         (void)IoSetCancelRoutine(Irp, AfdCancelHandler);
+        StartDirectReceive( FCB );
     } else {
         AFD_DbgPrint(MID_TRACE,("Completed with status %x\n", Status));
     }
@@ -533,6 +685,17 @@ AfdConnectedSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     return Status;
 }
 
+/* Queue a receive that is already pending with its buffers locked, as a
+ * super accept is once it got its connection. Called with the socket
+ * locked. */
+VOID QueueLockedReceive( PAFD_FCB FCB, PIRP Irp ) {
+    InsertTailList( &FCB->PendingIrpList[FUNCTION_RECV],
+                    &Irp->Tail.Overlay.ListEntry );
+
+    if( ReceiveActivity( FCB, Irp ) == STATUS_PENDING )
+        StartDirectReceive( FCB );
+}
+
 NTSTATUS NTAPI
 PacketSocketRecvComplete(
         PDEVICE_OBJECT DeviceObject,
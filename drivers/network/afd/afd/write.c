@@ -676,3 +676,483 @@ AfdPacketSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
     }
 }
+
+/* Send the data of a request that is already pending with its buffers
+ * locked, as a super connect is once connected. Called with the socket
+ * locked, possibly from a completion routine, so the buffers are only
+ * reached through their MDLs. */
+NTSTATUS QueueLockedSend( PAFD_FCB FCB, PIRP Irp ) {
+    PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation( Irp );
+    PAFD_SEND_INFO SendReq = GetLockedData( Irp, IrpSp );
+    PAFD_MAPBUF Map = (PAFD_MAPBUF)(SendReq->BufferArray + SendReq->BufferCount);
+    UINT TotalBytesCopied = 0, i, SpaceAvail, BytesCopied;
+
+    SpaceAvail = FCB->Send.Size - FCB->Send.BytesUsed;
+
+    for ( i = 0; SpaceAvail > 0 && i < SendReq->BufferCount; i++ )
+    {
+        if (!Map[i].Mdl) continue;
+
+        BytesCopied = MIN(SendReq->BufferArray[i].len, SpaceAvail);
+
+        Map[i].BufferAddress = MmMapLockedPages( Map[i].Mdl, KernelMode );
+
+        RtlCopyMemory( FCB->Send.Window + FCB->Send.BytesUsed,
+                       Map[i].BufferAddress,
+                       BytesCopied );
+
+        MmUnmapLockedPages( Map[i].BufferAddress, Map[i].Mdl );
+
+        TotalBytesCopied += BytesCopied;
+        SpaceAvail -= BytesCopied;
+        FCB->Send.BytesUsed += BytesCopied;
+    }
+
+    if( TotalBytesCopied == 0 ) {
+        AFD_DbgPrint(MID_TRACE,("Empty send\n"));
+        UnlockBuffers( SendReq->BufferArray, SendReq->BufferCount, FALSE );
+        Irp->IoStatus.Status = STATUS_SUCCESS;
+        Irp->IoStatus.Information = 0;
+        if( Irp->MdlAddress ) UnlockRequest( Irp, IrpSp );
+        (void)IoSetCancelRoutine(Irp, NULL);
+        IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+        return STATUS_SUCCESS;
+    }
+
+    if (!SpaceAvail)
+        FCB->PollState &= ~AFD_EVENT_SEND;
+
+    /* Same bookkeeping as AfdConnectedSocketWriteData */
+    Irp->IoStatus.Information = TotalBytesCopied;
+    Irp->Tail.Overlay.DriverContext[3] = (PVOID)Irp->IoStatus.Information;
+
+    InsertTailList( &FCB->PendingIrpList[FUNCTION_SEND],
+                    &Irp->Tail.Overlay.ListEntry );
+
+    if (!FCB->SendIrp.InFlightRequest)
+    {
+        TdiSend(&FCB->SendIrp.InFlightRequest,
+                FCB->Connection.Object,
+                0,
+                FCB->Send.Window,
+                FCB->Send.BytesUsed,
+                SendComplete,
+                FCB);
+    }
+
+    return STATUS_PENDING;
+}
+
+/* Default and largest amount of file data read at a time by TransmitFile */
+#define TRANSMIT_FILE_CHUNK 0x10000
+
+/* What TransmitFile does next, see TransmitFileWorker */
+#define TRANSMIT_FILE_HEAD       0
+#define TRANSMIT_FILE_DATA       1
+#define TRANSMIT_FILE_TAIL       2
+#define TRANSMIT_FILE_DISCONNECT 3
+#define TRANSMIT_FILE_DONE       4
+
+typedef struct _AFD_TRANSMIT_FILE_CONTEXT {
+    PIO_WORKITEM WorkItem;
+    PDEVICE_OBJECT DeviceObject;
+    PFILE_OBJECT SocketObject;
+    PIRP Irp;
+    PIRP SendIrp;               /* Our request on the socket, reused for each one */
+    KSPIN_LOCK Lock;            /* Protects Cancelled and InFlight */
+    BOOLEAN Cancelled;
+    BOOLEAN InFlight;           /* SendIrp was passed to the socket */
+    KEVENT CancelDone;          /* Set when TransmitFileCancel no longer needs us */
+    ULONG Step;
+    HANDLE FileHandle;          /* Kernel handle, NULL for no file */
+    PCHAR Buffer;               /* File data being sent */
+    ULONG ChunkSize;
+    LARGE_INTEGER Offset;
+    LARGE_INTEGER Remaining;
+    ULONG_PTR TotalBytesSent;
+    AFD_TRANSMIT_FILE_INFO Info;    /* Head and Tail point to pool copies */
+    AFD_SEND_INFO SendInfo;
+    AFD_WSABUF SendBuffer;      /* What is left to send of the current buffer */
+    AFD_DISCONNECT_INFO DisconnectInfo;
+} AFD_TRANSMIT_FILE_CONTEXT, *PAFD_TRANSMIT_FILE_CONTEXT;
+
+static VOID FreeTransmitFileContext( PAFD_TRANSMIT_FILE_CONTEXT Transmit ) {
+    if( Transmit->Info.Head.buf )
+        ExFreePoolWithTag( Transmit->Info.Head.buf, TAG_AFD_TRANSMIT_FILE );
+    if( Transmit->Info.Tail.buf )
+        ExFreePoolWithTag( Transmit->Info.Tail.buf, TAG_AFD_TRANSMIT_FILE );
+    if( Transmit->Buffer )
+        ExFreePoolWithTag( Transmit->Buffer, TAG_AFD_TRANSMIT_FILE );
+    if( Transmit->FileHandle )
+        ZwClose( Transmit->FileHandle );
+    if( Transmit->SendIrp )
+        IoFreeIrp( Transmit->SendIrp );
+    if( Transmit->WorkItem )
+        IoFreeWorkItem( Transmit->WorkItem );
+    ExFreePoolWithTag( Transmit, TAG_AFD_TRANSMIT_FILE );
+}
+
+static NTSTATUS CaptureTransmitBuffer( PAFD_WSABUF Captured, PAFD_WSABUF Buffer,
+                                       KPROCESSOR_MODE PreviousMode ) {
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    Captured->buf = NULL;
+    Captured->len = Buffer->len;
+    if( !Buffer->buf || !Buffer->len ) {
+        Captured->len = 0;
+        return STATUS_SUCCESS;
+    }
+
+    Captured->buf = ExAllocatePoolWithTag( PagedPool, Buffer->len, TAG_AFD_TRANSMIT_FILE );
+    if( !Captured->buf ) return STATUS_INSUFFICIENT_RESOURCES;
+
+    _SEH2_TRY {
+        if( PreviousMode != KernelMode )
+            ProbeForRead( Buffer->buf, Buffer->len, 1 );
+        RtlCopyMemory( Captured->buf, Buffer->buf, Buffer->len );
+    } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+        Status = _SEH2_GetExceptionCode();
+    } _SEH2_END;
+
+    return Status;
+}
+
+static VOID TransmitFileComplete( PAFD_TRANSMIT_FILE_CONTEXT Transmit,
+                                  NTSTATUS Status ) {
+    PIRP Irp = Transmit->Irp;
+    ULONG_PTR TotalBytesSent = Transmit->TotalBytesSent;
+
+    AFD_DbgPrint(MID_TRACE,("Transmitted %u bytes for %p (%x)\n",
+                            (UINT)TotalBytesSent, Irp, Status));
+
+    /* Once the cancel routine was called it may still be looking at our
+     * request, wait for it before freeing that */
+    if( !IoSetCancelRoutine( Irp, NULL ) )
+        KeWaitForSingleObject( &Transmit->CancelDone, Executive, KernelMode, FALSE, NULL );
+
+    FreeTransmitFileContext( Transmit );
+
+    Irp->IoStatus.Status = Status;
+    Irp->IoStatus.Information = TotalBytesSent;
+    IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+}
+
+static IO_WORKITEM_ROUTINE TransmitFileWorker;
+
+static IO_COMPLETION_ROUTINE TransmitFileRequestComplete;
+static NTSTATUS NTAPI TransmitFileRequestComplete( PDEVICE_OBJECT DeviceObject,
+                                                   PIRP Irp,
+                                                   PVOID Context ) {
+    PAFD_TRANSMIT_FILE_CONTEXT Transmit = Context;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+    UNREFERENCED_PARAMETER(Irp);
+
+    /* The next step may have to read the file, which is done at
+     * PASSIVE_LEVEL. The request is kept for the next one. */
+    IoQueueWorkItem( Transmit->WorkItem, TransmitFileWorker, DelayedWorkQueue, Transmit );
+
+    return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+/* Issue a request of ours on the socket, TransmitFileWorker is called
+ * again when it completes */
+static VOID TransmitFileRequest( PAFD_TRANSMIT_FILE_CONTEXT Transmit,
+                                 ULONG IoControlCode,
+                                 PVOID Request, ULONG RequestLength ) {
+    PIRP Irp = Transmit->SendIrp;
+    PIO_STACK_LOCATION IrpSp;
+    BOOLEAN Cancelled;
+    KIRQL OldIrql;
+
+    IoReuseIrp( Irp, STATUS_SUCCESS );
+
+    IrpSp = IoGetNextIrpStackLocation( Irp );
+    IrpSp->MajorFunction = IRP_MJ_DEVICE_CONTROL;
+    IrpSp->FileObject = Transmit->SocketObject;
+    IrpSp->Parameters.DeviceIoControl.IoControlCode = IoControlCode;
+    IrpSp->Parameters.DeviceIoControl.InputBufferLength = RequestLength;
+    IrpSp->Parameters.DeviceIoControl.Type3InputBuffer = Request;
+
+    IoSetCompletionRoutine( Irp, TransmitFileRequestComplete, Transmit, TRUE, TRUE, TRUE );
+
+    /* From now on cancelling the TransmitFile cancels this request */
+    KeAcquireSpinLock( &Transmit->Lock, &OldIrql );
+    Cancelled = Transmit->Cancelled;
+    Transmit->InFlight = !Cancelled;
+    KeReleaseSpinLock( &Transmit->Lock, OldIrql );
+
+    if( Cancelled ) {
+        TransmitFileComplete( Transmit, STATUS_CANCELLED );
+        return;
+    }
+
+    IoCallDriver( Transmit->DeviceObject, Irp );
+}
+
+/* Overlapped sends complete with what fit in the send window, the rest
+ * is sent by the next one */
+static VOID TransmitFileSend( PAFD_TRANSMIT_FILE_CONTEXT Transmit ) {
+    Transmit->SendInfo.BufferArray = &Transmit->SendBuffer;
+    Transmit->SendInfo.BufferCount = 1;
+    Transmit->SendInfo.AfdFlags = AFD_OVERLAPPED;
+    Transmit->SendInfo.TdiFlags = 0;
+
+    TransmitFileRequest( Transmit, IOCTL_AFD_SEND,
+                         &Transmit->SendInfo, sizeof(Transmit->SendInfo) );
+}
+
+/* Read the next chunk of the file into SendBuffer, which stays empty at
+ * the end of the data */
+static NTSTATUS TransmitFileRead( PAFD_TRANSMIT_FILE_CONTEXT Transmit ) {
+    IO_STATUS_BLOCK Iosb;
+    ULONG Length;
+    NTSTATUS Status;
+
+    if( !Transmit->Buffer ) {
+        Transmit->ChunkSize = Transmit->Info.SendPacketLength;
+        if( !Transmit->ChunkSize || Transmit->ChunkSize > TRANSMIT_FILE_CHUNK )
+            Transmit->ChunkSize = TRANSMIT_FILE_CHUNK;
+
+        Transmit->Buffer = ExAllocatePoolWithTag( PagedPool, Transmit->ChunkSize,
+                                                  TAG_AFD_TRANSMIT_FILE );
+        if( !Transmit->Buffer ) return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Length = Transmit->ChunkSize;
+    if( Transmit->Info.WriteLength.QuadPart ) {
+        if( !Transmit->Remaining.QuadPart ) return STATUS_SUCCESS;
+        if( Transmit->Remaining.QuadPart < Length ) Length = (ULONG)Transmit->Remaining.QuadPart;
+    }
+
+    /* Cached files are read by fast I/O straight from the cache */
+    Status = ZwReadFile( Transmit->FileHandle, NULL, NULL, NULL, &Iosb,
+                         Transmit->Buffer, Length, &Transmit->Offset, NULL );
+    if( Status == STATUS_PENDING ) {
+        ZwWaitForSingleObject( Transmit->FileHandle, FALSE, NULL );
+        Status = Iosb.Status;
+    }
+
+    if( Status == STATUS_END_OF_FILE ) return STATUS_SUCCESS;
+    if( !NT_SUCCESS(Status) ) return Status;
+
+    Transmit->SendBuffer.buf = Transmit->Buffer;
+    Transmit->SendBuffer.len = (UINT)Iosb.Information;
+    Transmit->Offset.QuadPart += Iosb.Information;
+    Transmit->Remaining.QuadPart -= Iosb.Information;
+
+    return STATUS_SUCCESS;
+}
+
+/* Runs once to start the transfer and then after each of our requests
+ * completed. It never waits for the socket: it issues the next request
+ * and returns, so a worker thread is only used while reading the file. */
+static VOID NTAPI TransmitFileWorker( PDEVICE_OBJECT DeviceObject,
+                                      PVOID Context ) {
+    PAFD_TRANSMIT_FILE_CONTEXT Transmit = Context;
+    PIRP SendIrp = Transmit->SendIrp;
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG_PTR BytesSent;
+    KIRQL OldIrql;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    if( Transmit->InFlight ) {
+        KeAcquireSpinLock( &Transmit->Lock, &OldIrql );
+        Transmit->InFlight = FALSE;
+        KeReleaseSpinLock( &Transmit->Lock, OldIrql );
+
+        Status = SendIrp->IoStatus.Status;
+        if( NT_SUCCESS(Status) && Transmit->SendBuffer.len ) {
+            BytesSent = SendIrp->IoStatus.Information;
+            if( !BytesSent || BytesSent > Transmit->SendBuffer.len ) {
+                Status = STATUS_UNSUCCESSFUL;
+            } else {
+                Transmit->SendBuffer.buf += BytesSent;
+                Transmit->SendBuffer.len -= (UINT)BytesSent;
+                Transmit->TotalBytesSent += BytesSent;
+            }
+        }
+    } else {
+        AFD_DbgPrint(MID_TRACE,("Transmitting for %p\n", Transmit->Irp));
+    }
+
+    while( NT_SUCCESS(Status) ) {
+        if( Transmit->Cancelled ) {
+            Status = STATUS_CANCELLED;
+            break;
+        }
+
+        if( Transmit->SendBuffer.len ) {
+            TransmitFileSend( Transmit );
+            return;
+        }
+
+        switch( Transmit->Step ) {
+        case TRANSMIT_FILE_HEAD:
+            Transmit->SendBuffer = Transmit->Info.Head;
+            Transmit->Step = TRANSMIT_FILE_DATA;
+            break;
+
+        case TRANSMIT_FILE_DATA:
+            if( Transmit->FileHandle )
+                Status = TransmitFileRead( Transmit );
+
+            /* Stay here until the end of the data */
+            if( !Transmit->SendBuffer.len )
+                Transmit->Step = TRANSMIT_FILE_TAIL;
+            break;
+
+        case TRANSMIT_FILE_TAIL:
+            Transmit->SendBuffer = Transmit->Info.Tail;
+            Transmit->Step = TRANSMIT_FILE_DISCONNECT;
+            break;
+
+        case TRANSMIT_FILE_DISCONNECT:
+            Transmit->Step = TRANSMIT_FILE_DONE;
+            if( Transmit->Info.Flags & (AFD_TF_DISCONNECT | AFD_TF_REUSE_SOCKET) ) {
+                Transmit->DisconnectInfo.DisconnectType = AFD_DISCONNECT_SEND;
+                if( Transmit->Info.Flags & AFD_TF_REUSE_SOCKET )
+                    Transmit->DisconnectInfo.DisconnectType |= AFD_DISCONNECT_REUSE;
+                Transmit->DisconnectInfo.Timeout = RtlConvertLongToLargeInteger(-1000000);
+
+                TransmitFileRequest( Transmit, IOCTL_AFD_DISCONNECT,
+                                     &Transmit->DisconnectInfo,
+                                     sizeof(Transmit->DisconnectInfo) );
+                return;
+            }
+            break;
+
+        default:
+            TransmitFileComplete( Transmit, STATUS_SUCCESS );
+            return;
+        }
+    }
+
+    TransmitFileComplete( Transmit, Status );
+}
+
+/* Cancelling a TransmitFile cancels the request it has in flight on the
+ * socket, whose completion then ends the transfer */
+static DRIVER_CANCEL TransmitFileCancel;
+static VOID NTAPI TransmitFileCancel( PDEVICE_OBJECT DeviceObject,
+                                      PIRP Irp ) {
+    PAFD_TRANSMIT_FILE_CONTEXT Transmit = Irp->Tail.Overlay.DriverContext[0];
+    PIRP SendIrp = NULL;
+    KIRQL OldIrql;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    IoReleaseCancelSpinLock( Irp->CancelIrql );
+
+    KeAcquireSpinLock( &Transmit->Lock, &OldIrql );
+    Transmit->Cancelled = TRUE;
+    if( Transmit->InFlight ) SendIrp = Transmit->SendIrp;
+    KeReleaseSpinLock( &Transmit->Lock, OldIrql );
+
+    /* The request is only freed after CancelDone is set */
+    if( SendIrp ) IoCancelIrp( SendIrp );
+
+    KeSetEvent( &Transmit->CancelDone, IO_NO_INCREMENT, FALSE );
+}
+
+/* TransmitFile. The file is read in the kernel and fed to the socket
+ * through ordinary overlapped sends, each completion starting the next. */
+NTSTATUS NTAPI
+AfdTransmitFile(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                PIO_STACK_LOCATION IrpSp) {
+    NTSTATUS Status = STATUS_SUCCESS;
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_TRANSMIT_FILE_INFO TransmitReq;
+    PAFD_TRANSMIT_FILE_CONTEXT Transmit;
+    PFILE_OBJECT File;
+
+    AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    if( (FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS) ||
+        IrpSp->Parameters.DeviceIoControl.InputBufferLength < sizeof(*TransmitReq) ) {
+        AFD_DbgPrint(MIN_TRACE,("Invalid parameter\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+    }
+
+    if( FCB->State != SOCKET_STATE_CONNECTED ) {
+        AFD_DbgPrint(MID_TRACE,("Socket not connected\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_CONNECTION, Irp, 0 );
+    }
+
+    if( !(TransmitReq = LockRequest( Irp, IrpSp, FALSE, NULL )) )
+        return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+
+    Transmit = ExAllocatePoolWithTag( NonPagedPool, sizeof(*Transmit), TAG_AFD_TRANSMIT_FILE );
+    if( !Transmit )
+        return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+
+    RtlZeroMemory( Transmit, sizeof(*Transmit) );
+    Transmit->DeviceObject = DeviceObject;
+    Transmit->SocketObject = FileObject;
+    Transmit->Irp = Irp;
+    KeInitializeSpinLock( &Transmit->Lock );
+    KeInitializeEvent( &Transmit->CancelDone, NotificationEvent, FALSE );
+    Transmit->Step = TRANSMIT_FILE_HEAD;
+    Transmit->Info = *TransmitReq;
+    Transmit->Info.Head.buf = NULL;
+    Transmit->Info.Tail.buf = NULL;
+    Transmit->Offset = TransmitReq->Offset;
+    Transmit->Remaining = TransmitReq->WriteLength;
+
+    Status = CaptureTransmitBuffer( &Transmit->Info.Head, &TransmitReq->Head, Irp->RequestorMode );
+    if( NT_SUCCESS(Status) )
+        Status = CaptureTransmitBuffer( &Transmit->Info.Tail, &TransmitReq->Tail, Irp->RequestorMode );
+
+    /* The worker runs in the system process, it gets a handle of its own */
+    if( NT_SUCCESS(Status) && TransmitReq->FileHandle ) {
+        Status = ObReferenceObjectByHandle( TransmitReq->FileHandle,
+                                            FILE_READ_DATA,
+                                            *IoFileObjectType,
+                                            Irp->RequestorMode,
+                                            (PVOID *)&File,
+                                            NULL );
+        if( NT_SUCCESS(Status) ) {
+            Status = ObOpenObjectByPointer( File,
+                                            OBJ_KERNEL_HANDLE,
+                                            NULL,
+                                            FILE_READ_DATA | SYNCHRONIZE,
+                                            *IoFileObjectType,
+                                            KernelMode,
+                                            &Transmit->FileHandle );
+            ObDereferenceObject( File );
+        }
+    }
+
+    if( NT_SUCCESS(Status) ) {
+        Transmit->WorkItem = IoAllocateWorkItem( DeviceObject );
+        Transmit->SendIrp = IoAllocateIrp( DeviceObject->StackSize, FALSE );
+        if( !Transmit->WorkItem || !Transmit->SendIrp )
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if( !NT_SUCCESS(Status) ) {
+        FreeTransmitFileContext( Transmit );
+        return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+
+    /* Everything needed was captured */
+    UnlockRequest( Irp, IrpSp );
+
+    Irp->Tail.Overlay.DriverContext[0] = Transmit;
+    (void)IoSetCancelRoutine( Irp, TransmitFileCancel );
+    if( Irp->Cancel && IoSetCancelRoutine( Irp, NULL ) ) {
+        FreeTransmitFileContext( Transmit );
+        return UnlockAndMaybeComplete( FCB, STATUS_CANCELLED, Irp, 0 );
+    }
+
+    IoMarkIrpPending( Irp );
+    SocketStateUnlock( FCB );
+
+    IoQueueWorkItem( Transmit->WorkItem, TransmitFileWorker, DelayedWorkQueue, Transmit );
+
+    return STATUS_PENDING;
+}
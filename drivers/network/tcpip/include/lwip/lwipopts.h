@@ -4,7 +4,9 @@
    ------------------------------------
 */
 
-/* This combo allows us to implement malloc, free, and realloc ourselves */
+/* This combo allows us to implement malloc, free, and realloc ourselves.
+ * lwip_glue/memory.c serves the memp element and frame sizes from per-CPU
+ * lookaside lists, so the pools grow and shrink with the load */
 #define MEM_LIBC_MALLOC                 1
 #define MEMP_MEM_MALLOC                 1
 
@@ -19,7 +21,9 @@
 
 #define ETH_PAD_SIZE                    2
 
-#define IP_REASS_MAX_PBUFS              0xFFFFFFFF
+/* Datagrams are reassembled in ip/network/receive.c before lwIP gets them,
+ * this only bounds whatever might still reach lwIP in pieces */
+#define IP_REASS_MAX_PBUFS              64
 
 #define IP_DEFAULT_TTL                  128
 
@@ -45,10 +49,22 @@
  * add support for other transport mediums */
 #define TCP_MSS                         1460
 
-#define TCP_WND                         0xFFFF
+/* With window scaling a connection can use up to TCP_WND of receive window
+ * and TCP_SND_BUF of send buffer. Connections start at 64 KB and the glue
+ * grows both with the measured bandwidth-delay product, see lwip_glue/tcp.c
+ * and lwip_glue/tcpwnd.c */
+#define LWIP_WND_SCALE                  1
+
+#define TCP_RCV_SCALE                   5
+
+#define TCP_WND                         (1024 * 1024)
 
 #define TCP_SND_BUF                     TCP_WND
 
+#define LWIP_TCP_SACK_OUT               1
+
+#define LWIP_TCP_MAX_SACK_NUM           4
+
 #define TCP_MAXRTX                      8
 
 #define TCP_SYNMAXRTX                   4
@@ -61,7 +77,17 @@
 
 #define LWIP_NETCONN                    0
 
-#define LWIP_STATS                      0
+#define LWIP_STATS                      1
+
+/* 16 bit counters wrap within seconds on a busy connection */
+#define LWIP_STATS_LARGE                1
+
+#define MEM_STATS                       1
+
+#define MEMP_STATS                      1
+
+/* Dumped to the debugger when the stack shuts down */
+#define LWIP_STATS_DISPLAY              DBG
 
 #define ICMP_STATS                      0
 
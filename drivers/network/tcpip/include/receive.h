@@ -12,6 +12,12 @@
 /* Number of seconds before destroying the IPDR */
 #define MAX_TIMEOUT_COUNT 3
 
+/* Number of buckets in the IPDR hash table, must be a power of two */
+#define IPDR_HASH_SIZE 256
+
+/* Bytes the IPDRs may hold in total before the oldest ones are evicted */
+#define IPDR_MAX_BYTES (1024 * 1024)
+
 /* IP datagram fragment descriptor. Used to store IP datagram fragments */
 typedef struct IP_FRAGMENT {
     LIST_ENTRY ListEntry; /* Entry on list */
@@ -31,8 +37,9 @@ typedef struct IPDATAGRAM_HOLE {
 
 /* IP datagram reassembly information */
 typedef struct IPDATAGRAM_REASSEMBLY {
-    LIST_ENTRY ListEntry;        /* Entry on list */
-    KSPIN_LOCK Lock;             /* Protecting spin lock */
+    LIST_ENTRY ListEntry;        /* Entry on list, oldest first */
+    LIST_ENTRY HashEntry;        /* Entry on hash bucket */
+    UINT Bytes;                  /* Memory held by the fragments */
     UINT DataSize;               /* Size of datagram data area */
     IP_ADDRESS SrcAddr;          /* Source address */
     IP_ADDRESS DstAddr;          /* Destination address */
@@ -45,8 +52,20 @@ typedef struct IPDATAGRAM_REASSEMBLY {
     UINT TimeoutCount;           /* Timeout counter */
 } IPDATAGRAM_REASSEMBLY, *PIPDATAGRAM_REASSEMBLY;
 
+/* IP datagram reassembly counters */
+typedef struct IPDATAGRAM_REASSEMBLY_STATS {
+    ULONG Requests;              /* Fragments received */
+    ULONG Hits;                  /* Fragments of an already known datagram */
+    ULONG Completed;             /* Datagrams reassembled */
+    ULONG Failures;              /* Datagrams dropped for lack of resources */
+    ULONG Timeouts;              /* Datagrams dropped after MAX_TIMEOUT_COUNT */
+    ULONG Evictions;             /* Datagrams dropped to stay in IPDR_MAX_BYTES */
+} IPDATAGRAM_REASSEMBLY_STATS, *PIPDATAGRAM_REASSEMBLY_STATS;
+
 
 extern LIST_ENTRY ReassemblyListHead;
+extern LIST_ENTRY ReassemblyHashTable[IPDR_HASH_SIZE];
+extern IPDATAGRAM_REASSEMBLY_STATS ReassemblyStats;
 extern KSPIN_LOCK ReassemblyListLock;
 extern NPAGED_LOOKASIDE_LIST IPDRList;
 extern NPAGED_LOOKASIDE_LIST IPFragmentList;
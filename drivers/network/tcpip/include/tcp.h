@@ -188,6 +188,8 @@ BOOLEAN TCPRemoveIRP( PCONNECTION_ENDPOINT Connection, PIRP Irp );
 
 NTSTATUS TCPSetNoDelay(PCONNECTION_ENDPOINT Connection, BOOLEAN Set);
 
+NTSTATUS TCPSetBufferLimits(PCONNECTION_ENDPOINT Connection, PULONG ReceiveLimit, PULONG SendLimit);
+
 VOID
 TCPUpdateInterfaceLinkStatus(PIP_INTERFACE IF);
 
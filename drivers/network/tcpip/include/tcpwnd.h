@@ -0,0 +1,40 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS TCP/IP protocol driver
+ * FILE:        include/tcpwnd.h
+ * PURPOSE:     TCP receive window autotuning
+ */
+
+#pragma once
+
+#include <lwip/opt.h>
+
+struct tcp_pcb;
+
+/* Receive window every connection starts with. Autotuning grows it up to
+ * TCP_WND (or SO_RCVBUF) when the connection turns out to be limited by it. */
+#ifndef TCP_INITIAL_WND
+#define TCP_INITIAL_WND 0xFFFF
+#endif
+
+/* Receive window autotuning state, only used by the lwIP thread */
+typedef struct _TCP_RECEIVE_WINDOW
+{
+    u32_t ReceiveWindow;   /* Receive window we want to offer */
+    u32_t Withheld;        /* Received bytes not given back to lwIP yet */
+    u32_t Received;        /* Bytes received since MeasureStart */
+    u32_t MeasureStart;    /* Start of the current measurement (ms) */
+    u32_t RttSeq;          /* Sequence number ending the current RTT sample */
+    u32_t RttStart;        /* Start of the current RTT sample (ms) */
+    u32_t Rtt;             /* Receiver side RTT estimate (ms, 0 if unknown) */
+} TCP_RECEIVE_WINDOW, *PTCP_RECEIVE_WINDOW;
+
+/* Limit is the buffer size requested with SO_RCVBUF, 0 if not set */
+void
+LibTCPStartReceiveWindow(PTCP_RECEIVE_WINDOW Window, u32_t Limit, struct tcp_pcb *pcb);
+
+void
+LibTCPUpdateReceiveWindow(PTCP_RECEIVE_WINDOW Window, u32_t Limit, struct tcp_pcb *pcb, u32_t len);
+
+void
+LibTCPReleaseReceiveWindow(PTCP_RECEIVE_WINDOW Window, struct tcp_pcb *pcb);
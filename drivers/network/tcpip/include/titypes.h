@@ -51,6 +51,7 @@
 #define ASSERT_TCPIP_OBJECT_LOCKED(Object) ASSERT(ExIsResourceAcquiredExclusiveLite(&(Object)->Resource))
 
 #include <ip.h>
+#include <tcpwnd.h>
 
 struct _ADDRESS_FILE;
 
@@ -266,6 +267,16 @@ typedef struct _CONNECTION_ENDPOINT {
     NTSTATUS ReceiveShutdownStatus;
     BOOLEAN Closing;
 
+    /* Buffer sizes requested with SO_RCVBUF / SO_SNDBUF (0 if not set) */
+    ULONG ReceiveBufferLimit;
+    ULONG SendBufferLimit;
+
+    /* Receive window and send buffer autotuning, only used by the lwIP thread */
+    struct {
+        TCP_RECEIVE_WINDOW Receive;
+        ULONG SendBuffer;      /* Send buffer size given to lwIP (0 if untouched) */
+    } AutoTune;
+
     struct _CONNECTION_ENDPOINT *Next; /* Next connection in address file list */
 } CONNECTION_ENDPOINT, *PCONNECTION_ENDPOINT;
 
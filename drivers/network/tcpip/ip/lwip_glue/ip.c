@@ -1,11 +1,18 @@
 #include <lwip/netif.h>
 #include <lwip/tcpip.h>
+#include <lwip/stats.h>
 
 typedef struct netif* PNETIF;
 
 void
 sys_shutdown(void);
 
+void
+LibIPMemoryInitialize(void);
+
+void
+LibIPMemoryShutdown(void);
+
 void
 LibIPInsertPacket(void *ifarg,
                   const void *const data,
@@ -32,6 +39,8 @@ LibIPInsertPacket(void *ifarg,
 void
 LibIPInitialize(void)
 {
+    LibIPMemoryInitialize();
+
     /* This completes asynchronously */
     tcpip_init(NULL, NULL);
 }
@@ -41,4 +50,9 @@ LibIPShutdown(void)
 {
     /* This is synchronous */
     sys_shutdown();
+
+    /* Dump the lwIP counters, including the use of each memory pool */
+    stats_display();
+
+    LibIPMemoryShutdown();
 }
@@ -1,13 +1,176 @@
 #include <lwip/mem.h>
+#include <lwip/memp.h>
+#include <lwip/pbuf.h>
+#include <lwip/priv/memp_priv.h>
+#include <lwip/stats.h>
 
 #ifndef LWIP_TAG
     #define LWIP_TAG 'PIwl'
 #endif
 
+/*
+ * lwIP allocates everything through mem_malloc(), which ends up here. Almost
+ * all of it is memp elements (PCBs, segments, pbuf headers, timeouts...) and
+ * pbufs of at most a full frame, so the sizes mem_malloc() asks for are known
+ * up front. Each of them gets its own size class backed by one nonpaged
+ * lookaside list per processor; anything else goes to the pool.
+ */
+
+/* What mem_malloc() adds in front of each block to keep MEM_STATS */
+#if LWIP_STATS && MEM_STATS
+#define LWIP_MEM_STATS_SIZE LWIP_MEM_ALIGN_SIZE(sizeof(mem_size_t))
+#else
+#define LWIP_MEM_STATS_SIZE 0
+#endif
+
+/* A full sized PBUF_RAM pbuf, as used for received frames and TCP segments */
+#define LWIP_FRAME_PBUF_SIZE (LWIP_MEM_ALIGN_SIZE(sizeof(struct pbuf)) + \
+                              LWIP_MEM_ALIGN_SIZE(PBUF_POOL_BUFSIZE) + \
+                              LWIP_MEM_STATS_SIZE)
+
+#define LWIP_MAX_CLASSES (MEMP_MAX + 1)
+
+/* Class of blocks that come straight from the pool */
+#define LWIP_POOL_CLASS ((ULONG)-1)
+
+typedef struct _LWIP_BLOCK_HEADER
+{
+    /* Size class index or LWIP_POOL_CLASS */
+    ULONG Class;
+    /* Usable size of the block */
+    ULONG Size;
+} LWIP_BLOCK_HEADER, *PLWIP_BLOCK_HEADER;
+
+static ULONG ClassSize[LWIP_MAX_CLASSES];
+static ULONG ClassCount;
+static ULONG ProcessorCount;
+/* ProcessorCount rows of ClassCount lists */
+static PNPAGED_LOOKASIDE_LIST LookasideLists;
+
+static
+void
+AddClass(ULONG Size)
+{
+    ULONG i, j;
+
+    for (i = 0; i < ClassCount; i++)
+    {
+        if (ClassSize[i] == Size)
+            return;
+        if (ClassSize[i] > Size)
+            break;
+    }
+
+    /* Keep the classes sorted by size */
+    for (j = ClassCount; j > i; j--)
+        ClassSize[j] = ClassSize[j - 1];
+    ClassSize[i] = Size;
+    ClassCount++;
+}
+
+void
+LibIPMemoryInitialize(void)
+{
+    ULONG i, Count;
+
+    for (i = 0; i < MEMP_MAX; i++)
+        AddClass(MEMP_SIZE + MEMP_ALIGN_SIZE(memp_pools[i]->size) + LWIP_MEM_STATS_SIZE);
+    AddClass(LWIP_FRAME_PBUF_SIZE);
+
+    ProcessorCount = KeNumberProcessors;
+    Count = ProcessorCount * ClassCount;
+    LookasideLists = ExAllocatePoolWithTag(NonPagedPool,
+                                           Count * sizeof(NPAGED_LOOKASIDE_LIST),
+                                           LWIP_TAG);
+    if (!LookasideLists)
+    {
+        /* Everything will simply come from the pool */
+        ClassCount = 0;
+        return;
+    }
+
+    for (i = 0; i < Count; i++)
+    {
+        ExInitializeNPagedLookasideList(&LookasideLists[i],
+                                        NULL,
+                                        NULL,
+                                        0,
+                                        sizeof(LWIP_BLOCK_HEADER) + ClassSize[i % ClassCount],
+                                        LWIP_TAG,
+                                        0);
+    }
+}
+
+/*
+ * Called once the lwIP thread is gone, but blocks can still be outstanding:
+ * the PCBs and timeouts lwIP never frees, and pbufs queued on connections.
+ * Lookaside lists allocate from the pool with the same tag, so once the lists
+ * are gone such blocks are simply given back to the pool by free().
+ */
+void
+LibIPMemoryShutdown(void)
+{
+    PNPAGED_LOOKASIDE_LIST Lists;
+    ULONG i, Count;
+
+    /* Route new allocations and frees to the pool before the lists go away */
+    Count = ProcessorCount * ClassCount;
+    ClassCount = 0;
+    Lists = InterlockedExchangePointer((PVOID*)&LookasideLists, NULL);
+    if (!Lists)
+        return;
+
+    for (i = 0; i < Count; i++)
+        ExDeleteNPagedLookasideList(&Lists[i]);
+
+    ExFreePoolWithTag(Lists, LWIP_TAG);
+}
+
+static
+PNPAGED_LOOKASIDE_LIST
+GetLookasideList(ULONG Class)
+{
+    ULONG Processor = KeGetCurrentProcessorNumber();
+
+    /* Any list of the class will do, the current processor's is just the
+     * least contended one */
+    if (Processor >= ProcessorCount)
+        Processor = 0;
+
+    return &LookasideLists[Processor * ClassCount + Class];
+}
+
 void *
 malloc(mem_size_t size)
 {
-    return ExAllocatePoolWithTag(NonPagedPool, size, LWIP_TAG);
+    PLWIP_BLOCK_HEADER Header;
+    ULONG Class;
+
+    for (Class = 0; Class < ClassCount; Class++)
+    {
+        if (ClassSize[Class] >= size)
+            break;
+    }
+
+    if (Class < ClassCount)
+    {
+        Header = ExAllocateFromNPagedLookasideList(GetLookasideList(Class));
+        if (!Header) return NULL;
+
+        Header->Size = ClassSize[Class];
+    }
+    else
+    {
+        Header = ExAllocatePoolWithTag(NonPagedPool, sizeof(*Header) + size, LWIP_TAG);
+        if (!Header) return NULL;
+
+        Class = LWIP_POOL_CLASS;
+        Header->Size = (ULONG)size;
+    }
+
+    Header->Class = Class;
+
+    return Header + 1;
 }
 
 void *
@@ -25,10 +188,15 @@ calloc(mem_size_t count, mem_size_t size)
 void
 free(void *mem)
 {
-    ExFreePoolWithTag(mem, LWIP_TAG);
+    PLWIP_BLOCK_HEADER Header = (PLWIP_BLOCK_HEADER)mem - 1;
+
+    /* Also covers blocks that outlived their list, see LibIPMemoryShutdown */
+    if (Header->Class == LWIP_POOL_CLASS || !LookasideLists)
+        ExFreePoolWithTag(Header, LWIP_TAG);
+    else
+        ExFreeToNPagedLookasideList(GetLookasideList(Header->Class), Header);
 }
 
-/* This is only used to trim in lwIP */
 void *
 realloc(void *mem, size_t size)
 {
@@ -45,6 +213,11 @@ realloc(void *mem, size_t size)
         return NULL;
     }
 
+    /* Trimming never needs to move the block */
+    if (size <= ((PLWIP_BLOCK_HEADER)mem - 1)->Size) {
+        return mem;
+    }
+
     /* Allocate the new buffer first */
     new_mem = malloc(size);
     if (new_mem == NULL) {
@@ -53,7 +226,7 @@ realloc(void *mem, size_t size)
     }
 
     /* Copy the data over */
-    RtlCopyMemory(new_mem, mem, size);
+    RtlCopyMemory(new_mem, mem, ((PLWIP_BLOCK_HEADER)mem - 1)->Size);
 
     /* Deallocate the old buffer */
     free(mem);
@@ -196,6 +196,53 @@ WaitForEventSafely(PRKEVENT Event)
     }
 }
 
+/* Send buffer every connection starts with. Autotuning grows it up to
+ * TCP_SND_BUF (or SO_SNDBUF) when the connection turns out to be limited by
+ * it. The receive window is handled by tcpwnd.c. */
+#define TCP_INITIAL_SND_BUF 0xFFFF
+
+/* A connection endpoint can be used for several connections, each new PCB
+ * starts from lwIP's defaults */
+static
+void
+LibTCPResetAutoTune(PCONNECTION_ENDPOINT Connection)
+{
+    RtlZeroMemory(&Connection->AutoTune, sizeof(Connection->AutoTune));
+}
+
+/* Sizes lwIP's send buffer to about two bandwidth-delay products, the
+ * congestion window (or the peer's window) being the estimate of one. lwIP
+ * only accounts the free space in snd_buf, so the size is changed by
+ * adjusting that. */
+static
+void
+LibTCPUpdateSendBuffer(PCONNECTION_ENDPOINT Connection, PTCP_PCB pcb)
+{
+    u32_t Current = Connection->AutoTune.SendBuffer ? Connection->AutoTune.SendBuffer : TCP_SND_BUF;
+    u32_t Target, Shrink;
+
+    Target = 2 * (u32_t)LWIP_MIN(pcb->cwnd, pcb->snd_wnd);
+    Target = LWIP_MAX(Target, TCP_INITIAL_SND_BUF);
+    Target = LWIP_MAX(Target, Connection->AutoTune.SendBuffer);
+    Target = LWIP_MIN(Target, TCP_SND_BUF);
+    if (Connection->SendBufferLimit)
+        Target = LWIP_MIN(Target, LWIP_MAX(Connection->SendBufferLimit, 2 * (u32_t)pcb->mss));
+
+    if (Target >= Current)
+    {
+        pcb->snd_buf += Target - Current;
+    }
+    else
+    {
+        /* Queued data can only be given up once it is acknowledged */
+        Shrink = LWIP_MIN(Current - Target, pcb->snd_buf);
+        pcb->snd_buf -= Shrink;
+        Target = Current - Shrink;
+    }
+
+    Connection->AutoTune.SendBuffer = Target;
+}
+
 static
 err_t
 InternalSendEventHandler(void *arg, PTCP_PCB pcb, const u16_t space)
@@ -203,6 +250,8 @@ InternalSendEventHandler(void *arg, PTCP_PCB pcb, const u16_t space)
     /* Make sure the socket didn't get closed */
     if (!arg) return ERR_OK;
 
+    LibTCPUpdateSendBuffer(arg, pcb);
+
     TCPSendEventHandler(arg, space);
 
     return ERR_OK;
@@ -227,7 +276,10 @@ InternalRecvEventHandler(void *arg, PTCP_PCB pcb, struct pbuf *p, const err_t er
     {
         LibTCPEnqueuePacket(Connection, p);
 
-        tcp_recved(pcb, p->tot_len);
+        LibTCPUpdateReceiveWindow(&Connection->AutoTune.Receive,
+                                  Connection->ReceiveBufferLimit,
+                                  pcb,
+                                  p->tot_len);
 
         TCPRecvEventHandler(arg);
     }
@@ -287,6 +339,13 @@ InternalConnectEventHandler(void *arg, PTCP_PCB pcb, const err_t err)
     if (!arg)
         return ERR_OK;
 
+    if (err == ERR_OK)
+    {
+        PCONNECTION_ENDPOINT Connection = arg;
+
+        LibTCPStartReceiveWindow(&Connection->AutoTune.Receive, Connection->ReceiveBufferLimit, pcb);
+    }
+
     TCPConnectEventHandler(arg, err);
 
     return ERR_OK;
@@ -325,6 +384,7 @@ LibTCPSocketCallback(void *arg)
 
     if (msg->Output.Socket.NewPcb)
     {
+        LibTCPResetAutoTune(msg->Input.Socket.Arg);
         tcp_arg(msg->Output.Socket.NewPcb, msg->Input.Socket.Arg);
         tcp_err(msg->Output.Socket.NewPcb, InternalErrorEventHandler);
     }
@@ -516,6 +576,8 @@ LibTCPSendCallback(void *arg)
         goto done;
     }
 
+    LibTCPUpdateSendBuffer(msg->Input.Send.Connection, pcb);
+
     SendFlags = TCP_WRITE_FLAG_COPY;
     SendLength = msg->Input.Send.DataLength;
     if (tcp_sndbuf(pcb) == 0)
@@ -668,6 +730,9 @@ LibTCPShutdownCallback(void *arg)
      * PCB without telling us if we shutdown TX and RX. To avoid these problems, we'll clear the
      * socket context if we have called shutdown for TX and RX.
      */
+    if (msg->Input.Shutdown.shut_rx)
+        LibTCPReleaseReceiveWindow(&msg->Input.Shutdown.Connection->AutoTune.Receive, pcb);
+
     if (msg->Input.Shutdown.shut_rx != msg->Input.Shutdown.shut_tx) {
         if (msg->Input.Shutdown.shut_rx) {
             msg->Output.Shutdown.Error = tcp_shutdown(pcb, TRUE, FALSE);
@@ -771,6 +836,8 @@ LibTCPCloseCallback(void *arg)
         goto done;
     }
 
+    LibTCPReleaseReceiveWindow(&msg->Input.Close.Connection->AutoTune.Receive, pcb);
+
     /* Clear the PCB pointer and stop callbacks */
     msg->Input.Close.Connection->SocketContext = NULL;
     tcp_arg(pcb, NULL);
@@ -829,8 +896,12 @@ LibTCPClose(PCONNECTION_ENDPOINT Connection, const int safe, const int callback)
 void
 LibTCPAccept(PTCP_PCB pcb, struct tcp_pcb *listen_pcb, void *arg)
 {
+    PCONNECTION_ENDPOINT Connection = arg;
+
     ASSERT(arg);
 
+    LibTCPResetAutoTune(Connection);
+    LibTCPStartReceiveWindow(&Connection->AutoTune.Receive, Connection->ReceiveBufferLimit, pcb);
     tcp_arg(pcb, NULL);
     tcp_recv(pcb, InternalRecvEventHandler);
     tcp_sent(pcb, InternalSendEventHandler);
@@ -0,0 +1,128 @@
+#include <lwip/tcp.h>
+#include <lwip/sys.h>
+#include <lwip/priv/tcp_priv.h>
+
+#include <tcpwnd.h>
+
+/*
+ * lwIP offers its whole TCP_WND once window scaling is negotiated, so the
+ * window is kept at the wanted size by not handing all received bytes back
+ * to lwIP: the right edge of the window never moves back, it just stops
+ * advancing. This only depends on lwIP, so that the lwIP unit tests can
+ * drive it too.
+ */
+
+static
+void
+LibTCPRecved(struct tcp_pcb *pcb, u32_t len)
+{
+    /* tcp_recved() only takes 16 bit lengths */
+    while (len > 0)
+    {
+        u16_t chunk = (u16_t)LWIP_MIN(len, 0xFFFF);
+
+        tcp_recved(pcb, chunk);
+        len -= chunk;
+    }
+}
+
+static
+u32_t
+LibTCPReceiveTarget(PTCP_RECEIVE_WINDOW Window, u32_t Limit, struct tcp_pcb *pcb)
+{
+    u32_t Target = Window->ReceiveWindow;
+
+    if (Limit)
+        Target = LWIP_MIN(Target, LWIP_MAX(Limit, 2 * (u32_t)pcb->mss));
+
+    return LWIP_MIN(Target, TCP_WND_MAX(pcb));
+}
+
+/* Called once the connection is established (by connect or accept), before
+ * any data was received */
+void
+LibTCPStartReceiveWindow(PTCP_RECEIVE_WINDOW Window, u32_t Limit, struct tcp_pcb *pcb)
+{
+    u32_t Now = sys_now();
+    u32_t Offered = 0;
+    u32_t Target;
+
+    Window->ReceiveWindow = LWIP_MIN(TCP_INITIAL_WND, TCP_WND_MAX(pcb));
+    Window->Withheld = 0;
+    Window->Received = 0;
+    Window->MeasureStart = Now;
+    Window->RttSeq = pcb->rcv_nxt + Window->ReceiveWindow;
+    Window->RttStart = Now;
+    Window->Rtt = 0;
+
+    /* The SYN-ACK of a passive open already offered up to 64k (SYN windows
+     * are never scaled), taking that back would shrink the window */
+    if (TCP_SEQ_GT(pcb->rcv_ann_right_edge, pcb->rcv_nxt))
+        Offered = LWIP_MIN(pcb->rcv_ann_right_edge - pcb->rcv_nxt, 0xFFFF);
+
+    Target = LWIP_MAX(LibTCPReceiveTarget(Window, Limit, pcb), Offered);
+
+    /* lwIP set rcv_wnd to TCP_WND when it saw the window scale option */
+    if (pcb->rcv_wnd > Target)
+    {
+        Window->Withheld = pcb->rcv_wnd - Target;
+        pcb->rcv_wnd = (tcpwnd_size_t)Target;
+        pcb->rcv_ann_wnd = (tcpwnd_size_t)Target;
+        pcb->rcv_ann_right_edge = pcb->rcv_nxt + Target;
+    }
+}
+
+/* Called for every received segment instead of tcp_recved() */
+void
+LibTCPUpdateReceiveWindow(PTCP_RECEIVE_WINDOW Window, u32_t Limit, struct tcp_pcb *pcb, u32_t len)
+{
+    u32_t Now = sys_now();
+    u32_t Max = TCP_WND_MAX(pcb);
+    u32_t Target, Sample;
+
+    LWIP_ASSERT("receive window not started", Window->ReceiveWindow != 0);
+
+    /* Receiving a whole window takes at least one round trip, which gives an
+     * upper bound of the RTT without any help from the sender */
+    if ((s32_t)(pcb->rcv_nxt - Window->RttSeq) >= 0)
+    {
+        Sample = LWIP_MAX(Now - Window->RttStart, 1);
+        if (!Window->Rtt || Sample < Window->Rtt)
+            Window->Rtt = Sample;
+        else
+            Window->Rtt = (7 * Window->Rtt + Sample) / 8;
+
+        Window->RttSeq = pcb->rcv_nxt + Window->ReceiveWindow;
+        Window->RttStart = Now;
+    }
+
+    /* If most of the window arrived within one RTT the window is what limits
+     * the transfer, so offer twice what the sender managed to send */
+    Window->Received += len;
+    if (Window->Rtt && Now - Window->MeasureStart >= Window->Rtt)
+    {
+        if (Window->Received >= Window->ReceiveWindow / 4 * 3)
+            Window->ReceiveWindow = LWIP_MIN(LWIP_MAX(2 * Window->Received, Window->ReceiveWindow), Max);
+
+        Window->Received = 0;
+        Window->MeasureStart = Now;
+    }
+
+    Target = LibTCPReceiveTarget(Window, Limit, pcb);
+
+    Window->Withheld += len;
+    if (Window->Withheld > Max - Target)
+    {
+        LibTCPRecved(pcb, Window->Withheld - (Max - Target));
+        Window->Withheld = Max - Target;
+    }
+}
+
+/* tcp_close() resets connections whose window is not fully open, as that
+ * means the application did not read everything */
+void
+LibTCPReleaseReceiveWindow(PTCP_RECEIVE_WINDOW Window, struct tcp_pcb *pcb)
+{
+    LibTCPRecved(pcb, Window->Withheld);
+    Window->Withheld = 0;
+}
@@ -460,8 +460,10 @@ NTSTATUS IPStartup(PUNICODE_STRING RegistryPath)
     InitializeListHead(&NetTableListHead);
     TcpipInitializeSpinLock(&NetTableListLock);
 
-    /* Initialize reassembly list and protecting lock */
+    /* Initialize reassembly list, hash table and protecting lock */
     InitializeListHead(&ReassemblyListHead);
+    for (i = 0; i < IPDR_HASH_SIZE; i++)
+        InitializeListHead(&ReassemblyHashTable[i]);
     TcpipInitializeSpinLock(&ReassemblyListLock);
 
     IPInitialized = TRUE;
@@ -13,7 +13,10 @@
 #include "precomp.h"
 
 LIST_ENTRY ReassemblyListHead;
+LIST_ENTRY ReassemblyHashTable[IPDR_HASH_SIZE];
 KSPIN_LOCK ReassemblyListLock;
+IPDATAGRAM_REASSEMBLY_STATS ReassemblyStats;
+static UINT ReassemblyBytes;
 NPAGED_LOOKASIDE_LIST IPDRList;
 NPAGED_LOOKASIDE_LIST IPFragmentList;
 NPAGED_LOOKASIDE_LIST IPHoleList;
@@ -120,21 +123,45 @@ VOID FreeIPDR(
 }
 
 
+static ULONG IPDRHash(
+  IPv4_RAW_ADDRESS SrcAddr,
+  IPv4_RAW_ADDRESS DstAddr,
+  USHORT Id,
+  UCHAR Protocol)
+/*
+ * FUNCTION: Returns the hash bucket of an IP datagram
+ * ARGUMENTS:
+ *     SrcAddr  = Source address
+ *     DstAddr  = Destination address
+ *     Id       = Identification number
+ *     Protocol = Internet Protocol number
+ */
+{
+  ULONG Hash;
+
+  Hash = SrcAddr ^ DstAddr ^ ((ULONG)Id << 8) ^ Protocol;
+  Hash ^= Hash >> 16;
+  Hash ^= Hash >> 8;
+
+  return Hash & (IPDR_HASH_SIZE - 1);
+}
+
+
 VOID RemoveIPDR(
   PIPDATAGRAM_REASSEMBLY IPDR)
 /*
  * FUNCTION: Removes an IP datagram reassembly structure from the global list
  * ARGUMENTS:
  *     IPDR = Pointer to IP datagram reassembly structure
+ * NOTES:
+ *     The reassembly list lock is held when this routine is called
  */
 {
-  KIRQL OldIrql;
-
   TI_DbgPrint(DEBUG_IP, ("Removing IPDR at (0x%X).\n", IPDR));
 
-  TcpipAcquireSpinLock(&ReassemblyListLock, &OldIrql);
   RemoveEntryList(&IPDR->ListEntry);
-  TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
+  RemoveEntryList(&IPDR->HashEntry);
+  ReassemblyBytes -= IPDR->Bytes;
 }
 
 
@@ -147,40 +174,77 @@ PIPDATAGRAM_REASSEMBLY GetReassemblyInfo(
  * NOTES:
  *     A datagram is identified by four paramters, which are
  *     Source and destination address, protocol number and
- *     identification number
+ *     identification number.
+ *     The reassembly list lock is held when this routine is called
  */
 {
-  KIRQL OldIrql;
+  PLIST_ENTRY BucketHead;
   PLIST_ENTRY CurrentEntry;
   PIPDATAGRAM_REASSEMBLY Current;
   PIPv4_HEADER Header = (PIPv4_HEADER)IPPacket->Header;
 
   TI_DbgPrint(DEBUG_IP, ("Searching for IPDR for IP packet at (0x%X).\n", IPPacket));
 
-  TcpipAcquireSpinLock(&ReassemblyListLock, &OldIrql);
-
   /* FIXME: Assume IPv4 */
 
-  CurrentEntry = ReassemblyListHead.Flink;
-  while (CurrentEntry != &ReassemblyListHead) {
-	  Current = CONTAINING_RECORD(CurrentEntry, IPDATAGRAM_REASSEMBLY, ListEntry);
+  BucketHead = &ReassemblyHashTable[IPDRHash(Header->SrcAddr, Header->DstAddr,
+                                             Header->Id, Header->Protocol)];
+
+  CurrentEntry = BucketHead->Flink;
+  while (CurrentEntry != BucketHead) {
+    Current = CONTAINING_RECORD(CurrentEntry, IPDATAGRAM_REASSEMBLY, HashEntry);
     if (AddrIsEqual(&IPPacket->SrcAddr, &Current->SrcAddr) &&
       (Header->Id == Current->Id) &&
       (Header->Protocol == Current->Protocol) &&
       (AddrIsEqual(&IPPacket->DstAddr, &Current->DstAddr))) {
-      TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
-
       return Current;
     }
     CurrentEntry = CurrentEntry->Flink;
   }
 
-  TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
-
   return NULL;
 }
 
 
+static VOID EvictIPDRs(
+  PIPDATAGRAM_REASSEMBLY IPDR)
+/*
+ * FUNCTION: Frees the oldest IP datagram reassembly structures until
+ *           the fragments fit in IPDR_MAX_BYTES again
+ * ARGUMENTS:
+ *     IPDR = Pointer to the IP datagram reassembly structure that just
+ *            grew, only freed if everything else was not enough
+ * NOTES:
+ *     The reassembly list lock is held when this routine is called
+ */
+{
+  PLIST_ENTRY CurrentEntry, NextEntry;
+  PIPDATAGRAM_REASSEMBLY Current;
+
+  CurrentEntry = ReassemblyListHead.Flink;
+  while (ReassemblyBytes > IPDR_MAX_BYTES && CurrentEntry != &ReassemblyListHead) {
+    NextEntry = CurrentEntry->Flink;
+    Current = CONTAINING_RECORD(CurrentEntry, IPDATAGRAM_REASSEMBLY, ListEntry);
+
+    if (Current != IPDR) {
+      TI_DbgPrint(MID_TRACE, ("Evicting IPDR at (0x%X).\n", Current));
+      RemoveIPDR(Current);
+      FreeIPDR(Current);
+      ReassemblyStats.Evictions++;
+    }
+
+    CurrentEntry = NextEntry;
+  }
+
+  if (ReassemblyBytes > IPDR_MAX_BYTES) {
+    TI_DbgPrint(MID_TRACE, ("Evicting IPDR at (0x%X).\n", IPDR));
+    RemoveIPDR(IPDR);
+    FreeIPDR(IPDR);
+    ReassemblyStats.Evictions++;
+  }
+}
+
+
 BOOLEAN
 ReassembleDatagram(
   PIP_PACKET             IPPacket,
@@ -248,23 +312,21 @@ ReassembleDatagram(
 
 
 static inline VOID Cleanup(
-  PKSPIN_LOCK Lock,
   KIRQL OldIrql,
   PIPDATAGRAM_REASSEMBLY IPDR)
 /*
  * FUNCTION: Performs cleaning operations on errors
  * ARGUMENTS:
- *     Lock     = Pointer to spin lock to be released
- *     OldIrql  = Value of IRQL when spin lock was acquired
+ *     OldIrql  = Value of IRQL when the reassembly list lock was acquired
  *     IPDR     = Pointer to IP datagram reassembly structure to free
- *     Buffer   = Optional pointer to a buffer to free
  */
 {
   TI_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
 
-  TcpipReleaseSpinLock(Lock, OldIrql);
   RemoveIPDR(IPDR);
   FreeIPDR(IPDR);
+  ReassemblyStats.Failures++;
+  TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
 }
 
 
@@ -297,12 +359,16 @@ VOID ProcessFragment(
 
   IPv4Header = (PIPv4_HEADER)IPPacket->Header;
 
+  /* The reassembly list lock protects every IPDR as well */
+  TcpipAcquireSpinLock(&ReassemblyListLock, &OldIrql);
+
+  ReassemblyStats.Requests++;
+
   /* Check if we already have an reassembly structure for this datagram */
   IPDR = GetReassemblyInfo(IPPacket);
   if (IPDR) {
     TI_DbgPrint(DEBUG_IP, ("Continueing assembly.\n"));
-    /* We have a reassembly structure */
-    TcpipAcquireSpinLock(&IPDR->Lock, &OldIrql);
+    ReassemblyStats.Hits++;
 
     /* Reset the timeout since we received a fragment */
     IPDR->TimeoutCount = 0;
@@ -311,9 +377,12 @@ VOID ProcessFragment(
 
     /* We don't have a reassembly structure, create one */
     IPDR = ExAllocateFromNPagedLookasideList(&IPDRList);
-    if (!IPDR)
+    if (!IPDR) {
       /* We don't have the resources to process this packet, discard it */
+      ReassemblyStats.Failures++;
+      TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
       return;
+    }
 
     /* Create a descriptor spanning from zero to infinity.
        Actually, we use a value slightly greater than the
@@ -322,6 +391,8 @@ VOID ProcessFragment(
     if (!Hole) {
       /* We don't have the resources to process this packet, discard it */
       ExFreeToNPagedLookasideList(&IPDRList, IPDR);
+      ReassemblyStats.Failures++;
+      TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
       return;
     }
     AddrInitIPv4(&IPDR->SrcAddr, IPv4Header->SrcAddr);
@@ -329,19 +400,21 @@ VOID ProcessFragment(
     IPDR->Id         = IPv4Header->Id;
     IPDR->Protocol   = IPv4Header->Protocol;
     IPDR->TimeoutCount = 0;
+    IPDR->IPv4Header = NULL;
+    IPDR->HeaderSize = 0;
+    IPDR->DataSize   = 0;
+    IPDR->Bytes      = 0;
     InitializeListHead(&IPDR->FragmentListHead);
     InitializeListHead(&IPDR->HoleListHead);
     InsertTailList(&IPDR->HoleListHead, &Hole->ListEntry);
 
-    TcpipInitializeSpinLock(&IPDR->Lock);
-
-    TcpipAcquireSpinLock(&IPDR->Lock, &OldIrql);
-
-    /* Update the reassembly list */
-    TcpipInterlockedInsertTailList(
-	&ReassemblyListHead,
-	&IPDR->ListEntry,
-	&ReassemblyListLock);
+    /* Update the reassembly list and the hash table */
+    InsertTailList(&ReassemblyListHead, &IPDR->ListEntry);
+    InsertTailList(&ReassemblyHashTable[IPDRHash(IPv4Header->SrcAddr,
+                                                 IPv4Header->DstAddr,
+                                                 IPv4Header->Id,
+                                                 IPv4Header->Protocol)],
+                   &IPDR->HashEntry);
   }
 
   FragFirst     = (WN2H(IPv4Header->FlagsFragOfs) & IPv4_FRAGOFS_MASK) << 3;
@@ -375,7 +448,7 @@ VOID ProcessFragment(
       if (!NewHole) {
         /* We don't have the resources to process this packet, discard it */
         ExFreeToNPagedLookasideList(&IPHoleList, Hole);
-        Cleanup(&IPDR->Lock, OldIrql, IPDR);
+        Cleanup(OldIrql, IPDR);
         return;
       }
 
@@ -388,7 +461,7 @@ VOID ProcessFragment(
       if (!NewHole) {
         /* We don't have the resources to process this packet, discard it */
         ExFreeToNPagedLookasideList(&IPHoleList, Hole);
-        Cleanup(&IPDR->Lock, OldIrql, IPDR);
+        Cleanup(OldIrql, IPDR);
         return;
       }
 
@@ -405,12 +478,14 @@ VOID ProcessFragment(
                                                  PACKET_BUFFER_TAG);
         if (!IPDR->IPv4Header)
         {
-            Cleanup(&IPDR->Lock, OldIrql, IPDR);
+            Cleanup(OldIrql, IPDR);
             return;
         }
 
         RtlCopyMemory(IPDR->IPv4Header, IPPacket->Header, IPPacket->HeaderSize);
         IPDR->HeaderSize = IPPacket->HeaderSize;
+        IPDR->Bytes += IPPacket->HeaderSize;
+        ReassemblyBytes += IPPacket->HeaderSize;
 
         TI_DbgPrint(DEBUG_IP, ("First fragment found. Header buffer is at (0x%X). "
                                "Header size is (%d).\n", &IPDR->IPv4Header, IPPacket->HeaderSize));
@@ -423,7 +498,7 @@ VOID ProcessFragment(
     Fragment = ExAllocateFromNPagedLookasideList(&IPFragmentList);
     if (!Fragment) {
       /* We don't have the resources to process this packet, discard it */
-      Cleanup(&IPDR->Lock, OldIrql, IPDR);
+      Cleanup(OldIrql, IPDR);
       return;
     }
 
@@ -438,6 +513,10 @@ VOID ProcessFragment(
     /* Disassociate the NDIS packet so it isn't freed upon return from IPReceive() */
     IPPacket->NdisPacket = NULL;
 
+    /* The whole packet stays around, not just the fragment data */
+    IPDR->Bytes += Fragment->PacketOffset + Fragment->Size;
+    ReassemblyBytes += Fragment->PacketOffset + Fragment->Size;
+
     /* If this is the last fragment, compute and save the datagram data size */
     if (!MoreFragments)
       IPDR->DataSize = FragFirst + Fragment->Size;
@@ -456,7 +535,8 @@ VOID ProcessFragment(
     TI_DbgPrint(DEBUG_IP, ("Complete datagram received.\n"));
 
     RemoveIPDR(IPDR);
-    TcpipReleaseSpinLock(&IPDR->Lock, OldIrql);
+    ReassemblyStats.Completed++;
+    TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
 
     /* FIXME: Assumes IPv4 */
     IPInitializePacket(&Datagram, IP_ADDRESS_V4);
@@ -477,8 +557,13 @@ VOID ProcessFragment(
     /* We're done with this datagram */
     TI_DbgPrint(MAX_TRACE, ("Freeing datagram at (0x%X).\n", Datagram));
     Datagram.Free(&Datagram);
-  } else
-    TcpipReleaseSpinLock(&IPDR->Lock, OldIrql);
+  } else {
+    /* Make room by dropping the oldest datagrams */
+    if (ReassemblyBytes > IPDR_MAX_BYTES)
+      EvictIPDRs(IPDR);
+
+    TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
+  }
 }
 
 
@@ -500,7 +585,7 @@ VOID IPFreeReassemblyList(
     Current = CONTAINING_RECORD(CurrentEntry, IPDATAGRAM_REASSEMBLY, ListEntry);
 
     /* Unlink it from the list */
-    RemoveEntryList(CurrentEntry);
+    RemoveIPDR(Current);
 
     /* And free the descriptor */
     FreeIPDR(Current);
@@ -532,18 +617,15 @@ VOID IPDatagramReassemblyTimeout(
        NextEntry = CurrentEntry->Flink;
        CurrentIPDR = CONTAINING_RECORD(CurrentEntry, IPDATAGRAM_REASSEMBLY, ListEntry);
 
-       TcpipAcquireSpinLockAtDpcLevel(&CurrentIPDR->Lock);
-
        if (++CurrentIPDR->TimeoutCount == MAX_TIMEOUT_COUNT)
        {
-           TcpipReleaseSpinLockFromDpcLevel(&CurrentIPDR->Lock);
-           RemoveEntryList(CurrentEntry);
+           RemoveIPDR(CurrentIPDR);
            FreeIPDR(CurrentIPDR);
+           ReassemblyStats.Timeouts++;
        }
        else
        {
            ASSERT(CurrentIPDR->TimeoutCount < MAX_TIMEOUT_COUNT);
-           TcpipReleaseSpinLockFromDpcLevel(&CurrentIPDR->Lock);
        }
 
        CurrentEntry = NextEntry;
@@ -745,6 +745,24 @@ TCPSetNoDelay(
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+TCPSetBufferLimits(
+    PCONNECTION_ENDPOINT Connection,
+    PULONG ReceiveLimit,
+    PULONG SendLimit)
+{
+    if (!Connection)
+        return STATUS_UNSUCCESSFUL;
+
+    /* The lwIP glue applies these the next time the connection sends or receives */
+    if (ReceiveLimit)
+        Connection->ReceiveBufferLimit = *ReceiveLimit;
+    if (SendLimit)
+        Connection->SendBufferLimit = *SendLimit;
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS
 TCPGetSocketStatus(
     PCONNECTION_ENDPOINT Connection,
@@ -36,3 +36,11 @@ set(LWIP_TESTFILES
 	${LWIP_TESTDIR}/udp/test_udp.c
 	${LWIP_TESTDIR}/ppp/test_pppos.c
 )
+
+# ReactOS: the TCP tests drive the receive window autotuning of the tcpip
+# glue, tcpwnd.h is in ${LWIP_TESTGLUE_INCLUDE_DIR}. The test target takes
+# its include path from LWIP_INCLUDE_DIRS, the glue directory goes last so
+# that the lwIP and test headers win over the tcpip ones.
+set(LWIP_TESTGLUE_INCLUDE_DIR ${LWIP_DIR}/../include)
+list(APPEND LWIP_TESTFILES ${LWIP_DIR}/../ip/lwip_glue/tcpwnd.c)
+list(APPEND LWIP_INCLUDE_DIRS ${LWIP_TESTGLUE_INCLUDE_DIR})
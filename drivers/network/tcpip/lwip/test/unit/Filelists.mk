@@ -52,3 +52,10 @@ TESTFILES=$(TESTDIR)/lwip_unittests.c \
 	$(TESTDIR)/udp/test_udp.c \
 	$(TESTDIR)/ppp/test_pppos.c
 
+# ReactOS: the TCP tests drive the receive window autotuning of the tcpip
+# glue, tcpwnd.h is in $(TESTGLUEINCLUDEDIR). It goes last so that the
+# lwIP and test headers win over the tcpip ones.
+TESTGLUEINCLUDEDIR=$(LWIPDIR)/../../include
+TESTFILES+=$(LWIPDIR)/../../ip/lwip_glue/tcpwnd.c
+CFLAGS+=-I$(TESTGLUEINCLUDEDIR)
+
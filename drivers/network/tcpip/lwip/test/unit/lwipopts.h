@@ -65,7 +65,9 @@
 #define TCP_SND_BUF                     (12 * TCP_MSS)
 #define TCP_WND                         (10 * TCP_MSS)
 #define LWIP_WND_SCALE                  1
-#define TCP_RCV_SCALE                   0
+#define TCP_RCV_SCALE                   2
+/* Initial receive window of the ReactOS glue (tcpwnd.h), below TCP_WND */
+#define TCP_INITIAL_WND                 (4 * TCP_MSS)
 #define PBUF_POOL_SIZE                  400 /* pbuf tests need ~200KByte */
 
 /* Enable IGMP and MDNS for MDNS tests */
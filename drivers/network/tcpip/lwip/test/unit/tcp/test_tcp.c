@@ -5,6 +5,7 @@
 #include "lwip/inet.h"
 #include "tcp_helper.h"
 #include "lwip/inet_chksum.h"
+#include "tcpwnd.h"
 
 #ifdef _MSC_VER
 #pragma warning(disable: 4307) /* we explicitly wrap around TCP seqnos */
@@ -1669,6 +1670,454 @@ START_TEST(test_tcp_persist_split)
 }
 END_TEST
 
+/** Create a SYN (or SYN-ACK) carrying MSS and window scale options, using
+ * the helper's payload for the option bytes */
+static struct pbuf*
+test_tcp_create_syn_wnd_scale(ip_addr_t* src_ip, ip_addr_t* dst_ip,
+                              u16_t src_port, u16_t dst_port,
+                              u32_t seqno, u32_t ackno, u8_t headerflags, u8_t shift)
+{
+  u8_t opts[] = {LWIP_TCP_OPT_MSS, 4, TCP_MSS >> 8, TCP_MSS & 0xFF,
+                 LWIP_TCP_OPT_NOP, LWIP_TCP_OPT_WS, 3, 0};
+  struct pbuf *p;
+  struct tcp_hdr *tcphdr;
+
+  opts[7] = shift;
+  p = tcp_create_segment(src_ip, dst_ip, src_port, dst_port, opts, sizeof(opts),
+                         seqno, ackno, headerflags);
+  EXPECT_RETNULL(p != NULL);
+  EXPECT_RETNULL(p->next == NULL);
+
+  /* turn the payload into options and fix up the checksum */
+  pbuf_remove_header(p, sizeof(struct ip_hdr));
+  tcphdr = (struct tcp_hdr *)p->payload;
+  TCPH_HDRLEN_SET(tcphdr, (sizeof(struct tcp_hdr) + sizeof(opts)) / 4);
+  tcphdr->chksum = 0;
+  tcphdr->chksum = ip_chksum_pseudo(p, IP_PROTO_TCP, p->tot_len, src_ip, dst_ip);
+  pbuf_add_header(p, sizeof(struct ip_hdr));
+  return p;
+}
+
+/** Find the window scale option in a transmitted segment, returns -1 if none */
+static int
+test_tcp_find_wnd_scale(struct pbuf *p)
+{
+  u8_t hdr[60];
+  u16_t hdrlen, i;
+
+  if (pbuf_copy_partial(p, hdr, sizeof(struct tcp_hdr), IP_HLEN) != sizeof(struct tcp_hdr)) {
+    return -1;
+  }
+  hdrlen = TCPH_HDRLEN_BYTES((struct tcp_hdr *)hdr);
+  if (pbuf_copy_partial(p, hdr, hdrlen, IP_HLEN) != hdrlen) {
+    return -1;
+  }
+  for (i = sizeof(struct tcp_hdr); i < hdrlen; ) {
+    if (hdr[i] == LWIP_TCP_OPT_EOL) {
+      break;
+    } else if (hdr[i] == LWIP_TCP_OPT_NOP) {
+      i++;
+    } else if (i + 1 >= hdrlen || hdr[i + 1] < 2) {
+      break;
+    } else if (hdr[i] == LWIP_TCP_OPT_WS && hdr[i + 1] == 3) {
+      return hdr[i + 2];
+    } else {
+      i += hdr[i + 1];
+    }
+  }
+  return -1;
+}
+
+/** Accept a connection from a peer that offers window scaling and check
+ * that the scale factors are taken over and the SYN-ACK window is unscaled */
+START_TEST(test_tcp_wnd_scale_passive_open)
+{
+  struct tcp_pcb *pcb, *pcbl;
+  struct tcp_pcb_listen *lpcb;
+  struct netif netif;
+  struct test_tcp_txcounters txcounters;
+  struct tcp_hdr synack;
+  struct pbuf *p;
+  ip_addr_t src_addr;
+  err_t err;
+  LWIP_UNUSED_ARG(_i);
+
+  fail_unless(MEMP_STATS_GET(used, MEMP_TCP_PCB) == 0);
+
+  test_tcp_init_netif(&netif, &txcounters, &test_local_ip, &test_netmask);
+
+  pcb = tcp_new();
+  EXPECT_RET(pcb != NULL);
+  err = tcp_bind(pcb, &netif.ip_addr, 1234);
+  EXPECT(err == ERR_OK);
+  pcbl = tcp_listen(pcb);
+  EXPECT_RET(pcbl != NULL);
+  lpcb = (struct tcp_pcb_listen *)pcbl;
+
+  ip_addr_set_ip4_u32_val(src_addr, lwip_htonl(lwip_ntohl(ip_addr_get_ip4_u32(&lpcb->local_ip)) + 1));
+
+  p = test_tcp_create_syn_wnd_scale(&src_addr, &lpcb->local_ip, 12345, lpcb->local_port,
+                                    12345, 0, TCP_SYN, 7);
+  EXPECT_RET(p != NULL);
+  txcounters.copy_tx_packets = 1;
+  test_tcp_input(p, &netif);
+  txcounters.copy_tx_packets = 0;
+  EXPECT(txcounters.num_tx_calls == 1);
+
+  /* the new pcb uses the full window and both scale factors */
+  pcb = tcp_active_pcbs;
+  EXPECT_RET(pcb != NULL);
+  EXPECT(pcb->state == SYN_RCVD);
+  EXPECT(pcb->flags & TF_WND_SCALE);
+  EXPECT(pcb->snd_scale == 7);
+  EXPECT(pcb->rcv_scale == TCP_RCV_SCALE);
+  EXPECT(pcb->rcv_wnd == TCP_WND);
+
+  /* the window in a SYN is never scaled */
+  EXPECT_RET(txcounters.tx_packets != NULL);
+  EXPECT(pbuf_copy_partial(txcounters.tx_packets, &synack, sizeof(synack), IP_HLEN) == sizeof(synack));
+  EXPECT(lwip_ntohs(synack.wnd) == TCPWND16(TCP_WND));
+  EXPECT(test_tcp_find_wnd_scale(txcounters.tx_packets) == TCP_RCV_SCALE);
+  pbuf_free(txcounters.tx_packets);
+  txcounters.tx_packets = NULL;
+
+  tcp_abort(pcb);
+  tcp_close(pcbl);
+  EXPECT(MEMP_STATS_GET(used, MEMP_TCP_PCB) == 0);
+}
+END_TEST
+
+/** A peer that does not offer window scaling must not get it */
+START_TEST(test_tcp_wnd_scale_passive_open_no_option)
+{
+  struct tcp_pcb *pcb, *pcbl;
+  struct tcp_pcb_listen *lpcb;
+  struct netif netif;
+  struct test_tcp_txcounters txcounters;
+  struct tcp_hdr synack;
+  struct pbuf *p;
+  ip_addr_t src_addr;
+  err_t err;
+  LWIP_UNUSED_ARG(_i);
+
+  fail_unless(MEMP_STATS_GET(used, MEMP_TCP_PCB) == 0);
+
+  test_tcp_init_netif(&netif, &txcounters, &test_local_ip, &test_netmask);
+
+  pcb = tcp_new();
+  EXPECT_RET(pcb != NULL);
+  err = tcp_bind(pcb, &netif.ip_addr, 1234);
+  EXPECT(err == ERR_OK);
+  pcbl = tcp_listen(pcb);
+  EXPECT_RET(pcbl != NULL);
+  lpcb = (struct tcp_pcb_listen *)pcbl;
+
+  ip_addr_set_ip4_u32_val(src_addr, lwip_htonl(lwip_ntohl(ip_addr_get_ip4_u32(&lpcb->local_ip)) + 1));
+
+  p = tcp_create_segment(&src_addr, &lpcb->local_ip, 12345,
+    lpcb->local_port, NULL, 0, 12345, 0, TCP_SYN);
+  EXPECT_RET(p != NULL);
+  txcounters.copy_tx_packets = 1;
+  test_tcp_input(p, &netif);
+  txcounters.copy_tx_packets = 0;
+  EXPECT(txcounters.num_tx_calls == 1);
+
+  pcb = tcp_active_pcbs;
+  EXPECT_RET(pcb != NULL);
+  EXPECT(!(pcb->flags & TF_WND_SCALE));
+  EXPECT(pcb->snd_scale == 0);
+  EXPECT(pcb->rcv_scale == 0);
+  EXPECT(pcb->rcv_wnd == TCPWND_MIN16(TCP_WND));
+
+  EXPECT_RET(txcounters.tx_packets != NULL);
+  EXPECT(pbuf_copy_partial(txcounters.tx_packets, &synack, sizeof(synack), IP_HLEN) == sizeof(synack));
+  EXPECT(lwip_ntohs(synack.wnd) == TCPWND_MIN16(TCP_WND));
+  EXPECT(test_tcp_find_wnd_scale(txcounters.tx_packets) == -1);
+  pbuf_free(txcounters.tx_packets);
+  txcounters.tx_packets = NULL;
+
+  tcp_abort(pcb);
+  tcp_close(pcbl);
+  EXPECT(MEMP_STATS_GET(used, MEMP_TCP_PCB) == 0);
+}
+END_TEST
+
+/** On a connection with window scaling, the peer's window is shifted up on
+ * receive and our own window is shifted down on transmit */
+START_TEST(test_tcp_wnd_scale_established)
+{
+  struct test_tcp_counters counters;
+  struct test_tcp_txcounters txcounters;
+  struct tcp_pcb *pcb;
+  struct tcp_hdr ack;
+  struct pbuf *p;
+  struct netif netif;
+  char data[] = {1, 2, 3, 4, 5};
+  const tcpwnd_size_t wnd = 0x30000;
+  LWIP_UNUSED_ARG(_i);
+
+  test_tcp_init_netif(&netif, &txcounters, &test_local_ip, &test_netmask);
+  memset(&counters, 0, sizeof(counters));
+  counters.expected_data_len = sizeof(data);
+  counters.expected_data = data;
+
+  pcb = test_tcp_new_counters_pcb(&counters);
+  EXPECT_RET(pcb != NULL);
+  tcp_set_state(pcb, ESTABLISHED, &test_local_ip, &test_remote_ip, TEST_LOCAL_PORT, TEST_REMOTE_PORT);
+  /* pretend the handshake negotiated scaling with a window beyond 16 bits */
+  tcp_set_flags(pcb, TF_WND_SCALE);
+  pcb->snd_scale = 3;
+  pcb->rcv_scale = TCP_RCV_SCALE;
+  pcb->rcv_wnd = pcb->rcv_ann_wnd = wnd;
+
+  p = tcp_create_rx_segment_wnd(pcb, data, sizeof(data), 0, 0, TCP_ACK, 1000);
+  EXPECT_RET(p != NULL);
+  test_tcp_input(p, &netif);
+  EXPECT(counters.recv_calls == 1);
+  EXPECT(counters.recved_bytes == sizeof(data));
+  EXPECT(pcb->snd_wnd == (1000U << 3));
+  EXPECT(pcb->rcv_wnd == wnd - sizeof(data));
+
+  /* the acknowledgement announces the scaled remaining window */
+  memset(&txcounters, 0, sizeof(txcounters));
+  txcounters.copy_tx_packets = 1;
+  tcp_ack_now(pcb);
+  tcp_output(pcb);
+  txcounters.copy_tx_packets = 0;
+  EXPECT(txcounters.num_tx_calls == 1);
+  EXPECT_RET(txcounters.tx_packets != NULL);
+  EXPECT(pbuf_copy_partial(txcounters.tx_packets, &ack, sizeof(ack), IP_HLEN) == sizeof(ack));
+  EXPECT(lwip_ntohs(ack.wnd) == TCPWND_MIN16(pcb->rcv_ann_wnd >> TCP_RCV_SCALE));
+  EXPECT(lwip_ntohs(ack.wnd) == TCPWND_MIN16((wnd - sizeof(data)) >> TCP_RCV_SCALE));
+  pbuf_free(txcounters.tx_packets);
+  txcounters.tx_packets = NULL;
+
+  EXPECT(MEMP_STATS_GET(used, MEMP_TCP_PCB) == 1);
+  tcp_abort(pcb);
+  EXPECT(MEMP_STATS_GET(used, MEMP_TCP_PCB) == 0);
+}
+END_TEST
+
+/* Receive window autotuning of the ReactOS glue (ip/lwip_glue/tcpwnd.c),
+ * driven like the glue's connect, accept and recv callbacks do */
+static TCP_RECEIVE_WINDOW test_rcv_window;
+static u32_t test_rcv_limit;
+static u32_t test_rcv_bytes;
+
+static err_t
+test_tcp_autotune_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+  LWIP_UNUSED_ARG(arg);
+  LWIP_UNUSED_ARG(err);
+
+  if (p != NULL) {
+    test_rcv_bytes += p->tot_len;
+    LibTCPUpdateReceiveWindow(&test_rcv_window, test_rcv_limit, pcb, p->tot_len);
+    pbuf_free(p);
+  }
+  return ERR_OK;
+}
+
+static err_t
+test_tcp_autotune_connected(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+  LWIP_UNUSED_ARG(arg);
+  EXPECT(err == ERR_OK);
+
+  LibTCPStartReceiveWindow(&test_rcv_window, test_rcv_limit, pcb);
+  return ERR_OK;
+}
+
+static err_t
+test_tcp_autotune_accept(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+  LWIP_UNUSED_ARG(arg);
+  EXPECT_RETX(err == ERR_OK, ERR_VAL);
+
+  tcp_recv(newpcb, test_tcp_autotune_recv);
+  LibTCPStartReceiveWindow(&test_rcv_window, test_rcv_limit, newpcb);
+  return ERR_OK;
+}
+
+/** Connect to a peer that answers with window scaling and return the pcb,
+ * the ACK completing the handshake is left in txcounters->tx_packets */
+static struct tcp_pcb *
+test_tcp_autotune_connect(struct netif *netif, struct test_tcp_txcounters *txcounters)
+{
+  struct tcp_pcb *pcb;
+  struct pbuf *p;
+  err_t err;
+
+  memset(&test_rcv_window, 0, sizeof(test_rcv_window));
+  test_rcv_bytes = 0;
+
+  pcb = tcp_new();
+  EXPECT_RETNULL(pcb != NULL);
+  tcp_recv(pcb, test_tcp_autotune_recv);
+  err = tcp_connect(pcb, &netif->gw, TEST_REMOTE_PORT, test_tcp_autotune_connected);
+  EXPECT_RETNULL(err == ERR_OK);
+  EXPECT_RETNULL(pcb->state == SYN_SENT);
+
+  p = test_tcp_create_syn_wnd_scale(&pcb->remote_ip, &pcb->local_ip, pcb->remote_port, pcb->local_port,
+                                    12345, pcb->lastack + 1, TCP_SYN | TCP_ACK, 7);
+  EXPECT_RETNULL(p != NULL);
+  txcounters->num_tx_calls = 0;
+  txcounters->copy_tx_packets = 1;
+  test_tcp_input(p, netif);
+  txcounters->copy_tx_packets = 0;
+  EXPECT_RETNULL(pcb->state == ESTABLISHED);
+  EXPECT_RETNULL(pcb->flags & TF_WND_SCALE);
+  EXPECT(txcounters->num_tx_calls == 1);
+  return pcb;
+}
+
+/** An active open starts at the initial window instead of the TCP_WND lwIP
+ * opens when scaling is negotiated, and keeps it while data is read */
+START_TEST(test_tcp_autotune_active_open)
+{
+  struct netif netif;
+  struct test_tcp_txcounters txcounters;
+  struct tcp_pcb *pcb;
+  struct tcp_hdr ack;
+  struct pbuf *p;
+  LWIP_UNUSED_ARG(_i);
+
+  test_tcp_init_netif(&netif, &txcounters, &test_local_ip, &test_netmask);
+  test_rcv_limit = 0;
+
+  pcb = test_tcp_autotune_connect(&netif, &txcounters);
+  EXPECT_RET(pcb != NULL);
+  EXPECT(pcb->rcv_wnd == TCP_INITIAL_WND);
+  EXPECT(pcb->rcv_ann_wnd == TCP_INITIAL_WND);
+  EXPECT(test_rcv_window.Withheld == TCP_WND_MAX(pcb) - TCP_INITIAL_WND);
+
+  /* the ACK of the SYN-ACK announces the initial window, not TCP_WND */
+  EXPECT_RET(txcounters.tx_packets != NULL);
+  EXPECT(pbuf_copy_partial(txcounters.tx_packets, &ack, sizeof(ack), IP_HLEN) == sizeof(ack));
+  EXPECT(lwip_ntohs(ack.wnd) == (TCP_INITIAL_WND >> TCP_RCV_SCALE));
+  pbuf_free(txcounters.tx_packets);
+  txcounters.tx_packets = NULL;
+
+  /* received data is handed back to lwIP right away */
+  p = tcp_create_rx_segment(pcb, tx_data, TCP_MSS, 0, 0, TCP_ACK);
+  EXPECT_RET(p != NULL);
+  test_tcp_input(p, &netif);
+  EXPECT(test_rcv_bytes == TCP_MSS);
+  EXPECT(pcb->rcv_wnd == TCP_INITIAL_WND);
+
+  /* tcp_close() needs the whole window open */
+  LibTCPReleaseReceiveWindow(&test_rcv_window, pcb);
+  EXPECT(pcb->rcv_wnd == TCP_WND_MAX(pcb));
+  EXPECT(test_rcv_window.Withheld == 0);
+
+  tcp_abort(pcb);
+  EXPECT(MEMP_STATS_GET(used, MEMP_TCP_PCB) == 0);
+}
+END_TEST
+
+/** SO_RCVBUF limits the window a connection starts with */
+START_TEST(test_tcp_autotune_active_open_rcvbuf)
+{
+  struct netif netif;
+  struct test_tcp_txcounters txcounters;
+  struct tcp_pcb *pcb;
+  struct tcp_hdr ack;
+  LWIP_UNUSED_ARG(_i);
+
+  test_tcp_init_netif(&netif, &txcounters, &test_local_ip, &test_netmask);
+  /* raised to two segments */
+  test_rcv_limit = TCP_MSS;
+
+  pcb = test_tcp_autotune_connect(&netif, &txcounters);
+  EXPECT_RET(pcb != NULL);
+  EXPECT(pcb->rcv_wnd == 2 * TCP_MSS);
+  EXPECT(test_rcv_window.Withheld == TCP_WND_MAX(pcb) - 2 * TCP_MSS);
+
+  EXPECT_RET(txcounters.tx_packets != NULL);
+  EXPECT(pbuf_copy_partial(txcounters.tx_packets, &ack, sizeof(ack), IP_HLEN) == sizeof(ack));
+  EXPECT(lwip_ntohs(ack.wnd) == ((2 * TCP_MSS) >> TCP_RCV_SCALE));
+  pbuf_free(txcounters.tx_packets);
+  txcounters.tx_packets = NULL;
+
+  LibTCPReleaseReceiveWindow(&test_rcv_window, pcb);
+  EXPECT(pcb->rcv_wnd == TCP_WND_MAX(pcb));
+
+  tcp_abort(pcb);
+  EXPECT(MEMP_STATS_GET(used, MEMP_TCP_PCB) == 0);
+}
+END_TEST
+
+/** The SYN-ACK of a passive open offers a window before the glue gets to
+ * see the connection. A smaller SO_RCVBUF must not take that back, the
+ * window closes down to it as data arrives instead. */
+START_TEST(test_tcp_autotune_passive_open_rcvbuf)
+{
+  struct tcp_pcb *pcb, *pcbl;
+  struct tcp_pcb_listen *lpcb;
+  struct netif netif;
+  struct test_tcp_txcounters txcounters;
+  struct pbuf *p;
+  ip_addr_t src_addr;
+  u32_t right_edge;
+  int i;
+  err_t err;
+  LWIP_UNUSED_ARG(_i);
+
+  test_tcp_init_netif(&netif, &txcounters, &test_local_ip, &test_netmask);
+  memset(&test_rcv_window, 0, sizeof(test_rcv_window));
+  test_rcv_limit = TCP_MSS;
+  test_rcv_bytes = 0;
+
+  pcb = tcp_new();
+  EXPECT_RET(pcb != NULL);
+  err = tcp_bind(pcb, &netif.ip_addr, 1234);
+  EXPECT(err == ERR_OK);
+  pcbl = tcp_listen(pcb);
+  EXPECT_RET(pcbl != NULL);
+  tcp_accept(pcbl, test_tcp_autotune_accept);
+  lpcb = (struct tcp_pcb_listen *)pcbl;
+
+  ip_addr_set_ip4_u32_val(src_addr, lwip_htonl(lwip_ntohl(ip_addr_get_ip4_u32(&lpcb->local_ip)) + 1));
+
+  p = test_tcp_create_syn_wnd_scale(&src_addr, &lpcb->local_ip, 12345, lpcb->local_port,
+                                    12345, 0, TCP_SYN, 7);
+  EXPECT_RET(p != NULL);
+  test_tcp_input(p, &netif);
+  pcb = tcp_active_pcbs;
+  EXPECT_RET(pcb != NULL);
+  EXPECT_RET(pcb->state == SYN_RCVD);
+  right_edge = pcb->rcv_ann_right_edge;
+  EXPECT(right_edge - pcb->rcv_nxt == TCPWND16(TCP_WND));
+
+  /* the ACK completing the handshake makes lwIP call the accept callback */
+  p = tcp_create_segment(&src_addr, &lpcb->local_ip, 12345, lpcb->local_port,
+                         NULL, 0, 12346, pcb->lastack + 1, TCP_ACK);
+  EXPECT_RET(p != NULL);
+  test_tcp_input(p, &netif);
+  EXPECT_RET(pcb->state == ESTABLISHED);
+  EXPECT(pcb->rcv_ann_right_edge == right_edge);
+
+  /* the window closes down to SO_RCVBUF without its edge moving back */
+  for (i = 0; i < 10; i++) {
+    p = tcp_create_rx_segment(pcb, tx_data, TCP_MSS, 0, 0, TCP_ACK);
+    EXPECT_RET(p != NULL);
+    test_tcp_input(p, &netif);
+    EXPECT(pcb->rcv_wnd >= 2 * TCP_MSS);
+    EXPECT(TCP_SEQ_GEQ(pcb->rcv_nxt + pcb->rcv_wnd, right_edge));
+    right_edge = pcb->rcv_nxt + pcb->rcv_wnd;
+  }
+  EXPECT(test_rcv_bytes == 10 * TCP_MSS);
+  EXPECT(pcb->rcv_wnd == 2 * TCP_MSS);
+
+  LibTCPReleaseReceiveWindow(&test_rcv_window, pcb);
+  EXPECT(pcb->rcv_wnd == TCP_WND_MAX(pcb));
+
+  tcp_abort(pcb);
+  tcp_close(pcbl);
+  EXPECT(MEMP_STATS_GET(used, MEMP_TCP_PCB) == 0);
+}
+END_TEST
+
 /** Create the suite including all tests for this module */
 Suite *
 tcp_suite(void)
@@ -1694,7 +2143,13 @@ tcp_suite(void)
     TESTFUNC(test_tcp_rto_timeout_syn_sent_link_down),
     TESTFUNC(test_tcp_zwp_timeout),
     TESTFUNC(test_tcp_zwp_timeout_link_down),
-    TESTFUNC(test_tcp_persist_split)
+    TESTFUNC(test_tcp_persist_split),
+    TESTFUNC(test_tcp_wnd_scale_passive_open),
+    TESTFUNC(test_tcp_wnd_scale_passive_open_no_option),
+    TESTFUNC(test_tcp_wnd_scale_established),
+    TESTFUNC(test_tcp_autotune_active_open),
+    TESTFUNC(test_tcp_autotune_active_open_rcvbuf),
+    TESTFUNC(test_tcp_autotune_passive_open_rcvbuf)
   };
   return create_suite("TCP", tests, sizeof(tests)/sizeof(testfunc), tcp_setup, tcp_teardown);
 }
@@ -10,6 +10,8 @@
 
 #include "precomp.h"
 
+#include <receive.h>
+
 #define IP_ROUTE_TYPE_ADD 3
 #define IP_ROUTE_TYPE_DEL 2
 
@@ -165,6 +167,12 @@ TDI_STATUS InfoTdiQueryGetIPSnmpInfo( TDIEntityID ID,
 
     RtlZeroMemory(&SnmpInfo, sizeof(SnmpInfo));
 
+    SnmpInfo.ipsi_reasmtimeout = MAX_TIMEOUT_COUNT;
+    SnmpInfo.ipsi_reasmreqds = ReassemblyStats.Requests;
+    SnmpInfo.ipsi_reasmoks = ReassemblyStats.Completed;
+    SnmpInfo.ipsi_reasmfails = ReassemblyStats.Failures +
+                               ReassemblyStats.Timeouts +
+                               ReassemblyStats.Evictions;
     SnmpInfo.ipsi_numif = IfCount;
     SnmpInfo.ipsi_numaddr = 1;
     SnmpInfo.ipsi_numroutes = RouteCount;
@@ -172,7 +172,9 @@ AhciAllocateResourceForAdapter (
     AdapterExtension->PortCount = portCount;
     nonCachedExtensionSize =    sizeof(AHCI_COMMAND_HEADER) * AlignedNCS + //should be 1K aligned
                                 sizeof(AHCI_RECEIVED_FIS) +
-                                sizeof(IDENTIFY_DEVICE_DATA);
+                                sizeof(IDENTIFY_DEVICE_DATA) +
+                                sizeof(AHCI_COMMAND_TABLE) + // 128 byte aligned by what precedes it
+                                DEVICE_ATA_BLOCK_SIZE;
 
     // align nonCachedExtensionSize to 1024
     nonCachedExtensionSize = ROUND_UP(nonCachedExtensionSize, 1024);
@@ -206,6 +208,11 @@ AhciAllocateResourceForAdapter (
 
             PortExtension->ReceivedFIS = (PAHCI_RECEIVED_FIS)tmp;
             PortExtension->IdentifyDeviceData = (PIDENTIFY_DEVICE_DATA)(tmp + sizeof(AHCI_RECEIVED_FIS));
+
+            tmp = (PCHAR)(PortExtension->IdentifyDeviceData + 1);
+
+            PortExtension->RecoveryCommandTable = (PAHCI_COMMAND_TABLE)tmp;
+            PortExtension->NcqErrorLog = (PUCHAR)(tmp + sizeof(AHCI_COMMAND_TABLE));
             PortExtension->MaxPortQueueDepth = NCS;
             nonCachedExtension += nonCachedExtensionSize;
         }
@@ -440,30 +447,37 @@ AhciCommandCompletionDpcRoutine (
     AdapterExtension = (PAHCI_ADAPTER_EXTENSION)HwDeviceExtension;
     PortExtension = (PAHCI_PORT_EXTENSION)SystemArgument1;
 
-    StorPortAcquireSpinLock(AdapterExtension, InterruptLock, NULL, &lockhandle);
-    Srb = RemoveQueue(&PortExtension->CompletionQueue);
-    StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
+    // the DPC is queued once no matter how many Srbs completed meanwhile
+    for (;;)
+    {
+        StorPortAcquireSpinLock(AdapterExtension, InterruptLock, NULL, &lockhandle);
+        Srb = RemoveQueue(&PortExtension->CompletionQueue);
+        StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
 
-    NT_ASSERT(Srb != NULL);
+        if (Srb == NULL)
+        {
+            break;
+        }
 
-    if (Srb->SrbStatus == SRB_STATUS_PENDING)
-    {
-        Srb->SrbStatus = SRB_STATUS_SUCCESS;
-    }
-    else
-    {
-        return;
-    }
+        if (Srb->SrbStatus == SRB_STATUS_PENDING)
+        {
+            Srb->SrbStatus = SRB_STATUS_SUCCESS;
+        }
+        else
+        {
+            continue;
+        }
 
-    SrbExtension = GetSrbExtension(Srb);
+        SrbExtension = GetSrbExtension(Srb);
 
-    CompletionRoutine = SrbExtension->CompletionRoutine;
-    NT_ASSERT(CompletionRoutine != NULL);
+        CompletionRoutine = SrbExtension->CompletionRoutine;
+        NT_ASSERT(CompletionRoutine != NULL);
 
-    // now it's completion routine responsibility to set SrbStatus
-    CompletionRoutine(PortExtension, Srb);
+        // now it's completion routine responsibility to set SrbStatus
+        CompletionRoutine(PortExtension, Srb);
 
-    StorPortNotification(RequestComplete, AdapterExtension, Srb);
+        StorPortNotification(RequestComplete, AdapterExtension, Srb);
+    }
 
     return;
 }// -- AhciCommandCompletionDpcRoutine();
@@ -499,6 +513,7 @@ AhciHwPassiveInitialize (
             PortExtension = &AdapterExtension->PortExtension[index];
             PortExtension->DeviceParams.IsActive = AhciStartPort(PortExtension);
             StorPortInitializeDpc(AdapterExtension, &PortExtension->CommandCompletion, AhciCommandCompletionDpcRoutine);
+            StorPortInitializeDpc(AdapterExtension, &PortExtension->PortRecovery, AhciPortRecoveryDpcRoutine);
         }
     }
 
@@ -579,9 +594,10 @@ AhciCompleteIssuedSrb (
 
     for (i = 0; i < NCS; i++)
     {
-        if (((1 << i) & CommandsToComplete) != 0)
+        if (((1UL << i) & CommandsToComplete) != 0)
         {
             Srb = PortExtension->Slot[i];
+            PortExtension->Slot[i] = NULL;
 
             if (Srb == NULL)
             {
@@ -608,6 +624,405 @@ AhciCompleteIssuedSrb (
     return;
 }// -- AhciCompleteIssuedSrb();
 
+/**
+ * @name AhciFailIssuedSrb
+ * @implemented
+ *
+ * Complete issued Srbs which the port could not execute
+ *
+ * @param PortExtension
+ * @param CommandsToFail
+ * @param SrbStatus
+ *
+ */
+VOID
+AhciFailIssuedSrb (
+    __in PAHCI_PORT_EXTENSION PortExtension,
+    __in ULONG CommandsToFail,
+    __in UCHAR SrbStatus
+    )
+{
+    ULONG NCS, i;
+    PSCSI_REQUEST_BLOCK Srb;
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+
+    AhciDebugPrint("AhciFailIssuedSrb()\n");
+
+    AdapterExtension = PortExtension->AdapterExtension;
+    NCS = AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP);
+
+    for (i = 0; i < NCS; i++)
+    {
+        if (((1UL << i) & CommandsToFail) != 0)
+        {
+            Srb = PortExtension->Slot[i];
+            PortExtension->Slot[i] = NULL;
+
+            if (Srb == NULL)
+            {
+                continue;
+            }
+
+            // completion routines only deal with successful commands
+            Srb->SrbStatus = SrbStatus;
+            StorPortNotification(RequestComplete, AdapterExtension, Srb);
+        }
+    }
+
+    return;
+}// -- AhciFailIssuedSrb();
+
+/**
+ * @name AhciPortReset
+ * @implemented
+ *
+ * 10.4.2 Port Reset
+ * COMRESET the device of a port whose command list is stopped
+ *
+ * @param PortExtension
+ *
+ * @return
+ * return TRUE if the device came back ready for commands
+ */
+BOOLEAN
+AhciPortReset (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    ULONG ticks;
+    AHCI_TASK_FILE_DATA tfd;
+    AHCI_SERIAL_ATA_STATUS ssts;
+    AHCI_SERIAL_ATA_CONTROL sctl;
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+
+    AhciDebugPrint("AhciPortReset()\n");
+
+    AdapterExtension = PortExtension->AdapterExtension;
+
+    // PxSCTL.DET stays 1h for at least 1 millisecond, so that at least one COMRESET is sent
+    sctl.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->SCTL);
+    sctl.DET = 1;
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SCTL, sctl.Status);
+
+    StorPortStallExecution(1000);
+
+    sctl.DET = 0;
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SCTL, sctl.Status);
+
+    // the link comes back with PxSSTS.DET = 3h, the device clears BSY once
+    // it sent its signature
+    for (ticks = 0; ticks < 100; ticks++)
+    {
+        ssts.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->SSTS);
+        tfd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->TFD);
+        if ((ssts.DET == 0x3) && (tfd.STS.BSY == 0) && (tfd.STS.DRQ == 0))
+        {
+            break;
+        }
+        StorPortStallExecution(10000);
+    }
+
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SERR, (ULONG)~0);
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->IS, (ULONG)~0);
+
+    if (ticks == 100)
+    {
+        AhciDebugPrint("\tDevice not ready after COMRESET: %x %x\n", ssts.Status, tfd.Status);
+        return FALSE;
+    }
+
+    return TRUE;
+}// -- AhciPortReset();
+
+/**
+ * @name AhciPortRecover
+ * @implemented
+ *
+ * 6.2.2.1 Non-Queued Error Recovery / 6.2.2.2 Native Command Queuing Error Recovery
+ * Restart the command list processing of a port that stopped on an error.
+ * Called from the recovery DPC, the port interrupts are masked.
+ *
+ * @param PortExtension
+ * @param ForceReset
+ * COMRESET the device even if it is not busy
+ * @param Reset
+ * Set to TRUE if the device was reset, it lost its NCQ error log then
+ *
+ * @return
+ * return TRUE if the port runs again
+ */
+BOOLEAN
+AhciPortRecover (
+    __in PAHCI_PORT_EXTENSION PortExtension,
+    __in BOOLEAN ForceReset,
+    __out PBOOLEAN Reset
+    )
+{
+    ULONG ticks;
+    AHCI_PORT_CMD cmd;
+    AHCI_TASK_FILE_DATA tfd;
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+
+    AhciDebugPrint("AhciPortRecover()\n");
+
+    AdapterExtension = PortExtension->AdapterExtension;
+    *Reset = FALSE;
+
+    // clearing PxCMD.ST resets PxCI and PxSACT
+    cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+    cmd.ST = 0;
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CMD, cmd.Status);
+
+    for (ticks = 0; ticks < 50; ticks++)
+    {
+        cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+        if (cmd.CR == 0)
+        {
+            break;
+        }
+        StorPortStallExecution(10000);
+    }
+
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SERR, (ULONG)~0);
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->IS, (ULONG)~0);
+
+    // a device still busy with the failed command keeps the port from starting,
+    // a Command List Override clears BSY and DRQ without resetting it
+    tfd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->TFD);
+    if ((cmd.CR == 0) && ((tfd.STS.BSY) || (tfd.STS.DRQ)) &&
+        (AdapterExtension->CAP & AHCI_Global_HBA_CAP_SCLO))
+    {
+        cmd.CLO = 1;
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CMD, cmd.Status);
+
+        for (ticks = 0; ticks < 50; ticks++)
+        {
+            cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+            if (cmd.CLO == 0)
+            {
+                break;
+            }
+            StorPortStallExecution(10000);
+        }
+
+        tfd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->TFD);
+    }
+
+    if ((ForceReset) || (cmd.CR != 0) || (tfd.STS.BSY) || (tfd.STS.DRQ))
+    {
+        AhciDebugPrint("\tCOMRESET, CMD: %x TFD: %x\n", cmd.Status, tfd.Status);
+
+        *Reset = TRUE;
+        if (!AhciPortReset(PortExtension))
+        {
+            return FALSE;
+        }
+    }
+
+    cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+    cmd.ST = 1;
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CMD, cmd.Status);
+
+    return TRUE;
+}// -- AhciPortRecover();
+
+/**
+ * @name AhciReadNcqErrorLog
+ * @implemented
+ *
+ * 6.2.2.2 Native Command Queuing Error Recovery
+ * After an NCQ error the device aborts all queued commands and only takes
+ * READ LOG EXT of the NCQ Command Error log, which tells the failed tag.
+ * Issued in slot 0 and polled, as the port interrupts are masked.
+ *
+ * @param PortExtension
+ * @param Tag
+ * Receives the failed tag, -1 if the log does not name one
+ *
+ * @return
+ * return TRUE if the log was read
+ */
+BOOLEAN
+AhciReadNcqErrorLog (
+    __in PAHCI_PORT_EXTENSION PortExtension,
+    __out PLONG Tag
+    )
+{
+    ULONG ticks, length, ci, index;
+    UCHAR checksum;
+    PUCHAR log;
+    AHCI_INTERRUPT_STATUS PxIS;
+    PAHCI_COMMAND_TABLE cmdTable;
+    PAHCI_COMMAND_HEADER CommandHeader;
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+    STOR_PHYSICAL_ADDRESS CommandTablePhysicalAddress, LogPhysicalAddress;
+
+    AhciDebugPrint("AhciReadNcqErrorLog()\n");
+
+    AdapterExtension = PortExtension->AdapterExtension;
+    cmdTable = PortExtension->RecoveryCommandTable;
+    log = PortExtension->NcqErrorLog;
+    *Tag = -1;
+
+    CommandTablePhysicalAddress = StorPortGetPhysicalAddress(AdapterExtension, NULL, cmdTable, &length);
+    NT_ASSERT((CommandTablePhysicalAddress.LowPart % 128) == 0);
+    LogPhysicalAddress = StorPortGetPhysicalAddress(AdapterExtension, NULL, log, &length);
+
+    AhciZeroMemory((PCHAR)cmdTable->CFIS, sizeof(cmdTable->CFIS));
+
+    cmdTable->CFIS[AHCI_ATA_CFIS_FisType] = FIS_TYPE_REG_H2D;       // FIS Type
+    cmdTable->CFIS[AHCI_ATA_CFIS_PMPort_C] = (1 << 7);              // PM Port & C
+    cmdTable->CFIS[AHCI_ATA_CFIS_CommandReg] = IDE_COMMAND_READ_LOG_EXT;
+    cmdTable->CFIS[AHCI_ATA_CFIS_LBA0] = ATA_LOG_NCQ_COMMAND_ERROR; // log address
+    cmdTable->CFIS[AHCI_ATA_CFIS_SectorCountLow] = 1;               // one page
+
+    cmdTable->PRDT[0].DBA = LogPhysicalAddress.LowPart;
+    cmdTable->PRDT[0].DBAU = 0;
+    if (IsAdapterCAPS64(AdapterExtension->CAP))
+    {
+        cmdTable->PRDT[0].DBAU = LogPhysicalAddress.HighPart;
+    }
+    cmdTable->PRDT[0].RSV0 = 0;
+    cmdTable->PRDT[0].DBC = DEVICE_ATA_BLOCK_SIZE - 1;
+    cmdTable->PRDT[0].RSV1 = 0;
+    cmdTable->PRDT[0].I = 0;
+
+    // the Srb of slot 0, if any, is failed or retried after recovery
+    CommandHeader = &PortExtension->CommandList[0];
+    AhciZeroMemory((PCHAR)CommandHeader, sizeof(AHCI_COMMAND_HEADER));
+    CommandHeader->DI.CFL = 5;
+    CommandHeader->DI.PRDTL = 1;
+    CommandHeader->CTBA = CommandTablePhysicalAddress.LowPart;
+    if (IsAdapterCAPS64(AdapterExtension->CAP))
+    {
+        CommandHeader->CTBA_U = CommandTablePhysicalAddress.HighPart;
+    }
+
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, 1);
+
+    for (ticks = 0; ticks < 50; ticks++)
+    {
+        ci = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CI);
+        PxIS.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->IS);
+        if (((ci & 1) == 0) || PxIS.HBFS || PxIS.HBDS || PxIS.IFS || PxIS.TFES)
+        {
+            break;
+        }
+        StorPortStallExecution(10000);
+    }
+
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SERR, (ULONG)~0);
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->IS, (ULONG)~0);
+
+    if (((ci & 1) != 0) || PxIS.HBFS || PxIS.HBDS || PxIS.IFS || PxIS.TFES)
+    {
+        AhciDebugPrint("\tREAD LOG EXT failed, CI: %x IS: %x\n", ci, PxIS.Status);
+        return FALSE;
+    }
+
+    // the last byte makes the page sum up to 0
+    checksum = 0;
+    for (index = 0; index < DEVICE_ATA_BLOCK_SIZE; index++)
+    {
+        checksum += log[index];
+    }
+
+    if (checksum != 0)
+    {
+        AhciDebugPrint("\tNCQ error log checksum mismatch\n");
+    }
+    else if ((log[0] & ATA_NCQ_LOG_NQ) == 0)
+    {
+        *Tag = log[0] & ATA_NCQ_LOG_TAG_MASK;
+    }
+
+    AhciDebugPrint("\tNCQ error, Tag: %d Status: %x Error: %x\n", *Tag, log[2], log[3]);
+    return TRUE;
+}// -- AhciReadNcqErrorLog();
+
+/**
+ * @name AhciPortRecoveryDpcRoutine
+ * @implemented
+ *
+ * Recover a port the interrupt handler found stopped on a fatal error. Stopping
+ * and resetting the port takes up to several hundred milliseconds, too long for
+ * the interrupt handler. It masked the port interrupts and nothing is issued to
+ * the port until Recovering is cleared, so the port registers are ours.
+ *
+ * @param Dpc
+ * @param AdapterExtension
+ * @param SystemArgument1
+ * @param SystemArgument2
+ */
+VOID
+AhciPortRecoveryDpcRoutine (
+    __in PSTOR_DPC Dpc,
+    __in PVOID HwDeviceExtension,
+    __in PVOID SystemArgument1,
+    __in PVOID SystemArgument2
+  )
+{
+    LONG tag;
+    ULONG failed;
+    BOOLEAN running, reset;
+    STOR_LOCK_HANDLE lockhandle = {0};
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+    PAHCI_PORT_EXTENSION PortExtension;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    AhciDebugPrint("AhciPortRecoveryDpcRoutine()\n");
+
+    AdapterExtension = (PAHCI_ADAPTER_EXTENSION)HwDeviceExtension;
+    PortExtension = (PAHCI_PORT_EXTENSION)SystemArgument1;
+
+    NT_ASSERT(PortExtension->Recovering);
+
+    // only native queued commands are left, the interrupt handler failed the non-queued one
+    failed = PortExtension->CommandIssuedSlots;
+    tag = -1;
+
+    running = AhciPortRecover(PortExtension, FALSE, &reset);
+    if ((running) && (failed != 0) && (!reset))
+    {
+        if (!AhciReadNcqErrorLog(PortExtension, &tag))
+        {
+            running = AhciPortRecover(PortExtension, TRUE, &reset);
+        }
+    }
+
+    StorPortAcquireSpinLock(AdapterExtension, InterruptLock, NULL, &lockhandle);
+
+    // the failed command gets its error, the others were aborted with it and are retried
+    if ((tag >= 0) && ((failed & (1UL << tag)) != 0))
+    {
+        AhciFailIssuedSrb(PortExtension, 1UL << tag, SRB_STATUS_ERROR);
+        failed &= ~(1UL << tag);
+    }
+
+    AhciFailIssuedSrb(PortExtension, failed, SRB_STATUS_BUS_RESET);
+    PortExtension->NcqSlots &= ~PortExtension->CommandIssuedSlots;
+    PortExtension->CommandIssuedSlots = 0;
+
+    if (running)
+    {
+        PortExtension->Recovering = FALSE;
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->IE, PortExtension->InterruptEnable);
+
+        AhciIssueQueuedSrbs(PortExtension);
+    }
+    else
+    {
+        // the port stays masked and stopped, the pending Srbs time out
+        AhciDebugPrint("\tPort %d could not be recovered\n", PortExtension->PortNumber);
+    }
+
+    StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
+
+    return;
+}// -- AhciPortRecoveryDpcRoutine();
+
 /**
  * @name AhciInterruptHandler
  * @not_implemented
@@ -622,7 +1037,7 @@ AhciInterruptHandler (
     __in PAHCI_PORT_EXTENSION PortExtension
     )
 {
-    ULONG is, ci, sact, outstanding;
+    ULONG is, ci, sact, outstanding, completed, failed;
     AHCI_INTERRUPT_STATUS PxIS;
     AHCI_INTERRUPT_STATUS PxISMasked;
     PAHCI_ADAPTER_EXTENSION AdapterExtension;
@@ -633,6 +1048,13 @@ AhciInterruptHandler (
     AdapterExtension = PortExtension->AdapterExtension;
     NT_ASSERT(IsPortValid(AdapterExtension, PortExtension->PortNumber));
 
+    if (PortExtension->Recovering)
+    {
+        // masked, the recovery DPC clears the port status
+        StorPortWriteRegisterUlong(AdapterExtension, AdapterExtension->IS, (1 << PortExtension->PortNumber));
+        return;
+    }
+
     // 5.5.3
     // 1. Software determines the cause of the interrupt by reading the PxIS register.
     //    It is possible for multiple bits to be set
@@ -692,13 +1114,40 @@ AhciInterruptHandler (
     ci = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CI);
     sact = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->SACT);
 
-    outstanding = ci | sact; // NOTE: Including both non-NCQ and NCQ based commands
-    if ((PortExtension->CommandIssuedSlots & (~outstanding)) != 0)
+    // Non-queued commands are done once their PxCI bit is clear, native queued
+    // ones once their PxSACT bit is clear -- the Set Device Bits FIS may report
+    // several tags at once
+    outstanding = ci | sact;
+    completed = PortExtension->CommandIssuedSlots & (~outstanding);
+    if (completed != 0)
     {
-        AhciCompleteIssuedSrb(PortExtension, (PortExtension->CommandIssuedSlots & (~outstanding)));
+        AhciCompleteIssuedSrb(PortExtension, completed);
         PortExtension->CommandIssuedSlots &= outstanding;
+        PortExtension->NcqSlots &= ~completed;
     }
 
+    if (PxIS.HBFS || PxIS.HBDS || PxIS.IFS || PxIS.TFES)
+    {
+        // Restarting the port can take several hundred milliseconds, the recovery
+        // DPC does it. Until then the port is masked and nothing is issued to it.
+        PortExtension->InterruptEnable = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->IE);
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->IE, 0);
+        PortExtension->Recovering = TRUE;
+
+        // A non-queued command is the failing one. Which native queued command
+        // failed is only known from the NCQ error log, they stay outstanding
+        // until the DPC read it.
+        failed = PortExtension->CommandIssuedSlots & ~PortExtension->NcqSlots;
+        AhciFailIssuedSrb(PortExtension, failed, SRB_STATUS_ERROR);
+        PortExtension->CommandIssuedSlots &= ~failed;
+
+        StorPortIssueDpc(AdapterExtension, &PortExtension->PortRecovery, PortExtension, NULL);
+        return;
+    }
+
+    // slots got free, start what is waiting for them
+    AhciIssueQueuedSrbs(PortExtension);
+
     return;
 }// -- AhciInterruptHandler();
 
@@ -721,7 +1170,8 @@ AhciHwInterrupt (
     )
 {
     PAHCI_ADAPTER_EXTENSION AdapterExtension;
-    ULONG portPending, nextPort, i, portCount;
+    ULONG portPending, nextPort, lastPort, i, portCount;
+    BOOLEAN handled;
 
     AdapterExtension = (PAHCI_ADAPTER_EXTENSION)DeviceExtension;
 
@@ -741,6 +1191,10 @@ AhciHwInterrupt (
         return FALSE;
     }
 
+    // with queued commands several ports are busy at once,
+    // serve all of them rather than taking another interrupt for each
+    handled = FALSE;
+    lastPort = AdapterExtension->LastInterruptPort;
     for (i = 1; i <= portCount; i++)
     {
         nextPort = (AdapterExtension->LastInterruptPort + i) % portCount;
@@ -754,19 +1208,22 @@ AhciHwInterrupt (
             continue;
         }
 
-        // we can assign this interrupt to this port
-        AdapterExtension->LastInterruptPort = nextPort;
         AhciInterruptHandler(&AdapterExtension->PortExtension[nextPort]);
 
         portPending &= ~(1 << nextPort);
+        lastPort = nextPort;
+        handled = TRUE;
+    }
 
-        // interrupt belongs to this device
-        // should always return TRUE
-        return TRUE;
+    if (!handled)
+    {
+        AhciDebugPrint("\tSomething went wrong");
+        return FALSE;
     }
 
-    AhciDebugPrint("\tSomething went wrong");
-    return FALSE;
+    // start the next round robin after the last port we served
+    AdapterExtension->LastInterruptPort = lastPort;
+    return TRUE;
 }// -- AhciHwInterrupt();
 
 /**
@@ -1403,6 +1860,13 @@ AhciProcessSrb (
     NT_ASSERT(SlotIndex < AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP));
     SrbExtension->SlotIndex = SlotIndex;
 
+    if (SrbExtension->Flags & ATA_FLAGS_NCQ)
+    {
+        // the command slot doubles as the NCQ tag, Count(7:3)
+        SrbExtension->SectorCountLow = (UCHAR)(SlotIndex << 3);
+        PortExtension->NcqSlots |= 1UL << SlotIndex;
+    }
+
     // program the CFIS in the CommandTable
     CommandHeader = &PortExtension->CommandList[SlotIndex];
 
@@ -1467,7 +1931,7 @@ AhciProcessSrb (
 
     // mark this slot
     PortExtension->Slot[SlotIndex] = Srb;
-    PortExtension->QueueSlots |= 1 << SlotIndex;
+    PortExtension->QueueSlots |= 1UL << SlotIndex;
     return;
 }// -- AhciProcessSrb();
 
@@ -1480,19 +1944,13 @@ AhciProcessSrb (
  * @param PortExtension
  *
  */
-
-#ifdef _MSC_VER     // avoid MSVC C4700
-    #pragma warning(push)
-    #pragma warning(disable: 4700)
-#endif
-
 VOID
 AhciActivatePort (
     __in PAHCI_PORT_EXTENSION PortExtension
     )
 {
     AHCI_PORT_CMD cmd;
-    ULONG QueueSlots, slotToActivate, tmp;
+    ULONG QueueSlots, NcqSlots;
     PAHCI_ADAPTER_EXTENSION AdapterExtension;
 
     AhciDebugPrint("AhciActivatePort()\n");
@@ -1514,30 +1972,99 @@ AhciActivatePort (
         return;
     }
 
-    // get the lowest set bit
-    tmp = QueueSlots & (QueueSlots - 1);
-
-    if (tmp == 0)
-        slotToActivate = QueueSlots;
-    else
-        slotToActivate = (QueueSlots & (~tmp));
-
-    // mark that bit off in QueueSlots
-    // so we can know we it is really needed to activate port or not
-    PortExtension->QueueSlots &= ~slotToActivate;
+    // every programmed slot is issued at once
+    PortExtension->QueueSlots = 0;
     // mark this CommandIssuedSlots
     // to validate in completeIssuedCommand
-    PortExtension->CommandIssuedSlots |= slotToActivate;
+    PortExtension->CommandIssuedSlots |= QueueSlots;
+
+    // section 3.3.13
+    // PxSACT has to be set for a native queued command before its PxCI bit
+    NcqSlots = QueueSlots & PortExtension->NcqSlots;
+    if (NcqSlots != 0)
+    {
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SACT, NcqSlots);
+    }
 
-    // tell the HBA to issue this Command Slot to the given port
-    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, slotToActivate);
+    // tell the HBA to issue these Command Slots to the given port
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, QueueSlots);
 
     return;
 }// -- AhciActivatePort();
 
-#ifdef _MSC_VER     // avoid MSVC C4700
-    #pragma warning(pop)
-#endif
+/**
+ * @name AhciIssueQueuedSrbs
+ * @implemented
+ *
+ * Move pending Srbs to free command slots and issue them. Native queued commands
+ * can share the port with each other but not with non-queued ones, so the queue
+ * waits whenever the Srb at its head can't go along with what is outstanding.
+ * Interrupt lock must be held.
+ *
+ * @param PortExtension
+ *
+ */
+VOID
+AhciIssueQueuedSrbs (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    PSCSI_REQUEST_BLOCK tmpSrb;
+    ULONG freeSlots, occupiedSlots, slotIndex;
+
+    if (PortExtension->DeviceParams.IsActive == FALSE)
+    {
+        return; // we should wait for device to get active
+    }
+
+    if (PortExtension->Recovering)
+    {
+        return; // the recovery DPC issues them once the port runs again
+    }
+
+    occupiedSlots = (PortExtension->QueueSlots | PortExtension->CommandIssuedSlots); // Busy command slots for given port
+    freeSlots = AHCI_SLOT_MASK(PortExtension->MaxPortQueueDepth) & ~occupiedSlots;
+
+    slotIndex = 0;
+    while (freeSlots != 0)
+    {
+        tmpSrb = PeekQueue(&PortExtension->SrbQueue);
+        if (tmpSrb == NULL)
+        {
+            break;
+        }
+
+        if (GetSrbExtension(tmpSrb)->Flags & ATA_FLAGS_NCQ)
+        {
+            if ((occupiedSlots & ~PortExtension->NcqSlots) != 0)
+            {
+                break;
+            }
+        }
+        else if (occupiedSlots != 0)
+        {
+            break;
+        }
+
+        // find first free slot
+        while ((freeSlots & (1UL << slotIndex)) == 0)
+        {
+            slotIndex++;
+        }
+
+        RemoveQueue(&PortExtension->SrbQueue);
+        NT_ASSERT(tmpSrb->PathId == PortExtension->PortNumber);
+        AhciProcessSrb(PortExtension, tmpSrb, slotIndex);
+
+        occupiedSlots |= 1UL << slotIndex;
+        freeSlots &= ~(1UL << slotIndex);
+    }
+
+    // program HBA port
+    AhciActivatePort(PortExtension);
+
+    return;
+}// -- AhciIssueQueuedSrbs();
 
 /**
  * @name AhciProcessIO
@@ -1558,10 +2085,8 @@ AhciProcessIO (
     __in PSCSI_REQUEST_BLOCK Srb
     )
 {
-    PSCSI_REQUEST_BLOCK tmpSrb;
     STOR_LOCK_HANDLE lockhandle = {0};
     PAHCI_PORT_EXTENSION PortExtension;
-    ULONG commandSlotMask, occupiedSlots, slotIndex, NCS;
 
     AhciDebugPrint("AhciProcessIO()\n");
     AhciDebugPrint("\tPathId: %d\n", PathId);
@@ -1576,46 +2101,7 @@ AhciProcessIO (
     // add Srb to queue
     AddQueue(&PortExtension->SrbQueue, Srb);
 
-    if (PortExtension->DeviceParams.IsActive == FALSE)
-    {
-        // Release Lock
-        StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
-        return; // we should wait for device to get active
-    }
-
-    occupiedSlots = (PortExtension->QueueSlots | PortExtension->CommandIssuedSlots); // Busy command slots for given port
-    NCS = AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP);
-    commandSlotMask = (1 << NCS) - 1; // available slots mask
-
-    commandSlotMask = (commandSlotMask & ~occupiedSlots);
-    if(commandSlotMask != 0)
-    {
-        // iterate over HBA port slots
-        for (slotIndex = 0; slotIndex < NCS; slotIndex++)
-        {
-            // find first free slot
-            if ((commandSlotMask & (1 << slotIndex)) != 0)
-            {
-                tmpSrb = RemoveQueue(&PortExtension->SrbQueue);
-                if (tmpSrb != NULL)
-                {
-                    NT_ASSERT(tmpSrb->PathId == PathId);
-                    AhciProcessSrb(PortExtension, tmpSrb, slotIndex);
-                }
-                else
-                {
-                    break;
-                }
-            }
-            else
-            {
-                break;
-            }
-        }
-    }
-
-    // program HBA port
-    AhciActivatePort(PortExtension);
+    AhciIssueQueuedSrbs(PortExtension);
 
     // Release Lock
     StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
@@ -1655,12 +2141,15 @@ AtapiInquiryCompletion (
 
     AdapterExtension = PortExtension->AdapterExtension;
 
+    // packet commands are never queued
+    PortExtension->MaxPortQueueDepth = 1;
+
     // send queue depth
     status = StorPortSetDeviceQueueDepth(PortExtension->AdapterExtension,
                                          Srb->PathId,
                                          Srb->TargetId,
                                          Srb->Lun,
-                                         AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP));
+                                         PortExtension->MaxPortQueueDepth);
 
     NT_ASSERT(status == TRUE);
     return;
@@ -1725,6 +2214,7 @@ InquiryCompletion (
     if (SrbExtension->CommandReg == IDE_COMMAND_IDENTIFY)
     {
         PortExtension->DeviceParams.DeviceType = AHCI_DEVICE_TYPE_ATA;
+        PortExtension->DeviceParams.NcqEnabled = 0;
         if (IdentifyDeviceData->GeneralConfiguration.RemovableMedia)
         {
             PortExtension->DeviceParams.RemovableDevice = 1;
@@ -1775,6 +2265,26 @@ InquiryCompletion (
         PortExtension->DeviceParams.RevisionID[sizeof(PortExtension->DeviceParams.RevisionID) - 1] = '\0';
         PortExtension->DeviceParams.SerialNumber[sizeof(PortExtension->DeviceParams.SerialNumber) - 1] = '\0';
 
+        // Native Command Queuing needs both the HBA and the device, the queued
+        // commands only come with 48 bit addressing
+        if ((AdapterExtension->CAP & AHCI_Global_HBA_CAP_SNCQ) &&
+            (PortExtension->DeviceParams.Lba48BitMode) &&
+            (((PUSHORT)IdentifyDeviceData)[IDENTIFY_SATA_CAPABILITIES] & IDENTIFY_SATA_CAPABILITIES_NCQ))
+        {
+            PortExtension->DeviceParams.NcqEnabled = 1;
+            // QueueDepth is 0's based
+            PortExtension->MaxPortQueueDepth = min(AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP),
+                                                   (ULONG)IdentifyDeviceData->QueueDepth + 1);
+        }
+        else
+        {
+            PortExtension->MaxPortQueueDepth = 1;
+        }
+
+        AhciDebugPrint("\tNCQ: %d Queue Depth: %d\n",
+                       PortExtension->DeviceParams.NcqEnabled,
+                       PortExtension->MaxPortQueueDepth);
+
         // TODO: Add other device params
         AhciDebugPrint("\tATA Device\n");
     }
@@ -1798,7 +2308,7 @@ InquiryCompletion (
     // prepare data to send
     InquiryData->Versions = 2;
     InquiryData->Wide32Bit = 1;
-    InquiryData->CommandQueue = 0; // NCQ not supported
+    InquiryData->CommandQueue = PortExtension->DeviceParams.NcqEnabled;
     InquiryData->ResponseDataFormat = 0x2;
     InquiryData->DeviceTypeModifier = 0;
     InquiryData->DeviceTypeQualifier = DEVICE_CONNECTED;
@@ -1820,7 +2330,7 @@ InquiryCompletion (
                                          Srb->PathId,
                                          Srb->TargetId,
                                          Srb->Lun,
-                                         AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP));
+                                         PortExtension->MaxPortQueueDepth);
 
     NT_ASSERT(status == TRUE);
     return;
@@ -2027,7 +2537,7 @@ DeviceRequestReadWrite (
     NT_ASSERT(SectorCount > 0);
 
     SrbExtension->AtaFunction = ATA_FUNCTION_ATA_READ;
-    SrbExtension->Flags |= ATA_FLAGS_USE_DMA;
+    SrbExtension->Flags = ATA_FLAGS_USE_DMA;
     SrbExtension->CompletionRoutine = NULL;
 
     if (IsReading)
@@ -2074,6 +2584,19 @@ DeviceRequestReadWrite (
     SrbExtension->SectorCountLow = (SectorCount >> 0) & 0xFF;
     SrbExtension->SectorCountHigh = (SectorCount >> 8) & 0xFF;
 
+    if (PortExtension->DeviceParams.NcqEnabled)
+    {
+        // READ/WRITE FPDMA QUEUED carry the sector count in the features
+        // registers, the tag goes to Count(7:3) once a slot is assigned
+        SrbExtension->Flags |= ATA_FLAGS_NCQ;
+        SrbExtension->CommandReg = IsReading ? IDE_COMMAND_READ_FPDMA_QUEUED : IDE_COMMAND_WRITE_FPDMA_QUEUED;
+        SrbExtension->FeaturesLow = (SectorCount >> 0) & 0xFF;
+        SrbExtension->FeaturesHigh = (SectorCount >> 8) & 0xFF;
+        SrbExtension->SectorCountLow = 0;
+        SrbExtension->SectorCountHigh = 0;
+        SrbExtension->Device = IDE_LBA_MODE;
+    }
+
     NT_ASSERT(SectorCount < 0x100);
 
     SrbExtension->pSgl = (PLOCAL_SCATTER_GATHER_LIST)StorPortGetScatterGatherList(AdapterExtension, Srb);
@@ -2284,7 +2807,7 @@ DeviceInquiryRequest (
         NT_ASSERT(SrbExtension != NULL);
 
         SrbExtension->AtaFunction = ATA_FUNCTION_ATA_IDENTIFY;
-        SrbExtension->Flags |= ATA_FLAGS_DATA_IN;
+        SrbExtension->Flags = ATA_FLAGS_DATA_IN;
         SrbExtension->CompletionRoutine = InquiryCompletion;
         SrbExtension->CommandReg = IDE_COMMAND_NOT_VALID;
 
@@ -2547,6 +3070,33 @@ RemoveQueue (
     return Srb;
 }// -- RemoveQueue();
 
+/**
+ * @name PeekQueue
+ * @implemented
+ *
+ * Return the Srb at the head of the Queue without removing it
+ *
+ * @param Queue
+ *
+ * @return
+ * return Srb
+ *
+ */
+FORCEINLINE
+PVOID
+PeekQueue (
+    __in PAHCI_QUEUE Queue
+    )
+{
+    NT_ASSERT(Queue->Head < MAXIMUM_QUEUE_BUFFER_SIZE);
+    NT_ASSERT(Queue->Tail < MAXIMUM_QUEUE_BUFFER_SIZE);
+
+    if (Queue->Head == Queue->Tail)
+        return NULL;
+
+    return Queue->Buffer[Queue->Tail];
+}// -- PeekQueue();
+
 /**
  * @name GetSrbExtension
  * @implemented
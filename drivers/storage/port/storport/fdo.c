@@ -139,6 +139,14 @@ PortFdoStartMiniport(
         return Status;
     }
 
+    /* Set up the request queues, now that the Srb extension size is known */
+    Status = PortInitializeQueues(DeviceExtension);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("PortInitializeQueues() failed (Status 0x%08lx)\n", Status);
+        return Status;
+    }
+
     /* Connect the configured interrupt */
     Status = PortFdoConnectInterrupt(DeviceExtension);
     if (!NT_SUCCESS(Status))
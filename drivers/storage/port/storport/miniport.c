@@ -365,6 +365,23 @@ MiniportHwInterrupt(
 }
 
 
+BOOLEAN
+MiniportBuildIo(
+    _In_ PMINIPORT Miniport,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    BOOLEAN Result;
+
+    DPRINT1("MiniportHwBuildIo(%p %p)\n",
+            Miniport, Srb);
+
+    Result = Miniport->InitData->HwBuildIo(&Miniport->MiniportExtension->HwDeviceExtension, Srb);
+    DPRINT1("HwBuildIo() returned %u\n", Result);
+
+    return Result;
+}
+
+
 BOOLEAN
 MiniportStartIo(
     _In_ PMINIPORT Miniport,
@@ -58,6 +58,21 @@ PortCreatePdo(
     DeviceExtension->FdoExtension = FdoDeviceExtension;
     DeviceExtension->PnpState = dsStopped;
 
+    DeviceExtension->QueueDepth = PORT_DEFAULT_QUEUE_DEPTH;
+
+    /* Allocate the per-processor latency counters */
+    DeviceExtension->Latency = ExAllocatePoolWithTag(NonPagedPool,
+                                                     FdoDeviceExtension->ProcessorCount * sizeof(PORT_LATENCY),
+                                                     TAG_LATENCY);
+    if (DeviceExtension->Latency == NULL)
+    {
+        IoDeleteDevice(Pdo);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(DeviceExtension->Latency,
+                  FdoDeviceExtension->ProcessorCount * sizeof(PORT_LATENCY));
+
     /* Add the PDO to the PDO list*/
     KeAcquireInStackQueuedSpinLock(&FdoDeviceExtension->PdoListLock,
                                    &LockHandle);
@@ -104,6 +119,12 @@ PortDeletePdo(
         PdoExtension->InquiryBuffer = NULL;
     }
 
+    if (PdoExtension->Latency)
+    {
+        ExFreePoolWithTag(PdoExtension->Latency, TAG_LATENCY);
+        PdoExtension->Latency = NULL;
+    }
+
 
     // FIXME: More uninitialization
 
@@ -115,18 +136,181 @@ PortDeletePdo(
 }
 
 
+PPDO_DEVICE_EXTENSION
+PortGetPdo(
+    _In_ PFDO_DEVICE_EXTENSION FdoExtension,
+    _In_ ULONG Bus,
+    _In_ ULONG Target,
+    _In_ ULONG Lun)
+{
+    PPDO_DEVICE_EXTENSION PdoExtension, Found = NULL;
+    KLOCK_QUEUE_HANDLE LockHandle;
+    PLIST_ENTRY Entry;
+
+    DPRINT("PortGetPdo(%p %lu %lu %lu)\n",
+           FdoExtension, Bus, Target, Lun);
+
+    KeAcquireInStackQueuedSpinLock(&FdoExtension->PdoListLock,
+                                   &LockHandle);
+
+    for (Entry = FdoExtension->PdoListHead.Flink;
+         Entry != &FdoExtension->PdoListHead;
+         Entry = Entry->Flink)
+    {
+        PdoExtension = CONTAINING_RECORD(Entry, PDO_DEVICE_EXTENSION, PdoListEntry);
+        if (PdoExtension->Bus == Bus &&
+            PdoExtension->Target == Target &&
+            PdoExtension->Lun == Lun)
+        {
+            Found = PdoExtension;
+            break;
+        }
+    }
+
+    KeReleaseInStackQueuedSpinLock(&LockHandle);
+
+    return Found;
+}
+
+
+static
+NTSTATUS
+PortPdoQueryLatency(
+    _In_ PPDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PIRP Irp,
+    _Out_ PULONG_PTR Information)
+{
+    PIO_STACK_LOCATION Stack;
+    PSTORPORT_LATENCY_HISTOGRAM Histogram;
+    PPORT_LATENCY Latency;
+    ULONG i, j;
+
+    DPRINT1("PortPdoQueryLatency(%p %p)\n", DeviceExtension, Irp);
+
+    Stack = IoGetCurrentIrpStackLocation(Irp);
+    if (Stack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(STORPORT_LATENCY_HISTOGRAM))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    Histogram = (PSTORPORT_LATENCY_HISTOGRAM)Irp->AssociatedIrp.SystemBuffer;
+    RtlZeroMemory(Histogram, sizeof(STORPORT_LATENCY_HISTOGRAM));
+
+    Histogram->Size = sizeof(STORPORT_LATENCY_HISTOGRAM);
+    Histogram->QueueDepth = DeviceExtension->QueueDepth;
+    Histogram->Outstanding = (ULONG)max(DeviceExtension->Outstanding, 0);
+
+    /* Sum up the counters of all processors; they keep changing while we
+       read them, which is fine for statistics */
+    for (i = 0; i < DeviceExtension->FdoExtension->ProcessorCount; i++)
+    {
+        Latency = &DeviceExtension->Latency[i];
+
+        Histogram->Requests += Latency->Requests;
+        Histogram->TotalMicroseconds += Latency->TotalMicroseconds;
+        for (j = 0; j < STORPORT_LATENCY_BUCKETS; j++)
+            Histogram->Buckets[j] += Latency->Buckets[j];
+    }
+
+    *Information = sizeof(STORPORT_LATENCY_HISTOGRAM);
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+NTAPI
+PortPdoDeviceControl(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp)
+{
+    PPDO_DEVICE_EXTENSION DeviceExtension;
+    PIO_STACK_LOCATION Stack;
+    ULONG_PTR Information = 0;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    DPRINT1("PortPdoDeviceControl(%p %p)\n", DeviceObject, Irp);
+
+    DeviceExtension = (PPDO_DEVICE_EXTENSION)DeviceObject->DeviceExtension;
+    ASSERT(DeviceExtension);
+    ASSERT(DeviceExtension->ExtensionType == PdoExtension);
+
+    Stack = IoGetCurrentIrpStackLocation(Irp);
+
+    switch (Stack->Parameters.DeviceIoControl.IoControlCode)
+    {
+        case IOCTL_STORPORT_QUERY_LATENCY:
+            DPRINT1("IOCTL_STORPORT_QUERY_LATENCY\n");
+            Status = PortPdoQueryLatency(DeviceExtension, Irp, &Information);
+            break;
+
+        default:
+            DPRINT1("Unhandled IOCTL 0x%lx\n",
+                    Stack->Parameters.DeviceIoControl.IoControlCode);
+            break;
+    }
+
+    Irp->IoStatus.Information = Information;
+    Irp->IoStatus.Status = Status;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return Status;
+}
+
+
 NTSTATUS
 NTAPI
 PortPdoScsi(
     _In_ PDEVICE_OBJECT DeviceObject,
     _In_ PIRP Irp)
 {
-    DPRINT1("PortPdoScsi(%p %p)\n", DeviceObject, Irp);
+    PPDO_DEVICE_EXTENSION DeviceExtension;
+    PIO_STACK_LOCATION Stack;
+    PSCSI_REQUEST_BLOCK Srb;
+    NTSTATUS Status;
+
+    DPRINT("PortPdoScsi(%p %p)\n", DeviceObject, Irp);
+
+    DeviceExtension = (PPDO_DEVICE_EXTENSION)DeviceObject->DeviceExtension;
+    ASSERT(DeviceExtension);
+    ASSERT(DeviceExtension->ExtensionType == PdoExtension);
+
+    Stack = IoGetCurrentIrpStackLocation(Irp);
+    Srb = Stack->Parameters.Scsi.Srb;
+
+    switch (Srb->Function)
+    {
+        case SRB_FUNCTION_CLAIM_DEVICE:
+        case SRB_FUNCTION_ATTACH_DEVICE:
+            /* Hand out the device the class driver has to send its requests to */
+            Srb->DataBuffer = DeviceObject;
+            Srb->SrbStatus = SRB_STATUS_SUCCESS;
+            Status = STATUS_SUCCESS;
+            break;
+
+        case SRB_FUNCTION_RELEASE_DEVICE:
+            Srb->SrbStatus = SRB_STATUS_SUCCESS;
+            Status = STATUS_SUCCESS;
+            break;
+
+        default:
+            /* Everything else goes to the miniport */
+            Srb->PathId = (UCHAR)DeviceExtension->Bus;
+            Srb->TargetId = (UCHAR)DeviceExtension->Target;
+            Srb->Lun = (UCHAR)DeviceExtension->Lun;
+
+            Status = PortStartRequest(DeviceExtension, Irp, Srb);
+            if (Status == STATUS_PENDING)
+                return Status;
+
+            DPRINT1("PortStartRequest() failed (Status 0x%08lx)\n", Status);
+            Srb->SrbStatus = SRB_STATUS_ERROR;
+            break;
+    }
 
     Irp->IoStatus.Information = 0;
-    Irp->IoStatus.Status = STATUS_SUCCESS;
+    Irp->IoStatus.Status = Status;
     IoCompleteRequest(Irp, IO_NO_INCREMENT);
-    return STATUS_SUCCESS;
+
+    return Status;
 }
 
 
@@ -21,6 +21,7 @@
 #include <ntdddisk.h>
 #include <mountdev.h>
 #include <wdmguid.h>
+#include <drivers/storport/storlat.h>
 
 /* Memory Tags */
 #define TAG_GLOBAL_DATA     'DGtS'
@@ -31,6 +32,25 @@
 #define TAG_ADDRESS_MAPPING 'MAtS'
 #define TAG_INQUIRY_DATA    'QItS'
 #define TAG_SENSE_DATA      'NStS'
+#define TAG_PROCESSOR_QUEUE 'QPtS'
+#define TAG_REQUEST         'QRtS'
+#define TAG_SG_LIST         'GStS'
+#define TAG_LATENCY         'ALtS'
+
+/* Outstanding requests per logical unit unless the miniport says otherwise */
+#define PORT_DEFAULT_QUEUE_DEPTH    20
+#define PORT_MAXIMUM_QUEUE_DEPTH    254
+
+/* Transfer length to size scatter/gather lists for if the miniport does not set one */
+#define PORT_DEFAULT_TRANSFER_LENGTH 0x10000
+
+/* Srb extensions per adapter, and their alignment. Miniports like storahci
+   put DMA structures that need 128 byte alignment into them. */
+#define PORT_SRB_EXTENSIONS          64
+#define PORT_SRB_EXTENSION_ALIGNMENT 128
+
+/* Performance options StorPortInitializePerfOpts can enable */
+#define PORT_SUPPORTED_PERF_OPTIONS (STOR_PERF_DPC_REDIRECTION | STOR_PERF_CONCURRENT_CHANNELS)
 
 typedef enum
 {
@@ -81,6 +101,40 @@ typedef struct _MINIPORT
     PMINIPORT_DEVICE_EXTENSION MiniportExtension;
 } MINIPORT, *PMINIPORT;
 
+/* State of one request between PortStartRequest and its completion. The
+ * scatter/gather list follows in the same block. */
+typedef struct _PORT_REQUEST
+{
+    SLIST_ENTRY CompletionEntry;
+    LIST_ENTRY ListEntry;
+    PIRP Irp;
+    PSCSI_REQUEST_BLOCK Srb;
+    struct _PDO_DEVICE_EXTENSION *PdoExtension;
+    PSTOR_SCATTER_GATHER_LIST SgList;
+    BOOLEAN SgListAllocated;
+    /* Processor the request was submitted on */
+    ULONG Processor;
+    LARGE_INTEGER StartTime;
+} PORT_REQUEST, *PPORT_REQUEST;
+
+typedef struct _PORT_PROCESSOR_QUEUE
+{
+    /* Requests completed by the miniport, finished by CompletionDpc */
+    SLIST_HEADER CompletionList;
+    KDPC CompletionDpc;
+    /* Requests submitted on this processor the miniport has not seen yet */
+    KSPIN_LOCK Lock;
+    LIST_ENTRY SubmitList;
+    NPAGED_LOOKASIDE_LIST RequestLookaside;
+} PORT_PROCESSOR_QUEUE, *PPORT_PROCESSOR_QUEUE;
+
+typedef struct _PORT_LATENCY
+{
+    ULONGLONG Requests;
+    ULONGLONG TotalMicroseconds;
+    ULONGLONG Buckets[STORPORT_LATENCY_BUCKETS];
+} PORT_LATENCY, *PPORT_LATENCY;
+
 typedef struct _UNIT_DATA
 {
     LIST_ENTRY ListEntry;
@@ -115,6 +169,21 @@ typedef struct _FDO_DEVICE_EXTENSION
     KSPIN_LOCK PdoListLock;
     LIST_ENTRY PdoListHead;
     ULONG PdoCount;
+
+    KSPIN_LOCK StartIoLock;
+    ULONG PerfOptions;
+    LARGE_INTEGER PerformanceFrequency;
+    PPORT_PROCESSOR_QUEUE ProcessorQueues;
+    ULONG ProcessorCount;
+    /* Requests sitting in the submit lists of all processors */
+    volatile LONG QueuedRequests;
+    /* Srb extensions, in memory the adapter can reach by DMA */
+    PVOID SrbExtensionVirtualBase;
+    PHYSICAL_ADDRESS SrbExtensionPhysicalBase;
+    ULONG SrbExtensionPoolSize;
+    SLIST_HEADER SrbExtensionList;
+    ULONG SgListOffset;
+    ULONG SgListElements;
 } FDO_DEVICE_EXTENSION, *PFDO_DEVICE_EXTENSION;
 
 
@@ -132,7 +201,10 @@ typedef struct _PDO_DEVICE_EXTENSION
     ULONG Lun;
     PINQUIRYDATA InquiryBuffer;
 
-
+    ULONG QueueDepth;
+    volatile LONG Outstanding;
+    /* One set of counters per processor */
+    PPORT_LATENCY Latency;
 } PDO_DEVICE_EXTENSION, *PPDO_DEVICE_EXTENSION;
 
 
@@ -171,6 +243,11 @@ BOOLEAN
 MiniportHwInterrupt(
     _In_ PMINIPORT Miniport);
 
+BOOLEAN
+MiniportBuildIo(
+    _In_ PMINIPORT Miniport,
+    _In_ PSCSI_REQUEST_BLOCK Srb);
+
 BOOLEAN
 MiniportStartIo(
     _In_ PMINIPORT Miniport,
@@ -243,6 +320,19 @@ NTSTATUS
 PortDeletePdo(
     _In_ PPDO_DEVICE_EXTENSION PdoExtension);
 
+PPDO_DEVICE_EXTENSION
+PortGetPdo(
+    _In_ PFDO_DEVICE_EXTENSION FdoExtension,
+    _In_ ULONG Bus,
+    _In_ ULONG Target,
+    _In_ ULONG Lun);
+
+NTSTATUS
+NTAPI
+PortPdoDeviceControl(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp);
+
 NTSTATUS
 NTAPI
 PortPdoScsi(
@@ -256,6 +346,34 @@ PortPdoPnp(
     _In_ PIRP Irp);
 
 
+/* queue.c */
+
+NTSTATUS
+PortInitializeQueues(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension);
+
+NTSTATUS
+PortStartRequest(
+    _In_ PPDO_DEVICE_EXTENSION PdoExtension,
+    _In_ PIRP Irp,
+    _In_ PSCSI_REQUEST_BLOCK Srb);
+
+VOID
+PortCompleteRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb);
+
+VOID
+PortKickQueues(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension);
+
+ULONG
+PortInitializePerfOpts(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ BOOLEAN Query,
+    _Inout_ PPERF_CONFIGURATION_DATA PerfConfigData);
+
+
 /* storport.c */
 
 PHW_INITIALIZATION_DATA
@@ -0,0 +1,672 @@
+/*
+ * PROJECT:     ReactOS Storport Driver
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Request submission and completion
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include "precomp.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/*
+ * Every processor has its own submit list, request lookaside list and
+ * completion DPC, so that requests issued on different processors never
+ * share a lock before they reach the miniport. A request waits in the submit
+ * list of the processor it was issued on while its logical unit has
+ * QueueDepth requests in the miniport already, or while all Srb extensions
+ * are in use. Completed requests are finished by the completion DPC of the
+ * processor the miniport completed them on, or of the processor they were
+ * issued on if the miniport enabled STOR_PERF_DPC_REDIRECTION.
+ */
+
+/* FUNCTIONS ******************************************************************/
+
+static
+PPORT_PROCESSOR_QUEUE
+PortGetProcessorQueue(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ ULONG Processor)
+{
+    if (Processor >= DeviceExtension->ProcessorCount)
+        Processor = 0;
+
+    return &DeviceExtension->ProcessorQueues[Processor];
+}
+
+
+static
+NTSTATUS
+PortSrbStatusToNtStatus(
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    switch (SRB_STATUS(Srb->SrbStatus))
+    {
+        case SRB_STATUS_SUCCESS:
+        case SRB_STATUS_DATA_OVERRUN:
+            return STATUS_SUCCESS;
+
+        case SRB_STATUS_INVALID_REQUEST:
+        case SRB_STATUS_BAD_FUNCTION:
+        case SRB_STATUS_BAD_SRB_BLOCK_LENGTH:
+            return STATUS_INVALID_DEVICE_REQUEST;
+
+        case SRB_STATUS_NO_DEVICE:
+        case SRB_STATUS_INVALID_LUN:
+        case SRB_STATUS_INVALID_TARGET_ID:
+        case SRB_STATUS_SELECTION_TIMEOUT:
+            return STATUS_DEVICE_DOES_NOT_EXIST;
+
+        case SRB_STATUS_TIMEOUT:
+        case SRB_STATUS_COMMAND_TIMEOUT:
+            return STATUS_IO_TIMEOUT;
+
+        case SRB_STATUS_BUSY:
+            return STATUS_DEVICE_BUSY;
+
+        default:
+            return STATUS_IO_DEVICE_ERROR;
+    }
+}
+
+
+static
+VOID
+PortBuildScatterGatherList(
+    _In_ PIRP Irp,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _Out_ PSTOR_SCATTER_GATHER_LIST SgList)
+{
+    PSTOR_SCATTER_GATHER_ELEMENT Element = NULL;
+    PUCHAR Buffer = Srb->DataBuffer;
+    ULONG Remaining = Srb->DataTransferLength;
+    PMDL Mdl = Irp->MdlAddress;
+    PPFN_NUMBER Pfn = NULL;
+    PHYSICAL_ADDRESS Address;
+    ULONG Offset, Length;
+
+    /* Take the pages from the MDL if the buffer lies in it, the buffer may
+       belong to a process other than the current one */
+    if (Mdl != NULL &&
+        Buffer >= (PUCHAR)MmGetMdlVirtualAddress(Mdl) &&
+        Buffer + Remaining <= (PUCHAR)MmGetMdlVirtualAddress(Mdl) + MmGetMdlByteCount(Mdl))
+    {
+        Offset = MmGetMdlByteOffset(Mdl) + (ULONG)(Buffer - (PUCHAR)MmGetMdlVirtualAddress(Mdl));
+        Pfn = MmGetMdlPfnArray(Mdl) + (Offset >> PAGE_SHIFT);
+        Offset &= PAGE_SIZE - 1;
+    }
+    else
+    {
+        Offset = BYTE_OFFSET(Buffer);
+    }
+
+    SgList->NumberOfElements = 0;
+    SgList->Reserved = 0;
+
+    while (Remaining != 0)
+    {
+        Length = min(PAGE_SIZE - Offset, Remaining);
+
+        if (Pfn != NULL)
+            Address.QuadPart = ((ULONGLONG)*Pfn++ << PAGE_SHIFT) + Offset;
+        else
+            Address = MmGetPhysicalAddress(Buffer);
+
+        /* Merge physically contiguous pages into one element */
+        if (Element != NULL &&
+            Element->PhysicalAddress.QuadPart + Element->Length == Address.QuadPart)
+        {
+            Element->Length += Length;
+        }
+        else
+        {
+            Element = &SgList->List[SgList->NumberOfElements++];
+            Element->PhysicalAddress.QuadPart = Address.QuadPart;
+            Element->Length = Length;
+            Element->Reserved = 0;
+        }
+
+        Buffer += Length;
+        Remaining -= Length;
+        Offset = 0;
+    }
+}
+
+
+static
+VOID
+PortSendRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PPORT_REQUEST Request)
+{
+    PMINIPORT Miniport = &DeviceExtension->Miniport;
+    KIRQL OldIrql;
+
+    DPRINT("PortSendRequest(%p %p)\n", DeviceExtension, Request);
+
+    /* HwBuildIo runs without any lock held; if it fails, the miniport has
+       completed the request already */
+    if (Miniport->InitData->HwBuildIo != NULL &&
+        !MiniportBuildIo(Miniport, Request->Srb))
+        return;
+
+    if (DeviceExtension->PerfOptions & STOR_PERF_CONCURRENT_CHANNELS)
+    {
+        /* The miniport synchronizes HwStartIo itself */
+        MiniportStartIo(Miniport, Request->Srb);
+    }
+    else if (Miniport->PortConfig.SynchronizationModel == StorSynchronizeHalfDuplex &&
+             DeviceExtension->Interrupt != NULL)
+    {
+        OldIrql = KeAcquireInterruptSpinLock(DeviceExtension->Interrupt);
+        MiniportStartIo(Miniport, Request->Srb);
+        KeReleaseInterruptSpinLock(DeviceExtension->Interrupt, OldIrql);
+    }
+    else
+    {
+        KeAcquireSpinLockAtDpcLevel(&DeviceExtension->StartIoLock);
+        MiniportStartIo(Miniport, Request->Srb);
+        KeReleaseSpinLockFromDpcLevel(&DeviceExtension->StartIoLock);
+    }
+}
+
+
+/* Must be called at DISPATCH_LEVEL */
+static
+VOID
+PortIssueRequests(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PPORT_PROCESSOR_QUEUE Queue)
+{
+    PPDO_DEVICE_EXTENSION PdoExtension;
+    PPORT_REQUEST Request;
+    PLIST_ENTRY Entry;
+    PSLIST_ENTRY SrbExtension;
+    ULONG SrbExtensionSize = DeviceExtension->Miniport.PortConfig.SrbExtensionSize;
+
+    for (;;)
+    {
+        Request = NULL;
+        SrbExtension = NULL;
+
+        KeAcquireSpinLockAtDpcLevel(&Queue->Lock);
+
+        for (Entry = Queue->SubmitList.Flink;
+             Entry != &Queue->SubmitList;
+             Entry = Entry->Flink)
+        {
+            PdoExtension = CONTAINING_RECORD(Entry, PORT_REQUEST, ListEntry)->PdoExtension;
+
+            /* Take the first request whose unit is below its queue depth.
+               A completion that frees a slot while the lock is held runs
+               this loop again afterwards, so nothing is left behind */
+            if (InterlockedIncrement(&PdoExtension->Outstanding) <= (LONG)PdoExtension->QueueDepth)
+            {
+                /* No request can go without an Srb extension, the next
+                   completion that returns one runs this loop again */
+                if (SrbExtensionSize != 0)
+                {
+                    SrbExtension = InterlockedPopEntrySList(&DeviceExtension->SrbExtensionList);
+                    if (SrbExtension == NULL)
+                    {
+                        InterlockedDecrement(&PdoExtension->Outstanding);
+                        break;
+                    }
+                }
+
+                RemoveEntryList(Entry);
+                Request = CONTAINING_RECORD(Entry, PORT_REQUEST, ListEntry);
+                break;
+            }
+
+            InterlockedDecrement(&PdoExtension->Outstanding);
+        }
+
+        KeReleaseSpinLockFromDpcLevel(&Queue->Lock);
+
+        if (Request == NULL)
+            break;
+
+        InterlockedDecrement(&DeviceExtension->QueuedRequests);
+
+        if (SrbExtension != NULL)
+        {
+            RtlZeroMemory(SrbExtension, SrbExtensionSize);
+            Request->Srb->SrbExtension = SrbExtension;
+        }
+
+        PortSendRequest(DeviceExtension, Request);
+    }
+}
+
+
+static
+VOID
+PortIssueAllRequests(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    ULONG i;
+
+    for (i = 0; i < DeviceExtension->ProcessorCount; i++)
+    {
+        if (DeviceExtension->QueuedRequests == 0)
+            break;
+
+        PortIssueRequests(DeviceExtension, &DeviceExtension->ProcessorQueues[i]);
+    }
+}
+
+
+static
+VOID
+PortRecordLatency(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PPORT_REQUEST Request)
+{
+    PPORT_LATENCY Latency;
+    LARGE_INTEGER Now;
+    ULONGLONG Microseconds;
+    ULONG Bucket = 0;
+    ULONG Processor;
+
+    Processor = KeGetCurrentProcessorNumber();
+    ASSERT(Processor < DeviceExtension->ProcessorCount);
+
+    /* Only the completion DPC of this processor updates these counters */
+    Latency = &Request->PdoExtension->Latency[Processor];
+
+    Now = KeQueryPerformanceCounter(NULL);
+    Microseconds = (ULONGLONG)(Now.QuadPart - Request->StartTime.QuadPart) * 1000000 /
+                   DeviceExtension->PerformanceFrequency.QuadPart;
+
+    while (Bucket < STORPORT_LATENCY_BUCKETS - 1 && (Microseconds >> Bucket) != 0)
+        Bucket++;
+
+    Latency->Requests++;
+    Latency->TotalMicroseconds += Microseconds;
+    Latency->Buckets[Bucket]++;
+}
+
+
+static
+VOID
+PortFinishRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PPORT_PROCESSOR_QUEUE Queue,
+    _In_ PPORT_REQUEST Request)
+{
+    PSCSI_REQUEST_BLOCK Srb = Request->Srb;
+    PIRP Irp = Request->Irp;
+
+    DPRINT("PortFinishRequest(%p %p)\n", DeviceExtension, Request);
+
+    PortRecordLatency(DeviceExtension, Request);
+
+    InterlockedDecrement(&Request->PdoExtension->Outstanding);
+
+    if (Request->SgListAllocated)
+        ExFreePoolWithTag(Request->SgList, TAG_SG_LIST);
+
+    if (Srb->SrbExtension != NULL)
+    {
+        InterlockedPushEntrySList(&DeviceExtension->SrbExtensionList,
+                                  (PSLIST_ENTRY)Srb->SrbExtension);
+        Srb->SrbExtension = NULL;
+    }
+
+    Irp->IoStatus.Status = PortSrbStatusToNtStatus(Srb);
+    Irp->IoStatus.Information = NT_SUCCESS(Irp->IoStatus.Status) ? Srb->DataTransferLength : 0;
+
+    ExFreeToNPagedLookasideList(&Queue->RequestLookaside, Request);
+
+    IoCompleteRequest(Irp, IO_DISK_INCREMENT);
+}
+
+
+static
+VOID
+NTAPI
+PortCompletionDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2)
+{
+    PFDO_DEVICE_EXTENSION DeviceExtension = (PFDO_DEVICE_EXTENSION)DeferredContext;
+    PPORT_PROCESSOR_QUEUE Queue = CONTAINING_RECORD(Dpc, PORT_PROCESSOR_QUEUE, CompletionDpc);
+    PSLIST_ENTRY Entry, Next, Ordered = NULL;
+
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    /* The list comes back newest first, finish the requests in order */
+    Entry = ExInterlockedFlushSList(&Queue->CompletionList);
+    while (Entry != NULL)
+    {
+        Next = Entry->Next;
+        Entry->Next = Ordered;
+        Ordered = Entry;
+        Entry = Next;
+    }
+
+    while (Ordered != NULL)
+    {
+        Entry = Ordered;
+        Ordered = Ordered->Next;
+
+        PortFinishRequest(DeviceExtension,
+                          Queue,
+                          CONTAINING_RECORD(Entry, PORT_REQUEST, CompletionEntry));
+    }
+
+    /* Requests that were held back by a queue depth limit may go now */
+    if (DeviceExtension->QueuedRequests != 0)
+        PortIssueAllRequests(DeviceExtension);
+}
+
+
+/*
+ * The miniport may hand the physical address of an Srb extension to the
+ * adapter, e.g. storahci builds its command tables in them, so they come
+ * from contiguous memory below 4 GB, like the uncached extension, rather
+ * than from pool. StorPortGetPhysicalAddress translates addresses in it.
+ */
+static
+NTSTATUS
+PortAllocateSrbExtensions(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    PHYSICAL_ADDRESS LowestAddress, HighestAddress, Alignment;
+    ULONG Size, Count, i;
+    PUCHAR Base;
+
+    /* Already done by an earlier start */
+    if (DeviceExtension->SrbExtensionVirtualBase != NULL)
+        return STATUS_SUCCESS;
+
+    Size = ALIGN_UP_BY(DeviceExtension->Miniport.PortConfig.SrbExtensionSize,
+                       PORT_SRB_EXTENSION_ALIGNMENT);
+
+    Alignment.QuadPart = 0;
+    LowestAddress.QuadPart = 0;
+    HighestAddress.QuadPart = 0x00000000FFFFFFFF;
+
+    /* Settle for fewer if contiguous memory is short */
+    for (Count = PORT_SRB_EXTENSIONS; Count != 0; Count /= 2)
+    {
+        Base = MmAllocateContiguousMemorySpecifyCache(Count * Size,
+                                                      LowestAddress,
+                                                      HighestAddress,
+                                                      Alignment,
+                                                      MmCached);
+        if (Base != NULL)
+            break;
+    }
+
+    if (Count == 0)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    DPRINT1("SrbExtensions: %lu of %lu bytes\n", Count, Size);
+
+    DeviceExtension->SrbExtensionVirtualBase = Base;
+    DeviceExtension->SrbExtensionPhysicalBase = MmGetPhysicalAddress(Base);
+    DeviceExtension->SrbExtensionPoolSize = Count * Size;
+
+    InitializeSListHead(&DeviceExtension->SrbExtensionList);
+    for (i = 0; i < Count; i++)
+    {
+        InterlockedPushEntrySList(&DeviceExtension->SrbExtensionList,
+                                  (PSLIST_ENTRY)(Base + i * Size));
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+PortInitializeQueues(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    PPORT_CONFIGURATION_INFORMATION PortConfig = &DeviceExtension->Miniport.PortConfig;
+    PPORT_PROCESSOR_QUEUE Queue;
+    ULONG TransferLength, RequestSize;
+    ULONG i;
+    NTSTATUS Status;
+
+    DPRINT1("PortInitializeQueues(%p)\n", DeviceExtension);
+
+    /* Already done by an earlier start */
+    if (DeviceExtension->ProcessorQueues != NULL)
+        return STATUS_SUCCESS;
+
+    KeQueryPerformanceCounter(&DeviceExtension->PerformanceFrequency);
+
+    if (PortConfig->SrbExtensionSize != 0)
+    {
+        Status = PortAllocateSrbExtensions(DeviceExtension);
+        if (!NT_SUCCESS(Status))
+            return Status;
+    }
+
+    /* Size the scatter/gather list that comes with every request for the
+       largest transfer the miniport accepts */
+    TransferLength = PortConfig->MaximumTransferLength;
+    if (TransferLength == 0 || TransferLength == SP_UNINITIALIZED_VALUE)
+        TransferLength = PORT_DEFAULT_TRANSFER_LENGTH;
+    DeviceExtension->SgListElements = BYTES_TO_PAGES(TransferLength) + 1;
+
+    DeviceExtension->SgListOffset = ALIGN_UP_BY(sizeof(PORT_REQUEST), MEMORY_ALLOCATION_ALIGNMENT);
+    RequestSize = DeviceExtension->SgListOffset +
+                  sizeof(STOR_SCATTER_GATHER_LIST) +
+                  DeviceExtension->SgListElements * sizeof(STOR_SCATTER_GATHER_ELEMENT);
+
+    DPRINT1("SgListElements: %lu  RequestSize: %lu\n",
+            DeviceExtension->SgListElements, RequestSize);
+
+    DeviceExtension->ProcessorCount = KeNumberProcessors;
+    DeviceExtension->ProcessorQueues = ExAllocatePoolWithTag(NonPagedPool,
+                                                             DeviceExtension->ProcessorCount * sizeof(PORT_PROCESSOR_QUEUE),
+                                                             TAG_PROCESSOR_QUEUE);
+    if (DeviceExtension->ProcessorQueues == NULL)
+    {
+        DeviceExtension->ProcessorCount = 0;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (i = 0; i < DeviceExtension->ProcessorCount; i++)
+    {
+        Queue = &DeviceExtension->ProcessorQueues[i];
+
+        InitializeSListHead(&Queue->CompletionList);
+        KeInitializeDpc(&Queue->CompletionDpc,
+                        PortCompletionDpc,
+                        DeviceExtension);
+        KeSetTargetProcessorDpc(&Queue->CompletionDpc, (CCHAR)i);
+
+        KeInitializeSpinLock(&Queue->Lock);
+        InitializeListHead(&Queue->SubmitList);
+
+        ExInitializeNPagedLookasideList(&Queue->RequestLookaside,
+                                        NULL,
+                                        NULL,
+                                        0,
+                                        RequestSize,
+                                        TAG_REQUEST,
+                                        0);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+PortStartRequest(
+    _In_ PPDO_DEVICE_EXTENSION PdoExtension,
+    _In_ PIRP Irp,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PFDO_DEVICE_EXTENSION DeviceExtension = PdoExtension->FdoExtension;
+    PPORT_PROCESSOR_QUEUE Queue;
+    PPORT_REQUEST Request;
+    ULONG Elements;
+    KIRQL OldIrql;
+
+    DPRINT("PortStartRequest(%p %p %p)\n", PdoExtension, Irp, Srb);
+
+    if (DeviceExtension->ProcessorQueues == NULL)
+        return STATUS_DEVICE_NOT_READY;
+
+    /* Stay on this processor until the request is in its submit list */
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+
+    Queue = PortGetProcessorQueue(DeviceExtension, KeGetCurrentProcessorNumber());
+
+    Request = ExAllocateFromNPagedLookasideList(&Queue->RequestLookaside);
+    if (Request == NULL)
+    {
+        KeLowerIrql(OldIrql);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Request->Irp = Irp;
+    Request->Srb = Srb;
+    Request->PdoExtension = PdoExtension;
+    Request->SgList = NULL;
+    Request->SgListAllocated = FALSE;
+    Request->Processor = (ULONG)(Queue - DeviceExtension->ProcessorQueues);
+
+    /* The Srb extension is taken when the request goes to the miniport */
+    Srb->SrbExtension = NULL;
+
+    if (Srb->DataBuffer != NULL &&
+        Srb->DataTransferLength != 0 &&
+        (Srb->SrbFlags & (SRB_FLAGS_DATA_IN | SRB_FLAGS_DATA_OUT)))
+    {
+        Elements = ADDRESS_AND_SIZE_TO_SPAN_PAGES(Srb->DataBuffer, Srb->DataTransferLength);
+        if (Elements <= DeviceExtension->SgListElements)
+        {
+            Request->SgList = (PSTOR_SCATTER_GATHER_LIST)((PUCHAR)Request + DeviceExtension->SgListOffset);
+        }
+        else
+        {
+            Request->SgList = ExAllocatePoolWithTag(NonPagedPool,
+                                                    sizeof(STOR_SCATTER_GATHER_LIST) +
+                                                    Elements * sizeof(STOR_SCATTER_GATHER_ELEMENT),
+                                                    TAG_SG_LIST);
+            if (Request->SgList == NULL)
+            {
+                ExFreeToNPagedLookasideList(&Queue->RequestLookaside, Request);
+                KeLowerIrql(OldIrql);
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            Request->SgListAllocated = TRUE;
+        }
+
+        PortBuildScatterGatherList(Irp, Srb, Request->SgList);
+    }
+
+    Srb->OriginalRequest = Irp;
+    Srb->SrbStatus = SRB_STATUS_PENDING;
+    Irp->Tail.Overlay.DriverContext[0] = Request;
+
+    IoMarkIrpPending(Irp);
+
+    Request->StartTime = KeQueryPerformanceCounter(NULL);
+
+    KeAcquireSpinLockAtDpcLevel(&Queue->Lock);
+    InsertTailList(&Queue->SubmitList, &Request->ListEntry);
+    KeReleaseSpinLockFromDpcLevel(&Queue->Lock);
+
+    InterlockedIncrement(&DeviceExtension->QueuedRequests);
+
+    PortIssueRequests(DeviceExtension, Queue);
+
+    KeLowerIrql(OldIrql);
+
+    return STATUS_PENDING;
+}
+
+
+/* Called for RequestComplete notifications, at any IRQL up to DIRQL */
+VOID
+PortCompleteRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PPORT_PROCESSOR_QUEUE Queue;
+    PPORT_REQUEST Request;
+    PIRP Irp;
+
+    DPRINT("PortCompleteRequest(%p %p)\n", DeviceExtension, Srb);
+
+    Irp = (PIRP)Srb->OriginalRequest;
+    if (Irp == NULL)
+        return;
+
+    Request = (PPORT_REQUEST)Irp->Tail.Overlay.DriverContext[0];
+    ASSERT(Request->Srb == Srb);
+
+    /* Finish the request on the processor that issued it if the miniport
+       asked for it, where the IRP and its buffers are still cache hot */
+    if (DeviceExtension->PerfOptions & STOR_PERF_DPC_REDIRECTION)
+        Queue = PortGetProcessorQueue(DeviceExtension, Request->Processor);
+    else
+        Queue = PortGetProcessorQueue(DeviceExtension, KeGetCurrentProcessorNumber());
+
+    InterlockedPushEntrySList(&Queue->CompletionList, &Request->CompletionEntry);
+    KeInsertQueueDpc(&Queue->CompletionDpc, NULL, NULL);
+}
+
+
+/* Have waiting requests looked at again, e.g. after a queue depth change.
+   The miniport may call this while it holds the StartIo lock, so the work
+   is left to a completion DPC. */
+VOID
+PortKickQueues(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    PPORT_PROCESSOR_QUEUE Queue;
+
+    if (DeviceExtension->ProcessorQueues == NULL ||
+        DeviceExtension->QueuedRequests == 0)
+        return;
+
+    Queue = PortGetProcessorQueue(DeviceExtension, KeGetCurrentProcessorNumber());
+    KeInsertQueueDpc(&Queue->CompletionDpc, NULL, NULL);
+}
+
+
+ULONG
+PortInitializePerfOpts(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ BOOLEAN Query,
+    _Inout_ PPERF_CONFIGURATION_DATA PerfConfigData)
+{
+    DPRINT1("PortInitializePerfOpts(%p %u %p)\n",
+            DeviceExtension, Query, PerfConfigData);
+
+    if (DeviceExtension == NULL || PerfConfigData == NULL)
+        return STOR_STATUS_INVALID_PARAMETER;
+
+    if (PerfConfigData->Version == 0 || PerfConfigData->Version > STOR_PERF_VERSION)
+        return STOR_STATUS_UNSUPPORTED_VERSION;
+
+    if (Query)
+    {
+        PerfConfigData->Flags = PORT_SUPPORTED_PERF_OPTIONS;
+        return STOR_STATUS_SUCCESS;
+    }
+
+    if (PerfConfigData->Flags & ~PORT_SUPPORTED_PERF_OPTIONS)
+        return STOR_STATUS_INVALID_PARAMETER;
+
+    DPRINT1("Performance options: 0x%lx\n", PerfConfigData->Flags);
+    DeviceExtension->PerfOptions = PerfConfigData->Flags;
+
+    return STOR_STATUS_SUCCESS;
+}
+
+/* EOF */
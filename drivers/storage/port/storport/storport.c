@@ -121,6 +121,8 @@ PortAcquireSpinLock(
 
         case StartIoLock: /* 2 */
             DPRINT1("StartIoLock\n");
+            KeAcquireSpinLock(&DeviceExtension->StartIoLock,
+                              &LockHandle->Context.OldIrql);
             break;
 
         case InterruptLock: /* 3 */
@@ -151,6 +153,8 @@ PortReleaseSpinLock(
 
         case StartIoLock: /* 2 */
             DPRINT1("StartIoLock\n");
+            KeReleaseSpinLock(&DeviceExtension->StartIoLock,
+                              LockHandle->Context.OldIrql);
             break;
 
         case InterruptLock: /* 3 */
@@ -226,6 +230,8 @@ PortAddDevice(
     KeInitializeSpinLock(&DeviceExtension->PdoListLock);
     InitializeListHead(&DeviceExtension->PdoListHead);
 
+    KeInitializeSpinLock(&DeviceExtension->StartIoLock);
+
     /* Attach the FDO to the device stack */
     Status = IoAttachDeviceToDeviceStackSafe(Fdo,
                                              PhysicalDeviceObject,
@@ -327,9 +333,16 @@ PortDispatchDeviceControl(
     IN PDEVICE_OBJECT DeviceObject,
     IN PIRP Irp)
 {
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+
     DPRINT1("PortDispatchDeviceControl(%p %p)\n",
             DeviceObject, Irp);
 
+    DeviceExtension = (PFDO_DEVICE_EXTENSION)DeviceObject->DeviceExtension;
+    if (DeviceExtension->ExtensionType == PdoExtension)
+        return PortPdoDeviceControl(DeviceObject,
+                                    Irp);
+
     Irp->IoStatus.Status = STATUS_SUCCESS;
     Irp->IoStatus.Information = 0;
 
@@ -611,10 +624,48 @@ StorPortExtendedFunction(
     _In_ PVOID HwDeviceExtension,
     ...)
 {
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension = NULL;
+    PPERF_CONFIGURATION_DATA PerfConfigData;
+    BOOLEAN Query;
+    ULONG Status;
+    va_list ap;
+
     DPRINT1("StorPortExtendedFunction(%d %p ...)\n",
             FunctionCode, HwDeviceExtension);
-    UNIMPLEMENTED;
-    return STATUS_NOT_IMPLEMENTED;
+
+    /* Get the miniport extension */
+    if (HwDeviceExtension != NULL)
+    {
+        MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                              MINIPORT_DEVICE_EXTENSION,
+                                              HwDeviceExtension);
+        DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+    }
+
+    va_start(ap, HwDeviceExtension);
+
+    switch (FunctionCode)
+    {
+        case ExtFunctionInitializePerformanceOptimizations:
+            DPRINT1("ExtFunctionInitializePerformanceOptimizations\n");
+            Query = (BOOLEAN)va_arg(ap, int);
+            PerfConfigData = (PPERF_CONFIGURATION_DATA)va_arg(ap, PPERF_CONFIGURATION_DATA);
+            Status = PortInitializePerfOpts(DeviceExtension,
+                                            Query,
+                                            PerfConfigData);
+            break;
+
+        default:
+            DPRINT1("Unsupported function code %d\n", FunctionCode);
+            UNIMPLEMENTED;
+            Status = STOR_STATUS_NOT_IMPLEMENTED;
+            break;
+    }
+
+    va_end(ap);
+
+    return Status;
 }
 
 
@@ -823,6 +874,18 @@ StorPortGetPhysicalAddress(
         return PhysicalAddress;
     }
 
+    /* Inside of an Srb extension? */
+    if (((ULONG_PTR)VirtualAddress >= (ULONG_PTR)DeviceExtension->SrbExtensionVirtualBase) &&
+        ((ULONG_PTR)VirtualAddress < (ULONG_PTR)DeviceExtension->SrbExtensionVirtualBase + DeviceExtension->SrbExtensionPoolSize))
+    {
+        Offset = (ULONG_PTR)VirtualAddress - (ULONG_PTR)DeviceExtension->SrbExtensionVirtualBase;
+
+        PhysicalAddress.QuadPart = DeviceExtension->SrbExtensionPhysicalBase.QuadPart + Offset;
+        *Length = DeviceExtension->SrbExtensionPoolSize - Offset;
+
+        return PhysicalAddress;
+    }
+
     // FIXME
 
 
@@ -838,7 +901,7 @@ StorPortGetPhysicalAddress(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 PSTOR_SCATTER_GATHER_LIST
@@ -847,9 +910,20 @@ StorPortGetScatterGatherList(
     _In_ PVOID DeviceExtension,
     _In_ PSCSI_REQUEST_BLOCK Srb)
 {
-    DPRINT1("StorPortGetScatterGatherList()\n");
-    UNIMPLEMENTED;
-    return NULL;
+    PPORT_REQUEST Request;
+    PIRP Irp;
+
+    DPRINT("StorPortGetScatterGatherList(%p %p)\n",
+           DeviceExtension, Srb);
+
+    Irp = (PIRP)Srb->OriginalRequest;
+    if (Irp == NULL)
+        return NULL;
+
+    /* The list was built when the request was started */
+    Request = (PPORT_REQUEST)Irp->Tail.Overlay.DriverContext[0];
+
+    return Request->SgList;
 }
 
 
@@ -1102,6 +1176,8 @@ StorPortNotification(
     PBOOLEAN Result;
     PSTOR_DPC Dpc;
     PHW_DPC_ROUTINE HwDpcRoutine;
+    PVOID SystemArgument1, SystemArgument2;
+    PLONG Inserted;
     va_list ap;
 
     STOR_SPINLOCK SpinLock;
@@ -1132,11 +1208,8 @@ StorPortNotification(
             DPRINT1("RequestComplete\n");
             Srb = (PSCSI_REQUEST_BLOCK)va_arg(ap, PSCSI_REQUEST_BLOCK);
             DPRINT1("Srb %p\n", Srb);
-            if (Srb->OriginalRequest != NULL)
-            {
-                DPRINT1("Need to complete the IRP!\n");
-
-            }
+            if (DeviceExtension != NULL)
+                PortCompleteRequest(DeviceExtension, Srb);
             break;
 
         case GetExtendedFunctionTable:
@@ -1171,10 +1244,22 @@ StorPortNotification(
 
             KeInitializeDpc((PRKDPC)&Dpc->Dpc,
                             (PKDEFERRED_ROUTINE)HwDpcRoutine,
-                            (PVOID)DeviceExtension);
+                            HwDeviceExtension);
             KeInitializeSpinLock(&Dpc->Lock);
             break;
 
+        case IssueDpc:
+            DPRINT1("IssueDpc\n");
+            Dpc = (PSTOR_DPC)va_arg(ap, PSTOR_DPC);
+            DPRINT1("Dpc %p\n", Dpc);
+            SystemArgument1 = (PVOID)va_arg(ap, PVOID);
+            SystemArgument2 = (PVOID)va_arg(ap, PVOID);
+            Inserted = (PLONG)va_arg(ap, PLONG);
+            *Inserted = KeInsertQueueDpc((PRKDPC)&Dpc->Dpc,
+                                         SystemArgument1,
+                                         SystemArgument2);
+            break;
+
         case AcquireSpinLock:
             DPRINT1("AcquireSpinLock\n");
             SpinLock = (STOR_SPINLOCK)va_arg(ap, STOR_SPINLOCK);
@@ -1390,7 +1475,7 @@ StorPortSetBusDataByOffset(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 BOOLEAN
@@ -1402,9 +1487,31 @@ StorPortSetDeviceQueueDepth(
     _In_ UCHAR Lun,
     _In_ ULONG Depth)
 {
-    DPRINT1("StorPortSetDeviceQueueDepth()\n");
-    UNIMPLEMENTED;
-    return FALSE;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+    PPDO_DEVICE_EXTENSION PdoExtension;
+
+    DPRINT1("StorPortSetDeviceQueueDepth(%p %u %u %u %lu)\n",
+            HwDeviceExtension, PathId, TargetId, Lun, Depth);
+
+    if (Depth == 0 || Depth > PORT_MAXIMUM_QUEUE_DEPTH)
+        return FALSE;
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    PdoExtension = PortGetPdo(DeviceExtension, PathId, TargetId, Lun);
+    if (PdoExtension == NULL)
+        return FALSE;
+
+    PdoExtension->QueueDepth = Depth;
+
+    /* Requests held back by the old depth may be issued now */
+    PortKickQueues(DeviceExtension);
+
+    return TRUE;
 }
 
 
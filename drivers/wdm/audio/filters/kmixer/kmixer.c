@@ -71,6 +71,7 @@ KMix_AddDevice(
     DeviceExtension = (PKMIXER_DEVICE_EXT)DeviceObject->DeviceExtension;
     /* initialize device extension */
     RtlZeroMemory(DeviceExtension, sizeof(KMIXER_DEVICE_EXT));
+    MixerInitialize(&DeviceExtension->Mixer);
 
     Status = KMixAllocateDeviceHeader(DeviceExtension);
     if (!NT_SUCCESS(Status))
@@ -3,14 +3,55 @@
 
 #include <portcls.h>
 #include <float_cast.h>
+#include <samplerate.h>
 
+/* Mixes the streams of all pins of the device */
 typedef struct
 {
-    KSDEVICE_HEADER KsDeviceHeader;
+    /* protects the stream list and the stream rings */
+    KSPIN_LOCK Lock;
+    LIST_ENTRY StreamList;
+    /* serializes MixerRender, which owns MixBuffer */
+    FAST_MUTEX RenderMutex;
+    /* sum of the streams, grown as needed */
+    PFLOAT MixBuffer;
+    ULONG MixBufferSize;
+}MIXER_CONTEXT, *PMIXER_CONTEXT;
 
+/* Samples of a pin waiting to be mixed, in the pin output format */
+typedef struct
+{
+    LIST_ENTRY Entry;
+    ULONG SamplesPerSec;
+    ULONG Channels;
+    /* ring of Size samples */
+    PFLOAT Buffer;
+    ULONG Size;
+    ULONG ReadIndex;
+    ULONG Count;
+}MIX_STREAM, *PMIX_STREAM;
+
+typedef struct
+{
+    KSDEVICE_HEADER KsDeviceHeader;
+    MIXER_CONTEXT Mixer;
 
 }KMIXER_DEVICE_EXT, *PKMIXER_DEVICE_EXT;
 
+typedef struct
+{
+    /* input and output format, set through KSPROPERTY_CONNECTION_DATAFORMAT */
+    KSDATAFORMAT_WAVEFORMATEX Formats[2];
+    PMIXER_CONTEXT Mixer;
+    MIX_STREAM Stream;
+    /* kept for the lifetime of the pin so that buffers are filtered as one stream */
+    SRC_STATE * Resampler;
+    ULONG ResamplerChannels;
+    /* float work buffers, grown as needed */
+    PFLOAT Scratch[2];
+    ULONG ScratchSize[2];
+}PIN_CONTEXT, *PPIN_CONTEXT;
+
 typedef struct
 {
     KSPIN_LOCK Lock;
@@ -28,6 +69,64 @@ NTSTATUS
 CreatePin(
     IN PIRP Irp);
 
+/* mix.c */
+VOID
+MixerInitialize(
+    IN PMIXER_CONTEXT Mixer);
+
+VOID
+MixerAddStream(
+    IN PMIXER_CONTEXT Mixer,
+    IN PMIX_STREAM Stream);
+
+VOID
+MixerRemoveStream(
+    IN PMIXER_CONTEXT Mixer,
+    IN PMIX_STREAM Stream);
+
+ULONG
+MixerSubmit(
+    IN PMIXER_CONTEXT Mixer,
+    IN PMIX_STREAM Stream,
+    IN const FLOAT * Samples,
+    IN ULONG Count);
+
+NTSTATUS
+MixerRender(
+    IN PMIXER_CONTEXT Mixer,
+    IN PKSDATAFORMAT_WAVEFORMATEX Format,
+    OUT PVOID Buffer,
+    IN ULONG Frames,
+    OUT PULONG FramesMixed);
+
+VOID
+MixPcmToFloat(
+    IN const VOID * Buffer,
+    IN ULONG BitsPerSample,
+    OUT PFLOAT Samples,
+    IN ULONG Count);
+
+VOID
+MixFloatToPcm(
+    IN const FLOAT * Samples,
+    IN ULONG BitsPerSample,
+    OUT PVOID Buffer,
+    IN ULONG Count);
+
+VOID
+MixMapChannels(
+    IN const FLOAT * Samples,
+    IN ULONG Channels,
+    OUT PFLOAT Result,
+    IN ULONG NewChannels,
+    IN ULONG Frames);
+
+VOID
+MixAddSamples(
+    IN OUT PFLOAT Sum,
+    IN const FLOAT * Samples,
+    IN ULONG Count);
+
 #ifndef _M_IX86
 #define KeSaveFloatingPointState(x) ((void)(x), STATUS_SUCCESS)
 #define KeRestoreFloatingPointState(x) ((void)0)
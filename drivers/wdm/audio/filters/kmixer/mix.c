@@ -0,0 +1,415 @@
+/*
+ * PROJECT:         ReactOS Kernel Streaming Mixer
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            drivers/wdm/audio/filters/kmixer/mix.c
+ * PURPOSE:         Sample format conversion and stream mixing
+ */
+
+#include "kmixer.h"
+
+#if defined(_M_IX86) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define KMIXER_SSE2
+#endif
+
+#define NDEBUG
+#include <debug.h>
+
+#define TAG_KMIXER 'xiMK'
+
+#ifdef KMIXER_SSE2
+static BOOLEAN MixUseSse2;
+#endif
+
+/*
+ * All conversions go through 32 bit float samples in [-1.0, 1.0).
+ * 8 bit PCM is unsigned, the other widths are signed and 24 bit samples
+ * are packed in 3 bytes. Converting back clips to the range of the
+ * target width.
+ */
+
+VOID
+MixPcmToFloat(
+    IN const VOID * Buffer,
+    IN ULONG BitsPerSample,
+    OUT PFLOAT Samples,
+    IN ULONG Count)
+{
+    ULONG Index;
+
+    if (BitsPerSample == 8)
+    {
+        const UCHAR * In = Buffer;
+
+        for(Index = 0; Index < Count; Index++)
+            Samples[Index] = (FLOAT)((LONG)In[Index] - 0x80) * (1.0f / 0x80);
+    }
+    else if (BitsPerSample == 16)
+    {
+        const SHORT * In = Buffer;
+
+        for(Index = 0; Index < Count; Index++)
+            Samples[Index] = (FLOAT)In[Index] * (1.0f / 0x8000);
+    }
+    else if (BitsPerSample == 24)
+    {
+        const UCHAR * In = Buffer;
+
+        for(Index = 0; Index < Count; Index++, In += 3)
+            Samples[Index] = (FLOAT)(LONG)((ULONG)In[0] << 8 | (ULONG)In[1] << 16 | (ULONG)In[2] << 24) * (1.0f / 2147483648.0f);
+    }
+    else if (BitsPerSample == 32)
+    {
+        const LONG * In = Buffer;
+
+        for(Index = 0; Index < Count; Index++)
+            Samples[Index] = (FLOAT)In[Index] * (1.0f / 2147483648.0f);
+    }
+}
+
+static
+LONG
+MixClipToLong(
+    IN FLOAT Sample)
+{
+    /* done in double, a float cannot hold 0x7FFFFFFF */
+    DOUBLE Value = (DOUBLE)Sample * 2147483648.0;
+
+    if (Value >= 2147483647.0)
+        return 0x7FFFFFFF;
+    if (Value <= -2147483648.0)
+        return (LONG)0x80000000;
+    return lrint(Value);
+}
+
+#ifdef KMIXER_SSE2
+static
+__ATTRIBUTE_SSE2__
+ULONG
+MixFloatToPcm16Sse2(
+    IN const FLOAT * Samples,
+    OUT PSHORT Out,
+    IN ULONG Count)
+{
+    const __m128 Scale = _mm_set1_ps(32768.0f);
+    __m128i Low, High;
+    ULONG Index;
+
+    /* the conversion rounds like lrintf and the pack saturates, which is the clipping */
+    for(Index = 0; Index + 8 <= Count; Index += 8)
+    {
+        Low = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&Samples[Index]), Scale));
+        High = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&Samples[Index + 4]), Scale));
+        _mm_storeu_si128((__m128i *)&Out[Index], _mm_packs_epi32(Low, High));
+    }
+
+    return Index;
+}
+#endif
+
+VOID
+MixFloatToPcm(
+    IN const FLOAT * Samples,
+    IN ULONG BitsPerSample,
+    OUT PVOID Buffer,
+    IN ULONG Count)
+{
+    ULONG Index = 0;
+    LONG Value;
+
+    if (BitsPerSample == 8)
+    {
+        PUCHAR Out = Buffer;
+
+        for(; Index < Count; Index++)
+        {
+            Value = lrintf(Samples[Index] * 0x80);
+            Out[Index] = (UCHAR)(max(-0x80, min(0x7F, Value)) + 0x80);
+        }
+    }
+    else if (BitsPerSample == 16)
+    {
+        PSHORT Out = Buffer;
+
+#ifdef KMIXER_SSE2
+        if (MixUseSse2)
+            Index = MixFloatToPcm16Sse2(Samples, Out, Count);
+#endif
+        for(; Index < Count; Index++)
+        {
+            Value = lrintf(Samples[Index] * 0x8000);
+            Out[Index] = (SHORT)max(-0x8000, min(0x7FFF, Value));
+        }
+    }
+    else if (BitsPerSample == 24)
+    {
+        PUCHAR Out = Buffer;
+
+        for(; Index < Count; Index++, Out += 3)
+        {
+            Value = MixClipToLong(Samples[Index]);
+            Out[0] = (UCHAR)(Value >> 8);
+            Out[1] = (UCHAR)(Value >> 16);
+            Out[2] = (UCHAR)(Value >> 24);
+        }
+    }
+    else if (BitsPerSample == 32)
+    {
+        PLONG Out = Buffer;
+
+        for(; Index < Count; Index++)
+            Out[Index] = MixClipToLong(Samples[Index]);
+    }
+}
+
+VOID
+MixMapChannels(
+    IN const FLOAT * Samples,
+    IN ULONG Channels,
+    OUT PFLOAT Result,
+    IN ULONG NewChannels,
+    IN ULONG Frames)
+{
+    ULONG Frame, Channel, Sources;
+    FLOAT Sum;
+
+    for(Frame = 0; Frame < Frames; Frame++, Samples += Channels, Result += NewChannels)
+    {
+        for(Channel = 0; Channel < NewChannels; Channel++)
+        {
+            if (NewChannels > Channels)
+            {
+                /* 2 channel stretched to 4 looks like LRLR */
+                Result[Channel] = Samples[Channel % Channels];
+                continue;
+            }
+
+            /* fold the channels that have no place of their own into the others */
+            Sum = 0.0f;
+            for(Sources = 0; Channel + Sources * NewChannels < Channels; Sources++)
+                Sum += Samples[Channel + Sources * NewChannels];
+
+            Result[Channel] = Sum / (FLOAT)Sources;
+        }
+    }
+}
+
+#ifdef KMIXER_SSE2
+static
+__ATTRIBUTE_SSE2__
+ULONG
+MixAddSamplesSse2(
+    IN OUT PFLOAT Sum,
+    IN const FLOAT * Samples,
+    IN ULONG Count)
+{
+    ULONG Index;
+
+    for(Index = 0; Index + 8 <= Count; Index += 8)
+    {
+        _mm_storeu_ps(&Sum[Index], _mm_add_ps(_mm_loadu_ps(&Sum[Index]), _mm_loadu_ps(&Samples[Index])));
+        _mm_storeu_ps(&Sum[Index + 4], _mm_add_ps(_mm_loadu_ps(&Sum[Index + 4]), _mm_loadu_ps(&Samples[Index + 4])));
+    }
+
+    return Index;
+}
+#endif
+
+VOID
+MixAddSamples(
+    IN OUT PFLOAT Sum,
+    IN const FLOAT * Samples,
+    IN ULONG Count)
+{
+    ULONG Index = 0;
+
+#ifdef KMIXER_SSE2
+    if (MixUseSse2)
+        Index = MixAddSamplesSse2(Sum, Samples, Count);
+#endif
+    for(; Index < Count; Index++)
+        Sum[Index] += Samples[Index];
+}
+
+VOID
+MixerInitialize(
+    IN PMIXER_CONTEXT Mixer)
+{
+    KeInitializeSpinLock(&Mixer->Lock);
+    InitializeListHead(&Mixer->StreamList);
+    ExInitializeFastMutex(&Mixer->RenderMutex);
+    Mixer->MixBuffer = NULL;
+    Mixer->MixBufferSize = 0;
+
+#if defined(_M_AMD64)
+    MixUseSse2 = TRUE;
+#elif defined(_M_IX86)
+    MixUseSse2 = ExIsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#endif
+}
+
+VOID
+MixerAddStream(
+    IN PMIXER_CONTEXT Mixer,
+    IN PMIX_STREAM Stream)
+{
+    KIRQL OldIrql;
+
+    KeAcquireSpinLock(&Mixer->Lock, &OldIrql);
+    InsertTailList(&Mixer->StreamList, &Stream->Entry);
+    KeReleaseSpinLock(&Mixer->Lock, OldIrql);
+}
+
+VOID
+MixerRemoveStream(
+    IN PMIXER_CONTEXT Mixer,
+    IN PMIX_STREAM Stream)
+{
+    KIRQL OldIrql;
+
+    KeAcquireSpinLock(&Mixer->Lock, &OldIrql);
+    RemoveEntryList(&Stream->Entry);
+    Stream->ReadIndex = 0;
+    Stream->Count = 0;
+    KeReleaseSpinLock(&Mixer->Lock, OldIrql);
+
+    if (Stream->Buffer)
+    {
+        ExFreePoolWithTag(Stream->Buffer, TAG_KMIXER);
+        Stream->Buffer = NULL;
+        Stream->Size = 0;
+    }
+}
+
+ULONG
+MixerSubmit(
+    IN PMIXER_CONTEXT Mixer,
+    IN PMIX_STREAM Stream,
+    IN const FLOAT * Samples,
+    IN ULONG Count)
+{
+    KIRQL OldIrql;
+    ULONG WriteIndex, Chunk, Done;
+
+    if (!Stream->Buffer)
+    {
+        /* half a second of audio, the writer is not supposed to run further ahead */
+        Stream->Size = max(Count, Stream->SamplesPerSec * Stream->Channels / 2);
+        Stream->Buffer = ExAllocatePoolWithTag(NonPagedPool, Stream->Size * sizeof(FLOAT), TAG_KMIXER);
+        if (!Stream->Buffer)
+        {
+            Stream->Size = 0;
+            return 0;
+        }
+    }
+
+    /* keep the newest samples */
+    if (Count > Stream->Size)
+    {
+        Samples += Count - Stream->Size;
+        Count = Stream->Size;
+    }
+
+    KeAcquireSpinLock(&Mixer->Lock, &OldIrql);
+
+    if (Stream->Count + Count > Stream->Size)
+    {
+        Chunk = Stream->Count + Count - Stream->Size;
+        DPRINT("Stream %p overrun, dropping %u samples\n", Stream, Chunk);
+        Stream->ReadIndex = (Stream->ReadIndex + Chunk) % Stream->Size;
+        Stream->Count -= Chunk;
+    }
+
+    WriteIndex = (Stream->ReadIndex + Stream->Count) % Stream->Size;
+    for(Done = 0; Done < Count; Done += Chunk)
+    {
+        Chunk = min(Count - Done, Stream->Size - WriteIndex);
+        RtlCopyMemory(&Stream->Buffer[WriteIndex], &Samples[Done], Chunk * sizeof(FLOAT));
+        WriteIndex = (WriteIndex + Chunk) % Stream->Size;
+    }
+    Stream->Count += Count;
+
+    KeReleaseSpinLock(&Mixer->Lock, OldIrql);
+
+    return Count;
+}
+
+NTSTATUS
+MixerRender(
+    IN PMIXER_CONTEXT Mixer,
+    IN PKSDATAFORMAT_WAVEFORMATEX Format,
+    OUT PVOID Buffer,
+    IN ULONG Frames,
+    OUT PULONG FramesMixed)
+{
+    KFLOATING_SAVE FloatSave;
+    KIRQL OldIrql;
+    NTSTATUS Status;
+    PLIST_ENTRY Entry;
+    PMIX_STREAM Stream;
+    PFLOAT MixBuffer;
+    ULONG Count, Available, Chunk, Done, Mixed = 0;
+
+    Count = Frames * Format->WaveFormatEx.nChannels;
+
+    /* the caller's buffer may be pageable, only the streams are summed
+     * under the spin lock */
+    ExAcquireFastMutex(&Mixer->RenderMutex);
+
+    if (Mixer->MixBufferSize < Count)
+    {
+        MixBuffer = ExAllocatePoolWithTag(NonPagedPool, Count * sizeof(FLOAT), TAG_KMIXER);
+        if (!MixBuffer)
+        {
+            ExReleaseFastMutex(&Mixer->RenderMutex);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        if (Mixer->MixBuffer)
+            ExFreePoolWithTag(Mixer->MixBuffer, TAG_KMIXER);
+        Mixer->MixBuffer = MixBuffer;
+        Mixer->MixBufferSize = Count;
+    }
+
+    Status = KeSaveFloatingPointState(&FloatSave);
+    if (!NT_SUCCESS(Status))
+    {
+        ExReleaseFastMutex(&Mixer->RenderMutex);
+        return Status;
+    }
+
+    RtlZeroMemory(Mixer->MixBuffer, Count * sizeof(FLOAT));
+
+    KeAcquireSpinLock(&Mixer->Lock, &OldIrql);
+
+    /* sum every stream in the requested format, missing samples are silence */
+    for(Entry = Mixer->StreamList.Flink; Entry != &Mixer->StreamList; Entry = Entry->Flink)
+    {
+        Stream = CONTAINING_RECORD(Entry, MIX_STREAM, Entry);
+
+        if (Stream->SamplesPerSec != Format->WaveFormatEx.nSamplesPerSec ||
+            Stream->Channels != Format->WaveFormatEx.nChannels ||
+            !Stream->Count)
+            continue;
+
+        Available = min(Count, Stream->Count);
+        for(Done = 0; Done < Available; Done += Chunk)
+        {
+            Chunk = min(Available - Done, Stream->Size - Stream->ReadIndex);
+            MixAddSamples(&Mixer->MixBuffer[Done], &Stream->Buffer[Stream->ReadIndex], Chunk);
+            Stream->ReadIndex = (Stream->ReadIndex + Chunk) % Stream->Size;
+        }
+        Stream->Count -= Available;
+        Mixed = max(Mixed, Available);
+    }
+
+    KeReleaseSpinLock(&Mixer->Lock, OldIrql);
+
+    MixFloatToPcm(Mixer->MixBuffer, Format->WaveFormatEx.wBitsPerSample, Buffer, Count);
+
+    KeRestoreFloatingPointState(&FloatSave);
+    ExReleaseFastMutex(&Mixer->RenderMutex);
+
+    *FramesMixed = Mixed / Format->WaveFormatEx.nChannels;
+    return STATUS_SUCCESS;
+}
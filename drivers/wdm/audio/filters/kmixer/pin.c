@@ -15,409 +15,192 @@
 
 const GUID KSPROPSETID_Connection              = {0x1D58C920L, 0xAC9B, 0x11CF, {0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00}};
 
-NTSTATUS
-PerformSampleRateConversion(
-    PUCHAR Buffer,
-    ULONG BufferLength,
-    ULONG OldRate,
-    ULONG NewRate,
-    ULONG BytesPerSample,
-    ULONG NumChannels,
-    PVOID * Result,
-    PULONG ResultLength)
+static
+PFLOAT
+GetScratchBuffer(
+    IN PPIN_CONTEXT Pin,
+    IN ULONG Index,
+    IN ULONG Count)
 {
-    KFLOATING_SAVE FloatSave;
-    NTSTATUS Status;
-    ULONG Index;
-    SRC_STATE * State;
-    SRC_DATA Data;
-    PUCHAR ResultOut;
-    int error;
-    PFLOAT FloatIn, FloatOut;
-    ULONG NumSamples;
-    ULONG NewSamples;
-
-    DPRINT("PerformSampleRateConversion OldRate %u NewRate %u BytesPerSample %u NumChannels %u Irql %u\n", OldRate, NewRate, BytesPerSample, NumChannels, KeGetCurrentIrql());
+    PFLOAT Buffer;
 
-    ASSERT(BytesPerSample == 1 || BytesPerSample == 2 || BytesPerSample == 4);
+    if (Pin->ScratchSize[Index] >= Count)
+        return Pin->Scratch[Index];
 
-    /* first acquire float save context */
-    Status = KeSaveFloatingPointState(&FloatSave);
-
-    if (!NT_SUCCESS(Status))
-    {
-        DPRINT1("KeSaveFloatingPointState failed with %x\n", Status);
-        return Status;
-    }
+    Buffer = ExAllocatePool(NonPagedPool, Count * sizeof(FLOAT));
+    if (!Buffer)
+        return NULL;
 
-    NumSamples = BufferLength / (BytesPerSample * NumChannels);
+    if (Pin->Scratch[Index])
+        ExFreePool(Pin->Scratch[Index]);
 
-    FloatIn = ExAllocatePool(NonPagedPool, NumSamples * NumChannels * sizeof(FLOAT));
-    if (!FloatIn)
-    {
-        KeRestoreFloatingPointState(&FloatSave);
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
-
-    NewSamples = ((((ULONG64)NumSamples * NewRate) + (OldRate / 2)) / OldRate) + 2;
+    Pin->Scratch[Index] = Buffer;
+    Pin->ScratchSize[Index] = Count;
+    return Buffer;
+}
 
-    FloatOut = ExAllocatePool(NonPagedPool, NewSamples * NumChannels * sizeof(FLOAT));
-    if (!FloatOut)
-    {
-        ExFreePool(FloatIn);
-        KeRestoreFloatingPointState(&FloatSave);
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
+/*
+ * Converts a buffer in the pin input format to float samples in the pin
+ * output format. Width, channels and rate are converted in one pass over
+ * the pin work buffers; the caller has saved the floating point state.
+ * The resampler lives as long as the pin, so the filter history carries
+ * over from one buffer to the next.
+ */
+NTSTATUS
+PerformConversion(
+    IN PPIN_CONTEXT Pin,
+    IN PUCHAR Buffer,
+    IN ULONG BufferLength,
+    OUT PFLOAT * Result,
+    OUT PULONG ResultCount)
+{
+    PWAVEFORMATEX InputFormat = &Pin->Formats[0].WaveFormatEx;
+    PWAVEFORMATEX OutputFormat = &Pin->Formats[1].WaveFormatEx;
+    ULONG Frames, NewFrames, Count;
+    PFLOAT Current, Other, Swap;
+    SRC_DATA Data;
+    int error;
 
-    ResultOut = ExAllocatePool(NonPagedPool, NewSamples * NumChannels * BytesPerSample);
-    if (!ResultOut)
-    {
-        ExFreePool(FloatIn);
-        ExFreePool(FloatOut);
-        KeRestoreFloatingPointState(&FloatSave);
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
+    DPRINT("PerformConversion Rate %u -> %u Bits %u -> %u Channels %u -> %u Irql %u\n",
+           InputFormat->nSamplesPerSec, OutputFormat->nSamplesPerSec,
+           InputFormat->wBitsPerSample, OutputFormat->wBitsPerSample,
+           InputFormat->nChannels, OutputFormat->nChannels, KeGetCurrentIrql());
 
-    State = src_new(SRC_SINC_FASTEST, NumChannels, &error);
-    if (!State)
-    {
-        DPRINT1("src_new failed with %x\n", error);
-        KeRestoreFloatingPointState(&FloatSave);
-        ExFreePool(FloatIn);
-        ExFreePool(FloatOut);
-        ExFreePool(ResultOut);
-        return STATUS_UNSUCCESSFUL;
-    }
+    if (!InputFormat->nChannels || !OutputFormat->nChannels ||
+        !InputFormat->nSamplesPerSec || !OutputFormat->nSamplesPerSec ||
+        InputFormat->wBitsPerSample % 8 || InputFormat->wBitsPerSample < 8 || InputFormat->wBitsPerSample > 32 ||
+        OutputFormat->wBitsPerSample % 8 || OutputFormat->wBitsPerSample < 8 || OutputFormat->wBitsPerSample > 32)
+        return STATUS_INVALID_DEVICE_STATE;
 
-    /* fixme use asm */
-    if (BytesPerSample == 1)
-    {
-        for(Index = 0; Index < NumSamples * NumChannels; Index++)
-            FloatIn[Index] = (float)(Buffer[Index] / (1.0 * 0x80));
-    }
-    else if (BytesPerSample == 2)
+    Frames = BufferLength / (InputFormat->wBitsPerSample / 8 * InputFormat->nChannels);
+    if (!Frames)
     {
-        src_short_to_float_array((short*)Buffer, FloatIn, NumSamples * NumChannels);
-    }
-    else if (BytesPerSample == 4)
-    {
-        src_int_to_float_array((int*)Buffer, FloatIn, NumSamples * NumChannels);
+        *Result = NULL;
+        *ResultCount = 0;
+        return STATUS_SUCCESS;
     }
 
-    Data.data_in = FloatIn;
-    Data.data_out = FloatOut;
-    Data.input_frames = NumSamples;
-    Data.output_frames = NewSamples;
-    Data.src_ratio = (double)NewRate / (double)OldRate;
+    /* room for the output of the resampler, which may release a little more than the ratio */
+    NewFrames = Frames;
+    if (InputFormat->nSamplesPerSec != OutputFormat->nSamplesPerSec)
+        NewFrames = (ULONG)(((ULONG64)Frames * OutputFormat->nSamplesPerSec) / InputFormat->nSamplesPerSec) + 16;
 
-    error = src_process(State, &Data);
-    if (error)
-    {
-        DPRINT1("src_process failed with %x\n", error);
-        KeRestoreFloatingPointState(&FloatSave);
-        ExFreePool(FloatIn);
-        ExFreePool(FloatOut);
-        ExFreePool(ResultOut);
-        return STATUS_UNSUCCESSFUL;
-    }
+    Count = max(Frames * max(InputFormat->nChannels, OutputFormat->nChannels),
+                NewFrames * OutputFormat->nChannels);
 
-    if (BytesPerSample == 1)
-    {
-        /* FIXME perform over/under clipping */
+    Current = GetScratchBuffer(Pin, 0, Count);
+    Other = GetScratchBuffer(Pin, 1, Count);
+    if (!Current || !Other)
+        return STATUS_INSUFFICIENT_RESOURCES;
 
-        for(Index = 0; Index < Data.output_frames_gen * NumChannels; Index++)
-            ResultOut[Index] = (lrintf(FloatOut[Index]) >> 24);
-    }
-    else if (BytesPerSample == 2)
-    {
-        PUSHORT Res = (PUSHORT)ResultOut;
+    MixPcmToFloat(Buffer, InputFormat->wBitsPerSample, Current, Frames * InputFormat->nChannels);
 
-        src_float_to_short_array(FloatOut, (short*)Res, Data.output_frames_gen * NumChannels);
-    }
-    else if (BytesPerSample == 4)
+    if (InputFormat->nChannels != OutputFormat->nChannels)
     {
-        PULONG Res = (PULONG)ResultOut;
-
-        src_float_to_int_array(FloatOut, (int*)Res, Data.output_frames_gen * NumChannels);
+        MixMapChannels(Current, InputFormat->nChannels, Other, OutputFormat->nChannels, Frames);
+        Swap = Current; Current = Other; Other = Swap;
     }
 
-
-    *Result = ResultOut;
-    *ResultLength = Data.output_frames_gen * BytesPerSample * NumChannels;
-    ExFreePool(FloatIn);
-    ExFreePool(FloatOut);
-    src_delete(State);
-    KeRestoreFloatingPointState(&FloatSave);
-    return STATUS_SUCCESS;
-}
-
-NTSTATUS
-PerformChannelConversion(
-    PUCHAR Buffer,
-    ULONG BufferLength,
-    ULONG OldChannels,
-    ULONG NewChannels,
-    ULONG BitsPerSample,
-    PVOID * Result,
-    PULONG ResultLength)
-{
-    ULONG Samples;
-    ULONG NewIndex, OldIndex;
-
-    Samples = BufferLength / (BitsPerSample / 8) / OldChannels;
-
-    if (NewChannels > OldChannels)
+    if (InputFormat->nSamplesPerSec != OutputFormat->nSamplesPerSec)
     {
-        if (BitsPerSample == 8)
+        if (!Pin->Resampler || Pin->ResamplerChannels != OutputFormat->nChannels)
         {
-            PUCHAR BufferOut = ExAllocatePool(NonPagedPool, Samples * NewChannels);
-            if (!BufferOut)
-                return STATUS_INSUFFICIENT_RESOURCES;
+            if (Pin->Resampler)
+                src_delete(Pin->Resampler);
 
-            for(NewIndex = 0, OldIndex = 0; OldIndex < Samples * OldChannels; NewIndex += NewChannels, OldIndex += OldChannels)
+            Pin->Resampler = src_new(SRC_SINC_FASTEST, OutputFormat->nChannels, &error);
+            if (!Pin->Resampler)
             {
-                ULONG SubIndex = 0;
-
-                RtlMoveMemory(&BufferOut[NewIndex], &Buffer[OldIndex], OldChannels * sizeof(UCHAR));
-
-                do
-                {
-                    /* 2 channel stretched to 4 looks like LRLR */
-                     BufferOut[NewIndex+OldChannels + SubIndex] = Buffer[OldIndex + (SubIndex % OldChannels)];
-                }while(SubIndex++ < NewChannels - OldChannels);
+                DPRINT1("src_new failed with %x\n", error);
+                return STATUS_UNSUCCESSFUL;
             }
-            *Result = BufferOut;
-            *ResultLength = Samples * NewChannels;
+            Pin->ResamplerChannels = OutputFormat->nChannels;
         }
-        else if (BitsPerSample == 16)
-        {
-            PUSHORT BufferOut = ExAllocatePool(NonPagedPool, Samples * NewChannels);
-            if (!BufferOut)
-                return STATUS_INSUFFICIENT_RESOURCES;
-
-            for(NewIndex = 0, OldIndex = 0; OldIndex < Samples * OldChannels; NewIndex += NewChannels, OldIndex += OldChannels)
-            {
-                ULONG SubIndex = 0;
 
-                RtlMoveMemory(&BufferOut[NewIndex], &Buffer[OldIndex], OldChannels * sizeof(USHORT));
+        Data.data_in = Current;
+        Data.data_out = Other;
+        Data.input_frames = Frames;
+        Data.output_frames = NewFrames;
+        Data.end_of_input = 0;
+        Data.src_ratio = (double)OutputFormat->nSamplesPerSec / (double)InputFormat->nSamplesPerSec;
 
-                do
-                {
-                     BufferOut[NewIndex+OldChannels + SubIndex] = Buffer[OldIndex + (SubIndex % OldChannels)];
-                }while(SubIndex++ < NewChannels - OldChannels);
-            }
-            *Result = BufferOut;
-            *ResultLength = Samples * NewChannels;
-        }
-        else if (BitsPerSample == 24)
+        error = src_process(Pin->Resampler, &Data);
+        if (error)
         {
-            PUCHAR BufferOut = ExAllocatePool(NonPagedPool, Samples * NewChannels);
-            if (!BufferOut)
-                return STATUS_INSUFFICIENT_RESOURCES;
-
-            for(NewIndex = 0, OldIndex = 0; OldIndex < Samples * OldChannels; NewIndex += NewChannels, OldIndex += OldChannels)
-            {
-                ULONG SubIndex = 0;
-
-                RtlMoveMemory(&BufferOut[NewIndex], &Buffer[OldIndex], OldChannels * 3);
-
-                do
-                {
-                     RtlMoveMemory(&BufferOut[(NewIndex+OldChannels + SubIndex) * 3], &Buffer[(OldIndex + (SubIndex % OldChannels)) * 3], 3);
-                }while(SubIndex++ < NewChannels - OldChannels);
-            }
-            *Result = BufferOut;
-            *ResultLength = Samples * NewChannels;
-        }
-        else if (BitsPerSample == 32)
-        {
-            PULONG BufferOut = ExAllocatePool(NonPagedPool, Samples * NewChannels);
-            if (!BufferOut)
-                return STATUS_INSUFFICIENT_RESOURCES;
-
-            for(NewIndex = 0, OldIndex = 0; OldIndex < Samples * OldChannels; NewIndex += NewChannels, OldIndex += OldChannels)
-            {
-                ULONG SubIndex = 0;
-
-                RtlMoveMemory(&BufferOut[NewIndex], &Buffer[OldIndex], OldChannels * sizeof(ULONG));
-
-                do
-                {
-                     BufferOut[NewIndex+OldChannels + SubIndex] = Buffer[OldIndex + (SubIndex % OldChannels)];
-                }while(SubIndex++ < NewChannels - OldChannels);
-            }
-            *Result = BufferOut;
-            *ResultLength = Samples * NewChannels;
+            DPRINT1("src_process failed with %x\n", error);
+            return STATUS_UNSUCCESSFUL;
         }
 
+        Frames = Data.output_frames_gen;
+        Current = Other;
     }
-    else
-    {
-        PUSHORT BufferOut = ExAllocatePool(NonPagedPool, Samples * NewChannels);
-        if (!BufferOut)
-            return STATUS_INSUFFICIENT_RESOURCES;
 
-        for(NewIndex = 0, OldIndex = 0; OldIndex < Samples * OldChannels; NewIndex += NewChannels, OldIndex += OldChannels)
-        {
-            /* TODO
-             * mix stream instead of just dumping part of it ;)
-             */
-            RtlMoveMemory(&BufferOut[NewIndex], &Buffer[OldIndex], NewChannels * (BitsPerSample/8));
-        }
-
-        *Result = BufferOut;
-        *ResultLength = Samples * NewChannels;
-    }
+    *Result = Current;
+    *ResultCount = Frames * OutputFormat->nChannels;
     return STATUS_SUCCESS;
 }
 
-
+/*
+ * Writes feed the mixer with the converted stream of the pin, reads
+ * return the sum of all streams of the device in the pin output format.
+ * Only kernel mode clients (sysaudio) stream through the pins, the
+ * stream header is used as is and not probed.
+ */
+static
 NTSTATUS
-PerformQualityConversion(
-    PUCHAR Buffer,
-    ULONG BufferLength,
-    ULONG OldWidth,
-    ULONG NewWidth,
-    PVOID * Result,
-    PULONG ResultLength)
+Pin_StreamIo(
+    PIO_STACK_LOCATION IoStack,
+    PIRP Irp)
 {
-    ULONG Samples;
-    ULONG Index;
-
-    ASSERT(OldWidth != NewWidth);
-
-    Samples = BufferLength / (OldWidth / 8);
-    //DPRINT("Samples %u BufferLength %u\n", Samples, BufferLength);
+    PPIN_CONTEXT Pin = (PPIN_CONTEXT)IoStack->FileObject->FsContext2;
+    PKSSTREAM_HEADER StreamHeader = (PKSSTREAM_HEADER)Irp->UserBuffer;
+    KFLOATING_SAVE FloatSave;
+    NTSTATUS Status;
+    PFLOAT Samples;
+    ULONG Count, FrameSize, Frames;
 
-    if (OldWidth == 8 && NewWidth == 16)
+    if (Irp->RequestorMode != KernelMode)
     {
-         USHORT Sample;
-         PUSHORT BufferOut = ExAllocatePool(NonPagedPool, Samples * sizeof(USHORT));
-         if (!BufferOut)
-             return STATUS_INSUFFICIENT_RESOURCES;
-
-          for(Index = 0; Index < Samples; Index++)
-          {
-              Sample = Buffer[Index];
-              Sample *= 2;
-#ifdef _X86_
-              Sample = _byteswap_ushort(Sample);
-#endif
-              BufferOut[Index] = Sample;
-          }
-          *Result = BufferOut;
-          *ResultLength = Samples * sizeof(USHORT);
+        Status = STATUS_INVALID_DEVICE_REQUEST;
     }
-    else if (OldWidth == 8 && NewWidth == 32)
+    else if (IoStack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(KSSTREAM_HEADER) || !StreamHeader)
     {
-         ULONG Sample;
-         PULONG BufferOut = ExAllocatePool(NonPagedPool, Samples * sizeof(ULONG));
-         if (!BufferOut)
-             return STATUS_INSUFFICIENT_RESOURCES;
-
-          for(Index = 0; Index < Samples; Index++)
-          {
-              Sample = Buffer[Index];
-              Sample *= 16777216;
-#ifdef _X86_
-              Sample = _byteswap_ulong(Sample);
-#endif
-              BufferOut[Index] = Sample;
-          }
-          *Result = BufferOut;
-          *ResultLength = Samples * sizeof(ULONG);
+        Status = STATUS_INVALID_PARAMETER;
     }
-    else if (OldWidth == 16 && NewWidth == 32)
+    else if (IoStack->Parameters.DeviceIoControl.IoControlCode == IOCTL_KS_WRITE_STREAM)
     {
-         ULONG Sample;
-         PUSHORT BufferIn = (PUSHORT)Buffer;
-         PULONG BufferOut = ExAllocatePool(NonPagedPool, Samples * sizeof(ULONG));
-         if (!BufferOut)
-             return STATUS_INSUFFICIENT_RESOURCES;
-
-          for(Index = 0; Index < Samples; Index++)
-          {
-              Sample = BufferIn[Index];
-              Sample *= 65536;
-#ifdef _X86_
-              Sample = _byteswap_ulong(Sample);
-#endif
-              BufferOut[Index] = Sample;
-          }
-          *Result = BufferOut;
-          *ResultLength = Samples * sizeof(ULONG);
-    }
+        Status = KeSaveFloatingPointState(&FloatSave);
+        if (NT_SUCCESS(Status))
+        {
+            Status = PerformConversion(Pin, StreamHeader->Data, StreamHeader->DataUsed, &Samples, &Count);
+            if (NT_SUCCESS(Status) && Count)
+                MixerSubmit(Pin->Mixer, &Pin->Stream, Samples, Count);
 
-    else if (OldWidth == 16 && NewWidth == 8)
-    {
-         USHORT Sample;
-         PUSHORT BufferIn = (PUSHORT)Buffer;
-         PUCHAR BufferOut = ExAllocatePool(NonPagedPool, Samples * sizeof(UCHAR));
-         if (!BufferOut)
-             return STATUS_INSUFFICIENT_RESOURCES;
-
-          for(Index = 0; Index < Samples; Index++)
-          {
-              Sample = BufferIn[Index];
-#ifdef _X86_
-              Sample = _byteswap_ushort(Sample);
-#endif
-              Sample /= 256;
-              BufferOut[Index] = (Sample & 0xFF);
-          }
-          *Result = BufferOut;
-          *ResultLength = Samples * sizeof(UCHAR);
-    }
-    else if (OldWidth == 32 && NewWidth == 8)
-    {
-         ULONG Sample;
-         PULONG BufferIn = (PULONG)Buffer;
-         PUCHAR BufferOut = ExAllocatePool(NonPagedPool, Samples * sizeof(UCHAR));
-         if (!BufferOut)
-             return STATUS_INSUFFICIENT_RESOURCES;
-
-          for(Index = 0; Index < Samples; Index++)
-          {
-              Sample = BufferIn[Index];
-#ifdef _X86_
-              Sample = _byteswap_ulong(Sample);
-#endif
-              Sample /= 16777216;
-              BufferOut[Index] = (Sample & 0xFF);
-          }
-          *Result = BufferOut;
-          *ResultLength = Samples * sizeof(UCHAR);
-    }
-    else if (OldWidth == 32 && NewWidth == 16)
-    {
-         USHORT Sample;
-         PULONG BufferIn = (PULONG)Buffer;
-         PUSHORT BufferOut = ExAllocatePool(NonPagedPool, Samples * sizeof(USHORT));
-         if (!BufferOut)
-             return STATUS_INSUFFICIENT_RESOURCES;
-
-          for(Index = 0; Index < Samples; Index++)
-          {
-              Sample = BufferIn[Index];
-#ifdef _X86_
-              Sample = _byteswap_ulong(Sample);
-#endif
-              Sample /= 65536;
-              BufferOut[Index] = (Sample & 0xFFFF);
-          }
-          *Result = BufferOut;
-          *ResultLength = Samples * sizeof(USHORT);
+            KeRestoreFloatingPointState(&FloatSave);
+        }
     }
     else
     {
-        DPRINT1("Not implemented conversion OldWidth %u NewWidth %u\n", OldWidth, NewWidth);
-        return STATUS_NOT_IMPLEMENTED;
+        FrameSize = Pin->Formats[1].WaveFormatEx.nChannels * (Pin->Formats[1].WaveFormatEx.wBitsPerSample / 8);
+        if (!FrameSize)
+        {
+            Status = STATUS_INVALID_DEVICE_STATE;
+        }
+        else
+        {
+            Status = MixerRender(Pin->Mixer, &Pin->Formats[1], StreamHeader->Data,
+                                 StreamHeader->FrameExtent / FrameSize, &Frames);
+            if (NT_SUCCESS(Status))
+                StreamHeader->DataUsed = StreamHeader->FrameExtent / FrameSize * FrameSize;
+        }
     }
 
-    return STATUS_SUCCESS;
+    Irp->IoStatus.Information = NT_SUCCESS(Status) ? sizeof(KSSTREAM_HEADER) : 0;
+    Irp->IoStatus.Status = Status;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    return Status;
 }
 
-
 NTSTATUS
 NTAPI
 Pin_fnDeviceIoControl(
@@ -438,19 +221,34 @@ Pin_fnDeviceIoControl(
         {
             if (Property->Property.Id == KSPROPERTY_CONNECTION_DATAFORMAT && Property->Property.Flags == KSPROPERTY_TYPE_SET)
             {
-                PKSDATAFORMAT_WAVEFORMATEX Formats;
+                PPIN_CONTEXT Pin;
                 PKSDATAFORMAT_WAVEFORMATEX WaveFormat;
 
-                Formats = (PKSDATAFORMAT_WAVEFORMATEX)IoStack->FileObject->FsContext2;
+                Pin = (PPIN_CONTEXT)IoStack->FileObject->FsContext2;
                 WaveFormat = (PKSDATAFORMAT_WAVEFORMATEX)Irp->UserBuffer;
 
                 ASSERT(Property->PinId == 0 || Property->PinId == 1);
-                ASSERT(Formats);
+                ASSERT(Pin);
                 ASSERT(WaveFormat);
 
-                Formats[Property->PinId].WaveFormatEx.nChannels = WaveFormat->WaveFormatEx.nChannels;
-                Formats[Property->PinId].WaveFormatEx.wBitsPerSample = WaveFormat->WaveFormatEx.wBitsPerSample;
-                Formats[Property->PinId].WaveFormatEx.nSamplesPerSec = WaveFormat->WaveFormatEx.nSamplesPerSec;
+                Pin->Formats[Property->PinId].WaveFormatEx.nChannels = WaveFormat->WaveFormatEx.nChannels;
+                Pin->Formats[Property->PinId].WaveFormatEx.wBitsPerSample = WaveFormat->WaveFormatEx.wBitsPerSample;
+                Pin->Formats[Property->PinId].WaveFormatEx.nSamplesPerSec = WaveFormat->WaveFormatEx.nSamplesPerSec;
+
+                /* a new format starts a new stream */
+                if (Pin->Resampler)
+                {
+                    src_delete(Pin->Resampler);
+                    Pin->Resampler = NULL;
+                }
+
+                if (Property->PinId == 1)
+                {
+                    MixerRemoveStream(Pin->Mixer, &Pin->Stream);
+                    Pin->Stream.SamplesPerSec = WaveFormat->WaveFormatEx.nSamplesPerSec;
+                    Pin->Stream.Channels = WaveFormat->WaveFormatEx.nChannels;
+                    MixerAddStream(Pin->Mixer, &Pin->Stream);
+                }
 
                 Irp->IoStatus.Information = 0;
                 Irp->IoStatus.Status = STATUS_SUCCESS;
@@ -459,6 +257,13 @@ Pin_fnDeviceIoControl(
             }
         }
     }
+
+    if (IoStack->Parameters.DeviceIoControl.IoControlCode == IOCTL_KS_WRITE_STREAM ||
+        IoStack->Parameters.DeviceIoControl.IoControlCode == IOCTL_KS_READ_STREAM)
+    {
+        return Pin_StreamIo(IoStack, Irp);
+    }
+
     DPRINT1("Size %u Expected %u\n",IoStack->Parameters.DeviceIoControl.OutputBufferLength,  sizeof(KSDATAFORMAT_WAVEFORMATEX));
     Irp->IoStatus.Information = 0;
     Irp->IoStatus.Status = STATUS_UNSUCCESSFUL;
@@ -514,7 +319,24 @@ Pin_fnClose(
     PDEVICE_OBJECT DeviceObject,
     PIRP Irp)
 {
-    UNIMPLEMENTED;
+    PIO_STACK_LOCATION IoStack;
+    PPIN_CONTEXT Pin;
+
+    IoStack = IoGetCurrentIrpStackLocation(Irp);
+    Pin = (PPIN_CONTEXT)IoStack->FileObject->FsContext2;
+
+    if (Pin)
+    {
+        MixerRemoveStream(Pin->Mixer, &Pin->Stream);
+        if (Pin->Resampler)
+            src_delete(Pin->Resampler);
+        if (Pin->Scratch[0])
+            ExFreePool(Pin->Scratch[0]);
+        if (Pin->Scratch[1])
+            ExFreePool(Pin->Scratch[1]);
+        ExFreePool(Pin);
+        IoStack->FileObject->FsContext2 = NULL;
+    }
 
     Irp->IoStatus.Status = STATUS_SUCCESS;
     Irp->IoStatus.Information = 0;
@@ -602,17 +424,19 @@ Pin_fnFastWrite(
 {
     PKSSTREAM_HEADER StreamHeader;
     PVOID BufferOut;
-    ULONG BufferLength;
-    NTSTATUS Status = STATUS_SUCCESS;
-    PKSDATAFORMAT_WAVEFORMATEX Formats;
+    PFLOAT Samples;
+    ULONG Count;
+    KFLOATING_SAVE FloatSave;
+    NTSTATUS Status;
+    PPIN_CONTEXT Pin;
     PKSDATAFORMAT_WAVEFORMATEX InputFormat, OutputFormat;
 
     DPRINT("Pin_fnFastWrite called DeviceObject %p Irp %p\n", DeviceObject);
 
-    Formats = (PKSDATAFORMAT_WAVEFORMATEX)FileObject->FsContext2;
+    Pin = (PPIN_CONTEXT)FileObject->FsContext2;
 
-    InputFormat = Formats;
-    OutputFormat = (Formats + 1);
+    InputFormat = &Pin->Formats[0];
+    OutputFormat = &Pin->Formats[1];
     StreamHeader = (PKSSTREAM_HEADER)Buffer;
 
 
@@ -621,56 +445,36 @@ Pin_fnFastWrite(
                InputFormat->WaveFormatEx.nSamplesPerSec, OutputFormat->WaveFormatEx.nSamplesPerSec,
                InputFormat->WaveFormatEx.wBitsPerSample, OutputFormat->WaveFormatEx.wBitsPerSample);
 
-    if (InputFormat->WaveFormatEx.wBitsPerSample != OutputFormat->WaveFormatEx.wBitsPerSample)
+    if (InputFormat->WaveFormatEx.wBitsPerSample == OutputFormat->WaveFormatEx.wBitsPerSample &&
+        InputFormat->WaveFormatEx.nChannels == OutputFormat->WaveFormatEx.nChannels &&
+        InputFormat->WaveFormatEx.nSamplesPerSec == OutputFormat->WaveFormatEx.nSamplesPerSec)
     {
-        Status = PerformQualityConversion(StreamHeader->Data,
-                                          StreamHeader->DataUsed,
-                                          InputFormat->WaveFormatEx.wBitsPerSample,
-                                          OutputFormat->WaveFormatEx.wBitsPerSample,
-                                          &BufferOut,
-                                          &BufferLength);
-        if (NT_SUCCESS(Status))
-        {
-            ExFreePool(StreamHeader->Data);
-            StreamHeader->Data = BufferOut;
-            StreamHeader->DataUsed = BufferLength;
-        }
+        IoStatus->Status = STATUS_SUCCESS;
+        return TRUE;
     }
 
-    if (InputFormat->WaveFormatEx.nChannels != OutputFormat->WaveFormatEx.nChannels)
+    Status = KeSaveFloatingPointState(&FloatSave);
+    if (NT_SUCCESS(Status))
     {
-        Status = PerformChannelConversion(StreamHeader->Data,
-                                          StreamHeader->DataUsed,
-                                          InputFormat->WaveFormatEx.nChannels,
-                                          OutputFormat->WaveFormatEx.nChannels,
-                                          OutputFormat->WaveFormatEx.wBitsPerSample,
-                                          &BufferOut,
-                                          &BufferLength);
-
+        Status = PerformConversion(Pin, StreamHeader->Data, StreamHeader->DataUsed, &Samples, &Count);
         if (NT_SUCCESS(Status))
         {
-            ExFreePool(StreamHeader->Data);
-            StreamHeader->Data = BufferOut;
-            StreamHeader->DataUsed = BufferLength;
-        }
-    }
+            BufferOut = ExAllocatePool(NonPagedPool, max(Count * (OutputFormat->WaveFormatEx.wBitsPerSample / 8), 1));
+            if (BufferOut)
+            {
+                MixFloatToPcm(Samples, OutputFormat->WaveFormatEx.wBitsPerSample, BufferOut, Count);
 
-    if (InputFormat->WaveFormatEx.nSamplesPerSec != OutputFormat->WaveFormatEx.nSamplesPerSec)
-    {
-        Status = PerformSampleRateConversion(StreamHeader->Data,
-                                             StreamHeader->DataUsed,
-                                             InputFormat->WaveFormatEx.nSamplesPerSec,
-                                             OutputFormat->WaveFormatEx.nSamplesPerSec,
-                                             OutputFormat->WaveFormatEx.wBitsPerSample / 8,
-                                             OutputFormat->WaveFormatEx.nChannels,
-                                             &BufferOut,
-                                             &BufferLength);
-        if (NT_SUCCESS(Status))
-        {
-            ExFreePool(StreamHeader->Data);
-            StreamHeader->Data = BufferOut;
-            StreamHeader->DataUsed = BufferLength;
+                ExFreePool(StreamHeader->Data);
+                StreamHeader->Data = BufferOut;
+                StreamHeader->DataUsed = Count * (OutputFormat->WaveFormatEx.wBitsPerSample / 8);
+            }
+            else
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+            }
         }
+
+        KeRestoreFloatingPointState(&FloatSave);
     }
 
     IoStatus->Status = Status;
@@ -701,21 +505,34 @@ CreatePin(
 {
     NTSTATUS Status;
     KSOBJECT_HEADER ObjectHeader;
-    PKSDATAFORMAT DataFormat;
+    PPIN_CONTEXT Pin;
     PIO_STACK_LOCATION IoStack;
+    PKMIXER_DEVICE_EXT DeviceExtension;
 
 
-    DataFormat = ExAllocatePool(NonPagedPool, sizeof(KSDATAFORMAT_WAVEFORMATEX) * 2);
-    if (!DataFormat)
+    Pin = ExAllocatePool(NonPagedPool, sizeof(PIN_CONTEXT));
+    if (!Pin)
         return STATUS_INSUFFICIENT_RESOURCES;
 
-    RtlZeroMemory(DataFormat, sizeof(KSDATAFORMAT_WAVEFORMATEX) * 2);
+    RtlZeroMemory(Pin, sizeof(PIN_CONTEXT));
 
     IoStack = IoGetCurrentIrpStackLocation(Irp);
-    IoStack->FileObject->FsContext2 = (PVOID)DataFormat;
+    DeviceExtension = (PKMIXER_DEVICE_EXT)IoStack->DeviceObject->DeviceExtension;
+
+    /* every pin contributes one stream to the device mix */
+    Pin->Mixer = &DeviceExtension->Mixer;
+    MixerAddStream(Pin->Mixer, &Pin->Stream);
+
+    IoStack->FileObject->FsContext2 = (PVOID)Pin;
 
     /* allocate object header */
     Status = KsAllocateObjectHeader(&ObjectHeader, 0, NULL, Irp, &PinTable);
+    if (!NT_SUCCESS(Status))
+    {
+        MixerRemoveStream(Pin->Mixer, &Pin->Stream);
+        IoStack->FileObject->FsContext2 = NULL;
+        ExFreePool(Pin);
+    }
     return Status;
 }
 
@@ -0,0 +1,173 @@
+/*
+ * Named rop microbenchmark
+ *
+ * Runs every named rop through the DIB_8BPP_BitBlt, DIB_16BPP_BitBlt and
+ * DIB_32BPP_BitBlt that sdk/tools/gendib generates (BLACKNESS and
+ * WHITENESS are color fills, NOOP does nothing and a plain SRCCOPY is a
+ * RtlMoveMemory per line, so those are left out), once with the pixel
+ * loops and once with the SSE2 row kernels of DIB_XXBPP_BitBltRows
+ * (dibropgen.c). The brush is solid and the source an untranslated surface
+ * of the same format, with unaligned lines. The small blts show where
+ * BITBLT_ROWS_SSE2_MIN_BYTES leaves them to the pixel loops.
+ *
+ * This is a host program for gcc or clang (the kernels use vector
+ * extensions), built against the generated files with the win32k.h next
+ * to it:
+ *
+ *   cc -O2 ../../../../sdk/tools/gendib/gendib.c -o gendib
+ *   mkdir -p gen && ./gendib gen
+ *   cc -O2 -I. -I../../../../sdk/include/host ropbench.c gen/dib8gen.c \
+ *      gen/dib16gen.c gen/dib32gen.c gen/dibropgen.c -o ropbench
+ */
+
+#include <time.h>
+#include "win32k.h"
+
+BOOLEAN RopBenchSse2;
+ULONG RopBenchRowBlts;
+
+typedef BOOLEAN (*PFN_BITBLT)(PBLTINFO);
+
+#define ROP_ENTRY(Name, Rop3) { #Name, (Rop3) | ((Rop3) << 8) }
+
+static const struct
+{
+    const char *pszName;
+    ROP4 Rop4;
+} gaRops[] =
+{
+    ROP_ENTRY(NOTSRCERASE, 0x11),
+    ROP_ENTRY(NOTSRCCOPY, 0x33),
+    ROP_ENTRY(SRCERASE, 0x44),
+    ROP_ENTRY(DSTINVERT, 0x55),
+    ROP_ENTRY(PATINVERT, 0x5a),
+    ROP_ENTRY(SRCINVERT, 0x66),
+    ROP_ENTRY(SRCAND, 0x88),
+    ROP_ENTRY(MERGEPAINT, 0xbb),
+    ROP_ENTRY(MERGECOPY, 0xc0),
+    ROP_ENTRY(SRCPAINT, 0xee),
+    ROP_ENTRY(PATCOPY, 0xf0),
+    ROP_ENTRY(PATPAINT, 0xfb),
+};
+
+static const struct
+{
+    ULONG iFormat;
+    ULONG cjPixel;
+    PFN_BITBLT pfnBitBlt;
+} gaFormats[] =
+{
+    { BMF_8BPP, 1, DIB_8BPP_BitBlt },
+    { BMF_16BPP, 2, DIB_16BPP_BitBlt },
+    { BMF_32BPP, 4, DIB_32BPP_BitBlt },
+};
+
+/* Every size is blted cBlts times, the whole surface each time */
+static const struct
+{
+    ULONG cx, cy, cBlts;
+} gaSizes[] =
+{
+    { 8, 8, 200000 },
+    { 32, 32, 50000 },
+    { 1920, 1080, 20 },
+};
+
+/* Returns the time of one blt in microseconds */
+static double Run(PFN_BITBLT pfnBitBlt, PBLTINFO pBltInfo, ULONG cBlts)
+{
+    clock_t start = clock();
+    ULONG n;
+
+    for (n = 0; n < cBlts; n++)
+        pfnBitBlt(pBltInfo);
+
+    return (double)(clock() - start) / CLOCKS_PER_SEC * 1e6 / cBlts;
+}
+
+int main(void)
+{
+    UCHAR *pjSource, *pjDest1, *pjDest2, *pjInit;
+    SURFOBJ DestSurface, SourceSurface;
+    BRUSHOBJ Brush;
+    BLTINFO BltInfo;
+    unsigned int f, s, r;
+    size_t cj, i;
+    double t1, t2;
+
+    cj = (size_t)1920 * 1080 * 4;
+    /* Offset the source by 4 bytes so that its loads are unaligned */
+    pjSource = (UCHAR *)aligned_alloc(64, cj + 64) + 4;
+    pjInit = aligned_alloc(64, cj);
+    pjDest1 = aligned_alloc(64, cj);
+    pjDest2 = aligned_alloc(64, cj);
+
+    srand(1);
+    for (i = 0; i < cj; i++)
+    {
+        pjSource[i] = (UCHAR)rand();
+        pjInit[i] = (UCHAR)rand();
+    }
+
+    memset(&BltInfo, 0, sizeof(BltInfo));
+    BltInfo.DestSurface = &DestSurface;
+    BltInfo.SourceSurface = &SourceSurface;
+    BltInfo.Brush = &Brush;
+
+    printf("%-5s %-10s %-12s %12s %12s %8s %5s\n", "bpp", "size", "rop",
+           "pixel loops", "sse2 rows", "speedup", "rows");
+    for (f = 0; f < sizeof(gaFormats) / sizeof(gaFormats[0]); f++)
+    {
+        ULONG cjPixel = gaFormats[f].cjPixel;
+
+        Brush.iSolidColor = 0x00336699 & (0xffffffff >> (32 - 8 * cjPixel));
+        for (s = 0; s < sizeof(gaSizes) / sizeof(gaSizes[0]); s++)
+        {
+            ULONG cx = gaSizes[s].cx, cy = gaSizes[s].cy;
+            size_t cjSurface = (size_t)cx * cy * cjPixel;
+            char szSize[16];
+
+            DestSurface.sizlBitmap.cx = SourceSurface.sizlBitmap.cx = cx;
+            DestSurface.sizlBitmap.cy = SourceSurface.sizlBitmap.cy = cy;
+            DestSurface.lDelta = SourceSurface.lDelta = cx * cjPixel;
+            DestSurface.iBitmapFormat = gaFormats[f].iFormat;
+            SourceSurface.iBitmapFormat = gaFormats[f].iFormat;
+            SourceSurface.pvScan0 = pjSource;
+            BltInfo.DestRect.right = cx;
+            BltInfo.DestRect.bottom = cy;
+
+            sprintf(szSize, "%ux%u", cx, cy);
+            for (r = 0; r < sizeof(gaRops) / sizeof(gaRops[0]); r++)
+            {
+                BltInfo.Rop4 = gaRops[r].Rop4;
+
+                /* Every blt works on the previous result, start both from
+                   the same pixels so the results can be compared */
+                memcpy(pjDest1, pjInit, cjSurface);
+                memcpy(pjDest2, pjInit, cjSurface);
+
+                RopBenchSse2 = FALSE;
+                DestSurface.pvScan0 = pjDest1;
+                t1 = Run(gaFormats[f].pfnBitBlt, &BltInfo, gaSizes[s].cBlts);
+
+                RopBenchSse2 = TRUE;
+                RopBenchRowBlts = 0;
+                DestSurface.pvScan0 = pjDest2;
+                t2 = Run(gaFormats[f].pfnBitBlt, &BltInfo, gaSizes[s].cBlts);
+
+                if (memcmp(pjDest1, pjDest2, cjSurface) != 0)
+                {
+                    printf("%u bpp %s %s: results differ\n", 8 * cjPixel,
+                           szSize, gaRops[r].pszName);
+                    return 1;
+                }
+
+                printf("%-5u %-10s %-12s %9.3f us %9.3f us %7.2fx %5s\n",
+                       8 * cjPixel, szSize, gaRops[r].pszName, t1, t2,
+                       t2 > 0 ? t1 / t2 : 0.0, RopBenchRowBlts ? "yes" : "no");
+            }
+        }
+    }
+
+    return 0;
+}
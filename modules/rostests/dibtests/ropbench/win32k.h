@@ -0,0 +1,159 @@
+/*
+ * Just enough of win32k.h and the kernel to build the dib8gen.c,
+ * dib16gen.c, dib32gen.c and dibropgen.c that sdk/tools/gendib generates
+ * for ropbench with the host headers (sdk/include/host). Only what the
+ * named rops with a solid brush and an untranslated source reach is real,
+ * everything else stops the bench.
+ */
+
+#ifndef _ROPBENCH_WIN32K_H
+#define _ROPBENCH_WIN32K_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <typedefs.h>
+
+#if defined(__x86_64__) && !defined(_M_AMD64)
+#define _M_AMD64
+#elif defined(__i386__) && !defined(_M_IX86)
+#define _M_IX86
+#endif
+
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+
+#define STATUS_SUCCESS                   ((NTSTATUS)0x00000000)
+#define PF_XMMI64_INSTRUCTIONS_AVAILABLE 10
+
+#define BMF_1BPP  1
+#define BMF_4BPP  2
+#define BMF_8BPP  3
+#define BMF_16BPP 4
+#define BMF_24BPP 5
+#define BMF_32BPP 6
+
+#define XO_TRIVIAL 0x00000001
+
+#define ROP4_USES_SOURCE(Rop4)  ((((Rop4) & 0xCCCC) >> 2) != ((Rop4) & 0x3333))
+#define ROP4_USES_PATTERN(Rop4) ((((Rop4) & 0xF0F0) >> 4) != ((Rop4) & 0x0F0F))
+
+typedef BYTE *PBYTE;
+typedef ULONG ROP4;
+typedef ULONG KFLOATING_SAVE;
+
+typedef struct _RECTL
+{
+    LONG left;
+    LONG top;
+    LONG right;
+    LONG bottom;
+} RECTL;
+
+typedef struct _POINTL
+{
+    LONG x;
+    LONG y;
+} POINTL;
+
+typedef struct _SIZEL
+{
+    LONG cx;
+    LONG cy;
+} SIZEL;
+
+typedef struct _SURFOBJ
+{
+    SIZEL sizlBitmap;
+    PVOID pvScan0;
+    LONG lDelta;
+    ULONG iBitmapFormat;
+} SURFOBJ;
+
+typedef struct _BRUSHOBJ
+{
+    ULONG iSolidColor;
+} BRUSHOBJ;
+
+typedef struct _XLATEOBJ
+{
+    ULONG flXlate;
+} XLATEOBJ;
+
+typedef struct _BLTINFO
+{
+    SURFOBJ *DestSurface;
+    SURFOBJ *SourceSurface;
+    SURFOBJ *PatternSurface;
+    XLATEOBJ *XlateSourceToDest;
+    RECTL DestRect;
+    POINTL SourcePoint;
+    BRUSHOBJ *Brush;
+    POINTL BrushOrigin;
+    ROP4 Rop4;
+} BLTINFO, *PBLTINFO;
+
+/* Set by the bench to run DIB_XXBPP_BitBltRows or the pixel loops */
+extern BOOLEAN RopBenchSse2;
+/* Blts that went through DIB_XXBPP_BitBltRows */
+extern ULONG RopBenchRowBlts;
+
+static __inline BOOLEAN
+ExIsProcessorFeaturePresent(ULONG ProcessorFeature)
+{
+    return PF_XMMI64_INSTRUCTIONS_AVAILABLE == ProcessorFeature &&
+           RopBenchSse2 && __builtin_cpu_supports("sse2");
+}
+
+static __inline NTSTATUS
+KeSaveFloatingPointState(KFLOATING_SAVE *Save)
+{
+    UNREFERENCED_PARAMETER(Save);
+    RopBenchRowBlts++;
+    return STATUS_SUCCESS;
+}
+
+static __inline NTSTATUS
+KeRestoreFloatingPointState(KFLOATING_SAVE *Save)
+{
+    UNREFERENCED_PARAMETER(Save);
+    return STATUS_SUCCESS;
+}
+
+static __inline VOID
+RopBenchNotReached(const char *Function)
+{
+    fprintf(stderr, "%s is not part of the bench\n", Function);
+    exit(1);
+}
+
+static __inline ULONG
+XLATEOBJ_iXlate(XLATEOBJ *XlateObj, ULONG Color)
+{
+    UNREFERENCED_PARAMETER(XlateObj);
+    RopBenchNotReached(__FUNCTION__);
+    return Color;
+}
+
+static __inline ULONG
+DIB_DoRop(ULONG Rop, ULONG Dest, ULONG Source, ULONG Pattern)
+{
+    UNREFERENCED_PARAMETER(Rop);
+    UNREFERENCED_PARAMETER(Source);
+    UNREFERENCED_PARAMETER(Pattern);
+    RopBenchNotReached(__FUNCTION__);
+    return Dest;
+}
+
+#define DIB_GetSourceIndex(SourceSurf, sx, sy) \
+    (RopBenchNotReached(__FUNCTION__), 0)
+
+#define DIB_8BPP_ColorFill(Surf, Rect, Color)  RopBenchNotReached(__FUNCTION__)
+#define DIB_16BPP_ColorFill(Surf, Rect, Color) RopBenchNotReached(__FUNCTION__)
+#define DIB_32BPP_ColorFill(Surf, Rect, Color) RopBenchNotReached(__FUNCTION__)
+
+BOOLEAN DIB_8BPP_BitBlt(PBLTINFO);
+BOOLEAN DIB_16BPP_BitBlt(PBLTINFO);
+BOOLEAN DIB_32BPP_BitBlt(PBLTINFO);
+BOOLEAN DIB_XXBPP_BitBltRows(PBLTINFO);
+
+#endif /* _ROPBENCH_WIN32K_H */
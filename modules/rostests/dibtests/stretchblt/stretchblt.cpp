@@ -18,6 +18,7 @@
 //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 #include <windows.h>
 #include <stdio.h>
+#include <string.h>
 //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
 
 
@@ -35,6 +36,120 @@ LRESULT CALLBACK MainWndProc(HWND HWnd, UINT Msg, WPARAM WParam,
    LPARAM LParam);
 
 
+// Benchmark mode (pass /bench on the command line): times StretchBlt
+// between DIB sections of each depth, enlarging and reducing, with
+// COLORONCOLOR and HALFTONE, and shows the results in a message box.
+static HBITMAP CreateBenchDIB(HDC hdc, int bpp, int cx, int cy)
+{
+   struct
+   {
+      BITMAPINFOHEADER bmiHeader;
+      RGBQUAD bmiColors[256];
+   } bmi;
+   void* pvBits = NULL;
+
+   memset(&bmi, 0, sizeof(bmi));
+   bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+   bmi.bmiHeader.biWidth = cx;
+   bmi.bmiHeader.biHeight = -cy;
+   bmi.bmiHeader.biPlanes = 1;
+   bmi.bmiHeader.biBitCount = (WORD)bpp;
+   bmi.bmiHeader.biCompression = BI_RGB;
+   for (int i = 0; i < 256; ++i)
+   {
+      bmi.bmiColors[i].rgbRed = (BYTE)i;
+      bmi.bmiColors[i].rgbGreen = (BYTE)(255 - i);
+      bmi.bmiColors[i].rgbBlue = (BYTE)(i * 7);
+   }
+
+   HBITMAP hbm = CreateDIBSection(hdc, (BITMAPINFO*)&bmi, DIB_RGB_COLORS,
+                                  &pvBits, NULL, 0);
+   if (hbm && pvBits)
+   {
+      // fill with a pattern so that filtering has something to do
+      BYTE* pb = (BYTE*)pvBits;
+      int stride = ((cx * bpp + 31) / 32) * 4;
+      for (int y = 0; y < cy; ++y)
+         for (int x = 0; x < stride; ++x)
+            pb[y * stride + x] = (BYTE)(x * 13 + y * 7);
+   }
+   return hbm;
+}
+
+static void RunBenchmark()
+{
+   static const int depths[] = { 32, 24, 16, 8 };
+   static const struct { int scx, scy, dcx, dcy; } sizes[] =
+   {
+      { 320, 240, 1024, 768 },   // enlarge
+      { 1024, 768, 320, 240 }    // reduce
+   };
+   static const int modes[] = { COLORONCOLOR, HALFTONE };
+   const int loops = 20;
+
+   char text[2048] = "";
+   char line[128];
+   LARGE_INTEGER freq, start, stop;
+   QueryPerformanceFrequency(&freq);
+
+   HDC hdcScreen = GetDC(NULL);
+   HDC hdcSrc = CreateCompatibleDC(hdcScreen);
+   HDC hdcDst = CreateCompatibleDC(hdcScreen);
+
+   for (int d = 0; d < 4; ++d)
+   {
+      for (int s = 0; s < 2; ++s)
+      {
+         HBITMAP hbmSrc = CreateBenchDIB(hdcScreen, depths[d],
+                                         sizes[s].scx, sizes[s].scy);
+         HBITMAP hbmDst = CreateBenchDIB(hdcScreen, depths[d],
+                                         sizes[s].dcx, sizes[s].dcy);
+         if (!hbmSrc || !hbmDst)
+         {
+            if (hbmSrc) DeleteObject(hbmSrc);
+            if (hbmDst) DeleteObject(hbmDst);
+            continue;
+         }
+         HGDIOBJ hOldSrc = SelectObject(hdcSrc, hbmSrc);
+         HGDIOBJ hOldDst = SelectObject(hdcDst, hbmDst);
+
+         for (int m = 0; m < 2; ++m)
+         {
+            SetStretchBltMode(hdcDst, modes[m]);
+            SetBrushOrgEx(hdcDst, 0, 0, NULL);
+            QueryPerformanceCounter(&start);
+            for (int i = 0; i < loops; ++i)
+            {
+               StretchBlt(hdcDst, 0, 0, sizes[s].dcx, sizes[s].dcy,
+                          hdcSrc, 0, 0, sizes[s].scx, sizes[s].scy, SRCCOPY);
+            }
+            GdiFlush();
+            QueryPerformanceCounter(&stop);
+
+            double ms = (double)(stop.QuadPart - start.QuadPart) * 1000.0 /
+                        (double)freq.QuadPart / loops;
+            sprintf(line, "%2d bpp %4dx%-4d -> %4dx%-4d %-12s %8.2f ms\n",
+                    depths[d], sizes[s].scx, sizes[s].scy,
+                    sizes[s].dcx, sizes[s].dcy,
+                    modes[m] == HALFTONE ? "HALFTONE" : "COLORONCOLOR", ms);
+            strcat(text, line);
+         }
+
+         SelectObject(hdcSrc, hOldSrc);
+         SelectObject(hdcDst, hOldDst);
+         DeleteObject(hbmSrc);
+         DeleteObject(hbmDst);
+      }
+   }
+
+   DeleteDC(hdcSrc);
+   DeleteDC(hdcDst);
+   ReleaseDC(NULL, hdcScreen);
+
+   MessageBoxA(NULL, text, "StretchBlt benchmark", MB_OK);
+}
+
+
 int APIENTRY WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance,
     LPTSTR lpCmdLine, int nCmdShow)
 {
@@ -42,6 +157,12 @@ int APIENTRY WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance,
    HPrevInst = HPrevInstance;
    cmdline = lpCmdLine;
 
+   if (lpCmdLine && strstr(lpCmdLine, "/bench"))
+   {
+      RunBenchmark();
+      return 0;
+   }
+
    WNDCLASS wc;
    memset(&wc, 0, sizeof(WNDCLASS));
 
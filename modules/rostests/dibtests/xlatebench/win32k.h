@@ -0,0 +1,226 @@
+/*
+ * Just enough of win32k.h to build win32ss/gdi/eng/xlateobj.c for
+ * xlatebench with the host headers (sdk/include/host). The palettes are
+ * plain structures set up by the bench, and the palette helpers are
+ * copies of the ones in win32ss/gdi/ntgdi/palette.c.
+ */
+
+#ifndef _XLATEBENCH_WIN32K_H
+#define _XLATEBENCH_WIN32K_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <typedefs.h>
+
+#define FASTCALL
+#define FORCEINLINE static __inline
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
+#define _Notnull_
+#define _Out_cap_(s)
+#define _In_reads_(s)
+#define _Out_writes_(s)
+#define _Post_satisfies_(e)
+#define _Function_class_(f)
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+#define RTL_NUMBER_OF(a) (sizeof(a) / sizeof((a)[0]))
+#define InterlockedIncrement(p) (++*(p))
+#define EngAllocMem(Flags, Size, Tag) malloc(Size)
+#define EngFreeMem(p) free(p)
+
+typedef ULONG FLONG, COLORREF;
+
+#define RGB(r, g, b) ((COLORREF)(((BYTE)(r) | ((WORD)((BYTE)(g)) << 8)) | \
+                                 (((DWORD)(BYTE)(b)) << 16)))
+#define GetRValue(rgb) ((BYTE)(rgb))
+#define GetGValue(rgb) ((BYTE)(((WORD)(rgb)) >> 8))
+#define GetBValue(rgb) ((BYTE)((rgb) >> 16))
+
+#define XO_TRIVIAL       0x00000001
+#define XO_TABLE         0x00000002
+#define XO_TO_MONO       0x00000004
+#define XO_SRCPALETTE    1
+#define XO_DESTPALETTE   2
+#define XO_DESTDCPALETTE 3
+#define XO_SRCBITFIELDS  4
+#define XO_DESTBITFIELDS 5
+
+#define PAL_INDEXED    0x00000001
+#define PAL_BITFIELDS  0x00000002
+#define PAL_RGB        0x00000004
+#define PAL_BGR        0x00000008
+#define PAL_MONOCHROME 0x00002000
+#define PAL_RGB16_555  0x00200000
+#define PAL_RGB16_565  0x00400000
+
+#define GDITAG_PXLATE 'gtlx'
+
+typedef struct _XLATEOBJ
+{
+    ULONG iUniq;
+    FLONG flXlate;
+    USHORT iSrcType;
+    USHORT iDstType;
+    ULONG cEntries;
+    ULONG *pulXlate;
+} XLATEOBJ;
+
+typedef struct _PALETTEENTRY
+{
+    BYTE peRed;
+    BYTE peGreen;
+    BYTE peBlue;
+    BYTE peFlags;
+} PALETTEENTRY, *PPALETTEENTRY;
+
+typedef struct _PALETTE
+{
+    FLONG flFlags;
+    ULONG NumColors;
+    PALETTEENTRY *IndexedColors;
+    ULONG RedMask;
+    ULONG GreenMask;
+    ULONG BlueMask;
+    ULONG ulRedShift;
+    ULONG ulGreenShift;
+    ULONG ulBlueShift;
+} PALETTE, *PPALETTE;
+
+typedef struct _SURFACE
+{
+    PPALETTE ppal;
+} SURFACE, *PSURFACE;
+
+typedef struct _DC_ATTR
+{
+    COLORREF crBackgroundClr;
+    COLORREF crForegroundClr;
+} DC_ATTR;
+
+typedef struct _DCLEVEL
+{
+    PSURFACE pSurface;
+    PPALETTE ppal;
+} DCLEVEL;
+
+typedef struct _DC
+{
+    DCLEVEL dclevel;
+    DC_ATTR *pdcattr;
+} DC, *PDC;
+
+extern PALETTE gpalRGB, *gppalMono;
+
+static __inline ULONG
+_rotl(ULONG Value, int Shift)
+{
+    Shift &= 31;
+    return Shift ? (Value << Shift) | (Value >> (32 - Shift)) : Value;
+}
+
+static __inline BOOLEAN
+BitScanReverse(ULONG *Index, ULONG Mask)
+{
+    *Index = Mask ? 31 - __builtin_clz(Mask) : 0;
+    return Mask != 0;
+}
+
+FORCEINLINE
+ULONG
+CalculateShift(ULONG ulMask1, ULONG ulMask2)
+{
+    ULONG ulShift1, ulShift2;
+    BitScanReverse(&ulShift1, ulMask1);
+    BitScanReverse(&ulShift2, ulMask2);
+    ulShift2 -= ulShift1;
+    if ((INT)ulShift2 < 0) ulShift2 += 32;
+    return ulShift2;
+}
+
+static __inline ULONG
+PALETTE_ulGetNearestPaletteIndex(PALETTE *ppal, ULONG iColor)
+{
+    ULONG ulDiff, ulColorDiff, ulMinimalDiff = 0xFFFFFF;
+    ULONG i, ulBestIndex = 0;
+    PALETTEENTRY peColor;
+
+    memcpy(&peColor, &iColor, sizeof(peColor));
+
+    for (i = 0; i < ppal->NumColors; i++)
+    {
+        ulDiff = peColor.peRed - ppal->IndexedColors[i].peRed;
+        ulColorDiff = ulDiff * ulDiff;
+        ulDiff = peColor.peGreen - ppal->IndexedColors[i].peGreen;
+        ulColorDiff += ulDiff * ulDiff;
+        ulDiff = peColor.peBlue - ppal->IndexedColors[i].peBlue;
+        ulColorDiff += ulDiff * ulDiff;
+
+        if (ulColorDiff < ulMinimalDiff)
+        {
+            ulBestIndex = i;
+            ulMinimalDiff = ulColorDiff;
+            if (ulMinimalDiff == 0) break;
+        }
+    }
+
+    return ulBestIndex;
+}
+
+static __inline ULONG
+PALETTE_ulGetNearestBitFieldsIndex(PALETTE *ppal, ULONG ulColor)
+{
+    ULONG ulNewColor;
+
+    ppal->ulRedShift = CalculateShift(RGB(0xff,0,0), ppal->RedMask);
+    ppal->ulGreenShift = CalculateShift(RGB(0,0xff,0), ppal->GreenMask);
+    ppal->ulBlueShift = CalculateShift(RGB(0,0,0xff), ppal->BlueMask);
+
+    ulNewColor = _rotl(ulColor, ppal->ulRedShift) & ppal->RedMask;
+    ulNewColor |= _rotl(ulColor, ppal->ulGreenShift) & ppal->GreenMask;
+    ulNewColor |= _rotl(ulColor, ppal->ulBlueShift) & ppal->BlueMask;
+
+    return ulNewColor;
+}
+
+static __inline ULONG
+PALETTE_ulGetNearestIndex(PALETTE *ppal, ULONG ulColor)
+{
+    if (ppal->flFlags & PAL_INDEXED)
+        return PALETTE_ulGetNearestPaletteIndex(ppal, ulColor);
+    else
+        return PALETTE_ulGetNearestBitFieldsIndex(ppal, ulColor);
+}
+
+static __inline VOID
+PALETTE_vGetBitMasks(PPALETTE ppal, PULONG pulColors)
+{
+    if (ppal->flFlags & PAL_INDEXED || ppal->flFlags & PAL_RGB)
+    {
+        pulColors[0] = RGB(0xFF, 0x00, 0x00);
+        pulColors[1] = RGB(0x00, 0xFF, 0x00);
+        pulColors[2] = RGB(0x00, 0x00, 0xFF);
+    }
+    else if (ppal->flFlags & PAL_BGR)
+    {
+        pulColors[0] = RGB(0x00, 0x00, 0xFF);
+        pulColors[1] = RGB(0x00, 0xFF, 0x00);
+        pulColors[2] = RGB(0xFF, 0x00, 0x00);
+    }
+    else if (ppal->flFlags & PAL_BITFIELDS)
+    {
+        pulColors[0] = ppal->RedMask;
+        pulColors[1] = ppal->GreenMask;
+        pulColors[2] = ppal->BlueMask;
+    }
+}
+
+#include "../../../../win32ss/gdi/eng/xlateobj.h"
+
+#endif /* _XLATEBENCH_WIN32K_H */
@@ -0,0 +1,141 @@
+/*
+ * Color translation microbenchmark
+ *
+ * Compares translating pixels one at a time through XLATEOBJ_iXlate with
+ * the span loops EXLATEOBJ_vXlateScanline uses, both from
+ * win32ss/gdi/eng/xlateobj.c, which is built into the bench. The
+ * translations are set up by EXLATEOBJ_vInitialize from the same kinds of
+ * palettes win32k uses.
+ *
+ * This is a host program built together with xlateobj.c, the win32k.h in
+ * this directory stands in for the ReactOS one:
+ *   cc -O2 -I. -I../../../../sdk/include/host xlatebench.c -o xlatebench
+ */
+
+#include "../../../../win32ss/gdi/eng/xlateobj.c"
+#include <time.h>
+
+#define SPAN_PIXELS 1024
+#define SPAN_COUNT  20000
+
+typedef ULONG (NTAPI *PFN_IXLATE)(XLATEOBJ *pxlo, ULONG iColor);
+
+PALETTE gpalRGB = { PAL_RGB, 0, NULL, 0xFF, 0xFF00, 0xFF0000 };
+static PALETTE gpalBGR = { PAL_BGR, 0, NULL, 0xFF0000, 0xFF00, 0xFF };
+static PALETTE gpalRGB555 = { PAL_RGB16_555 | PAL_BITFIELDS, 0, NULL, 0x7C00, 0x3E0, 0x1F };
+static PALETTE gpalRGB565 = { PAL_RGB16_565 | PAL_BITFIELDS, 0, NULL, 0xF800, 0x7E0, 0x1F };
+/* A 32bpp bitfields surface with red and blue swapped, as some drivers use */
+static PALETTE gpalBitfields = { PAL_BITFIELDS, 0, NULL, 0xFF0000, 0xFF00, 0xFF };
+static PALETTEENTRY gapeMono[2] = { { 0, 0, 0, 0 }, { 0xFF, 0xFF, 0xFF, 0 } };
+static PALETTE gpalMono = { PAL_INDEXED | PAL_MONOCHROME, 2, gapeMono };
+PALETTE *gppalMono = &gpalMono;
+static PALETTEENTRY gape256[256];
+static PALETTE gpal256 = { PAL_INDEXED, 256, gape256 };
+static PALETTEENTRY gape16[16];
+static PALETTE gpal16 = { PAL_INDEXED, 16, gape16 };
+
+static const struct
+{
+    const char *pszName;
+    PPALETTE ppalSrc;
+    PPALETTE ppalDst;
+    ULONG ulSourceMask;
+} gaPairs[] =
+{
+    { "RGB -> BGR",      &gpalRGB,       &gpalBGR,    0x00FFFFFF },
+    { "RGB -> 565",      &gpalRGB,       &gpalRGB565, 0x00FFFFFF },
+    { "555 -> RGB",      &gpalRGB555,    &gpalRGB,    0x7FFF },
+    { "565 -> RGB",      &gpalRGB565,    &gpalRGB,    0xFFFF },
+    { "565 -> BGR",      &gpalRGB565,    &gpalBGR,    0xFFFF },
+    { "8bpp pal -> RGB", &gpal256,       &gpalRGB,    0xFF },
+    { "bitfields -> RGB", &gpalBitfields, &gpalRGB,   0x00FFFFFF },
+    /* Searches the palette, so it goes through the generic span loop */
+    { "RGB -> 4bpp pal", &gpalRGB,       &gpal16,     0x00FFFFFF },
+};
+
+static double Seconds(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* Per pixel through a pointer the compiler cannot see through, the way the
+   DIB code calls XLATEOBJ_iXlate from other files */
+static void PerPixel(volatile PFN_IXLATE *ppfn, XLATEOBJ *pxlo, ULONG *pulDest,
+                     const ULONG *pulSource, ULONG c)
+{
+    ULONG i;
+    for (i = 0; i < c; i++)
+        pulDest[i] = (*ppfn)(pxlo, pulSource[i]);
+}
+
+int main(void)
+{
+    static ULONG aulSource[SPAN_PIXELS], aulDest1[SPAN_PIXELS], aulDest2[SPAN_PIXELS];
+    volatile PFN_IXLATE pfn = XLATEOBJ_iXlate;
+    EXLATEOBJ exlo;
+    unsigned int p, n, i;
+    clock_t start;
+    double t1, t2;
+
+    srand(1);
+    for (i = 0; i < 256; i++)
+    {
+        gape256[i].peRed = (BYTE)rand();
+        gape256[i].peGreen = (BYTE)rand();
+        gape256[i].peBlue = (BYTE)rand();
+    }
+    for (i = 0; i < 16; i++)
+    {
+        gape16[i].peRed = (i & 1) ? 0xFF : 0;
+        gape16[i].peGreen = (i & 2) ? 0xFF : 0;
+        gape16[i].peBlue = (i & 4) ? 0xFF : 0;
+        if (i & 8)
+        {
+            gape16[i].peRed >>= 1;
+            gape16[i].peGreen >>= 1;
+            gape16[i].peBlue >>= 1;
+        }
+    }
+
+    printf("%-17s %12s %12s %8s\n", "pair", "per pixel", "span", "speedup");
+    for (p = 0; p < sizeof(gaPairs) / sizeof(gaPairs[0]); p++)
+    {
+        EXLATEOBJ_vInitialize(&exlo, gaPairs[p].ppalSrc, gaPairs[p].ppalDst,
+                              0, 0xFFFFFF, 0);
+
+        srand(p);
+        for (i = 0; i < SPAN_PIXELS; i++)
+        {
+            /* Short runs of the same color, like in most bitmaps */
+            if (i == 0 || rand() % 4 == 0)
+                aulSource[i] = ((ULONG)rand() * 65599u + rand()) & gaPairs[p].ulSourceMask;
+            else
+                aulSource[i] = aulSource[i - 1];
+        }
+
+        start = clock();
+        for (n = 0; n < SPAN_COUNT; n++)
+            PerPixel(&pfn, &exlo.xlo, aulDest1, aulSource, SPAN_PIXELS);
+        t1 = Seconds(start);
+
+        start = clock();
+        for (n = 0; n < SPAN_COUNT; n++)
+            EXLATEOBJ_vXlateScanline(&exlo, aulDest2, aulSource, SPAN_PIXELS);
+        t2 = Seconds(start);
+
+        EXLATEOBJ_vCleanup(&exlo);
+
+        if (memcmp(aulDest1, aulDest2, sizeof(aulDest1)) != 0)
+        {
+            printf("%s: results differ\n", gaPairs[p].pszName);
+            return 1;
+        }
+
+        printf("%-17s %9.2f ns %9.2f ns %7.2fx\n", gaPairs[p].pszName,
+               t1 * 1e9 / ((double)SPAN_PIXELS * SPAN_COUNT),
+               t2 * 1e9 / ((double)SPAN_PIXELS * SPAN_COUNT),
+               t2 > 0 ? t1 / t2 : 0.0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * PROJECT:     ReactOS kernel-mode tests
+ * LICENSE:     LGPL-2.1-or-later (https://spdx.org/licenses/LGPL-2.1-or-later)
+ * PURPOSE:     Kernel-Mode Test Suite name lookup benchmark for large directories
+ */
+
+#include <kmt_test.h>
+
+/*
+ * 8.3 upper case names take a single directory entry each, which keeps
+ * 50000 files below the 65536 entries a FAT directory can hold.
+ */
+#define FILE_COUNT 50000
+
+static UNICODE_STRING DirectoryName = RTL_CONSTANT_STRING(L"\\SystemRoot\\KMTLARGE");
+
+static
+VOID
+MakeFileName(
+    _Out_writes_(13) PWCHAR Buffer,
+    _In_ ULONG Index,
+    _In_ BOOLEAN LowerCase,
+    _Out_ PUNICODE_STRING FileName)
+{
+    ULONG i;
+
+    Buffer[0] = LowerCase ? L'f' : L'F';
+    for (i = 7; i > 0; i--)
+    {
+        Buffer[i] = L'0' + Index % 10;
+        Index /= 10;
+    }
+    RtlCopyMemory(&Buffer[8], LowerCase ? L".dat" : L".DAT", 5 * sizeof(WCHAR));
+    RtlInitUnicodeString(FileName, Buffer);
+}
+
+static
+NTSTATUS
+OpenRelative(
+    _Out_ PHANDLE FileHandle,
+    _In_ HANDLE DirectoryHandle,
+    _In_ PUNICODE_STRING FileName,
+    _In_ ACCESS_MASK DesiredAccess,
+    _In_ ULONG CreateDisposition,
+    _In_ ULONG CreateOptions)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+
+    InitializeObjectAttributes(&ObjectAttributes,
+                               FileName,
+                               OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE,
+                               DirectoryHandle,
+                               NULL);
+    return ZwCreateFile(FileHandle,
+                        DesiredAccess | SYNCHRONIZE,
+                        &ObjectAttributes,
+                        &IoStatus,
+                        NULL,
+                        FILE_ATTRIBUTE_NORMAL,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        CreateDisposition,
+                        CreateOptions | FILE_SYNCHRONOUS_IO_NONALERT,
+                        NULL,
+                        0);
+}
+
+static
+ULONG64
+ElapsedMilliseconds(
+    _In_ LARGE_INTEGER Start)
+{
+    LARGE_INTEGER End, Frequency;
+
+    End = KeQueryPerformanceCounter(&Frequency);
+    return (End.QuadPart - Start.QuadPart) * 1000 / Frequency.QuadPart;
+}
+
+START_TEST(IoLargeDirectory)
+{
+    NTSTATUS Status;
+    HANDLE DirectoryHandle;
+    HANDLE FileHandle;
+    WCHAR Buffer[13];
+    UNICODE_STRING FileName;
+    LARGE_INTEGER Start;
+    ULONG i, Created, Failed;
+
+    Status = OpenRelative(&DirectoryHandle,
+                          NULL,
+                          &DirectoryName,
+                          FILE_LIST_DIRECTORY | DELETE,
+                          FILE_OPEN_IF,
+                          FILE_DIRECTORY_FILE);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (skip(NT_SUCCESS(Status), "No directory, %lx\n", Status))
+        return;
+
+    /* Populate */
+    Start = KeQueryPerformanceCounter(NULL);
+    for (Created = 0; Created < FILE_COUNT; Created++)
+    {
+        MakeFileName(Buffer, Created, FALSE, &FileName);
+        Status = OpenRelative(&FileHandle, DirectoryHandle, &FileName,
+                              FILE_READ_ATTRIBUTES, FILE_OPEN_IF, FILE_NON_DIRECTORY_FILE);
+        if (!NT_SUCCESS(Status))
+            break;
+        ObCloseHandle(FileHandle, KernelMode);
+    }
+    ok(Created == FILE_COUNT, "Created %lu files, last status %lx\n", Created, Status);
+    trace("Created %lu files in %I64u ms\n", Created, ElapsedMilliseconds(Start));
+
+    /* Open every file once, alternating the case of the name */
+    Failed = 0;
+    Start = KeQueryPerformanceCounter(NULL);
+    for (i = 0; i < Created; i++)
+    {
+        MakeFileName(Buffer, i, (i & 1) != 0, &FileName);
+        Status = OpenRelative(&FileHandle, DirectoryHandle, &FileName,
+                              FILE_READ_ATTRIBUTES, FILE_OPEN, FILE_NON_DIRECTORY_FILE);
+        if (!NT_SUCCESS(Status))
+        {
+            if (Failed++ < 10)
+                ok(0, "Opening %wZ failed with %lx\n", &FileName, Status);
+            continue;
+        }
+        ObCloseHandle(FileHandle, KernelMode);
+    }
+    ok_eq_ulong(Failed, 0LU);
+    trace("Opened %lu files in %I64u ms\n", Created, ElapsedMilliseconds(Start));
+
+    /* Misses must still be reported as such */
+    MakeFileName(Buffer, FILE_COUNT, FALSE, &FileName);
+    Status = OpenRelative(&FileHandle, DirectoryHandle, &FileName,
+                          FILE_READ_ATTRIBUTES, FILE_OPEN, FILE_NON_DIRECTORY_FILE);
+    ok_eq_hex(Status, STATUS_OBJECT_NAME_NOT_FOUND);
+    if (NT_SUCCESS(Status))
+        ObCloseHandle(FileHandle, KernelMode);
+
+    /* Delete every other file, the rest must remain reachable */
+    for (i = 0; i < Created; i += 2)
+    {
+        MakeFileName(Buffer, i, FALSE, &FileName);
+        Status = OpenRelative(&FileHandle, DirectoryHandle, &FileName,
+                              DELETE, FILE_OPEN, FILE_NON_DIRECTORY_FILE | FILE_DELETE_ON_CLOSE);
+        if (NT_SUCCESS(Status))
+            ObCloseHandle(FileHandle, KernelMode);
+    }
+    Failed = 0;
+    for (i = 0; i < Created; i++)
+    {
+        MakeFileName(Buffer, i, FALSE, &FileName);
+        Status = OpenRelative(&FileHandle, DirectoryHandle, &FileName,
+                              DELETE, FILE_OPEN, FILE_NON_DIRECTORY_FILE | FILE_DELETE_ON_CLOSE);
+        if (Status != ((i & 1) ? STATUS_SUCCESS : STATUS_OBJECT_NAME_NOT_FOUND))
+            Failed++;
+        if (NT_SUCCESS(Status))
+            ObCloseHandle(FileHandle, KernelMode);
+    }
+    ok_eq_ulong(Failed, 0LU);
+
+    /* The directory is empty now */
+    Status = OpenRelative(&FileHandle, NULL, &DirectoryName,
+                          DELETE, FILE_OPEN, FILE_DIRECTORY_FILE | FILE_DELETE_ON_CLOSE);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (NT_SUCCESS(Status))
+        ObCloseHandle(FileHandle, KernelMode);
+    ObCloseHandle(DirectoryHandle, KernelMode);
+}
@@ -0,0 +1,7 @@
+/*
+ * The tree does not carry the coefficients of SRC_SINC_BEST_QUALITY, which
+ * kmixer does not use. Let src_sinc.c build for kmixbench with the medium
+ * quality ones in their place.
+ */
+
+#define slow_high_qual_coeffs slow_mid_qual_coeffs
@@ -0,0 +1,194 @@
+/*
+ * Kernel mixer conversion microbenchmark
+ *
+ * Compares the way drivers/wdm/audio/filters/kmixer used to convert a
+ * stream (a new resampler for every buffer, one integer pass per
+ * conversion step) with the float pipeline of kmixer/mix.c (one resampler
+ * per pin, streams submitted to the mixer in float and rendered to 16 bit
+ * once), with and without its SSE2 paths.
+ *
+ * This is a host program built together with mix.c and the in-tree
+ * libsamplerate, portcls.h and high_qual_coeffs.h in this directory stand
+ * in for the ReactOS ones:
+ *   cc -O2 -D__cdecl= -I. -I../../../../sdk/include/host
+ *      -idirafter ../../../../sdk/lib/3rdparty/libsamplerate kmixbench.c
+ *      ../../../../sdk/lib/3rdparty/libsamplerate/s*.c -lm -o kmixbench
+ */
+
+#include "../../../../drivers/wdm/audio/filters/kmixer/mix.c"
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+
+#define IN_RATE     44100
+#define OUT_RATE    48000
+#define CHANNELS    2
+/* 10 ms buffers, the size sysaudio hands down */
+#define FRAMES      (IN_RATE / 100)
+#define OUT_FRAMES  (FRAMES * OUT_RATE / IN_RATE + 16)
+#define BUFFERS     2000
+#define STREAMS     4
+
+static short Input[STREAMS][BUFFERS][FRAMES * CHANNELS];
+static float InFloat[FRAMES * CHANNELS];
+static float OutFloat[OUT_FRAMES * CHANNELS];
+static short Output[OUT_FRAMES * CHANNELS];
+
+/* libsamplerate's config.h maps exit and printf to these */
+void __debugbreak(void)
+{
+    abort();
+}
+
+unsigned long DbgPrint(const char *Format, ...)
+{
+    va_list Args;
+    int Length;
+
+    va_start(Args, Format);
+    Length = vprintf(Format, Args);
+    va_end(Args);
+
+    return Length;
+}
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* What kmixer did before: a new resampler per buffer and per stream,
+ * the result converted back to 16 bit right away */
+static double RunPerBuffer(unsigned long *Frames)
+{
+    SRC_STATE *State;
+    SRC_DATA Data;
+    double Start = Now();
+    int Stream, Buffer, error;
+
+    *Frames = 0;
+    for (Buffer = 0; Buffer < BUFFERS; Buffer++)
+    {
+        for (Stream = 0; Stream < STREAMS; Stream++)
+        {
+            State = src_new(SRC_SINC_FASTEST, CHANNELS, &error);
+            src_short_to_float_array(Input[Stream][Buffer], InFloat, FRAMES * CHANNELS);
+
+            Data.data_in = InFloat;
+            Data.data_out = OutFloat;
+            Data.input_frames = FRAMES;
+            Data.output_frames = OUT_FRAMES;
+            Data.end_of_input = 1;
+            Data.src_ratio = (double)OUT_RATE / IN_RATE;
+            src_process(State, &Data);
+            src_delete(State);
+
+            src_float_to_short_array(OutFloat, Output, Data.output_frames_gen * CHANNELS);
+            *Frames += Data.output_frames_gen;
+        }
+    }
+
+    return Now() - Start;
+}
+
+/* What kmixer does now: one resampler per stream, the streams submitted to
+ * the mixer and rendered to 16 bit once per buffer. The checksum of the
+ * rendered samples must not depend on Sse2. */
+static double RunMixer(BOOLEAN Sse2, unsigned long *Frames, long long *Checksum)
+{
+    MIXER_CONTEXT Mixer;
+    MIX_STREAM Streams[STREAMS];
+    KSDATAFORMAT_WAVEFORMATEX Format;
+    SRC_STATE *State[STREAMS];
+    SRC_DATA Data;
+    double Start;
+    int Stream, Buffer, Index, error;
+    ULONG Mixed;
+
+    MixerInitialize(&Mixer);
+    MixUseSse2 = Sse2;
+
+    memset(Streams, 0, sizeof(Streams));
+    memset(&Format, 0, sizeof(Format));
+    Format.WaveFormatEx.nChannels = CHANNELS;
+    Format.WaveFormatEx.nSamplesPerSec = OUT_RATE;
+    Format.WaveFormatEx.wBitsPerSample = 16;
+
+    for (Stream = 0; Stream < STREAMS; Stream++)
+    {
+        State[Stream] = src_new(SRC_SINC_FASTEST, CHANNELS, &error);
+        Streams[Stream].SamplesPerSec = OUT_RATE;
+        Streams[Stream].Channels = CHANNELS;
+        MixerAddStream(&Mixer, &Streams[Stream]);
+    }
+
+    *Frames = 0;
+    *Checksum = 0;
+    Start = Now();
+    for (Buffer = 0; Buffer < BUFFERS; Buffer++)
+    {
+        for (Stream = 0; Stream < STREAMS; Stream++)
+        {
+            MixPcmToFloat(Input[Stream][Buffer], 16, InFloat, FRAMES * CHANNELS);
+
+            Data.data_in = InFloat;
+            Data.data_out = OutFloat;
+            Data.input_frames = FRAMES;
+            Data.output_frames = OUT_FRAMES;
+            Data.end_of_input = 0;
+            Data.src_ratio = (double)OUT_RATE / IN_RATE;
+            src_process(State[Stream], &Data);
+
+            MixerSubmit(&Mixer, &Streams[Stream], OutFloat, Data.output_frames_gen * CHANNELS);
+            *Frames += Data.output_frames_gen;
+        }
+
+        MixerRender(&Mixer, &Format, Output, FRAMES * OUT_RATE / IN_RATE, &Mixed);
+        for (Index = 0; Index < Mixed * CHANNELS; Index++)
+            *Checksum += Output[Index];
+    }
+
+    Start = Now() - Start;
+
+    for (Stream = 0; Stream < STREAMS; Stream++)
+    {
+        MixerRemoveStream(&Mixer, &Streams[Stream]);
+        src_delete(State[Stream]);
+    }
+    ExFreePoolWithTag(Mixer.MixBuffer, TAG_KMIXER);
+
+    return Start;
+}
+
+int main(void)
+{
+    unsigned long Frames;
+    long long Checksum;
+    double Seconds;
+    int Stream, Buffer, Index;
+
+    /* a tone per stream, quiet enough that the sum does not clip */
+    for (Stream = 0; Stream < STREAMS; Stream++)
+        for (Buffer = 0; Buffer < BUFFERS; Buffer++)
+            for (Index = 0; Index < FRAMES * CHANNELS; Index++)
+                Input[Stream][Buffer][Index] = (short)(6000 * sin(((double)Buffer * FRAMES + Index / CHANNELS) *
+                                                                  (220.0 * (Stream + 1)) * 2 * 3.14159265358979 / IN_RATE));
+
+    printf("%d streams of %d buffers, %d Hz -> %d Hz, %d channels\n",
+           STREAMS, BUFFERS, IN_RATE, OUT_RATE, CHANNELS);
+
+    Seconds = RunPerBuffer(&Frames);
+    printf("per buffer resampler      %8.1f ms  %lu frames\n", Seconds * 1000, Frames);
+
+    Seconds = RunMixer(FALSE, &Frames, &Checksum);
+    printf("mixer, float              %8.1f ms  %lu frames  checksum %lld\n", Seconds * 1000, Frames, Checksum);
+
+#ifdef KMIXER_SSE2
+    Seconds = RunMixer(TRUE, &Frames, &Checksum);
+    printf("mixer, SSE2               %8.1f ms  %lu frames  checksum %lld\n", Seconds * 1000, Frames, Checksum);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Just enough of portcls.h and the kernel to build
+ * drivers/wdm/audio/filters/kmixer/mix.c for kmixbench with the host
+ * headers (sdk/include/host). The bench is single threaded, so the locks
+ * do nothing.
+ */
+
+#ifndef _KMIXBENCH_PORTCLS_H
+#define _KMIXBENCH_PORTCLS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <typedefs.h>
+
+#if defined(__x86_64__) && !defined(_M_AMD64)
+#define _M_AMD64
+#elif defined(__i386__) && !defined(_M_IX86)
+#define _M_IX86
+#endif
+
+#ifndef __ATTRIBUTE_SSE2__
+#define __ATTRIBUTE_SSE2__ __attribute__((__target__("sse2")))
+#endif
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009A)
+#define NonPagedPool                    0
+#define PF_XMMI64_INSTRUCTIONS_AVAILABLE 10
+
+typedef FLOAT *PFLOAT;
+typedef UCHAR KIRQL;
+typedef ULONG_PTR KSPIN_LOCK;
+typedef LONG FAST_MUTEX;
+typedef ULONG KFLOATING_SAVE;
+typedef PVOID KSDEVICE_HEADER, PIRP;
+
+typedef struct
+{
+    USHORT wFormatTag;
+    USHORT nChannels;
+    ULONG nSamplesPerSec;
+    ULONG nAvgBytesPerSec;
+    USHORT nBlockAlign;
+    USHORT wBitsPerSample;
+    USHORT cbSize;
+} WAVEFORMATEX;
+
+typedef struct
+{
+    WAVEFORMATEX WaveFormatEx;
+} KSDATAFORMAT_WAVEFORMATEX, *PKSDATAFORMAT_WAVEFORMATEX;
+
+#define KeInitializeSpinLock(Lock) (*(Lock) = 0)
+#define KeAcquireSpinLock(Lock, OldIrql) ((void)(Lock), *(OldIrql) = 0)
+#define KeReleaseSpinLock(Lock, OldIrql) ((void)(Lock), (void)(OldIrql))
+#define ExInitializeFastMutex(Mutex) (*(Mutex) = 0)
+#define ExAcquireFastMutex(Mutex) ((void)(Mutex))
+#define ExReleaseFastMutex(Mutex) ((void)(Mutex))
+#define ExAllocatePoolWithTag(PoolType, Size, Tag) malloc(Size)
+#define ExFreePoolWithTag(Buffer, Tag) free(Buffer)
+#define ExIsProcessorFeaturePresent(Feature) __builtin_cpu_supports("sse2")
+#ifdef _M_IX86
+/* kmixer.h has these for the other architectures */
+#define KeSaveFloatingPointState(Save) ((void)(Save), STATUS_SUCCESS)
+#define KeRestoreFloatingPointState(Save) ((void)(Save))
+#endif
+
+#endif /* _KMIXBENCH_PORTCLS_H */
@@ -439,6 +439,37 @@ extern "C" {
 #define STOR_MAP_ALL_BUFFERS                (1)
 #define STOR_MAP_NON_READ_WRITE_BUFFERS     (2)
 
+/* StorPortExtendedFunction return values */
+#define STOR_STATUS_SUCCESS                 (0x00000000L)
+#define STOR_STATUS_UNSUCCESSFUL            (0xC1000001L)
+#define STOR_STATUS_NOT_IMPLEMENTED         (0xC1000002L)
+#define STOR_STATUS_INSUFFICIENT_RESOURCES  (0xC1000003L)
+#define STOR_STATUS_BUFFER_TOO_SMALL        (0xC1000004L)
+#define STOR_STATUS_ACCESS_DENIED           (0xC1000005L)
+#define STOR_STATUS_INVALID_PARAMETER       (0xC1000006L)
+#define STOR_STATUS_INVALID_DEVICE_REQUEST  (0xC1000007L)
+#define STOR_STATUS_INVALID_IRQL            (0xC1000008L)
+#define STOR_STATUS_INVALID_DEVICE_STATE    (0xC1000009L)
+#define STOR_STATUS_INVALID_BUFFER_SIZE     (0xC100000AL)
+#define STOR_STATUS_UNSUPPORTED_VERSION     (0xC100000BL)
+#define STOR_STATUS_BUSY                    (0xC100000CL)
+
+/* PERF_CONFIGURATION_DATA.Flags constants */
+#define STOR_PERF_DPC_REDIRECTION           0x00000001
+#define STOR_PERF_CONCURRENT_CHANNELS       0x00000002
+#define STOR_PERF_INTERRUPT_MESSAGE_RANGES  0x00000004
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+#define STOR_PERF_ADV_CONFIG_LOCALITY       0x00000008
+#define STOR_PERF_OPTIMIZE_FOR_COMPLETION_DURING_STARTIO 0x00000010
+#define STOR_PERF_DPC_REDIRECTION_CURRENT_CPU 0x00000020
+#endif
+
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+#define STOR_PERF_VERSION                   0x00000003
+#else
+#define STOR_PERF_VERSION                   0x00000002
+#endif
+
 #define VPD_SUPPORTED_PAGES                 0x00
 #define VPD_SERIAL_NUMBER                   0x80
 #define VPD_DEVICE_IDENTIFIERS              0x83
@@ -121,6 +121,34 @@ typedef struct  _AFD_CONNECT_INFO {
     TRANSPORT_ADDRESS			RemoteAddress;
 } AFD_CONNECT_INFO , *PAFD_CONNECT_INFO ;
 
+/* AcceptEx. The first data goes to Recv, at most one buffer, which must
+ * come first so that the request can be queued as a receive on the
+ * accepted socket. The local and remote addresses are stored as an INT
+ * length followed by the SOCKADDR, in areas of the given sizes. */
+typedef struct _AFD_SUPER_ACCEPT_INFO {
+    AFD_RECV_INFO			Recv;
+    HANDLE				AcceptHandle;
+    PVOID				AddressBuffer;
+    ULONG				LocalAddressLength;
+    ULONG				RemoteAddressLength;
+} AFD_SUPER_ACCEPT_INFO, *PAFD_SUPER_ACCEPT_INFO;
+
+/* ConnectEx. The data in Send, at most one buffer, is sent once connected */
+typedef struct _AFD_SUPER_CONNECT_INFO {
+    AFD_SEND_INFO			Send;
+    AFD_CONNECT_INFO			Connect;
+} AFD_SUPER_CONNECT_INFO, *PAFD_SUPER_CONNECT_INFO;
+
+typedef struct _AFD_TRANSMIT_FILE_INFO {
+    HANDLE				FileHandle;
+    LARGE_INTEGER			Offset;
+    LARGE_INTEGER			WriteLength;	/* 0 is up to the end of the file */
+    ULONG				SendPacketLength;
+    ULONG				Flags;
+    AFD_WSABUF				Head;
+    AFD_WSABUF				Tail;
+} AFD_TRANSMIT_FILE_INFO, *PAFD_TRANSMIT_FILE_INFO;
+
 typedef struct _AFD_EVENT_SELECT_INFO {
     HANDLE				EventObject;
     ULONG				Events;
@@ -186,6 +214,7 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_INFO_SEND_WINDOW_SIZE	0x07L
 #define AFD_INFO_GROUP_ID_TYPE	        0x10L
 #define AFD_INFO_RECEIVE_CONTENT_SIZE   0x11L
+#define AFD_INFO_SOCKET_REUSED          0x12L
 
 /* AFD Share Flags */
 #define AFD_SHARE_UNIQUE		0x0L
@@ -198,6 +227,7 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_DISCONNECT_RECV		0x02L
 #define AFD_DISCONNECT_ABORT		0x04L
 #define AFD_DISCONNECT_DATAGRAM		0x08L
+#define AFD_DISCONNECT_REUSE		0x10L
 
 /* AFD Event Flags */
 #define AFD_EVENT_RECEIVE                   (1 << AFD_EVENT_RECEIVE_BIT)
@@ -219,6 +249,10 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_OVERLAPPED			0x2L
 #define AFD_IMMEDIATE                   0x4L
 
+/* AFD_TRANSMIT_FILE_INFO Flags */
+#define AFD_TF_DISCONNECT		0x1L
+#define AFD_TF_REUSE_SOCKET		0x2L
+
 /* IOCTL Generation */
 #define FSCTL_AFD_BASE                  FILE_DEVICE_NETWORK
 #define _AFD_CONTROL_CODE(Operation,Method) \
@@ -259,6 +293,9 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_EVENT_SELECT		33
 #define AFD_ENUM_NETWORK_EVENTS         34
 #define AFD_DEFER_ACCEPT		35
+#define AFD_SUPER_ACCEPT		36
+#define AFD_SUPER_CONNECT		37
+#define AFD_TRANSMIT_FILE		38
 #define AFD_GET_PENDING_CONNECT_DATA	41
 #define AFD_VALIDATE_GROUP		42
 
@@ -330,6 +367,12 @@ typedef struct _AFD_TDI_HANDLE_DATA
   _AFD_CONTROL_CODE(AFD_EVENT_SELECT, METHOD_NEITHER)
 #define IOCTL_AFD_DEFER_ACCEPT \
   _AFD_CONTROL_CODE(AFD_DEFER_ACCEPT, METHOD_NEITHER)
+#define IOCTL_AFD_SUPER_ACCEPT \
+  _AFD_CONTROL_CODE(AFD_SUPER_ACCEPT, METHOD_NEITHER)
+#define IOCTL_AFD_SUPER_CONNECT \
+  _AFD_CONTROL_CODE(AFD_SUPER_CONNECT, METHOD_NEITHER)
+#define IOCTL_AFD_TRANSMIT_FILE \
+  _AFD_CONTROL_CODE(AFD_TRANSMIT_FILE, METHOD_NEITHER)
 #define IOCTL_AFD_GET_PENDING_CONNECT_DATA \
   _AFD_CONTROL_CODE(AFD_GET_PENDING_CONNECT_DATA, METHOD_NEITHER)
 #define IOCTL_AFD_ENUM_NETWORK_EVENTS \
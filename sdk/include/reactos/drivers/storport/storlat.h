@@ -0,0 +1,34 @@
+/*
+ * PROJECT:     ReactOS Storport Driver
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Storport logical unit latency statistics
+ */
+
+#ifndef _STORLAT_H_
+#define _STORLAT_H_
+
+/* Returns a STORPORT_LATENCY_HISTOGRAM for the logical unit the request
+ * is sent to (or for the disk stacked on top of it) */
+#define IOCTL_STORPORT_QUERY_LATENCY \
+    CTL_CODE(FILE_DEVICE_CONTROLLER, 0x0800, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define STORPORT_LATENCY_BUCKETS 24
+
+typedef struct _STORPORT_LATENCY_HISTOGRAM
+{
+    /* sizeof(STORPORT_LATENCY_HISTOGRAM) */
+    ULONG Size;
+    /* Number of requests the unit may have in the miniport at a time */
+    ULONG QueueDepth;
+    /* Number of requests that are in the miniport right now */
+    ULONG Outstanding;
+    ULONG Reserved;
+    /* Number of completed requests and their total latency */
+    ULONGLONG Requests;
+    ULONGLONG TotalMicroseconds;
+    /* Bucket n counts the requests that took less than 2^n microseconds
+     * (and at least 2^(n-1)); the last bucket also counts anything slower */
+    ULONGLONG Buckets[STORPORT_LATENCY_BUCKETS];
+} STORPORT_LATENCY_HISTOGRAM, *PSTORPORT_LATENCY_HISTOGRAM;
+
+#endif /* _STORLAT_H_ */
@@ -70,29 +70,105 @@ void get_fat(FAT_ENTRY * entry, void *fat, uint32_t cluster, DOS_FS * fs)
     }
 }
 
+/* The FATs are read and compared this many bytes at a time */
+#define FAT_WINDOW_SIZE (1024 * 1024)
+
+/* Each owner page holds the owner runs of 64K clusters */
+#define OWNER_PAGE_SHIFT 16
+
+static void free_owners(DOS_FS * fs)
+{
+    uint32_t i, pages;
+
+    if (fs->owner_pages) {
+	pages = ((fs->data_clusters + 2) >> OWNER_PAGE_SHIFT) + 1;
+	for (i = 0; i < pages; i++)
+	    if (fs->owner_pages[i].runs)
+		free(fs->owner_pages[i].runs);
+	free(fs->owner_pages);
+    }
+    if (fs->cluster_owned)
+	free(fs->cluster_owned);
+    fs->owner_pages = NULL;
+    fs->cluster_owned = NULL;
+}
+
+static void *alloc_zeroed(size_t size)
+{
+    void *this = alloc(size);
+
+    memset(this, 0, size);
+    return this;
+}
+
+/**
+ * Pick the FAT copy to keep once the two copies were found to differ,
+ * based on their media descriptor entries.
+ *
+ * @param[in]	fs          Information about the filesystem
+ * @param[in]	first       Start of the first FAT copy
+ *
+ * @return  1 or 2          FAT copy to keep
+ */
+static int choose_fat(DOS_FS * fs, void *first)
+{
+    FAT_ENTRY first_media, second_media;
+    unsigned char media[4];
+    int first_ok, second_ok;
+
+    fs_read(fs->fat_start + fs->fat_size, sizeof(media), media);
+    get_fat(&first_media, first, 0, fs);
+    get_fat(&second_media, media, 0, fs);
+    first_ok = (first_media.value & FAT_EXTD(fs)) == FAT_EXTD(fs);
+    second_ok = (second_media.value & FAT_EXTD(fs)) == FAT_EXTD(fs);
+    if (first_ok && !second_ok) {
+	printf("FATs differ - using first FAT.\n");
+	return 1;
+    }
+    if (!first_ok && second_ok) {
+	printf("FATs differ - using second FAT.\n");
+	return 2;
+    }
+    if (first_ok && second_ok) {
+	if (interactive) {
+	    printf("FATs differ but appear to be intact. Use which FAT ?\n"
+		   "1) Use first FAT\n2) Use second FAT\n");
+	    return get_key("12", "?") == '1' ? 1 : 2;
+	}
+	printf("FATs differ but appear to be intact. Using first "
+	       "FAT.\n");
+	return 1;
+    }
+    printf("Both FATs appear to be corrupt. Giving up.\n");
+    exit(1);
+    return 0;			/* for GCC */
+}
+
 /**
  * Build a bookkeeping structure from the partition's FAT table.
  * If the partition has multiple FATs and they don't agree, try to pick a winner,
  * and queue a command to overwrite the loser.
  * One error that is fixed here is a cluster that links to something out of range.
  *
+ * Only the first FAT is kept in memory, the second one is compared to it
+ * one window at a time. Cluster ownership is tracked by a bitmap and by
+ * runs of clusters sharing an owner, instead of a pointer per cluster.
+ *
  * @param[inout]    fs      Information about the filesystem
  */
 void read_fat(DOS_FS * fs)
 {
-    int eff_size, alloc_size;
+    int eff_size, alloc_size, offset, size;
     uint32_t i;
-    void *first, *second = NULL;
-    int first_ok, second_ok;
+    unsigned char *first, *window;
+    int use = 0;
     uint32_t total_num_clusters;
 
     /* Clean up from previous pass */
     if (fs->fat)
 	free(fs->fat);
-    if (fs->cluster_owner)
-	free(fs->cluster_owner);
+    free_owners(fs);
     fs->fat = NULL;
-    fs->cluster_owner = NULL;
 
     total_num_clusters = fs->data_clusters + 2;
     eff_size = (total_num_clusters * fs->fat_bits + 7) / 8ULL;
@@ -105,54 +181,37 @@ void read_fat(DOS_FS * fs)
 	    alloc_size = (total_num_clusters * 12 + 23) / 24 * 3;
 
     first = alloc(alloc_size);
-    fs_read(fs->fat_start, eff_size, first);
-    if (fs->nfats > 1) {
-	second = alloc(alloc_size);
-	fs_read(fs->fat_start + fs->fat_size, eff_size, second);
+    for (offset = 0; offset < eff_size; offset += size) {
+	size = min(FAT_WINDOW_SIZE, eff_size - offset);
+	fs_read(fs->fat_start + offset, size, first + offset);
     }
-    if (second && memcmp(first, second, eff_size) != 0) {
-	FAT_ENTRY first_media, second_media;
-	get_fat(&first_media, first, 0, fs);
-	get_fat(&second_media, second, 0, fs);
-	first_ok = (first_media.value & FAT_EXTD(fs)) == FAT_EXTD(fs);
-	second_ok = (second_media.value & FAT_EXTD(fs)) == FAT_EXTD(fs);
-	if (first_ok && !second_ok) {
-	    printf("FATs differ - using first FAT.\n");
-	    fs_write(fs->fat_start + fs->fat_size, eff_size, first);
-	}
-	if (!first_ok && second_ok) {
-	    printf("FATs differ - using second FAT.\n");
-	    fs_write(fs->fat_start, eff_size, second);
-	    memcpy(first, second, eff_size);
-	}
-	if (first_ok && second_ok) {
-	    if (interactive) {
-		printf("FATs differ but appear to be intact. Use which FAT ?\n"
-		       "1) Use first FAT\n2) Use second FAT\n");
-		if (get_key("12", "?") == '1') {
-		    fs_write(fs->fat_start + fs->fat_size, eff_size, first);
-		} else {
-		    fs_write(fs->fat_start, eff_size, second);
-		    memcpy(first, second, eff_size);
-		}
+    if (fs->nfats > 1) {
+	window = alloc(min(FAT_WINDOW_SIZE, eff_size));
+	for (offset = 0; offset < eff_size; offset += size) {
+	    size = min(FAT_WINDOW_SIZE, eff_size - offset);
+	    fs_read(fs->fat_start + fs->fat_size + offset, size, window);
+	    if (memcmp(first + offset, window, size) == 0)
+		continue;
+
+	    /* Only the windows which differ get rewritten */
+	    if (!use)
+		use = choose_fat(fs, first);
+	    if (use == 1) {
+		fs_write(fs->fat_start + fs->fat_size + offset, size,
+			 first + offset);
 	    } else {
-		printf("FATs differ but appear to be intact. Using first "
-		       "FAT.\n");
-		fs_write(fs->fat_start + fs->fat_size, eff_size, first);
+		fs_write(fs->fat_start + offset, size, window);
+		memcpy(first + offset, window, size);
 	    }
 	}
-	if (!first_ok && !second_ok) {
-	    printf("Both FATs appear to be corrupt. Giving up.\n");
-	    exit(1);
-	}
-    }
-    if (second) {
-	free(second);
+	free(window);
     }
     fs->fat = (unsigned char *)first;
 
-    fs->cluster_owner = alloc(total_num_clusters * sizeof(DOS_FILE *));
-    memset(fs->cluster_owner, 0, (total_num_clusters * sizeof(DOS_FILE *)));
+    fs->cluster_owned = alloc_zeroed((total_num_clusters + 31) / 32 *
+				     sizeof(uint32_t));
+    fs->owner_pages = alloc_zeroed(((total_num_clusters >> OWNER_PAGE_SHIFT) + 1) *
+				   sizeof(OWNER_PAGE));
 
     /* Truncate any cluster chains that link to something out of range */
     for (i = 2; i < fs->data_clusters + 2; i++) {
@@ -291,6 +350,50 @@ off_t cluster_start(DOS_FS * fs, uint32_t cluster)
     return fs->data_start + ((off_t)cluster - 2) * (uint64_t)fs->cluster_size;
 }
 
+/* Index of the first run of the page starting after the cluster */
+static uint32_t owner_run_index(OWNER_PAGE * page, uint32_t cluster)
+{
+    uint32_t lo = 0, hi = page->used, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (page->runs[mid].start <= cluster)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+static void owner_run_insert(OWNER_PAGE * page, uint32_t index,
+			     uint32_t start, uint32_t count, DOS_FILE * owner)
+{
+    OWNER_RUN *runs;
+
+    if (page->used == page->size) {
+	page->size = page->size ? page->size * 2 : 16;
+	runs = alloc(page->size * sizeof(OWNER_RUN));
+	if (page->runs) {
+	    memcpy(runs, page->runs, page->used * sizeof(OWNER_RUN));
+	    free(page->runs);
+	}
+	page->runs = runs;
+    }
+    memmove(&page->runs[index + 1], &page->runs[index],
+	    (page->used - index) * sizeof(OWNER_RUN));
+    page->runs[index].start = start;
+    page->runs[index].count = count;
+    page->runs[index].owner = owner;
+    page->used++;
+}
+
+static void owner_run_remove(OWNER_PAGE * page, uint32_t index)
+{
+    memmove(&page->runs[index], &page->runs[index + 1],
+	    (page->used - index - 1) * sizeof(OWNER_RUN));
+    page->used--;
+}
+
 /**
  * Update internal bookkeeping to show that the specified cluster belongs
  * to the specified dentry.
@@ -302,21 +405,78 @@ off_t cluster_start(DOS_FS * fs, uint32_t cluster)
  */
 void set_owner(DOS_FS * fs, uint32_t cluster, DOS_FILE * owner)
 {
-    if (fs->cluster_owner == NULL)
+    OWNER_PAGE *page;
+    OWNER_RUN *run;
+    DOS_FILE *current;
+    uint32_t index, tail;
+
+    if (fs->cluster_owned == NULL)
 	die("Internal error: attempt to set owner in non-existent table");
 
-    if (owner && fs->cluster_owner[cluster]
-	&& (fs->cluster_owner[cluster] != owner))
+    current = get_owner(fs, cluster);
+    if (owner && current && (current != owner))
 	die("Internal error: attempt to change file owner");
-    fs->cluster_owner[cluster] = owner;
+    if (owner == current)
+	return;
+
+    page = &fs->owner_pages[cluster >> OWNER_PAGE_SHIFT];
+    index = owner_run_index(page, cluster);
+
+    if (!owner) {
+	/* Cut the cluster out of its run */
+	fs->cluster_owned[cluster / 32] &= ~(1U << (cluster % 32));
+	run = &page->runs[index - 1];
+	if (run->count == 1)
+	    owner_run_remove(page, index - 1);
+	else if (cluster == run->start) {
+	    run->start++;
+	    run->count--;
+	} else if (cluster == run->start + run->count - 1)
+	    run->count--;
+	else {
+	    tail = run->start + run->count - cluster - 1;
+	    run->count = cluster - run->start;
+	    owner_run_insert(page, index, cluster + 1, tail, current);
+	}
+	return;
+    }
+
+    fs->cluster_owned[cluster / 32] |= 1U << (cluster % 32);
+
+    /* Chains are mostly contiguous, grow the neighbouring runs if possible */
+    if (index > 0) {
+	run = &page->runs[index - 1];
+	if (run->owner == owner && run->start + run->count == cluster) {
+	    run->count++;
+	    if (index < page->used && page->runs[index].owner == owner &&
+		page->runs[index].start == cluster + 1) {
+		run->count += page->runs[index].count;
+		owner_run_remove(page, index);
+	    }
+	    return;
+	}
+    }
+    if (index < page->used) {
+	run = &page->runs[index];
+	if (run->owner == owner && run->start == cluster + 1) {
+	    run->start--;
+	    run->count++;
+	    return;
+	}
+    }
+    owner_run_insert(page, index, cluster, 1, owner);
 }
 
 DOS_FILE *get_owner(DOS_FS * fs, uint32_t cluster)
 {
-    if (fs->cluster_owner == NULL)
+    OWNER_PAGE *page;
+
+    if (fs->cluster_owned == NULL ||
+	!(fs->cluster_owned[cluster / 32] & (1U << (cluster % 32))))
 	return NULL;
-    else
-	return fs->cluster_owner[cluster];
+
+    page = &fs->owner_pages[cluster >> OWNER_PAGE_SHIFT];
+    return page->runs[owner_run_index(page, cluster) - 1].owner;
 }
 
 void fix_bad(DOS_FS * fs)
@@ -365,6 +525,65 @@ void reclaim_free(DOS_FS * fs)
 	       (unsigned long long)reclaimed * fs->cluster_size);
 }
 
+/*
+ * Reference counts of orphan clusters. Only clusters linked to by an
+ * orphan get an entry, so the table stays small on healthy volumes.
+ */
+typedef struct {
+    uint32_t *clusters;		/* 0 marks an empty slot */
+    uint32_t *counts;
+    uint32_t mask;
+    uint32_t used;
+} REF_TABLE;
+
+static void refs_init(REF_TABLE * refs, uint32_t size)
+{
+    refs->clusters = alloc_zeroed(size * sizeof(uint32_t));
+    refs->counts = alloc_zeroed(size * sizeof(uint32_t));
+    refs->mask = size - 1;
+    refs->used = 0;
+}
+
+static void refs_free(REF_TABLE * refs)
+{
+    free(refs->clusters);
+    free(refs->counts);
+}
+
+static uint32_t *refs_lookup(REF_TABLE * refs, uint32_t cluster, int create)
+{
+    REF_TABLE grown;
+    uint32_t i, slot;
+
+    for (slot = (cluster * 2654435761U) & refs->mask; refs->clusters[slot];
+	 slot = (slot + 1) & refs->mask)
+	if (refs->clusters[slot] == cluster)
+	    return &refs->counts[slot];
+    if (!create)
+	return NULL;
+
+    if ((refs->used + 1) * 2 > refs->mask + 1) {
+	/* Keep the table at most half full */
+	refs_init(&grown, (refs->mask + 1) * 2);
+	for (i = 0; i <= refs->mask; i++)
+	    if (refs->clusters[i])
+		*refs_lookup(&grown, refs->clusters[i], 1) = refs->counts[i];
+	refs_free(refs);
+	*refs = grown;
+	return refs_lookup(refs, cluster, 1);
+    }
+    refs->clusters[slot] = cluster;
+    refs->used++;
+    return &refs->counts[slot];
+}
+
+static uint32_t refs_get(REF_TABLE * refs, uint32_t cluster)
+{
+    uint32_t *count = refs_lookup(refs, cluster, 0);
+
+    return count ? *count : 0;
+}
+
 /**
  * Assign the specified owner to all orphan chains (except cycles).
  * Break cross-links between orphan chains.
@@ -375,7 +594,7 @@ void reclaim_free(DOS_FS * fs)
  *				   clusters link to it.
  * @param[in]	    start_cluster  Where to start scanning for orphans
  */
-static void tag_free(DOS_FS * fs, DOS_FILE * owner, uint32_t *num_refs,
+static void tag_free(DOS_FS * fs, DOS_FILE * owner, REF_TABLE * num_refs,
 		     uint32_t start_cluster)
 {
     int prev;
@@ -390,7 +609,7 @@ static void tag_free(DOS_FS * fs, DOS_FILE * owner, uint32_t *num_refs,
 
 	/* If the current entry is the head of an un-owned chain... */
 	if (curEntry.value && !FAT_IS_BAD(fs, curEntry.value) &&
-	    !get_owner(fs, i) && !num_refs[i]) {
+	    !get_owner(fs, i) && !refs_get(num_refs, i)) {
 	    prev = 0;
 	    /* Walk the chain, claiming ownership as we go */
 	    for (walk = i; walk != -1; walk = next_cluster(fs, walk)) {
@@ -409,7 +628,7 @@ static void tag_free(DOS_FS * fs, DOS_FILE * owner, uint32_t *num_refs,
 		     * It's easier to decrement than to prove that it's
 		     * unnecessary.
 		     */
-		    num_refs[walk]--;
+		    (*refs_lookup(num_refs, walk, 1))--;
 		    break;
 		}
 		prev = walk;
@@ -429,15 +648,15 @@ void reclaim_file(DOS_FS * fs)
     int reclaimed, files;
     int changed = 0;
     uint32_t i, next, walk;
-    uint32_t *num_refs = NULL;	/* Only for orphaned clusters */
+    REF_TABLE num_refs;		/* Only for orphaned clusters */
+    uint32_t *count;
     uint32_t total_num_clusters;
 
     if (verbose)
 	printf("Reclaiming unconnected clusters.\n");
 
     total_num_clusters = fs->data_clusters + 2;
-    num_refs = alloc(total_num_clusters * sizeof(uint32_t));
-    memset(num_refs, 0, (total_num_clusters * sizeof(uint32_t)));
+    refs_init(&num_refs, 1024);
 
     /* Guarantee that all orphan chains (except cycles) end cleanly
      * with an end-of-chain mark.
@@ -460,7 +679,7 @@ void reclaim_file(DOS_FS * fs)
 		FAT_IS_BAD(fs, nextEntry.value))
 		set_fat(fs, i, -1);
 	    else
-		num_refs[next]++;
+		(*refs_lookup(&num_refs, next, 1))++;
 	}
     }
 
@@ -468,7 +687,7 @@ void reclaim_file(DOS_FS * fs)
      * and all cycles and cross-links are broken
      */
     do {
-	tag_free(fs, &orphan, num_refs, changed);
+	tag_free(fs, &orphan, &num_refs, changed);
 	changed = 0;
 
 	/* Any unaccounted-for orphans must be part of a cycle */
@@ -478,7 +697,8 @@ void reclaim_file(DOS_FS * fs)
 
 	    if (curEntry.value && !FAT_IS_BAD(fs, curEntry.value) &&
 		!get_owner(fs, i)) {
-		if (!num_refs[curEntry.value]--)
+		count = refs_lookup(&num_refs, curEntry.value, 1);
+		if (!(*count)--)
 		    die("Internal error: num_refs going below zero");
 		set_fat(fs, i, -1);
 		changed = curEntry.value;
@@ -487,7 +707,7 @@ void reclaim_file(DOS_FS * fs)
 		/* If we've created a new chain head,
 		 * tag_free() can claim it
 		 */
-		if (num_refs[curEntry.value] == 0)
+		if (*count == 0)
 		    break;
 	    }
 	}
@@ -501,7 +721,7 @@ void reclaim_file(DOS_FS * fs)
     files = reclaimed = 0;
     for (i = 2; i < total_num_clusters; i++)
 	/* If this cluster is the head of an orphan chain... */
-	if (get_owner(fs, i) == &orphan && !num_refs[i]) {
+	if (get_owner(fs, i) == &orphan && !refs_get(&num_refs, i)) {
 	    DIR_ENT de;
 	    off_t offset;
 	    files++;
@@ -525,7 +745,7 @@ void reclaim_file(DOS_FS * fs)
 	}
 #endif
 
-    free(num_refs);
+    refs_free(&num_refs);
 }
 
 uint32_t update_free(DOS_FS * fs)
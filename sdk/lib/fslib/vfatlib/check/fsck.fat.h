@@ -194,6 +194,20 @@ typedef struct {
     uint32_t reserved;
 } FAT_ENTRY;
 
+/* Clusters owned by the same file, consecutive on disk */
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+    DOS_FILE *owner;
+} OWNER_RUN;
+
+/* The owner runs of one range of clusters, sorted by start cluster */
+typedef struct {
+    uint32_t used;
+    uint32_t size;
+    OWNER_RUN *runs;
+} OWNER_PAGE;
+
 typedef struct {
     int nfats;
     off_t fat_start;
@@ -210,7 +224,8 @@ typedef struct {
     long free_clusters;
     off_t backupboot_start;	/* 0 if not present */
     unsigned char *fat;
-    DOS_FILE **cluster_owner;
+    uint32_t *cluster_owned;	/* bitmap of the clusters having an owner */
+    OWNER_PAGE *owner_pages;
     char *label;
 } DOS_FS;
 
@@ -54,6 +54,13 @@ static int did_change = 0;
 static HANDLE fd;
 static LARGE_INTEGER CurrentOffset;
 
+/* Small reads, mostly directory entries, are served from a read-ahead
+ * window so that scanning a directory doesn't issue one read per entry */
+#define READ_WINDOW_SIZE (64 * 1024)
+static char *read_window;
+static off_t read_window_pos;
+static int read_window_size;	/* 0 if the window holds nothing */
+
 
 /**** Win32 / NT support ******************************************************/
 
@@ -203,6 +210,7 @@ NTSTATUS fs_open(PUNICODE_STRING DriveRoot, int read_write)
     // Query geometry and partition info, to have bytes per sector, etc
 
     CurrentOffset.QuadPart = 0LL;
+    read_window_size = 0;
 
     changes = last = NULL;
     did_change = 0;
@@ -291,7 +299,27 @@ void fs_read(off_t pos, int size, void *data)
 #if DBG
 	const size_t readsize = (size_t)(pos - seekpos_aligned) + readsize_aligned;
 #endif
-	char* tmpBuf = alloc(readsize_aligned);
+	char* tmpBuf;
+
+    if (size <= READ_WINDOW_SIZE / 2) {
+	if (!read_window_size || pos < read_window_pos ||
+	    pos + size > read_window_pos + read_window_size) {
+	    /* Refill the window, it may run past the end of the volume */
+	    if (!read_window)
+		read_window = alloc(READ_WINDOW_SIZE);
+	    read_window_pos = seekpos_aligned;
+	    read_window_size = 0;
+	    if (lseek(fd, read_window_pos, 0) == read_window_pos &&
+		read(fd, read_window, READ_WINDOW_SIZE) == READ_WINDOW_SIZE)
+		read_window_size = READ_WINDOW_SIZE;
+	}
+    }
+    if (read_window_size && pos >= read_window_pos &&
+	pos + size <= read_window_pos + read_window_size) {
+	memcpy(data, read_window + (pos - read_window_pos), size);
+	got = size;
+    } else {
+	tmpBuf = alloc(readsize_aligned);
     if (lseek(fd, seekpos_aligned, 0) != seekpos_aligned) pdie("Seek to %lld",pos);
     if ((got = read(fd, tmpBuf, readsize_aligned)) < 0) pdie("Read %d bytes at %lld",size,pos);
 	assert(got >= size);
@@ -299,6 +327,7 @@ void fs_read(off_t pos, int size, void *data)
 	assert(seek_delta + size <= readsize);
 	memcpy(data, tmpBuf+seek_delta, size);
 	free(tmpBuf);
+    }
 #else
     if (lseek(fd, pos, 0) != pos)
 	pdie("Seek to %lld", (long long)pos);
@@ -356,6 +385,9 @@ void fs_write(off_t pos, int size, void *data)
         const size_t seek_delta = (size_t)(pos - seekpos_aligned);
         BOOLEAN use_read = (seek_delta != 0) || ((readsize_aligned-size) != 0);
 
+        /* The read-ahead window doesn't know about this write */
+        read_window_size = 0;
+
         /* Aloc temp buffer if write is not aligned */
         if (use_read)
             scratch = alloc(readsize_aligned);
@@ -467,6 +499,13 @@ int fs_close(int write)
 	    free(changes);
 	    changes = next;
 	}
+#ifdef __REACTOS__
+    if (read_window) {
+	free(read_window);
+	read_window = NULL;
+    }
+    read_window_size = 0;
+#endif
     if (close(fd) < 0)
 	pdie("closing filesystem");
     return changed || did_change;
@@ -51,87 +51,298 @@ CalcVolumeSerialNumber(VOID)
     return Serial;
 }
 
-/***** Wipe function for FAT12, FAT16 and FAT32 formats *****/
+/*
+ * The volume is opened for asynchronous I/O, so that FatZeroSectors can keep
+ * several writes in flight. Every other request waits for its completion
+ * here, on the file handle, which is signaled when it completes.
+ */
 NTSTATUS
-FatWipeSectors(
+FatWaitForIo(
     IN HANDLE FileHandle,
-    IN ULONG TotalSectors,
-    IN ULONG SectorsPerCluster,
+    IN NTSTATUS Status,
+    IN PIO_STATUS_BLOCK IoStatusBlock)
+{
+    if (Status == STATUS_PENDING)
+    {
+        Status = NtWaitForSingleObject(FileHandle, FALSE, NULL);
+        if (NT_SUCCESS(Status))
+            Status = IoStatusBlock->Status;
+    }
+
+    return Status;
+}
+
+/*
+ * Returns TRUE if the device has trim enabled and guarantees that trimmed
+ * sectors read back as zeros. Trim alone doesn't, a device is free to
+ * return the old data or anything else until the sectors are written.
+ */
+BOOLEAN
+FatTrimReadsZeros(
+    IN HANDLE FileHandle)
+{
+    IO_STATUS_BLOCK IoStatusBlock;
+    STORAGE_PROPERTY_QUERY Query;
+    DEVICE_TRIM_DESCRIPTOR TrimDescriptor;
+    DEVICE_LB_PROVISIONING_DESCRIPTOR LbpDescriptor;
+    NTSTATUS Status;
+
+    Query.PropertyId = StorageDeviceTrimProperty;
+    Query.QueryType = PropertyStandardQuery;
+    Status = NtDeviceIoControlFile(FileHandle,
+                                   NULL,
+                                   NULL,
+                                   NULL,
+                                   &IoStatusBlock,
+                                   IOCTL_STORAGE_QUERY_PROPERTY,
+                                   &Query,
+                                   sizeof(Query),
+                                   &TrimDescriptor,
+                                   sizeof(TrimDescriptor));
+    Status = FatWaitForIo(FileHandle, Status, &IoStatusBlock);
+    if (!NT_SUCCESS(Status) ||
+        IoStatusBlock.Information < sizeof(TrimDescriptor) ||
+        !TrimDescriptor.TrimEnabled)
+    {
+        return FALSE;
+    }
+
+    Query.PropertyId = StorageDeviceLBProvisioningProperty;
+    Query.QueryType = PropertyStandardQuery;
+    RtlZeroMemory(&LbpDescriptor, sizeof(LbpDescriptor));
+    Status = NtDeviceIoControlFile(FileHandle,
+                                   NULL,
+                                   NULL,
+                                   NULL,
+                                   &IoStatusBlock,
+                                   IOCTL_STORAGE_QUERY_PROPERTY,
+                                   &Query,
+                                   sizeof(Query),
+                                   &LbpDescriptor,
+                                   sizeof(LbpDescriptor));
+    Status = FatWaitForIo(FileHandle, Status, &IoStatusBlock);
+    if (!NT_SUCCESS(Status) ||
+        IoStatusBlock.Information < DEVICE_LB_PROVISIONING_DESCRIPTOR_V1_SIZE)
+    {
+        return FALSE;
+    }
+
+    DPRINT("Trim enabled, reads zeros after trim: %u\n",
+           LbpDescriptor.ThinProvisioningReadZeros);
+    return LbpDescriptor.ThinProvisioningReadZeros;
+}
+
+/* Trims the sectors with a single data set management range */
+static NTSTATUS
+FatTrimSectors(
+    IN HANDLE FileHandle,
+    IN ULONG StartSector,
+    IN ULONG SectorCount,
+    IN ULONG BytesPerSector)
+{
+    IO_STATUS_BLOCK IoStatusBlock;
+    struct
+    {
+        DEVICE_MANAGE_DATA_SET_ATTRIBUTES Attributes;
+        DEVICE_DATA_SET_RANGE Range;
+    } Request;
+    NTSTATUS Status;
+
+    RtlZeroMemory(&Request, sizeof(Request));
+    Request.Attributes.Size = sizeof(Request.Attributes);
+    Request.Attributes.Action = DeviceDsmAction_Trim;
+    Request.Attributes.DataSetRangesOffset = (ULONG)((PUCHAR)&Request.Range - (PUCHAR)&Request);
+    Request.Attributes.DataSetRangesLength = sizeof(Request.Range);
+    Request.Range.StartingOffset = (LONGLONG)StartSector * BytesPerSector;
+    Request.Range.LengthInBytes = (ULONGLONG)SectorCount * BytesPerSector;
+
+    Status = NtDeviceIoControlFile(FileHandle,
+                                   NULL,
+                                   NULL,
+                                   NULL,
+                                   &IoStatusBlock,
+                                   IOCTL_STORAGE_MANAGE_DATA_SET_ATTRIBUTES,
+                                   &Request,
+                                   sizeof(Request),
+                                   NULL,
+                                   0);
+    return FatWaitForIo(FileHandle, Status, &IoStatusBlock);
+}
+
+/*
+ * Size of the zero-filled writes issued by format. Large writes keep the
+ * per-call overhead negligible on multi-GB volumes, they are aligned on
+ * this size so that they don't straddle device stripes more than needed.
+ * FAT_ZERO_WRITES of them are kept in flight, all from the same buffer.
+ */
+#define FAT_ZERO_WRITE_SIZE (4 * 1024 * 1024)
+#define FAT_ZERO_WRITES     4
+
+NTSTATUS
+FatZeroSectors(
+    IN HANDLE FileHandle,
+    IN ULONG StartSector,
+    IN ULONG SectorCount,
     IN ULONG BytesPerSector,
     IN OUT PFORMAT_CONTEXT Context)
 {
-    IO_STATUS_BLOCK IoStatusBlock;
+    IO_STATUS_BLOCK IoStatusBlock[FAT_ZERO_WRITES];
+    HANDLE Event[FAT_ZERO_WRITES];
+    ULONG Pending[FAT_ZERO_WRITES];
     PUCHAR Buffer;
     LARGE_INTEGER FileOffset;
-    ULONGLONG Sector;
-    ULONG Length;
-    NTSTATUS Status;
+    ULONGLONG Sector, EndSector;
+    ULONG BufferSectors;
+    ULONG Sectors;
+    ULONG i;
+    NTSTATUS Status = STATUS_SUCCESS, WriteStatus;
 
-    Length = SectorsPerCluster * BytesPerSector;
+    if (SectorCount == 0)
+        return STATUS_SUCCESS;
 
-    /* Allocate buffer for the cluster */
-    Buffer = (PUCHAR)RtlAllocateHeap(RtlGetProcessHeap(),
-                                     HEAP_ZERO_MEMORY,
-                                     Length);
+    /* Nothing to do if the whole volume was wiped already */
+    if (Context->VolumeWiped)
+    {
+        UpdateProgress(Context, SectorCount);
+        return STATUS_SUCCESS;
+    }
+
+    /* Trimmed sectors read back as zeros, write them only if the trim fails */
+    if (Context->TrimReadsZeros &&
+        NT_SUCCESS(FatTrimSectors(FileHandle, StartSector, SectorCount, BytesPerSector)))
+    {
+        UpdateProgress(Context, SectorCount);
+        return STATUS_SUCCESS;
+    }
+
+    BufferSectors = FAT_ZERO_WRITE_SIZE / BytesPerSector;
+    if (BufferSectors > SectorCount)
+        BufferSectors = SectorCount;
+
+    /* Allocate the zero buffer, settle for less if memory is short */
+    for (;;)
+    {
+        Buffer = (PUCHAR)RtlAllocateHeap(RtlGetProcessHeap(),
+                                         HEAP_ZERO_MEMORY,
+                                         BufferSectors * BytesPerSector);
+        if (Buffer != NULL || BufferSectors == 1)
+            break;
+
+        BufferSectors /= 2;
+    }
     if (Buffer == NULL)
         return STATUS_INSUFFICIENT_RESOURCES;
 
-    /* Wipe all clusters */
-    Sector = 0;
-    while (Sector + SectorsPerCluster < TotalSectors)
+    /* One event per write in flight */
+    for (i = 0; i < FAT_ZERO_WRITES; i++)
     {
-        FileOffset.QuadPart = Sector * BytesPerSector;
-
-        Status = NtWriteFile(FileHandle,
-                             NULL,
-                             NULL,
-                             NULL,
-                             &IoStatusBlock,
-                             Buffer,
-                             Length,
-                             &FileOffset,
-                             NULL);
-        if (!NT_SUCCESS(Status))
+        Pending[i] = 0;
+        Event[i] = NULL;
+        if (NT_SUCCESS(Status))
         {
-            DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
-            goto done;
+            Status = NtCreateEvent(&Event[i],
+                                   EVENT_ALL_ACCESS,
+                                   NULL,
+                                   NotificationEvent,
+                                   FALSE);
         }
-
-        UpdateProgress(Context, SectorsPerCluster);
-
-        Sector += SectorsPerCluster;
     }
 
-    /* Wipe the trailing space behind the last cluster */
-    if (Sector < TotalSectors)
+    Sector = StartSector;
+    EndSector = (ULONGLONG)StartSector + SectorCount;
+    i = 0;
+    while (NT_SUCCESS(Status) && Sector < EndSector)
     {
-        DPRINT("Remaining sectors %lu\n", TotalSectors - Sector);
+        /* Wait for the oldest write before reusing its slot */
+        if (Pending[i] != 0)
+        {
+            Status = NtWaitForSingleObject(Event[i], FALSE, NULL);
+            if (NT_SUCCESS(Status))
+                Status = IoStatusBlock[i].Status;
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
+                Pending[i] = 0;
+                break;
+            }
+
+            UpdateProgress(Context, Pending[i]);
+            Pending[i] = 0;
+        }
+
+        /* The first write stops at a buffer-aligned boundary, the next ones are aligned */
+        Sectors = BufferSectors - (ULONG)(Sector % BufferSectors);
+        if (Sectors > EndSector - Sector)
+            Sectors = (ULONG)(EndSector - Sector);
 
         FileOffset.QuadPart = Sector * BytesPerSector;
-        Length = (TotalSectors - Sector) * BytesPerSector;
 
         Status = NtWriteFile(FileHandle,
+                             Event[i],
                              NULL,
                              NULL,
-                             NULL,
-                             &IoStatusBlock,
+                             &IoStatusBlock[i],
                              Buffer,
-                             Length,
+                             Sectors * BytesPerSector,
                              &FileOffset,
                              NULL);
         if (!NT_SUCCESS(Status))
         {
             DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
-            goto done;
+            break;
         }
 
-        UpdateProgress(Context, TotalSectors - Sector);
+        Pending[i] = Sectors;
+        Sector += Sectors;
+        i = (i + 1) % FAT_ZERO_WRITES;
+    }
+
+    /* Wait for the writes still in flight, the buffer goes away below */
+    for (i = 0; i < FAT_ZERO_WRITES; i++)
+    {
+        if (Pending[i] != 0)
+        {
+            WriteStatus = NtWaitForSingleObject(Event[i], FALSE, NULL);
+            if (NT_SUCCESS(WriteStatus))
+                WriteStatus = IoStatusBlock[i].Status;
+
+            if (NT_SUCCESS(WriteStatus))
+                UpdateProgress(Context, Pending[i]);
+            else if (NT_SUCCESS(Status))
+                Status = WriteStatus;
+        }
+
+        if (Event[i] != NULL)
+            NtClose(Event[i]);
     }
 
-done:
     /* Free the buffer */
     RtlFreeHeap(RtlGetProcessHeap(), 0, Buffer);
     return Status;
 }
 
+/***** Wipe function for FAT12, FAT16 and FAT32 formats *****/
+NTSTATUS
+FatWipeSectors(
+    IN HANDLE FileHandle,
+    IN ULONG TotalSectors,
+    IN ULONG BytesPerSector,
+    IN OUT PFORMAT_CONTEXT Context)
+{
+    NTSTATUS Status;
+
+    Status = FatZeroSectors(FileHandle,
+                            0,
+                            TotalSectors,
+                            BytesPerSector,
+                            Context);
+    if (NT_SUCCESS(Status))
+    {
+        /* The FAT and root directory areas don't need to be zeroed again */
+        Context->VolumeWiped = TRUE;
+    }
+
+    return Status;
+}
+
 /* EOF */
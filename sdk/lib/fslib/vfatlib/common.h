@@ -14,11 +14,28 @@
 ULONG GetShiftCount(IN ULONG Value);
 ULONG CalcVolumeSerialNumber(VOID);
 
+NTSTATUS
+FatWaitForIo(
+    IN HANDLE FileHandle,
+    IN NTSTATUS Status,
+    IN PIO_STATUS_BLOCK IoStatusBlock);
+
+BOOLEAN
+FatTrimReadsZeros(
+    IN HANDLE FileHandle);
+
+NTSTATUS
+FatZeroSectors(
+    IN HANDLE FileHandle,
+    IN ULONG StartSector,
+    IN ULONG SectorCount,
+    IN ULONG BytesPerSector,
+    IN OUT PFORMAT_CONTEXT Context);
+
 NTSTATUS
 FatWipeSectors(
     IN HANDLE FileHandle,
     IN ULONG TotalSectors,
-    IN ULONG SectorsPerCluster,
     IN ULONG BytesPerSector,
     IN OUT PFORMAT_CONTEXT Context);
 
@@ -56,6 +56,7 @@ Fat12WriteBootSector(IN HANDLE FileHandle,
                          BootSector->BytesPerSector,
                          &FileOffset,
                          NULL);
+    Status = FatWaitForIo(FileHandle, Status, &IoStatusBlock);
     if (!NT_SUCCESS(Status))
     {
         DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
@@ -81,19 +82,16 @@ Fat12WriteFAT(IN HANDLE FileHandle,
     NTSTATUS Status;
     PUCHAR Buffer;
     LARGE_INTEGER FileOffset;
-    ULONG i;
-    ULONG Size;
-    ULONG Sectors;
 
     /* Allocate buffer */
     Buffer = (PUCHAR)RtlAllocateHeap(RtlGetProcessHeap(),
                                      0,
-                                     32 * 1024);
+                                     BootSector->BytesPerSector);
     if (Buffer == NULL)
         return STATUS_INSUFFICIENT_RESOURCES;
 
     /* Zero the buffer */
-    RtlZeroMemory(Buffer, 32 * 1024);
+    RtlZeroMemory(Buffer, BootSector->BytesPerSector);
 
     /* FAT cluster 0 & 1*/
     Buffer[0] = 0xf8; /* Media type */
@@ -111,6 +109,7 @@ Fat12WriteFAT(IN HANDLE FileHandle,
                          BootSector->BytesPerSector,
                          &FileOffset,
                          NULL);
+    Status = FatWaitForIo(FileHandle, Status, &IoStatusBlock);
     if (!NT_SUCCESS(Status))
     {
         DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
@@ -119,38 +118,12 @@ Fat12WriteFAT(IN HANDLE FileHandle,
 
     UpdateProgress(Context, 1);
 
-    /* Zero the begin of the buffer */
-    RtlZeroMemory(Buffer, 3);
-
     /* Zero the rest of the FAT */
-    Sectors = 32 * 1024 / BootSector->BytesPerSector;
-    for (i = 1; i < (ULONG)BootSector->FATSectors; i += Sectors)
-    {
-        /* Zero some sectors of the FAT */
-        FileOffset.QuadPart = (SectorOffset + BootSector->ReservedSectors + i) * BootSector->BytesPerSector;
-        if (((ULONG)BootSector->FATSectors - i) <= Sectors)
-        {
-            Sectors = (ULONG)BootSector->FATSectors - i;
-        }
-
-        Size = Sectors * BootSector->BytesPerSector;
-        Status = NtWriteFile(FileHandle,
-                             NULL,
-                             NULL,
-                             NULL,
-                             &IoStatusBlock,
-                             Buffer,
-                             Size,
-                             &FileOffset,
-                             NULL);
-        if (!NT_SUCCESS(Status))
-        {
-            DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
-            goto done;
-        }
-
-        UpdateProgress(Context, Sectors);
-    }
+    Status = FatZeroSectors(FileHandle,
+                            SectorOffset + BootSector->ReservedSectors + 1,
+                            (ULONG)BootSector->FATSectors - 1,
+                            BootSector->BytesPerSector,
+                            Context);
 
 done:
     /* Free the buffer */
@@ -164,15 +137,8 @@ Fat12WriteRootDirectory(IN HANDLE FileHandle,
                         IN PFAT16_BOOT_SECTOR BootSector,
                         IN OUT PFORMAT_CONTEXT Context)
 {
-    IO_STATUS_BLOCK IoStatusBlock;
-    NTSTATUS Status = STATUS_SUCCESS;
-    PUCHAR Buffer;
-    LARGE_INTEGER FileOffset;
     ULONG FirstRootDirSector;
     ULONG RootDirSectors;
-    ULONG Sectors;
-    ULONG Size;
-    ULONG i;
 
     DPRINT("BootSector->ReservedSectors = %hu\n", BootSector->ReservedSectors);
     DPRINT("BootSector->FATSectors = %hu\n", BootSector->FATSectors);
@@ -187,51 +153,12 @@ Fat12WriteRootDirectory(IN HANDLE FileHandle,
     DPRINT("RootDirSectors = %lu\n", RootDirSectors);
     DPRINT("FirstRootDirSector = %lu\n", FirstRootDirSector);
 
-    /* Allocate buffer for the cluster */
-    Buffer = (PUCHAR)RtlAllocateHeap(RtlGetProcessHeap(),
-                                     0,
-                                     32 * 1024);
-    if (Buffer == NULL)
-        return STATUS_INSUFFICIENT_RESOURCES;
-
-    /* Zero the buffer */
-    RtlZeroMemory(Buffer, 32 * 1024);
-
-    Sectors = 32 * 1024 / BootSector->BytesPerSector;
-    for (i = 0; i < RootDirSectors; i += Sectors)
-    {
-        /* Zero some sectors of the root directory */
-        FileOffset.QuadPart = (FirstRootDirSector + i) * BootSector->BytesPerSector;
-
-        if ((RootDirSectors - i) <= Sectors)
-        {
-            Sectors = RootDirSectors - i;
-        }
-
-        Size = Sectors * BootSector->BytesPerSector;
-
-        Status = NtWriteFile(FileHandle,
-                             NULL,
-                             NULL,
-                             NULL,
-                             &IoStatusBlock,
-                             Buffer,
-                             Size,
-                             &FileOffset,
-                             NULL);
-        if (!NT_SUCCESS(Status))
-        {
-            DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
-            goto done;
-        }
-
-        UpdateProgress(Context, Sectors);
-    }
-
-done:
-    /* Free the buffer */
-    RtlFreeHeap(RtlGetProcessHeap(), 0, Buffer);
-    return Status;
+    /* Zero the root directory */
+    return FatZeroSectors(FileHandle,
+                          FirstRootDirSector,
+                          RootDirSectors,
+                          BootSector->BytesPerSector,
+                          Context);
 }
 
 
@@ -331,7 +258,6 @@ Fat12Format(IN HANDLE FileHandle,
 
         Status = FatWipeSectors(FileHandle,
                                 SectorCount,
-                                (ULONG)BootSector.SectorsPerCluster,
                                 (ULONG)BootSector.BytesPerSector,
                                 Context);
         if (!NT_SUCCESS(Status))
@@ -56,6 +56,7 @@ Fat32WriteBootSector(IN HANDLE FileHandle,
                          BootSector->BytesPerSector,
                          &FileOffset,
                          NULL);
+    Status = FatWaitForIo(FileHandle, Status, &IoStatusBlock);
     if (!NT_SUCCESS(Status))
     {
         DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
@@ -77,6 +78,7 @@ Fat32WriteBootSector(IN HANDLE FileHandle,
                              BootSector->BytesPerSector,
                              &FileOffset,
                              NULL);
+        Status = FatWaitForIo(FileHandle, Status, &IoStatusBlock);
         if (!NT_SUCCESS(Status))
         {
             DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
@@ -134,6 +136,7 @@ Fat32WriteFsInfo(IN HANDLE FileHandle,
                          BootSector->BytesPerSector,
                          &FileOffset,
                          NULL);
+    Status = FatWaitForIo(FileHandle, Status, &IoStatusBlock);
     if (!NT_SUCCESS(Status))
     {
         DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
@@ -158,6 +161,7 @@ Fat32WriteFsInfo(IN HANDLE FileHandle,
                              BootSector->BytesPerSector,
                              &FileOffset,
                              NULL);
+        Status = FatWaitForIo(FileHandle, Status, &IoStatusBlock);
         if (!NT_SUCCESS(Status))
         {
             DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
@@ -182,6 +186,7 @@ Fat32WriteFsInfo(IN HANDLE FileHandle,
                          BootSector->BytesPerSector,
                          &FileOffset,
                          NULL);
+    Status = FatWaitForIo(FileHandle, Status, &IoStatusBlock);
     if (!NT_SUCCESS(Status))
     {
         DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
@@ -203,6 +208,7 @@ Fat32WriteFsInfo(IN HANDLE FileHandle,
                              BootSector->BytesPerSector,
                              &FileOffset,
                              NULL);
+        Status = FatWaitForIo(FileHandle, Status, &IoStatusBlock);
         if (!NT_SUCCESS(Status))
         {
             DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
@@ -229,18 +235,16 @@ Fat32WriteFAT(IN HANDLE FileHandle,
     NTSTATUS Status;
     PUCHAR Buffer;
     LARGE_INTEGER FileOffset;
-    ULONG i;
-    ULONG Sectors;
 
     /* Allocate buffer */
     Buffer = (PUCHAR)RtlAllocateHeap(RtlGetProcessHeap(),
                                      0,
-                                     64 * 1024);
+                                     BootSector->BytesPerSector);
     if (Buffer == NULL)
         return STATUS_INSUFFICIENT_RESOURCES;
 
     /* Zero the buffer */
-    RtlZeroMemory(Buffer, 64 * 1024);
+    RtlZeroMemory(Buffer, BootSector->BytesPerSector);
 
     /* FAT cluster 0 */
     Buffer[0] = 0xf8; /* Media type */
@@ -271,6 +275,7 @@ Fat32WriteFAT(IN HANDLE FileHandle,
                          BootSector->BytesPerSector,
                          &FileOffset,
                          NULL);
+    Status = FatWaitForIo(FileHandle, Status, &IoStatusBlock);
     if (!NT_SUCCESS(Status))
     {
         DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
@@ -279,38 +284,12 @@ Fat32WriteFAT(IN HANDLE FileHandle,
 
     UpdateProgress(Context, 1);
 
-    /* Zero the begin of the buffer */
-    RtlZeroMemory(Buffer, 12);
-
     /* Zero the rest of the FAT */
-    Sectors = 64 * 1024 / BootSector->BytesPerSector;
-    for (i = 1; i < BootSector->FATSectors32; i += Sectors)
-    {
-        /* Zero some sectors of the FAT */
-        FileOffset.QuadPart = (SectorOffset + BootSector->ReservedSectors + i) * BootSector->BytesPerSector;
-
-        if ((BootSector->FATSectors32 - i) <= Sectors)
-        {
-            Sectors = BootSector->FATSectors32 - i;
-        }
-
-        Status = NtWriteFile(FileHandle,
-                             NULL,
-                             NULL,
-                             NULL,
-                             &IoStatusBlock,
-                             Buffer,
-                             Sectors * BootSector->BytesPerSector,
-                             &FileOffset,
-                             NULL);
-        if (!NT_SUCCESS(Status))
-        {
-            DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
-            goto done;
-        }
-
-        UpdateProgress(Context, Sectors);
-    }
+    Status = FatZeroSectors(FileHandle,
+                            SectorOffset + BootSector->ReservedSectors + 1,
+                            BootSector->FATSectors32 - 1,
+                            BootSector->BytesPerSector,
+                            Context);
 
 done:
     /* Free the buffer */
@@ -367,6 +346,7 @@ Fat32WriteRootDirectory(IN HANDLE FileHandle,
                          BootSector->SectorsPerCluster * BootSector->BytesPerSector,
                          &FileOffset,
                          NULL);
+    Status = FatWaitForIo(FileHandle, Status, &IoStatusBlock);
     if (!NT_SUCCESS(Status))
     {
         DPRINT("NtWriteFile() failed (Status %lx)\n", Status);
@@ -499,7 +479,6 @@ Fat32Format(IN HANDLE FileHandle,
 
         Status = FatWipeSectors(FileHandle,
                                 BootSector.SectorsHuge,
-                                (ULONG)BootSector.SectorsPerCluster,
                                 (ULONG)BootSector.BytesPerSector,
                                 Context);
         if (!NT_SUCCESS(Status))
@@ -74,6 +74,8 @@ VfatFormat(
     Context.CurrentSectorCount = 0;
     Context.Callback = Callback;
     Context.Success = FALSE;
+    Context.VolumeWiped = FALSE;
+    Context.TrimReadsZeros = FALSE;
     Context.Percent = 0;
 
     InitializeObjectAttributes(&ObjectAttributes,
@@ -87,7 +89,7 @@ VfatFormat(
                         &ObjectAttributes,
                         &Iosb,
                         FILE_SHARE_READ,
-                        FILE_SYNCHRONOUS_IO_ALERT);
+                        0 /* Asynchronous, see FatZeroSectors */);
     if (!NT_SUCCESS(Status))
     {
         DPRINT1("NtOpenFile() failed with status 0x%08x\n", Status);
@@ -104,6 +106,7 @@ VfatFormat(
                                    0,
                                    &DiskGeometry,
                                    sizeof(DISK_GEOMETRY));
+    Status = FatWaitForIo(FileHandle, Status, &Iosb);
     if (!NT_SUCCESS(Status))
     {
         DPRINT("IOCTL_DISK_GET_DRIVE_GEOMETRY failed with status 0x%08x\n", Status);
@@ -133,12 +136,15 @@ VfatFormat(
                                        0,
                                        &PartitionInfo,
                                        sizeof(PARTITION_INFORMATION));
+        Status = FatWaitForIo(FileHandle, Status, &Iosb);
         if (!NT_SUCCESS(Status))
         {
             DPRINT("IOCTL_DISK_GET_PARTITION_INFO failed with status 0x%08x\n", Status);
             NtClose(FileHandle);
             return FALSE;
         }
+
+        Context.TrimReadsZeros = FatTrimReadsZeros(FileHandle);
     }
     else
     {
@@ -233,6 +239,7 @@ VfatFormat(
                                  0,
                                  NULL,
                                  0);
+    LockStatus = FatWaitForIo(FileHandle, LockStatus, &Iosb);
     if (!NT_SUCCESS(LockStatus))
     {
         DPRINT1("WARNING: Failed to lock volume for formatting! Format may fail! (Status: 0x%x)\n", LockStatus);
@@ -290,6 +297,7 @@ VfatFormat(
                                  0,
                                  NULL,
                                  0);
+    LockStatus = FatWaitForIo(FileHandle, LockStatus, &Iosb);
     if (!NT_SUCCESS(LockStatus))
     {
         DPRINT1("Failed to umount volume (Status: 0x%x)\n", LockStatus);
@@ -305,6 +313,7 @@ VfatFormat(
                                  0,
                                  NULL,
                                  0);
+    LockStatus = FatWaitForIo(FileHandle, LockStatus, &Iosb);
     if (!NT_SUCCESS(LockStatus))
     {
         DPRINT1("Failed to unlock volume (Status: 0x%x)\n", LockStatus);
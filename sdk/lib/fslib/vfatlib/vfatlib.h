@@ -16,11 +16,13 @@
 #include <windef.h>
 #include <winbase.h>
 #define NTOS_MODE_USER
+#include <ndk/exfuncs.h>
 #include <ndk/iofuncs.h>
 #include <ndk/kefuncs.h>
 #include <ndk/obfuncs.h>
 #include <ndk/rtlfuncs.h>
 #include <fmifs/fmifs.h>
+#include <ntddstor.h>
 
 #include "check/dosfsck.h"
 
@@ -106,6 +108,8 @@ typedef struct _FORMAT_CONTEXT
     ULONG TotalSectorCount;
     ULONG CurrentSectorCount;
     BOOLEAN Success;
+    BOOLEAN VolumeWiped;
+    BOOLEAN TrimReadsZeros;
     ULONG Percent;
 } FORMAT_CONTEXT, *PFORMAT_CONTEXT;
 
@@ -293,12 +293,19 @@ InfpFindLineById(PINFCACHESECTION Section, UINT Id)
 {
     PINFCACHELINE Line;
 
-    for (Line = Section->FirstLine;
-         Line != NULL;
-         Line = Line->Next)
+    /*
+     * Line IDs are increasing along the list, so start from
+     * the last line found if the wanted one comes after it.
+     */
+    Line = Section->LastFoundLine;
+    if (Line == NULL || Line->Id > Id)
+        Line = Section->FirstLine;
+
+    for (; Line != NULL; Line = Line->Next)
     {
         if (Line->Id == Id)
         {
+            Section->LastFoundLine = Line;
             return Line;
         }
     }
@@ -48,6 +48,7 @@ typedef struct _INFCACHESECTION
 
   PINFCACHELINE FirstLine;
   PINFCACHELINE LastLine;
+  PINFCACHELINE LastFoundLine; /* Lookup hint, lines are mostly enumerated in order */
   UINT Id;
 
   LONG LineCount;
@@ -9,6 +9,8 @@
 
 #include "diskio.h"		/* FatFs lower layer API */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 /*-----------------------------------------------------------------------*/
 /* Correspondence between physical drive number and image file handles.  */
@@ -17,6 +19,99 @@ UINT sectorCount[1] = { 0 };
 FILE* driveHandle[1] = { NULL };
 const int driveHandleCount = sizeof(driveHandle) / sizeof(FILE*);
 
+/*-----------------------------------------------------------------------*/
+/* The whole image is kept in memory while fatten runs. FatFs issues a   */
+/* lot of single sector requests, so reads and writes only touch this    */
+/* buffer and the modified range is written back to the file in one      */
+/* sequential pass on cleanup.                                           */
+
+BYTE* driveImage[1] = { NULL };
+DWORD driveImageSectors[1] = { 0 };
+DWORD driveFileSectors[1] = { 0 };	/* Size of the image file itself */
+DWORD driveDirtyFirst[1] = { 0 };
+DWORD driveDirtyLast[1] = { 0 };	/* Exclusive, equal to first when clean */
+
+static int disk_growimage(BYTE pdrv, DWORD sectors)
+{
+    BYTE* image;
+
+    if (sectors <= driveImageSectors[pdrv])
+        return 0;
+
+    // calloc leaves the pages of a new image untouched until they are used
+    if (!driveImage[pdrv])
+    {
+        image = calloc(sectors, 512);
+        if (!image)
+            return 1;
+    }
+    else
+    {
+        image = realloc(driveImage[pdrv], (size_t)sectors * 512);
+        if (!image)
+            return 1;
+
+        memset(image + (size_t)driveImageSectors[pdrv] * 512, 0,
+               (size_t)(sectors - driveImageSectors[pdrv]) * 512);
+    }
+    driveImage[pdrv] = image;
+    driveImageSectors[pdrv] = sectors;
+    return 0;
+}
+
+static void disk_markdirty(BYTE pdrv, DWORD sector, DWORD count)
+{
+    if (driveDirtyFirst[pdrv] == driveDirtyLast[pdrv])
+    {
+        driveDirtyFirst[pdrv] = sector;
+        driveDirtyLast[pdrv] = sector + count;
+        return;
+    }
+
+    if (sector < driveDirtyFirst[pdrv])
+        driveDirtyFirst[pdrv] = sector;
+    if (sector + count > driveDirtyLast[pdrv])
+        driveDirtyLast[pdrv] = sector + count;
+}
+
+static DRESULT disk_flush(BYTE pdrv)
+{
+    DWORD first = driveDirtyFirst[pdrv];
+    DWORD count = driveDirtyLast[pdrv] - first;
+    BYTE zero = 0;
+
+    if (count != 0)
+    {
+        if (fseek(driveHandle[pdrv], (long)first * 512, SEEK_SET))
+            return RES_ERROR;
+
+        if (fwrite(driveImage[pdrv] + (size_t)first * 512, 512, count, driveHandle[pdrv]) != count)
+            return RES_ERROR;
+
+        if (first + count > driveFileSectors[pdrv])
+            driveFileSectors[pdrv] = first + count;
+        driveDirtyFirst[pdrv] = driveDirtyLast[pdrv] = 0;
+    }
+
+    // A grown image that was never written to its end is still zero there,
+    // extending the file with its last byte is enough.
+    if (driveFileSectors[pdrv] < driveImageSectors[pdrv])
+    {
+        if (fseek(driveHandle[pdrv], (long)driveImageSectors[pdrv] * 512 - 1, SEEK_SET))
+            return RES_ERROR;
+
+        if (fwrite(&zero, 1, 1, driveHandle[pdrv]) != 1)
+            return RES_ERROR;
+
+        driveFileSectors[pdrv] = driveImageSectors[pdrv];
+    }
+
+    if (fflush(driveHandle[pdrv]))
+        return RES_ERROR;
+
+    return RES_OK;
+}
+
 /*-----------------------------------------------------------------------*/
 /* Open an image file a Drive                                            */
 /*-----------------------------------------------------------------------*/
@@ -35,7 +130,22 @@ DSTATUS disk_openimage(BYTE pdrv, const char* imageFileName)
         }
 
         if (driveHandle[0] != NULL)
-            return 0;
+        {
+            long size;
+
+            // Load the existing contents, a partial trailing sector is dropped
+            if (fseek(driveHandle[0], 0, SEEK_END) == 0 &&
+                (size = ftell(driveHandle[0])) >= 0 &&
+                disk_growimage(0, size / 512) == 0 &&
+                fseek(driveHandle[0], 0, SEEK_SET) == 0 &&
+                fread(driveImage[0], 512, driveImageSectors[0], driveHandle[0]) == driveImageSectors[0])
+            {
+                driveFileSectors[0] = driveImageSectors[0];
+                return 0;
+            }
+
+            disk_cleanup(0);
+        }
     }
     return STA_NOINIT;
 }
@@ -53,9 +163,17 @@ VOID disk_cleanup(
     {
         if (driveHandle[pdrv] != NULL)
         {
+            if (disk_flush(pdrv) != RES_OK)
+                fprintf(stderr, "Error: Unable to write back the image file!\n");
+
             fclose(driveHandle[pdrv]);
             driveHandle[pdrv] = NULL;
         }
+
+        free(driveImage[pdrv]);
+        driveImage[pdrv] = NULL;
+        driveImageSectors[pdrv] = driveFileSectors[pdrv] = 0;
+        driveDirtyFirst[pdrv] = driveDirtyLast[pdrv] = 0;
     }
 }
 
@@ -103,19 +221,15 @@ DRESULT disk_read(
     UINT count		/* Number of sectors to read (1..128) */
     )
 {
-    DWORD result;
-
     if (pdrv < driveHandleCount)
     {
         if (driveHandle[pdrv] != NULL)
         {
-            if (fseek(driveHandle[pdrv], sector * 512, SEEK_SET))
+            if (sector > driveImageSectors[pdrv] ||
+                count > driveImageSectors[pdrv] - sector)
                 return RES_ERROR;
 
-            result = fread(buff, 512, count, driveHandle[pdrv]);
-
-            if (result != count)
-                return RES_ERROR;
+            memcpy(buff, driveImage[pdrv] + (size_t)sector * 512, (size_t)count * 512);
 
             return RES_OK;
         }
@@ -138,19 +252,16 @@ DRESULT disk_write(
     UINT count			/* Number of sectors to write (1..128) */
     )
 {
-    DWORD result;
-
     if (pdrv < driveHandleCount)
     {
         if (driveHandle[pdrv] != NULL)
         {
-            if (fseek(driveHandle[pdrv], sector * 512, SEEK_SET))
+            // Writing past the end extends the image, as the file would
+            if (disk_growimage(pdrv, sector + count))
                 return RES_ERROR;
 
-            result = fwrite(buff, 512, count, driveHandle[pdrv]);
-
-            if (result != count)
-                return RES_ERROR;
+            memcpy(driveImage[pdrv] + (size_t)sector * 512, buff, (size_t)count * 512);
+            disk_markdirty(pdrv, sector, count);
 
             return RES_OK;
         }
@@ -179,7 +290,8 @@ DRESULT disk_ioctl(
             switch (cmd)
             {
             case CTRL_SYNC:
-                fflush(driveHandle[pdrv]);
+                // FatFs syncs on every file close, the image is only
+                // written back once, by disk_cleanup.
                 return RES_OK;
             case GET_SECTOR_SIZE:
                 *(DWORD*)buff = 512;
@@ -190,33 +302,24 @@ DRESULT disk_ioctl(
             case GET_SECTOR_COUNT:
             {
                 if (sectorCount[pdrv] <= 0)
-                {
-                    if (fseek(driveHandle[pdrv], 0, SEEK_END))
-                        printf("fseek failed!\n");
-                    else
-                        sectorCount[pdrv] = ftell(driveHandle[pdrv]) / 512;
-                }
+                    sectorCount[pdrv] = driveImageSectors[pdrv];
 
                 *(DWORD*)buff = sectorCount[pdrv];
                 return RES_OK;
             }
             case SET_SECTOR_COUNT:
             {
-                int count = *(DWORD*)buff;
-                long size;
+                DWORD count = *(DWORD*)buff;
+                DWORD size = driveImageSectors[pdrv];
 
                 sectorCount[pdrv] = count;
 
-                fseek(driveHandle[pdrv], 0, SEEK_END);
-                size = ftell(driveHandle[pdrv]) / 512;
-
                 if (size < count)
                 {
-                    if (fseek(driveHandle[pdrv], count * 512 - 1, SEEK_SET))
+                    // The file itself is extended on the next flush
+                    if (disk_growimage(pdrv, count))
                         return RES_ERROR;
 
-                    fwrite(buff, 1, 1, driveHandle[pdrv]);
-
                     return RES_OK;
                 }
                 else
@@ -6,6 +6,7 @@
  * PROGRAMMERS:     David Quintana
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
@@ -25,8 +26,22 @@ DWORD get_fattime(void)
     time_t rawtime;
     struct tm * timeinfo;
 
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
+    const char* epoch = getenv("SOURCE_DATE_EPOCH");
+
+    if (epoch && *epoch)
+    {
+        // Reproducible builds: stamp everything (including the volume
+        // serial number) with the given time instead of the current one.
+        rawtime = (time_t)strtoul(epoch, NULL, 10);
+        if (rawtime < 315532800) // 1980-01-01, the FAT epoch
+            rawtime = 315532800;
+        timeinfo = gmtime(&rawtime);
+    }
+    else
+    {
+        time(&rawtime);
+        timeinfo = localtime(&rawtime);
+    }
 
     {
     union FatTime {
@@ -83,6 +98,10 @@ void print_help(const char* name)
            "            Creates a directory.\n");
     printf("    -list [<pattern>]\n"
            "            Lists files a directory (defaults to root).\n");
+    printf("    -batch <manifest file>\n"
+           "            Adds all files and directories listed in the manifest, one\n"
+           "            '<dst path>=<src path>' per line ('<dst path>=' for a directory).\n"
+           "            The result only depends on the manifest contents, not their order.\n");
 }
 
 #define PRINT_HELP_AND_QUIT() \
@@ -129,6 +148,263 @@ int need_mount(void)
         goto exit; \
     } } while(0)
 
+typedef struct _BATCH_ENTRY
+{
+    char* dst;
+    char* src; // NULL for directories
+    DWORD size;
+} BATCH_ENTRY;
+
+#define BATCH_BUFFER_SIZE (1024 * 1024)
+
+// FAT names are case insensitive. '/' sorts before any other character,
+// so that a directory always comes right before its contents.
+int compare_batch_entries(const void* a, const void* b)
+{
+    const unsigned char* p = (const unsigned char*)((const BATCH_ENTRY*)a)->dst;
+    const unsigned char* q = (const unsigned char*)((const BATCH_ENTRY*)b)->dst;
+    int cp, cq;
+
+    do
+    {
+        cp = (*p == '/') ? 1 : toupper(*p);
+        cq = (*q == '/') ? 1 : toupper(*q);
+        p++;
+        q++;
+    } while (cp && cp == cq);
+
+    return cp - cq;
+}
+
+int make_parent_dirs(char* path)
+{
+    char* sep;
+    int r;
+
+    for (sep = strchr(path, '/'); sep; sep = strchr(sep + 1, '/'))
+    {
+        *sep = '\0';
+        r = f_mkdir(path);
+        *sep = '/';
+        if (r && r != FR_EXIST)
+            return r;
+    }
+
+    return FR_OK;
+}
+
+/*
+ * Adds a whole tree in three passes: all the directories, then all the
+ * (empty) file entries, then the file data. Directory tables are therefore
+ * complete before any data cluster is handed out, and each file gets its
+ * cluster chain allocated in one go right after the previous file's.
+ */
+int batch_add(const char* manifest)
+{
+    FILE* fm;
+    FILE* fe;
+    FIL fv;
+    BATCH_ENTRY* entries = NULL;
+    BATCH_ENTRY* entry;
+    BYTE* data = NULL;
+    char line[1024];
+    char* sep;
+    size_t count = 0, capacity = 0, i;
+    size_t rdlen;
+    UINT wrlen;
+    long size;
+    int r, ret = 1;
+
+    fm = fopen(manifest, "r");
+    if (!fm)
+    {
+        fprintf(stderr, "Error: Unable to open manifest '%s' for reading.\n", manifest);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), fm))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        sep = strchr(line, '=');
+        if (!sep || sep == line)
+        {
+            fprintf(stderr, "Error: Invalid manifest line '%s'.\n", line);
+            goto cleanup;
+        }
+        *sep++ = '\0';
+
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            entry = realloc(entries, capacity * sizeof(BATCH_ENTRY));
+            if (!entry)
+            {
+                fprintf(stderr, "Error: Out of memory.\n");
+                goto cleanup;
+            }
+            entries = entry;
+        }
+
+        entry = &entries[count];
+        entry->dst = strdup(line);
+        entry->src = *sep ? strdup(sep) : NULL;
+        entry->size = 0;
+        if (!entry->dst || (*sep && !entry->src))
+        {
+            free(entry->dst);
+            free(entry->src);
+            fprintf(stderr, "Error: Out of memory.\n");
+            goto cleanup;
+        }
+        count++;
+
+        // Accept either separator and strip leading/trailing ones
+        for (sep = entry->dst; *sep; sep++)
+        {
+            if (*sep == '\\')
+                *sep = '/';
+        }
+        while (sep > entry->dst && sep[-1] == '/')
+            *--sep = '\0';
+        while (entry->dst[0] == '/')
+            memmove(entry->dst, entry->dst + 1, strlen(entry->dst));
+        if (entry->dst[0] == '\0')
+        {
+            fprintf(stderr, "Error: Empty destination path in manifest.\n");
+            goto cleanup;
+        }
+    }
+
+    qsort(entries, count, sizeof(BATCH_ENTRY), compare_batch_entries);
+
+    for (i = 1; i < count; i++)
+    {
+        if (compare_batch_entries(&entries[i - 1], &entries[i]) == 0)
+        {
+            fprintf(stderr, "Error: '%s' is listed more than once in the manifest.\n", entries[i].dst);
+            goto cleanup;
+        }
+    }
+
+    // Pass 1: directories
+    for (i = 0; i < count; i++)
+    {
+        entry = &entries[i];
+        r = make_parent_dirs(entry->dst);
+        if (!r && !entry->src)
+            r = f_mkdir(entry->dst);
+        if (r && r != FR_EXIST)
+        {
+            fprintf(stderr, "Error: Unable to create the directory for '%s'.\n", entry->dst);
+            goto cleanup;
+        }
+    }
+
+    // Pass 2: file entries
+    for (i = 0; i < count; i++)
+    {
+        entry = &entries[i];
+        if (!entry->src)
+            continue;
+
+        fe = fopen(entry->src, "rb");
+        if (!fe)
+        {
+            fprintf(stderr, "Error: Unable to open external file '%s' for reading.\n", entry->src);
+            goto cleanup;
+        }
+        if (fseek(fe, 0, SEEK_END) || (size = ftell(fe)) < 0 || (unsigned long)size > 0xFFFFFFFFUL)
+        {
+            fprintf(stderr, "Error: Unable to get the size of external file '%s'.\n", entry->src);
+            fclose(fe);
+            goto cleanup;
+        }
+        fclose(fe);
+        entry->size = (DWORD)size;
+
+        if (f_open(&fv, entry->dst, FA_WRITE | FA_CREATE_ALWAYS))
+        {
+            fprintf(stderr, "Error: Unable to open file '%s' for writing.\n", entry->dst);
+            goto cleanup;
+        }
+        f_close(&fv);
+    }
+
+    data = malloc(BATCH_BUFFER_SIZE);
+    if (!data)
+    {
+        fprintf(stderr, "Error: Out of memory.\n");
+        goto cleanup;
+    }
+
+    // Pass 3: file data
+    for (i = 0; i < count; i++)
+    {
+        entry = &entries[i];
+        if (!entry->src || entry->size == 0)
+            continue;
+
+        if (f_open(&fv, entry->dst, FA_WRITE | FA_OPEN_EXISTING))
+        {
+            fprintf(stderr, "Error: Unable to open file '%s' for writing.\n", entry->dst);
+            goto cleanup;
+        }
+
+        // Seeking past the end in write mode allocates the whole chain
+        if (f_lseek(&fv, entry->size) || fv.fsize != entry->size || f_lseek(&fv, 0))
+        {
+            fprintf(stderr, "Error: Not enough space in the image for '%s'.\n", entry->dst);
+            f_close(&fv);
+            goto cleanup;
+        }
+
+        fe = fopen(entry->src, "rb");
+        if (!fe)
+        {
+            fprintf(stderr, "Error: Unable to open external file '%s' for reading.\n", entry->src);
+            f_close(&fv);
+            goto cleanup;
+        }
+
+        while ((rdlen = fread(data, 1, BATCH_BUFFER_SIZE, fe)) > 0)
+        {
+            if (f_write(&fv, data, (UINT)rdlen, &wrlen) || wrlen < rdlen)
+            {
+                fprintf(stderr, "Error: Unable to write '%d' bytes to disk.\n", (int)wrlen);
+                fclose(fe);
+                f_close(&fv);
+                goto cleanup;
+            }
+        }
+
+        fclose(fe);
+        if (f_tell(&fv) != entry->size)
+        {
+            fprintf(stderr, "Error: External file '%s' changed while being added.\n", entry->src);
+            f_close(&fv);
+            goto cleanup;
+        }
+        f_close(&fv);
+    }
+
+    ret = 0;
+
+cleanup:
+    for (i = 0; i < count; i++)
+    {
+        free(entries[i].dst);
+        free(entries[i].src);
+    }
+    free(entries);
+    free(data);
+    fclose(fm);
+
+    return ret;
+}
+
 int main(int oargc, char* oargv[])
 {
     int ret;
@@ -554,6 +830,17 @@ int main(int oargc, char* oargv[])
                     printf(" - %s\n", info.fname);
             }
         }
+        else if (strcmp(parg, "batch") == 0)
+        {
+            NEED_PARAMS(1, 1);
+
+            NEED_MOUNT();
+
+            // Arg 1: manifest file
+            ret = batch_add(argv[0]);
+            if (ret)
+                goto exit;
+        }
         else
         {
             fprintf(stderr, "Error: Unknown or invalid command: %s\n", argv[-1]);
@@ -77,6 +77,12 @@
  * video memory. Accessing video memory from the CPU is slooooooow, so let's
  * try to do this as little as possible, even if that means we have to do some
  * extra operations using main memory.
+ *
+ * Finally, all named rops are bitwise. When the source has the format of the
+ * destination and needs no translation, and the pattern is a solid color, a
+ * line of the blt is the rop applied to a run of bytes. For those cases we
+ * generate SSE2 row kernels (dibropgen.c) which are tried before the pixel
+ * loops above; the pixel loops still handle everything else.
  */
 
 #include <stdarg.h>
@@ -961,21 +967,452 @@ CreateBitBlt(FILE *Out, unsigned Bpp)
     Output(Out, "BOOLEAN\n");
     Output(Out, "DIB_%uBPP_BitBlt(PBLTINFO BltInfo)\n", Bpp);
     Output(Out, "{\n");
+    Output(Out, "#if defined(_M_IX86) || defined(_M_AMD64)\n");
+    Output(Out, "if (DIB_XXBPP_BitBltRows(BltInfo))\n");
+    Output(Out, "{\n");
+    Output(Out, "return TRUE;\n");
+    Output(Out, "}\n");
+    Output(Out, "#endif\n");
+    Output(Out, "\n");
     Output(Out, "PrimitivesTable[BltInfo->Rop4 & 0xff](BltInfo);\n");
     Output(Out, "\n");
     Output(Out, "return TRUE;\n");
     Output(Out, "}\n");
 }
 
+static int
+HasRowKernel(PROPINFO RopInfo)
+{
+    /* BLACKNESS, WHITENESS and NOOP don't loop, a plain SRCCOPY is a
+       RtlMoveMemory per line already */
+    return NULL != RopInfo &&
+           ROPCODE_GENERIC != RopInfo->RopCode &&
+           ROPCODE_BLACKNESS != RopInfo->RopCode &&
+           ROPCODE_WHITENESS != RopInfo->RopCode &&
+           ROPCODE_NOOP != RopInfo->RopCode &&
+           ROPCODE_SRCCOPY != RopInfo->RopCode;
+}
+
+/*
+ * Turns a rop operation like "D | (~S) | P" into SSE2 intrinsics working on
+ * the __m128i variables D, S and P. A complement is kept pending in
+ * Complement (with Text holding the operand) so that "(~D) & S" can become a
+ * single _mm_andnot_si128; NeedOnes is set when a complement had to be done
+ * with an xor against all ones.
+ */
+typedef struct _VECTOREXPR
+{
+    char Text[512];
+    int Complement;
+}
+VECTOREXPR, *PVECTOREXPR;
+
+static int NeedOnes;
+
+static void ParseVectorOr(const char **Template, PVECTOREXPR Expr);
+
+static void
+SkipBlanks(const char **Template)
+{
+    while (' ' == **Template)
+    {
+        (*Template)++;
+    }
+}
+
 static void
-Generate(char *OutputDir, unsigned Bpp)
+SetVectorText(PVECTOREXPR Expr, const char *Fmt, ...)
+{
+    char Text[sizeof(Expr->Text)];
+    va_list Args;
+    int Length;
+
+    va_start(Args, Fmt);
+    Length = vsnprintf(Text, sizeof(Text), Fmt, Args);
+    va_end(Args);
+    if (Length < 0 || sizeof(Text) <= (size_t) Length)
+    {
+        fprintf(stderr, "Rop operation too long\n");
+        exit(1);
+    }
+    strcpy(Expr->Text, Text);
+}
+
+static void
+ResolveComplement(PVECTOREXPR Expr)
+{
+    if (Expr->Complement)
+    {
+        SetVectorText(Expr, "_mm_xor_si128(%s, Ones)", Expr->Text);
+        Expr->Complement = 0;
+        NeedOnes = 1;
+    }
+}
+
+static void
+ParseVectorUnary(const char **Template, PVECTOREXPR Expr)
+{
+    SkipBlanks(Template);
+    switch (**Template)
+    {
+    case '~':
+        (*Template)++;
+        ParseVectorUnary(Template, Expr);
+        Expr->Complement = ! Expr->Complement;
+        break;
+    case '(':
+        (*Template)++;
+        ParseVectorOr(Template, Expr);
+        SkipBlanks(Template);
+        (*Template)++; /* ')' */
+        break;
+    case 'D':
+    case 'S':
+    case 'P':
+        Expr->Text[0] = **Template;
+        Expr->Text[1] = '\0';
+        Expr->Complement = 0;
+        (*Template)++;
+        break;
+    default:
+        fprintf(stderr, "Unexpected '%c' in rop operation\n", **Template);
+        exit(1);
+    }
+    SkipBlanks(Template);
+}
+
+static void
+ParseVectorAnd(const char **Template, PVECTOREXPR Expr)
+{
+    VECTOREXPR Right;
+
+    ParseVectorUnary(Template, Expr);
+    while ('&' == **Template)
+    {
+        (*Template)++;
+        ParseVectorUnary(Template, &Right);
+        if (Expr->Complement && ! Right.Complement)
+        {
+            SetVectorText(Expr, "_mm_andnot_si128(%s, %s)", Expr->Text, Right.Text);
+        }
+        else if (! Expr->Complement && Right.Complement)
+        {
+            SetVectorText(Expr, "_mm_andnot_si128(%s, %s)", Right.Text, Expr->Text);
+        }
+        else
+        {
+            ResolveComplement(Expr);
+            ResolveComplement(&Right);
+            SetVectorText(Expr, "_mm_and_si128(%s, %s)", Expr->Text, Right.Text);
+        }
+        Expr->Complement = 0;
+    }
+}
+
+static void
+ParseVectorBinary(const char **Template, PVECTOREXPR Expr, char Operator,
+                  const char *Intrinsic,
+                  void (*ParseOperand)(const char **, PVECTOREXPR))
+{
+    VECTOREXPR Right;
+
+    ParseOperand(Template, Expr);
+    while (Operator == **Template)
+    {
+        (*Template)++;
+        ParseOperand(Template, &Right);
+        ResolveComplement(Expr);
+        ResolveComplement(&Right);
+        SetVectorText(Expr, "%s(%s, %s)", Intrinsic, Expr->Text, Right.Text);
+    }
+}
+
+static void
+ParseVectorXor(const char **Template, PVECTOREXPR Expr)
+{
+    ParseVectorBinary(Template, Expr, '^', "_mm_xor_si128", ParseVectorAnd);
+}
+
+static void
+ParseVectorOr(const char **Template, PVECTOREXPR Expr)
+{
+    ParseVectorBinary(Template, Expr, '|', "_mm_or_si128", ParseVectorXor);
+}
+
+static void
+CreateRowKernelName(FILE *Out, PROPINFO RopInfo)
+{
+    Output(Out, "DIB_RopRow_%s_Sse2", RopInfo->Name);
+}
+
+static void
+CreateScalarRowOperation(FILE *Out, PROPINFO RopInfo)
+{
+    const char *Template;
+
+    Output(Out, "Dest[i] = (UCHAR)(");
+    for (Template = RopInfo->Operation; '\0' != *Template; Template++)
+    {
+        switch(*Template)
+        {
+        case 'S':
+            Output(Out, "Source[i]");
+            break;
+        case 'P':
+            Output(Out, "(UCHAR)(Pattern >> ((i & 3) << 3))");
+            break;
+        case 'D':
+            Output(Out, "Dest[i]");
+            break;
+        default:
+            Output(Out, "%c", *Template);
+            break;
+        }
+    }
+    Output(Out, ");\n");
+}
+
+static void
+CreateRowKernel(FILE *Out, PROPINFO RopInfo)
+{
+    const char *Template = RopInfo->Operation;
+    VECTOREXPR Expr;
+
+    MARK(Out);
+    NeedOnes = 0;
+    ParseVectorOr(&Template, &Expr);
+    ResolveComplement(&Expr);
+
+    Output(Out, "\n");
+    Output(Out, "__ATTRIBUTE_SSE2__\n");
+    Output(Out, "static VOID\n");
+    CreateRowKernelName(Out, RopInfo);
+    Output(Out, "(PUCHAR Dest, const UCHAR *Source, ULONG Pattern, ULONG Count)\n");
+    Output(Out, "{\n");
+    if (NeedOnes)
+    {
+        Output(Out, "__m128i Ones = _mm_set1_epi32(-1);\n");
+    }
+    if (RopInfo->UsesDest)
+    {
+        Output(Out, "__m128i D;\n");
+    }
+    if (RopInfo->UsesSource)
+    {
+        Output(Out, "__m128i S;\n");
+    }
+    if (RopInfo->UsesPattern)
+    {
+        Output(Out, "__m128i P;\n");
+        Output(Out, "ULONG Shift;\n");
+    }
+    Output(Out, "ULONG i = 0;\n");
+    if (! RopInfo->UsesSource || ! RopInfo->UsesPattern)
+    {
+        Output(Out, "\n");
+    }
+    if (! RopInfo->UsesSource)
+    {
+        Output(Out, "UNREFERENCED_PARAMETER(Source);\n");
+    }
+    if (! RopInfo->UsesPattern)
+    {
+        Output(Out, "UNREFERENCED_PARAMETER(Pattern);\n");
+    }
+    Output(Out, "\n");
+    Output(Out, "while (i < Count && 0 != ((ULONG_PTR) (Dest + i) & 0xf))\n");
+    Output(Out, "{\n");
+    CreateScalarRowOperation(Out, RopInfo);
+    Output(Out, "i++;\n");
+    Output(Out, "}\n");
+    Output(Out, "\n");
+    if (RopInfo->UsesPattern)
+    {
+        Output(Out, "Shift = (i & 3) << 3;\n");
+        Output(Out, "P = _mm_set1_epi32((int) (0 == Shift ? Pattern :\n");
+        Output(Out, "                          (Pattern >> Shift) | (Pattern << (32 - Shift))));\n");
+    }
+    Output(Out, "for (; i + 16 <= Count; i += 16)\n");
+    Output(Out, "{\n");
+    if (RopInfo->UsesDest)
+    {
+        Output(Out, "D = _mm_load_si128((const __m128i *) (Dest + i));\n");
+    }
+    if (RopInfo->UsesSource)
+    {
+        Output(Out, "S = _mm_loadu_si128((const __m128i *) (Source + i));\n");
+    }
+    Output(Out, "_mm_store_si128((__m128i *) (Dest + i), %s);\n", Expr.Text);
+    Output(Out, "}\n");
+    Output(Out, "\n");
+    Output(Out, "for (; i < Count; i++)\n");
+    Output(Out, "{\n");
+    CreateScalarRowOperation(Out, RopInfo);
+    Output(Out, "}\n");
+    Output(Out, "}\n");
+}
+
+static void
+CreateRowsBitBlt(FILE *Out)
 {
-    FILE *Out;
     unsigned RopCode;
     PROPINFO RopInfo;
+
+    MARK(Out);
+    Output(Out, "\n");
+    Output(Out, "BOOLEAN\n");
+    Output(Out, "DIB_XXBPP_BitBltRows(PBLTINFO BltInfo)\n");
+    Output(Out, "{\n");
+    Output(Out, "VOID (*RowFunction)(PUCHAR, const UCHAR *, ULONG, ULONG);\n");
+    Output(Out, "BOOLEAN UsesSource, UsesPattern;\n");
+    Output(Out, "ULONG BytesPerPixel, Pattern = 0, Count, LineIndex, LineCount;\n");
+    Output(Out, "char *DestBase, *SourceBase = NULL;\n");
+    Output(Out, "LONG DestDelta, SourceDelta = 0;\n");
+    Output(Out, "KFLOATING_SAVE FloatSave;\n");
+    Output(Out, "\n");
+    Output(Out, "switch (BltInfo->Rop4 & 0xff)\n");
+    Output(Out, "{\n");
+    for (RopCode = 0; RopCode < 256; RopCode++)
+    {
+        RopInfo = FindRopInfo(RopCode);
+        if (HasRowKernel(RopInfo))
+        {
+            Output(Out, "case 0x%02x: /* %s */\n", RopCode, RopInfo->Name);
+            Output(Out, "RowFunction = ");
+            CreateRowKernelName(Out, RopInfo);
+            Output(Out, ";\n");
+            Output(Out, "UsesSource = %s;\n", RopInfo->UsesSource ? "TRUE" : "FALSE");
+            Output(Out, "UsesPattern = %s;\n", RopInfo->UsesPattern ? "TRUE" : "FALSE");
+            Output(Out, "break;\n");
+        }
+    }
+    Output(Out, "default:\n");
+    Output(Out, "return FALSE;\n");
+    Output(Out, "}\n");
+    Output(Out, "\n");
+    Output(Out, "switch (BltInfo->DestSurface->iBitmapFormat)\n");
+    Output(Out, "{\n");
+    Output(Out, "case BMF_8BPP:\n");
+    Output(Out, "BytesPerPixel = 1;\n");
+    Output(Out, "break;\n");
+    Output(Out, "case BMF_16BPP:\n");
+    Output(Out, "BytesPerPixel = 2;\n");
+    Output(Out, "break;\n");
+    Output(Out, "case BMF_32BPP:\n");
+    Output(Out, "BytesPerPixel = 4;\n");
+    Output(Out, "break;\n");
+    Output(Out, "default:\n");
+    Output(Out, "return FALSE;\n");
+    Output(Out, "}\n");
+    Output(Out, "\n");
+    Output(Out, "if (BltInfo->DestRect.right <= BltInfo->DestRect.left ||\n");
+    Output(Out, "    BltInfo->DestRect.bottom <= BltInfo->DestRect.top)\n");
+    Output(Out, "{\n");
+    Output(Out, "return FALSE;\n");
+    Output(Out, "}\n");
+    Output(Out, "\n");
+    Output(Out, "if (UsesPattern)\n");
+    Output(Out, "{\n");
+    Output(Out, "if (NULL != BltInfo->PatternSurface)\n");
+    Output(Out, "{\n");
+    Output(Out, "return FALSE;\n");
+    Output(Out, "}\n");
+    Output(Out, "if (NULL != BltInfo->Brush)\n");
+    Output(Out, "{\n");
+    Output(Out, "Pattern = BltInfo->Brush->iSolidColor;\n");
+    Output(Out, "if (1 == BytesPerPixel)\n");
+    Output(Out, "{\n");
+    Output(Out, "Pattern = (Pattern & 0xff) * 0x01010101;\n");
+    Output(Out, "}\n");
+    Output(Out, "else if (2 == BytesPerPixel)\n");
+    Output(Out, "{\n");
+    Output(Out, "Pattern = (Pattern & 0xffff) * 0x00010001;\n");
+    Output(Out, "}\n");
+    Output(Out, "}\n");
+    Output(Out, "}\n");
+    Output(Out, "\n");
+    Output(Out, "if (UsesSource)\n");
+    Output(Out, "{\n");
+    Output(Out, "if (BltInfo->SourceSurface->iBitmapFormat != BltInfo->DestSurface->iBitmapFormat ||\n");
+    Output(Out, "    (NULL != BltInfo->XlateSourceToDest &&\n");
+    Output(Out, "     0 == (BltInfo->XlateSourceToDest->flXlate & XO_TRIVIAL)))\n");
+    Output(Out, "{\n");
+    Output(Out, "return FALSE;\n");
+    Output(Out, "}\n");
+    Output(Out, "/* Source and destination overlapping within a line are left to the\n");
+    Output(Out, "   pixel loops */\n");
+    Output(Out, "if (BltInfo->SourceSurface->pvScan0 == BltInfo->DestSurface->pvScan0 &&\n");
+    Output(Out, "    BltInfo->SourcePoint.y == BltInfo->DestRect.top)\n");
+    Output(Out, "{\n");
+    Output(Out, "return FALSE;\n");
+    Output(Out, "}\n");
+    Output(Out, "}\n");
+    Output(Out, "\n");
+    Output(Out, "Count = (BltInfo->DestRect.right - BltInfo->DestRect.left) * BytesPerPixel;\n");
+    Output(Out, "LineCount = BltInfo->DestRect.bottom - BltInfo->DestRect.top;\n");
+    Output(Out, "if (Count * LineCount < BITBLT_ROWS_SSE2_MIN_BYTES ||\n");
+    Output(Out, "    ! ExIsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) ||\n");
+    Output(Out, "    ! NT_SUCCESS(KeSaveFloatingPointState(&FloatSave)))\n");
+    Output(Out, "{\n");
+    Output(Out, "return FALSE;\n");
+    Output(Out, "}\n");
+    Output(Out, "\n");
+    Output(Out, "DestDelta = BltInfo->DestSurface->lDelta;\n");
+    Output(Out, "if (UsesSource)\n");
+    Output(Out, "{\n");
+    Output(Out, "SourceDelta = BltInfo->SourceSurface->lDelta;\n");
+    Output(Out, "}\n");
+    Output(Out, "\n");
+    Output(Out, "/* Same line order as the pixel loops, so that an overlapping source\n");
+    Output(Out, "   is read before it is overwritten */\n");
+    Output(Out, "if (! UsesSource || BltInfo->DestRect.top < BltInfo->SourcePoint.y)\n");
+    Output(Out, "{\n");
+    Output(Out, "DestBase = (char *) BltInfo->DestSurface->pvScan0 +\n");
+    Output(Out, "           BltInfo->DestRect.top * DestDelta;\n");
+    Output(Out, "if (UsesSource)\n");
+    Output(Out, "{\n");
+    Output(Out, "SourceBase = (char *) BltInfo->SourceSurface->pvScan0 +\n");
+    Output(Out, "             BltInfo->SourcePoint.y * SourceDelta;\n");
+    Output(Out, "}\n");
+    Output(Out, "}\n");
+    Output(Out, "else\n");
+    Output(Out, "{\n");
+    Output(Out, "DestBase = (char *) BltInfo->DestSurface->pvScan0 +\n");
+    Output(Out, "           (BltInfo->DestRect.bottom - 1) * DestDelta;\n");
+    Output(Out, "SourceBase = (char *) BltInfo->SourceSurface->pvScan0 +\n");
+    Output(Out, "             (BltInfo->SourcePoint.y + LineCount - 1) * SourceDelta;\n");
+    Output(Out, "DestDelta = -DestDelta;\n");
+    Output(Out, "SourceDelta = -SourceDelta;\n");
+    Output(Out, "}\n");
+    Output(Out, "DestBase += BltInfo->DestRect.left * BytesPerPixel;\n");
+    Output(Out, "if (UsesSource)\n");
+    Output(Out, "{\n");
+    Output(Out, "SourceBase += BltInfo->SourcePoint.x * BytesPerPixel;\n");
+    Output(Out, "}\n");
+    Output(Out, "\n");
+    Output(Out, "for (LineIndex = 0; LineIndex < LineCount; LineIndex++)\n");
+    Output(Out, "{\n");
+    Output(Out, "RowFunction((PUCHAR) DestBase, (const UCHAR *) SourceBase, Pattern, Count);\n");
+    Output(Out, "DestBase += DestDelta;\n");
+    Output(Out, "if (UsesSource)\n");
+    Output(Out, "{\n");
+    Output(Out, "SourceBase += SourceDelta;\n");
+    Output(Out, "}\n");
+    Output(Out, "}\n");
+    Output(Out, "\n");
+    Output(Out, "KeRestoreFloatingPointState(&FloatSave);\n");
+    Output(Out, "\n");
+    Output(Out, "return TRUE;\n");
+    Output(Out, "}\n");
+}
+
+static FILE *
+OpenOutput(char *OutputDir, const char *Name)
+{
+    FILE *Out;
     char *FileName;
 
-    FileName = malloc(strlen(OutputDir) + 12);
+    FileName = malloc(strlen(OutputDir) + strlen(Name) + 2);
     if (NULL == FileName)
     {
         fprintf(stderr, "Out of memory\n");
@@ -986,7 +1423,7 @@ Generate(char *OutputDir, unsigned Bpp)
     {
         strcat(FileName, "/");
     }
-    sprintf(FileName + strlen(FileName), "dib%ugen.c", Bpp);
+    strcat(FileName, Name);
 
     Out = fopen(FileName, "w");
     free(FileName);
@@ -996,6 +1433,63 @@ Generate(char *OutputDir, unsigned Bpp)
         exit(1);
     }
 
+    return Out;
+}
+
+static void
+GenerateRows(char *OutputDir)
+{
+    FILE *Out;
+    unsigned RopCode;
+    PROPINFO RopInfo;
+
+    Out = OpenOutput(OutputDir, "dibropgen.c");
+
+    MARK(Out);
+    Output(Out, "/* This is a generated file. Please do not edit */\n");
+    Output(Out, "\n");
+    Output(Out, "#include <win32k.h>\n");
+    Output(Out, "\n");
+    Output(Out, "#if defined(_M_IX86) || defined(_M_AMD64)\n");
+    Output(Out, "\n");
+    Output(Out, "#include <emmintrin.h>\n");
+    Output(Out, "\n");
+    Output(Out, "#ifndef __ATTRIBUTE_SSE2__\n");
+    Output(Out, "#define __ATTRIBUTE_SSE2__ __attribute__((__target__(\"sse2\")))\n");
+    Output(Out, "#endif\n");
+    Output(Out, "\n");
+    Output(Out, "/* Below this size saving the floating point state costs more than it gains */\n");
+    Output(Out, "#ifndef BITBLT_ROWS_SSE2_MIN_BYTES\n");
+    Output(Out, "#define BITBLT_ROWS_SSE2_MIN_BYTES 1024\n");
+    Output(Out, "#endif\n");
+
+    for (RopCode = 0; RopCode < 256; RopCode++)
+    {
+        RopInfo = FindRopInfo(RopCode);
+        if (HasRowKernel(RopInfo))
+        {
+            CreateRowKernel(Out, RopInfo);
+        }
+    }
+    CreateRowsBitBlt(Out);
+
+    Output(Out, "\n");
+    Output(Out, "#endif /* _M_IX86 || _M_AMD64 */\n");
+
+    fclose(Out);
+}
+
+static void
+Generate(char *OutputDir, unsigned Bpp)
+{
+    FILE *Out;
+    unsigned RopCode;
+    PROPINFO RopInfo;
+    char FileName[16];
+
+    sprintf(FileName, "dib%ugen.c", Bpp);
+    Out = OpenOutput(OutputDir, FileName);
+
     MARK(Out);
     Output(Out, "/* This is a generated file. Please do not edit */\n");
     Output(Out, "\n");
@@ -1032,6 +1526,7 @@ main(int argc, char *argv[])
     {
         Generate(argv[1], DestBpp[Index]);
     }
+    GenerateRows(argv[1]);
 
     return 0;
 }
@@ -31,12 +31,17 @@
 #include <limits.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "mkhive.h"
 
 #ifdef _MSC_VER
 #include <stdlib.h>
+#include <sys/utime.h>
 #define PATH_MAX _MAX_PATH
+#define utime _utime
+#else
+#include <utime.h>
 #endif // _MSC_VER
 
 #ifndef _WIN32
@@ -50,19 +55,98 @@
 #define DIR_SEPARATOR_STRING "\\"
 #endif
 
+/*
+ * Version of the hive cache stamps. Bump it whenever a change in mkhive
+ * or cmlib modifies the generated hives, so that existing stamps made
+ * by an older mkhive are not considered up to date anymore.
+ */
+#define MKHIVE_CACHE_VERSION    1
+
+#define STAMP_EXTENSION ".stamp"
+
 /* FUNCTIONS ****************************************************************/
 
 void usage(void)
 {
-    printf("Usage: mkhive [-?] -h:hive1[,hiveN...] [-u] -d:<dstdir> <inffiles>\n\n"
+    printf("Usage: mkhive [-?] -h:hive1[,hiveN...] [-u] [-f] -d:<dstdir> <inffiles>\n\n"
            "  -h:hiveN  - Comma-separated list of hives to create. Possible values are:\n"
            "              SETUPREG, SYSTEM, SOFTWARE, DEFAULT, SAM, SECURITY, BCD.\n"
            "  -u        - Generate file names in uppercase (default: lowercase) (TEMPORARY FLAG!).\n"
+           "  -f        - Force rebuilding all the hives, even the up-to-date ones.\n"
            "  -d:dstdir - The binary hive files are created in this directory.\n"
            "  inffiles  - List of INF files with full path.\n"
            "  -?        - Displays this help screen.\n");
 }
 
+static unsigned long
+elapsed_ms(clock_t Start)
+{
+    return (unsigned long)(((clock() - Start) * 1000) / CLOCKS_PER_SEC);
+}
+
+/*
+ * Check whether the hive file exists and was generated from the same inputs,
+ * as recorded in its stamp file.
+ */
+static BOOL
+is_hive_up_to_date(PCSTR FileName, ULONGLONG Hash)
+{
+    FILE *File;
+    CHAR StampName[PATH_MAX + sizeof(STAMP_EXTENSION)];
+    CHAR Line[32];
+    CHAR Expected[32];
+    BOOL ret;
+
+    File = fopen(FileName, "rb");
+    if (File == NULL)
+        return FALSE;
+    fclose(File);
+
+    strcpy(StampName, FileName);
+    strcat(StampName, STAMP_EXTENSION);
+
+    File = fopen(StampName, "r");
+    if (File == NULL)
+        return FALSE;
+
+    sprintf(Expected, "%08x%08x", (ULONG)(Hash >> 32), (ULONG)Hash);
+    ret = (fgets(Line, sizeof(Line), File) != NULL &&
+           strncmp(Line, Expected, strlen(Expected)) == 0);
+    fclose(File);
+
+    return ret;
+}
+
+/*
+ * Record the inputs of a hive once it has been written, or invalidate
+ * the previous record (Hash == 0) before writing it.
+ */
+static VOID
+write_hive_stamp(PCSTR FileName, ULONGLONG Hash)
+{
+    FILE *File;
+    CHAR StampName[PATH_MAX + sizeof(STAMP_EXTENSION)];
+
+    strcpy(StampName, FileName);
+    strcat(StampName, STAMP_EXTENSION);
+
+    if (Hash == 0)
+    {
+        remove(StampName);
+        return;
+    }
+
+    File = fopen(StampName, "w");
+    if (File == NULL)
+    {
+        printf("    Error creating stamp file %s\n", StampName);
+        return;
+    }
+
+    fprintf(File, "%08x%08x\n", (ULONG)(Hash >> 32), (ULONG)Hash);
+    fclose(File);
+}
+
 void convert_path(char *dst, char *src)
 {
     int i;
@@ -95,11 +179,22 @@ int main(int argc, char *argv[])
 {
     INT ret;
     INT i;
+    INT FirstInf;
     PSTR ptr;
     BOOL UpperCaseFileName = FALSE;
+    BOOL ForceRebuild = FALSE;
     PCSTR HiveList = NULL;
     CHAR DestPath[PATH_MAX] = "";
     CHAR FileName[PATH_MAX];
+    CHAR HiveFileNames[MAX_NUMBER_OF_REGISTRY_HIVES][PATH_MAX];
+    ULONGLONG HiveHashes[MAX_NUMBER_OF_REGISTRY_HIVES];
+    ULONG HiveMask = 0;
+    ULONG DirtyMask;
+    ULONG CacheVersion = MKHIVE_CACHE_VERSION;
+    PHINF InfHandles;
+    INT InfCount;
+    BOOL RegistryInitialized = FALSE;
+    clock_t Start;
 
     if (argc < 4)
     {
@@ -122,6 +217,10 @@ int main(int argc, char *argv[])
         {
             UpperCaseFileName = TRUE;
         }
+        else if (argv[i][1] == 'f' && argv[i][2] == 0)
+        {
+            ForceRebuild = TRUE;
+        }
         else
         if (argv[i][1] == 'h' && (argv[i][2] == ':' || argv[i][2] == '='))
         {
@@ -154,38 +253,29 @@ int main(int argc, char *argv[])
         fprintf(stderr, "Not enough parameters, or the list of INF files is missing.\n");
         return -1;
     }
+    FirstInf = i;
 
-    /* Initialize the registry */
-    RegInitializeRegistry(HiveList);
-
-    /* Default to failure */
-    ret = -1;
-
-    /* Now we should have the list of INF files: parse it */
-    for (; i < argc; ++i)
-    {
-        convert_path(FileName, argv[i]);
-        if (!ImportRegistryFile(FileName))
-            goto Quit;
-    }
-
+    /* Build the list of hives to create, with their file names */
     for (i = 0; i < MAX_NUMBER_OF_REGISTRY_HIVES; ++i)
     {
         /* Skip this registry hive if it's not in the list */
         if (!strstr(HiveList, RegistryHives[i].HiveName))
             continue;
 
-        strcpy(FileName, DestPath);
-        strcat(FileName, DIR_SEPARATOR_STRING);
+        HiveMask |= (1 << i);
+
+        ptr = HiveFileNames[i];
+        strcpy(ptr, DestPath);
+        strcat(ptr, DIR_SEPARATOR_STRING);
 
-        ptr = FileName + strlen(FileName);
+        ptr += strlen(ptr);
 
-        strcat(FileName, RegistryHives[i].HiveName);
+        strcat(ptr, RegistryHives[i].HiveName);
 
         /* Exception for the special setup registry hive */
         // if (strcmp(RegistryHives[i].HiveName, "SETUPREG") == 0)
         if (i == 0)
-            strcat(FileName, ".HIV");
+            strcat(ptr, ".HIV");
 
         /* Adjust file name case if needed */
         if (UpperCaseFileName)
@@ -199,8 +289,11 @@ int main(int argc, char *argv[])
                 *ptr = tolower(*ptr);
         }
 
-        if (!ExportBinaryHive(FileName, RegistryHives[i].CmHive))
-            goto Quit;
+        /* The hash of each hive covers the command line and its INF lines */
+        HiveHashes[i] = HashRegistryData(0, "mkhive", 6);
+        HiveHashes[i] = HashRegistryData(HiveHashes[i], &CacheVersion, sizeof(CacheVersion));
+        HiveHashes[i] = HashRegistryData(HiveHashes[i], HiveList, (ULONG)strlen(HiveList) + 1);
+        HiveHashes[i] = HashRegistryData(HiveHashes[i], &UpperCaseFileName, sizeof(UpperCaseFileName));
 
         /* If we happen to deal with the special setup registry hive, stop there */
         // if (strcmp(RegistryHives[i].HiveName, "SETUPREG") == 0)
@@ -208,12 +301,98 @@ int main(int argc, char *argv[])
             break;
     }
 
+    /* Default to failure */
+    ret = -1;
+
+    /* Load the INF files, once for both hashing and importing them */
+    InfCount = argc - FirstInf;
+    InfHandles = calloc(InfCount, sizeof(HINF));
+    if (InfHandles == NULL)
+        return ret;
+
+    Start = clock();
+    for (i = 0; i < InfCount; ++i)
+    {
+        convert_path(FileName, argv[FirstInf + i]);
+        if (!OpenRegistryFile(FileName, &InfHandles[i]))
+            goto Quit;
+    }
+    printf("  Loaded INF files in %lu ms\n", elapsed_ms(Start));
+
+    /* Hash the INF files, and find out which hives need to be rebuilt */
+    Start = clock();
+    for (i = 0; i < InfCount; ++i)
+        HashRegistryFile(InfHandles[i], HiveMask, HiveHashes);
+
+    DirtyMask = HiveMask;
+    if (!ForceRebuild)
+    {
+        for (i = 0; i < MAX_NUMBER_OF_REGISTRY_HIVES; ++i)
+        {
+            if (!(HiveMask & (1 << i)))
+                continue;
+
+            if (is_hive_up_to_date(HiveFileNames[i], HiveHashes[i]))
+            {
+                printf("  Binary hive is up to date: %s\n", HiveFileNames[i]);
+
+                /* Refresh its timestamp for the build system */
+                utime(HiveFileNames[i], NULL);
+                DirtyMask &= ~(1 << i);
+            }
+        }
+    }
+    printf("  Checked input files in %lu ms\n", elapsed_ms(Start));
+
+    if (DirtyMask == 0)
+    {
+        ret = 0;
+        goto Quit;
+    }
+
+    /* Initialize the registry */
+    RegInitializeRegistry(HiveList);
+    RegistryInitialized = TRUE;
+
+    /* Now we should have the list of INF files: import them */
+    Start = clock();
+    for (i = 0; i < InfCount; ++i)
+    {
+        if (!ImportRegistryFile(InfHandles[i], DirtyMask))
+            goto Quit;
+    }
+    printf("  Imported INF files in %lu ms\n", elapsed_ms(Start));
+
+    for (i = 0; i < MAX_NUMBER_OF_REGISTRY_HIVES; ++i)
+    {
+        /* Skip this registry hive if it's not to be rebuilt */
+        if (!(DirtyMask & (1 << i)))
+            continue;
+
+        write_hive_stamp(HiveFileNames[i], 0);
+
+        Start = clock();
+        if (!ExportBinaryHive(HiveFileNames[i], RegistryHives[i].CmHive))
+            goto Quit;
+        printf("    Written in %lu ms\n", elapsed_ms(Start));
+
+        write_hive_stamp(HiveFileNames[i], HiveHashes[i]);
+    }
+
     /* Success */
     ret = 0;
 
 Quit:
     /* Shut down the registry */
-    RegShutdownRegistry();
+    if (RegistryInitialized)
+        RegShutdownRegistry();
+
+    for (i = 0; i < InfCount; ++i)
+    {
+        if (InfHandles[i])
+            InfHostCloseFile(InfHandles[i]);
+    }
+    free(InfHandles);
 
     if (ret == 0)
         printf("  Done.\n");
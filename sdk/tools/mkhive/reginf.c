@@ -69,6 +69,10 @@ static const WCHAR BCDPath[] = {'\\','R','e','g','i','s','t','r','y','\\','M','a
 static const WCHAR AddReg[] = {'A','d','d','R','e','g',0};
 static const WCHAR DelReg[] = {'D','e','l','R','e','g',0};
 
+/* 64-bit FNV-1a parameters, used for the hive cache stamps */
+#define FNV_OFFSET_BASIS    0xCBF29CE484222325ULL
+#define FNV_PRIME           0x00000100000001B3ULL
+
 /* FUNCTIONS ****************************************************************/
 
 static BOOL
@@ -113,6 +117,63 @@ get_root_key(PWCHAR Name)
 }
 
 
+/***********************************************************************
+ *            get_hive_index
+ *
+ * Return the index in RegistryHives[] of the selected hive containing
+ * the given absolute key path, or -1 if none of them contains it.
+ */
+static INT
+get_hive_index(PCWSTR KeyPath, ULONG HiveMask)
+{
+    UINT i;
+    size_t Length;
+
+    if (*KeyPath == OBJ_NAME_PATH_SEPARATOR)
+        KeyPath++;
+
+    for (i = 0; i < MAX_NUMBER_OF_REGISTRY_HIVES; ++i)
+    {
+        if (!(HiveMask & (1 << i)))
+            continue;
+
+        Length = strlenW(RegistryHives[i].HiveRegistryPath);
+        if (strncmpiW(KeyPath, RegistryHives[i].HiveRegistryPath, (int)Length) == 0 &&
+            (KeyPath[Length] == 0 || KeyPath[Length] == OBJ_NAME_PATH_SEPARATOR))
+        {
+            return (INT)i;
+        }
+    }
+
+    return -1;
+}
+
+
+/***********************************************************************
+ *            get_key_name
+ *
+ * Retrieve the absolute key path of an AddReg/DelReg line.
+ */
+static BOOL
+get_key_name(PINFCONTEXT Context, PWCHAR Buffer, ULONG BufferSize)
+{
+    size_t Length;
+
+    /* Get root */
+    if (InfHostGetStringField(Context, 1, Buffer, BufferSize, NULL) != 0)
+        return FALSE;
+    if (!get_root_key(Buffer))
+        return FALSE;
+
+    /* Get key */
+    Length = strlenW(Buffer);
+    if (InfHostGetStringField(Context, 2, Buffer + Length, BufferSize - (ULONG)Length, NULL) != 0)
+        *Buffer = 0;
+
+    return TRUE;
+}
+
+
 /***********************************************************************
  * append_multi_sz_value
  *
@@ -395,12 +456,11 @@ do_reg_operation(
  * Called once for each AddReg and DelReg entry in a given section.
  */
 static BOOL
-registry_callback(HINF hInf, PCWSTR Section, BOOL Delete)
+registry_callback(HINF hInf, PCWSTR Section, BOOL Delete, ULONG HiveMask)
 {
     WCHAR Buffer[MAX_INF_STRING_LENGTH];
     PWCHAR ValuePtr;
     ULONG Flags;
-    size_t Length;
 
     PINFCONTEXT Context = NULL;
     HKEY KeyHandle;
@@ -412,16 +472,13 @@ registry_callback(HINF hInf, PCWSTR Section, BOOL Delete)
 
     for (Ok = TRUE; Ok; Ok = (InfHostFindNextLine(Context, Context) == 0))
     {
-        /* Get root */
-        if (InfHostGetStringField(Context, 1, Buffer, sizeof(Buffer)/sizeof(WCHAR), NULL) != 0)
-            continue;
-        if (!get_root_key(Buffer))
+        /* Get root and key */
+        if (!get_key_name(Context, Buffer, _countof(Buffer)))
             continue;
 
-        /* Get key */
-        Length = strlenW(Buffer);
-        if (InfHostGetStringField(Context, 2, Buffer + Length, sizeof(Buffer)/sizeof(WCHAR) - (ULONG)Length, NULL) != 0)
-            *Buffer = 0;
+        /* Skip the keys that do not belong to a hive we are building */
+        if (get_hive_index(Buffer, HiveMask) < 0)
+            continue;
 
         DPRINT("KeyName: <%S>\n", Buffer);
 
@@ -487,34 +544,175 @@ registry_callback(HINF hInf, PCWSTR Section, BOOL Delete)
 }
 
 
+/***********************************************************************
+ *            hash_section
+ *
+ * Fold every line of an AddReg or DelReg section into the cache hash
+ * of the hive it belongs to. The raw fields are hashed, the string
+ * substitutions are covered by hash_strings().
+ */
+static VOID
+hash_section(HINF hInf, PCWSTR Section, ULONG HiveMask, ULONGLONG* HiveHashes)
+{
+    WCHAR Buffer[MAX_INF_STRING_LENGTH];
+    PWCHAR Fields;
+    ULONG Size;
+    INT Index;
+
+    PINFCONTEXT Context = NULL;
+    BOOL Ok;
+
+    Ok = InfHostFindFirstLine(hInf, Section, NULL, &Context) == 0;
+    if (!Ok)
+        return;
+
+    for (Ok = TRUE; Ok; Ok = (InfHostFindNextLine(Context, Context) == 0))
+    {
+        if (!get_key_name(Context, Buffer, _countof(Buffer)))
+            continue;
+
+        Index = get_hive_index(Buffer, HiveMask);
+        if (Index < 0)
+            continue;
+
+        HiveHashes[Index] = HashRegistryData(HiveHashes[Index], Section,
+                                             (ULONG)(strlenW(Section) + 1) * sizeof(WCHAR));
+
+        /* Get all the raw fields at once, as a multi-string */
+        if (InfHostGetMultiSzField(Context, 1, NULL, 0, &Size) != 0)
+            continue;
+
+        Fields = malloc(Size * sizeof(WCHAR));
+        if (Fields == NULL)
+            continue;
+
+        if (InfHostGetMultiSzField(Context, 1, Fields, Size, NULL) == 0)
+        {
+            HiveHashes[Index] = HashRegistryData(HiveHashes[Index], Fields,
+                                                 Size * sizeof(WCHAR));
+        }
+        free(Fields);
+    }
+
+    InfHostFreeContext(Context);
+}
+
+
+/***********************************************************************
+ *            hash_strings
+ *
+ * Fold the [Strings] section, used for the substitutions in the
+ * AddReg and DelReg lines, into the cache hash of every selected hive.
+ */
+static VOID
+hash_strings(HINF hInf, ULONG HiveMask, ULONGLONG* HiveHashes)
+{
+    static const WCHAR Strings[] = {'S','t','r','i','n','g','s',0};
+    PWCHAR Key, Data;
+    UINT i;
+
+    PINFCONTEXT Context = NULL;
+    BOOL Ok;
+
+    Ok = InfHostFindFirstLine(hInf, Strings, NULL, &Context) == 0;
+    if (!Ok)
+        return;
+
+    for (Ok = TRUE; Ok; Ok = (InfHostFindNextLine(Context, Context) == 0))
+    {
+        if (InfHostGetData(Context, &Key, &Data) != 0)
+            continue;
+
+        for (i = 0; i < MAX_NUMBER_OF_REGISTRY_HIVES; ++i)
+        {
+            if (!(HiveMask & (1 << i)))
+                continue;
+
+            if (Key)
+            {
+                HiveHashes[i] = HashRegistryData(HiveHashes[i], Key,
+                                                 (ULONG)(strlenW(Key) + 1) * sizeof(WCHAR));
+            }
+            if (Data)
+            {
+                HiveHashes[i] = HashRegistryData(HiveHashes[i], Data,
+                                                 (ULONG)(strlenW(Data) + 1) * sizeof(WCHAR));
+            }
+        }
+    }
+
+    InfHostFreeContext(Context);
+}
+
+
+ULONGLONG
+HashRegistryData(
+    IN ULONGLONG Hash,
+    IN const VOID* Data,
+    IN ULONG Length)
+{
+    const UCHAR *Ptr = (const UCHAR*)Data;
+
+    if (Hash == 0)
+        Hash = FNV_OFFSET_BASIS;
+
+    while (Length--)
+    {
+        Hash ^= *Ptr++;
+        Hash *= FNV_PRIME;
+    }
+
+    return Hash;
+}
+
+
 BOOL
-ImportRegistryFile(PCHAR FileName)
+OpenRegistryFile(
+    IN PCHAR FileName,
+    OUT PHINF InfHandle)
 {
-    HINF hInf;
     ULONG ErrorLine;
 
     /* Load inf file from install media. */
-    if (InfHostOpenFile(&hInf, FileName, 0, &ErrorLine) != 0)
+    if (InfHostOpenFile(InfHandle, FileName, 0, &ErrorLine) != 0)
     {
         DPRINT1("InfHostOpenFile(%s) failed\n", FileName);
         return FALSE;
     }
 
-    if (!registry_callback(hInf, (PWCHAR)DelReg, TRUE))
+    return TRUE;
+}
+
+
+VOID
+HashRegistryFile(
+    IN HINF hInf,
+    IN ULONG HiveMask,
+    IN OUT ULONGLONG* HiveHashes)
+{
+    hash_strings(hInf, HiveMask, HiveHashes);
+    hash_section(hInf, DelReg, HiveMask, HiveHashes);
+    hash_section(hInf, AddReg, HiveMask, HiveHashes);
+}
+
+
+BOOL
+ImportRegistryFile(
+    IN HINF hInf,
+    IN ULONG HiveMask)
+{
+    if (!registry_callback(hInf, (PWCHAR)DelReg, TRUE, HiveMask))
     {
         DPRINT1("registry_callback() for DelReg failed\n");
-        InfHostCloseFile(hInf);
         return FALSE;
     }
 
-    if (!registry_callback(hInf, (PWCHAR)AddReg, FALSE))
+    if (!registry_callback(hInf, (PWCHAR)AddReg, FALSE, HiveMask))
     {
         DPRINT1("registry_callback() for AddReg failed\n");
-        InfHostCloseFile(hInf);
         return FALSE;
     }
 
-    InfHostCloseFile(hInf);
     return TRUE;
 }
 
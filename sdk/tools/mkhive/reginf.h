@@ -26,7 +26,26 @@
 
 #pragma once
 
+ULONGLONG
+HashRegistryData(
+    IN ULONGLONG Hash,
+    IN const VOID* Data,
+    IN ULONG Length);
+
+BOOL
+OpenRegistryFile(
+    IN PCHAR FileName,
+    OUT PHINF InfHandle);
+
+VOID
+HashRegistryFile(
+    IN HINF hInf,
+    IN ULONG HiveMask,
+    IN OUT ULONGLONG* HiveHashes);
+
 BOOL
-ImportRegistryFile(PCHAR Filename);
+ImportRegistryFile(
+    IN HINF hInf,
+    IN ULONG HiveMask);
 
 /* EOF */
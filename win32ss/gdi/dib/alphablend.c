@@ -35,13 +35,16 @@ DIB_XXBPP_AlphaBlend(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
                      XLATEOBJ* ColorTranslation, BLENDOBJ* BlendObj)
 {
   INT DstX, DstY, SrcX, SrcY;
+  LONG cx, i;
   BLENDFUNCTION BlendFunc;
   register NICEPIXEL32 DstPixel32;
   register NICEPIXEL32 SrcPixel32;
   UCHAR Alpha, SrcBpp = BitsPerFormat(Source->iBitmapFormat);
   EXLATEOBJ* pexlo;
   EXLATEOBJ exloSrcRGB, exloDstRGB, exloRGBSrc;
+  PULONG SrcRow, DstRow;
   PFN_DIB_PutPixel pfnDibPutPixel = DibFunctionsForBitmapFormat[Dest->iBitmapFormat].DIB_PutPixel;
+  PFN_DIB_GetPixel pfnDibGetPixel = DibFunctionsForBitmapFormat[Dest->iBitmapFormat].DIB_GetPixel;
 
   DPRINT("DIB_16BPP_AlphaBlend: srcRect: (%d,%d)-(%d,%d), dstRect: (%d,%d)-(%d,%d)\n",
     SourceRect->left, SourceRect->top, SourceRect->right, SourceRect->bottom,
@@ -76,6 +79,16 @@ DIB_XXBPP_AlphaBlend(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
     return FALSE;
   }
 
+  cx = DestRect->right - DestRect->left;
+  if (cx <= 0 || DestRect->bottom <= DestRect->top)
+    return TRUE;
+
+  /* One row of source and one row of destination colors */
+  SrcRow = ExAllocatePoolWithTag(NonPagedPool, 2 * cx * sizeof(ULONG), TAG_DIB);
+  if (SrcRow == NULL)
+    return FALSE;
+  DstRow = SrcRow + cx;
+
   pexlo = CONTAINING_RECORD(ColorTranslation, EXLATEOBJ, xlo);
   EXLATEOBJ_vInitialize(&exloSrcRGB, pexlo->ppalSrc, &gpalRGB, 0, 0, 0);
   EXLATEOBJ_vInitialize(&exloDstRGB, pexlo->ppalDst, &gpalRGB, 0, 0, 0);
@@ -85,11 +98,19 @@ DIB_XXBPP_AlphaBlend(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
   DstY = DestRect->top;
   while ( DstY < DestRect->bottom )
   {
-    SrcX = SourceRect->left;
-    DstX = DestRect->left;
-    while(DstX < DestRect->right)
+    /* Fetch both rows and translate them to RGB a scanline at a time */
+    for (i = 0; i < cx; i++)
+    {
+      SrcX = SourceRect->left + (i * (SourceRect->right - SourceRect->left)) / cx;
+      SrcRow[i] = DIB_GetSourceIndex(Source, SrcX, SrcY);
+      DstRow[i] = pfnDibGetPixel(Dest, DestRect->left + i, DstY);
+    }
+    EXLATEOBJ_vXlateScanline(&exloSrcRGB, SrcRow, SrcRow, cx);
+    EXLATEOBJ_vXlateScanline(&exloDstRGB, DstRow, DstRow, cx);
+
+    for (i = 0; i < cx; i++)
     {
-      SrcPixel32.ul = DIB_GetSource(Source, SrcX, SrcY, &exloSrcRGB.xlo);
+      SrcPixel32.ul = SrcRow[i];
       SrcPixel32.col.red = (SrcPixel32.col.red * BlendFunc.SourceConstantAlpha) / 255;
       SrcPixel32.col.green = (SrcPixel32.col.green * BlendFunc.SourceConstantAlpha) / 255;
       SrcPixel32.col.blue = (SrcPixel32.col.blue * BlendFunc.SourceConstantAlpha) / 255;
@@ -98,17 +119,20 @@ DIB_XXBPP_AlphaBlend(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
            (SrcPixel32.col.alpha * BlendFunc.SourceConstantAlpha) / 255 :
            BlendFunc.SourceConstantAlpha ;
 
-      DstPixel32.ul = DIB_GetSource(Dest, DstX, DstY, &exloDstRGB.xlo);
+      DstPixel32.ul = DstRow[i];
       DstPixel32.col.red = Clamp8((DstPixel32.col.red * (255 - Alpha)) / 255 + SrcPixel32.col.red) ;
       DstPixel32.col.green = Clamp8((DstPixel32.col.green * (255 - Alpha)) / 255 + SrcPixel32.col.green) ;
       DstPixel32.col.blue = Clamp8((DstPixel32.col.blue * (255 - Alpha)) / 255 + SrcPixel32.col.blue) ;
-      DstPixel32.ul = XLATEOBJ_iXlate(&exloRGBSrc.xlo, DstPixel32.ul);
-      pfnDibPutPixel(Dest, DstX, DstY, XLATEOBJ_iXlate(ColorTranslation, DstPixel32.ul));
+      DstRow[i] = DstPixel32.ul;
+    }
 
-      DstX++;
-      SrcX = SourceRect->left + ((DstX-DestRect->left)*(SourceRect->right - SourceRect->left))
-                                            /(DestRect->right-DestRect->left);
+    EXLATEOBJ_vXlateScanline(&exloRGBSrc, DstRow, DstRow, cx);
+    EXLATEOBJ_vXlateScanline(pexlo, DstRow, DstRow, cx);
+    for (i = 0, DstX = DestRect->left; i < cx; i++, DstX++)
+    {
+      pfnDibPutPixel(Dest, DstX, DstY, DstRow[i]);
     }
+
     DstY++;
     SrcY = SourceRect->top + ((DstY-DestRect->top)*(SourceRect->bottom - SourceRect->top))
                                             /(DestRect->bottom-DestRect->top);
@@ -118,6 +142,9 @@ DIB_XXBPP_AlphaBlend(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
   EXLATEOBJ_vCleanup(&exloRGBSrc);
   EXLATEOBJ_vCleanup(&exloSrcRGB);
 
+  ExFreePoolWithTag(SrcRow, TAG_DIB);
+
   return TRUE;
 }
 
+/* EOF */
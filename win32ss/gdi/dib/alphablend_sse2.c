@@ -0,0 +1,95 @@
+/*
+ * PROJECT:         Win32 subsystem
+ * LICENSE:         See COPYING in the top level directory
+ * FILE:            win32ss/gdi/dib/alphablend_sse2.c
+ * PURPOSE:         SSE2 row kernel for 32bpp AlphaBlend
+ */
+
+#include <win32k.h>
+#include <emmintrin.h>
+
+#ifndef __ATTRIBUTE_SSE2__
+#define __ATTRIBUTE_SSE2__ __attribute__((__target__("sse2")))
+#endif
+
+#define NDEBUG
+#include <debug.h>
+
+/* x / 255 for 0 <= x <= 255 * 255, exact */
+#define DIV255_EPU16(x) \
+  _mm_srli_epi16(_mm_mulhi_epu16((x), _mm_set1_epi16((SHORT)0x8081)), 7)
+
+/* Blend two pixels, unpacked to 16 bits per channel */
+static __inline __ATTRIBUTE_SSE2__ __m128i
+BlendPixels(__m128i Src, __m128i Dst, __m128i Constant, BOOLEAN bPerPixel)
+{
+  __m128i Alpha;
+
+  Src = DIV255_EPU16(_mm_mullo_epi16(Src, Constant));
+  if (bPerPixel)
+  {
+    Alpha = _mm_shufflelo_epi16(Src, _MM_SHUFFLE(3, 3, 3, 3));
+    Alpha = _mm_shufflehi_epi16(Alpha, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  else
+  {
+    Alpha = Constant;
+  }
+
+  Dst = DIV255_EPU16(_mm_mullo_epi16(Dst, _mm_sub_epi16(_mm_set1_epi16(255), Alpha)));
+  return _mm_add_epi16(Dst, Src);
+}
+
+/*
+ * Same results as DIB_32BPP_AlphaBlendRow for a 32bpp source, four pixels
+ * at a time. The caller has checked for SSE2 and saved the floating point
+ * state.
+ */
+__ATTRIBUTE_SSE2__
+VOID
+DIB_32BPP_AlphaBlendRowSse2(PULONG Dst, const ULONG *Src, ULONG cx,
+                            BLENDFUNCTION BlendFunc)
+{
+  __m128i Zero = _mm_setzero_si128();
+  __m128i Constant = _mm_set1_epi16(BlendFunc.SourceConstantAlpha);
+  __m128i s, d, Lo, Hi;
+  BOOLEAN bPerPixel = (BlendFunc.AlphaFormat & AC_SRC_ALPHA) != 0;
+  BOOLEAN bOpaqueSource = bPerPixel && BlendFunc.SourceConstantAlpha == 255;
+  ULONG i, And, Or;
+
+  for (i = 0; i + 4 <= cx; i += 4)
+  {
+    if (bOpaqueSource)
+    {
+      And = Src[i] & Src[i + 1] & Src[i + 2] & Src[i + 3];
+      Or = Src[i] | Src[i + 1] | Src[i + 2] | Src[i + 3];
+
+      /* Fully transparent and fully opaque premultiplied pixels */
+      if (Or == 0)
+        continue;
+      if ((And >> 24) == 0xFF)
+      {
+        _mm_storeu_si128((__m128i *)&Dst[i], _mm_loadu_si128((const __m128i *)&Src[i]));
+        continue;
+      }
+    }
+
+    s = _mm_loadu_si128((const __m128i *)&Src[i]);
+    d = _mm_loadu_si128((const __m128i *)&Dst[i]);
+    Lo = BlendPixels(_mm_unpacklo_epi8(s, Zero), _mm_unpacklo_epi8(d, Zero),
+                     Constant, bPerPixel);
+    Hi = BlendPixels(_mm_unpackhi_epi8(s, Zero), _mm_unpackhi_epi8(d, Zero),
+                     Constant, bPerPixel);
+    _mm_storeu_si128((__m128i *)&Dst[i], _mm_packus_epi16(Lo, Hi));
+  }
+
+  for (; i < cx; i++)
+  {
+    s = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)Src[i]), Zero);
+    d = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)Dst[i]), Zero);
+    Lo = BlendPixels(s, d, Constant, bPerPixel);
+    Dst[i] = (ULONG)_mm_cvtsi128_si32(_mm_packus_epi16(Lo, Lo));
+  }
+}
+
+/* EOF */
@@ -124,9 +124,24 @@ BOOLEAN DIB_32BPP_ColorFill(SURFOBJ*, RECTL*, ULONG);
 BOOLEAN DIB_32BPP_AlphaBlend(SURFOBJ*, SURFOBJ*, RECTL*, RECTL*, CLIPOBJ*, XLATEOBJ*, BLENDOBJ*);
 
 BOOLEAN DIB_XXBPP_StretchBlt(SURFOBJ*,SURFOBJ*,SURFOBJ*,SURFOBJ*,RECTL*,RECTL*,POINTL*,BRUSHOBJ*,POINTL*,XLATEOBJ*,ROP4);
+BOOLEAN DIB_XXBPP_StretchBltBilinear(SURFOBJ*,SURFOBJ*,SURFOBJ*,RECTL*,RECTL*,RECTL*,XLATEOBJ*,ROP4);
+BOOLEAN DIB_XXBPP_BitBltSrcCopySpan(PBLTINFO);
 BOOLEAN DIB_XXBPP_FloodFillSolid(SURFOBJ*, BRUSHOBJ*, RECTL*, POINTL*, ULONG, UINT);
 BOOLEAN DIB_XXBPP_AlphaBlend(SURFOBJ*, SURFOBJ*, RECTL*, RECTL*, CLIPOBJ*, XLATEOBJ*, BLENDOBJ*);
 
+typedef struct _DIB_BILINEAR_COLUMN
+{
+  LONG x0;
+  LONG x1;
+  LONG Weight;
+} DIB_BILINEAR_COLUMN, *PDIB_BILINEAR_COLUMN;
+
+#if defined(_M_IX86) || defined(_M_AMD64)
+VOID DIB_32BPP_BilinearRowSse2(PULONG,const ULONG*,const ULONG*,const DIB_BILINEAR_COLUMN*,LONG,LONG);
+VOID DIB_32BPP_AlphaBlendRowSse2(PULONG,const ULONG*,ULONG,BLENDFUNCTION);
+BOOLEAN DIB_XXBPP_BitBltRows(PBLTINFO);
+#endif
+
 extern unsigned char notmask[2];
 extern unsigned char altnotmask[2];
 #define MASK1BPP(x) (1<<(7-((x)&7)))
@@ -64,6 +64,10 @@ DIB_24BPP_BitBltSrcCopy(PBLTINFO BltInfo)
          BltInfo->DestSurface->sizlBitmap.cx, BltInfo->DestSurface->sizlBitmap.cy,
          BltInfo->DestRect.left, BltInfo->DestRect.top, BltInfo->DestRect.right, BltInfo->DestRect.bottom);
 
+  /* Unmirrored copies between two surfaces are done a scanline at a time */
+  if (DIB_XXBPP_BitBltSrcCopySpan(BltInfo))
+    return TRUE;
+
   /* Get back left to right flip here */
   bLeftToRight = (BltInfo->DestRect.left > BltInfo->DestRect.right);
 
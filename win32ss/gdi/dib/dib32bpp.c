@@ -89,6 +89,10 @@ DIB_32BPP_BitBltSrcCopy(PBLTINFO BltInfo)
   blDeltaSrcNeg = BltInfo->SourceSurface->lDelta < 0;
   blDeltaDestNeg = BltInfo->DestSurface->lDelta < 0;
 
+  /* Unmirrored copies between two surfaces are done a scanline at a time */
+  if (DIB_XXBPP_BitBltSrcCopySpan(BltInfo))
+    return TRUE;
+
   /* Get back left to right flip here */
   bLeftToRight = BltInfo->DestRect.left > BltInfo->DestRect.right;
 
@@ -759,16 +763,72 @@ Clamp8(ULONG val)
   return (val > 255) ? 255 : (UCHAR)val;
 }
 
+/* Blend one row of source colors onto a 32bpp row */
+static VOID
+DIB_32BPP_AlphaBlendRow(PULONG Dst, const ULONG *Src, ULONG cx,
+                        BLENDFUNCTION BlendFunc, UCHAR SrcBpp)
+{
+  register NICEPIXEL32 DstPixel, SrcPixel;
+  UCHAR Alpha;
+  ULONG i;
+  BOOLEAN bOpaqueSource = (BlendFunc.SourceConstantAlpha == 255 &&
+                           (BlendFunc.AlphaFormat & AC_SRC_ALPHA) != 0 &&
+                           SrcBpp == 32);
+
+  for (i = 0; i < cx; i++)
+  {
+    SrcPixel.ul = Src[i];
+
+    /* Fully transparent and fully opaque premultiplied pixels */
+    if (bOpaqueSource)
+    {
+      if (SrcPixel.ul == 0)
+        continue;
+      if (SrcPixel.col.alpha == 255)
+      {
+        Dst[i] = SrcPixel.ul;
+        continue;
+      }
+    }
+
+    SrcPixel.col.red = (SrcPixel.col.red * BlendFunc.SourceConstantAlpha) / 255;
+    SrcPixel.col.green = (SrcPixel.col.green * BlendFunc.SourceConstantAlpha)  / 255;
+    SrcPixel.col.blue = (SrcPixel.col.blue * BlendFunc.SourceConstantAlpha) / 255;
+    SrcPixel.col.alpha = (32 == SrcBpp) ?
+                      (SrcPixel.col.alpha * BlendFunc.SourceConstantAlpha) / 255 :
+                      BlendFunc.SourceConstantAlpha ;
+
+    Alpha = ((BlendFunc.AlphaFormat & AC_SRC_ALPHA) != 0) ?
+         SrcPixel.col.alpha : BlendFunc.SourceConstantAlpha ;
+
+    DstPixel.ul = Dst[i];
+    DstPixel.col.red = Clamp8((DstPixel.col.red * (255 - Alpha)) / 255 + SrcPixel.col.red) ;
+    DstPixel.col.green = Clamp8((DstPixel.col.green * (255 - Alpha)) / 255 + SrcPixel.col.green) ;
+    DstPixel.col.blue = Clamp8((DstPixel.col.blue * (255 - Alpha)) / 255 + SrcPixel.col.blue) ;
+    DstPixel.col.alpha = Clamp8((DstPixel.col.alpha * (255 - Alpha)) / 255 + SrcPixel.col.alpha) ;
+    Dst[i] = DstPixel.ul;
+  }
+}
+
+/* Below this size saving the floating point state costs more than it gains */
+#define ALPHABLEND_SSE2_MIN_PIXELS 256
+
 BOOLEAN
 DIB_32BPP_AlphaBlend(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
                      RECTL* SourceRect, CLIPOBJ* ClipRegion,
                      XLATEOBJ* ColorTranslation, BLENDOBJ* BlendObj)
 {
-  INT Rows, Cols, SrcX, SrcY;
-  register PULONG Dst;
+  LONG Rows, Cols, SrcX, SrcY, cx, cy, SrcCx, SrcCy;
+  PULONG Dst, SrcRow, RowBuffer;
+  PBYTE SrcLine;
   BLENDFUNCTION BlendFunc;
-  register NICEPIXEL32 DstPixel, SrcPixel;
-  UCHAR Alpha, SrcBpp;
+  PEXLATEOBJ pexlo = NULL;
+  UCHAR SrcBpp;
+  BOOLEAN bDirect;
+#if defined(_M_IX86) || defined(_M_AMD64)
+  KFLOATING_SAVE FloatSave;
+  BOOLEAN bUseSse2 = FALSE;
+#endif
 
   DPRINT("DIB_32BPP_AlphaBlend: SourceRect: (%d,%d)-(%d,%d), DestRect: (%d,%d)-(%d,%d)\n",
     SourceRect->left, SourceRect->top, SourceRect->right, SourceRect->bottom,
@@ -797,42 +857,81 @@ DIB_32BPP_AlphaBlend(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
     return FALSE;
   }
 
-  Dst = (PULONG)((ULONG_PTR)Dest->pvScan0 + (DestRect->top * Dest->lDelta) +
-    (DestRect->left << 2));
+  cx = DestRect->right - DestRect->left;
+  cy = DestRect->bottom - DestRect->top;
+  SrcCx = SourceRect->right - SourceRect->left;
+  SrcCy = SourceRect->bottom - SourceRect->top;
+  if (cx <= 0 || cy <= 0)
+    return TRUE;
+
   SrcBpp = BitsPerFormat(Source->iBitmapFormat);
 
-  Rows = 0;
-   SrcY = SourceRect->top;
-   while (++Rows <= DestRect->bottom - DestRect->top)
+  /* Unstretched 32bpp sources without translation are blended in place */
+  bDirect = (SrcBpp == 32 && SrcCx == cx &&
+             (ColorTranslation == NULL || (ColorTranslation->flXlate & XO_TRIVIAL)));
+  RowBuffer = NULL;
+  if (!bDirect)
+  {
+    RowBuffer = ExAllocatePoolWithTag(NonPagedPool, cx * sizeof(ULONG), TAG_DIB);
+    if (RowBuffer == NULL)
+      return FALSE;
+    if (ColorTranslation)
+      pexlo = CONTAINING_RECORD(ColorTranslation, EXLATEOBJ, xlo);
+  }
+
+#if defined(_M_IX86) || defined(_M_AMD64)
+  if (SrcBpp == 32 && cx * cy >= ALPHABLEND_SSE2_MIN_PIXELS &&
+      ExIsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) &&
+      NT_SUCCESS(KeSaveFloatingPointState(&FloatSave)))
+  {
+    bUseSse2 = TRUE;
+  }
+#endif
+
+  for (Rows = 0; Rows < cy; Rows++)
   {
-    Cols = 0;
-    SrcX = SourceRect->left;
-    while (++Cols <= DestRect->right - DestRect->left)
-    {
-      SrcPixel.ul = DIB_GetSource(Source, SrcX, SrcY, ColorTranslation);
-      SrcPixel.col.red = (SrcPixel.col.red * BlendFunc.SourceConstantAlpha) / 255;
-      SrcPixel.col.green = (SrcPixel.col.green * BlendFunc.SourceConstantAlpha)  / 255;
-      SrcPixel.col.blue = (SrcPixel.col.blue * BlendFunc.SourceConstantAlpha) / 255;
-      SrcPixel.col.alpha = (32 == SrcBpp) ?
-                        (SrcPixel.col.alpha * BlendFunc.SourceConstantAlpha) / 255 :
-                        BlendFunc.SourceConstantAlpha ;
-
-      Alpha = ((BlendFunc.AlphaFormat & AC_SRC_ALPHA) != 0) ?
-           SrcPixel.col.alpha : BlendFunc.SourceConstantAlpha ;
-
-      DstPixel.ul = *Dst;
-      DstPixel.col.red = Clamp8((DstPixel.col.red * (255 - Alpha)) / 255 + SrcPixel.col.red) ;
-      DstPixel.col.green = Clamp8((DstPixel.col.green * (255 - Alpha)) / 255 + SrcPixel.col.green) ;
-      DstPixel.col.blue = Clamp8((DstPixel.col.blue * (255 - Alpha)) / 255 + SrcPixel.col.blue) ;
-      DstPixel.col.alpha = Clamp8((DstPixel.col.alpha * (255 - Alpha)) / 255 + SrcPixel.col.alpha) ;
-      *Dst++ = DstPixel.ul;
-      SrcX = SourceRect->left + (Cols*(SourceRect->right - SourceRect->left))/(DestRect->right - DestRect->left);
-    }
     Dst = (PULONG)((ULONG_PTR)Dest->pvScan0 + ((DestRect->top + Rows) * Dest->lDelta) +
                 (DestRect->left << 2));
-    SrcY = SourceRect->top + (Rows*(SourceRect->bottom - SourceRect->top))/(DestRect->bottom - DestRect->top);
+    SrcY = SourceRect->top + (Rows * SrcCy) / cy;
+    SrcLine = (PBYTE)Source->pvScan0 + SrcY * Source->lDelta;
+
+    if (bDirect)
+    {
+      SrcRow = (PULONG)SrcLine + SourceRect->left;
+    }
+    else
+    {
+      /* Gather the source row, then translate it in one go */
+      for (Cols = 0; Cols < cx; Cols++)
+      {
+        SrcX = SourceRect->left + (Cols * SrcCx) / cx;
+        if (SrcBpp == 32)
+          RowBuffer[Cols] = ((PULONG)SrcLine)[SrcX];
+        else
+          RowBuffer[Cols] = DIB_GetSourceIndex(Source, SrcX, SrcY);
+      }
+      EXLATEOBJ_vXlateScanline(pexlo, RowBuffer, RowBuffer, cx);
+      SrcRow = RowBuffer;
+    }
+
+#if defined(_M_IX86) || defined(_M_AMD64)
+    if (bUseSse2)
+    {
+      DIB_32BPP_AlphaBlendRowSse2(Dst, SrcRow, cx, BlendFunc);
+      continue;
+    }
+#endif
+    DIB_32BPP_AlphaBlendRow(Dst, SrcRow, cx, BlendFunc, SrcBpp);
   }
 
+#if defined(_M_IX86) || defined(_M_AMD64)
+  if (bUseSse2)
+    KeRestoreFloatingPointState(&FloatSave);
+#endif
+
+  if (RowBuffer)
+    ExFreePoolWithTag(RowBuffer, TAG_DIB);
+
   return TRUE;
 }
 
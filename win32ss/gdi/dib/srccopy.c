@@ -0,0 +1,194 @@
+/*
+ * PROJECT:         Win32 subsystem
+ * LICENSE:         See COPYING in the top level directory
+ * FILE:            win32ss/gdi/dib/srccopy.c
+ * PURPOSE:         Scanline based BitBltSrcCopy suitable for all bit depths
+ */
+
+#include <win32k.h>
+
+#define NDEBUG
+#include <debug.h>
+
+/* Rows up to this width do not need a pool allocation */
+#define SPAN_STACK_PIXELS 64
+
+/* Unpack cx pixels starting at x into one ULONG per pixel */
+static VOID
+DIB_ReadSpan(ULONG iFormat, PBYTE Line, LONG x, LONG cx, PULONG Span)
+{
+  LONG i;
+  PBYTE Addr;
+
+  switch (iFormat)
+  {
+  case BMF_1BPP:
+    for (i = 0; i < cx; i++, x++)
+      Span[i] = (Line[x >> 3] & MASK1BPP(x)) ? 1 : 0;
+    break;
+  case BMF_4BPP:
+    for (i = 0; i < cx; i++, x++)
+      Span[i] = (Line[x >> 1] >> ((1 - (x & 1)) << 2)) & 0x0f;
+    break;
+  case BMF_8BPP:
+    Line += x;
+    for (i = 0; i < cx; i++)
+      Span[i] = Line[i];
+    break;
+  case BMF_16BPP:
+    for (i = 0; i < cx; i++)
+      Span[i] = ((PWORD)Line)[x + i];
+    break;
+  case BMF_24BPP:
+    Addr = Line + x * 3;
+    for (i = 0; i < cx; i++, Addr += 3)
+      Span[i] = *(PUSHORT)Addr + (Addr[2] << 16);
+    break;
+  default:
+    RtlCopyMemory(Span, (PULONG)Line + x, cx * sizeof(ULONG));
+    break;
+  }
+}
+
+/* Pack cx colors into pixels starting at x, like the PutPixel functions */
+static VOID
+DIB_WriteSpan(ULONG iFormat, PBYTE Line, LONG x, LONG cx, const ULONG *Span)
+{
+  LONG i;
+  PBYTE Addr;
+
+  switch (iFormat)
+  {
+  case BMF_1BPP:
+    for (i = 0; i < cx; i++, x++)
+    {
+      if (0 == (Span[i] & 0x01))
+        Line[x >> 3] &= ~MASK1BPP(x);
+      else
+        Line[x >> 3] |= MASK1BPP(x);
+    }
+    break;
+  case BMF_4BPP:
+    for (i = 0; i < cx; i++, x++)
+    {
+      Addr = Line + (x >> 1);
+      *Addr = (*Addr & notmask[x & 1]) | (BYTE)(Span[i] << ((1 - (x & 1)) << 2));
+    }
+    break;
+  case BMF_8BPP:
+    Line += x;
+    for (i = 0; i < cx; i++)
+      Line[i] = (BYTE)Span[i];
+    break;
+  case BMF_16BPP:
+    for (i = 0; i < cx; i++)
+      ((PWORD)Line)[x + i] = (WORD)Span[i];
+    break;
+  case BMF_24BPP:
+    Addr = Line + x * 3;
+    for (i = 0; i < cx; i++, Addr += 3)
+    {
+      *(PUSHORT)Addr = Span[i] & 0xFFFF;
+      Addr[2] = (Span[i] >> 16) & 0xFF;
+    }
+    break;
+  default:
+    RtlCopyMemory((PULONG)Line + x, Span, cx * sizeof(ULONG));
+    break;
+  }
+}
+
+static BOOLEAN
+DIB_IsSpanFormat(ULONG iFormat)
+{
+  switch (iFormat)
+  {
+  case BMF_1BPP:
+  case BMF_4BPP:
+  case BMF_8BPP:
+  case BMF_16BPP:
+  case BMF_24BPP:
+  case BMF_32BPP:
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+/*
+ * SRCCOPY between two different surfaces without flipping. Each source row
+ * is unpacked, translated with one EXLATEOBJ_vXlateScanline call and packed
+ * into the destination. Returns FALSE for the cases the per-format
+ * BitBltSrcCopy functions must handle themselves: mirrored blits, blits
+ * within one surface and 1bpp to 1bpp, which has its own code.
+ */
+BOOLEAN
+DIB_XXBPP_BitBltSrcCopySpan(PBLTINFO BltInfo)
+{
+  SURFOBJ *DestSurf = BltInfo->DestSurface;
+  SURFOBJ *SourceSurf = BltInfo->SourceSurface;
+  RECTL *DestRect = &BltInfo->DestRect;
+  ULONG DestFormat = DestSurf->iBitmapFormat;
+  ULONG SourceFormat = SourceSurf->iBitmapFormat;
+  ULONG aulStack[SPAN_STACK_PIXELS];
+  PULONG Span;
+  PBYTE SourceLine, DestLine;
+  LONG cx, y, Bpp;
+  BOOLEAN bCopy;
+
+  if (DestRect->left > DestRect->right || DestRect->top > DestRect->bottom ||
+      DestRect->left < 0 || DestRect->top < 0 ||
+      DestSurf->pvScan0 == SourceSurf->pvScan0 ||
+      !DIB_IsSpanFormat(DestFormat) || !DIB_IsSpanFormat(SourceFormat) ||
+      (DestFormat == BMF_1BPP && SourceFormat == BMF_1BPP))
+  {
+    return FALSE;
+  }
+
+  cx = DestRect->right - DestRect->left;
+  if (cx == 0 || DestRect->top == DestRect->bottom)
+    return TRUE;
+
+  /* Same byte aligned format without translation is a plain row copy */
+  bCopy = (DestFormat == SourceFormat && DestFormat != BMF_4BPP &&
+           (BltInfo->XlateSourceToDest == NULL ||
+            (BltInfo->XlateSourceToDest->flXlate & XO_TRIVIAL)));
+
+  Span = aulStack;
+  if (!bCopy && cx > SPAN_STACK_PIXELS)
+  {
+    Span = ExAllocatePoolWithTag(NonPagedPool, cx * sizeof(ULONG), TAG_DIB);
+    if (Span == NULL)
+      return FALSE;
+  }
+
+  Bpp = BitsPerFormat(DestFormat) >> 3;
+  SourceLine = (PBYTE)SourceSurf->pvScan0 + BltInfo->SourcePoint.y * SourceSurf->lDelta;
+  DestLine = (PBYTE)DestSurf->pvScan0 + DestRect->top * DestSurf->lDelta;
+
+  for (y = DestRect->top; y < DestRect->bottom; y++)
+  {
+    if (bCopy)
+    {
+      RtlCopyMemory(DestLine + DestRect->left * Bpp,
+                    SourceLine + BltInfo->SourcePoint.x * Bpp,
+                    cx * Bpp);
+    }
+    else
+    {
+      DIB_ReadSpan(SourceFormat, SourceLine, BltInfo->SourcePoint.x, cx, Span);
+      EXLATEOBJ_vXlateScanline((PEXLATEOBJ)BltInfo->XlateSourceToDest, Span, Span, cx);
+      DIB_WriteSpan(DestFormat, DestLine, DestRect->left, cx, Span);
+    }
+
+    SourceLine += SourceSurf->lDelta;
+    DestLine += DestSurf->lDelta;
+  }
+
+  if (Span != aulStack)
+    ExFreePoolWithTag(Span, TAG_DIB);
+
+  return TRUE;
+}
+
+/* EOF */
@@ -14,6 +14,436 @@
 #define NDEBUG
 #include <debug.h>
 
+/* Read one stretched source row into a buffer of destination colors */
+static VOID
+DIB_StretchReadRow(ULONG iFormat, PBYTE SourceLine, const LONG *Columns,
+                   LONG Count, const ULONG *Palette, XLATEOBJ *ColorTranslation,
+                   PULONG Row)
+{
+  LONG i;
+  PBYTE Addr;
+  ULONG Source, LastSource = 0, LastColor;
+  BOOLEAN bTrivial = (ColorTranslation == NULL ||
+                      (ColorTranslation->flXlate & XO_TRIVIAL));
+
+  switch (iFormat)
+  {
+  case BMF_8BPP:
+    for (i = 0; i < Count; i++)
+    {
+      if (Columns[i] >= 0)
+        Row[i] = Palette[SourceLine[Columns[i]]];
+    }
+    return;
+  case BMF_16BPP:
+    for (i = 0; i < Count; i++)
+    {
+      if (Columns[i] >= 0)
+        Row[i] = ((PUSHORT)SourceLine)[Columns[i]];
+    }
+    break;
+  case BMF_24BPP:
+    for (i = 0; i < Count; i++)
+    {
+      if (Columns[i] >= 0)
+      {
+        Addr = SourceLine + Columns[i] * 3;
+        Row[i] = *(PUSHORT)Addr + (Addr[2] << 16);
+      }
+    }
+    break;
+  default:
+    for (i = 0; i < Count; i++)
+    {
+      if (Columns[i] >= 0)
+        Row[i] = ((PULONG)SourceLine)[Columns[i]];
+    }
+    break;
+  }
+
+  if (bTrivial)
+    return;
+
+  /* Neighbouring pixels are often equal, so remember the last translation */
+  LastColor = XLATEOBJ_iXlate(ColorTranslation, LastSource);
+  for (i = 0; i < Count; i++)
+  {
+    if (Columns[i] < 0)
+      continue;
+    Source = Row[i];
+    if (Source != LastSource)
+    {
+      LastSource = Source;
+      LastColor = XLATEOBJ_iXlate(ColorTranslation, Source);
+    }
+    Row[i] = LastColor;
+  }
+}
+
+/* Write a buffer of colors to one destination row */
+static VOID
+DIB_StretchWriteRow(ULONG iFormat, PBYTE DestLine, const LONG *Columns,
+                    LONG Count, const ULONG *Row)
+{
+  LONG i;
+  PBYTE Addr;
+
+  switch (iFormat)
+  {
+  case BMF_8BPP:
+    for (i = 0; i < Count; i++)
+    {
+      if (Columns[i] >= 0)
+        DestLine[i] = (BYTE)Row[i];
+    }
+    break;
+  case BMF_16BPP:
+    for (i = 0; i < Count; i++)
+    {
+      if (Columns[i] >= 0)
+        ((PUSHORT)DestLine)[i] = (USHORT)Row[i];
+    }
+    break;
+  case BMF_24BPP:
+    for (i = 0; i < Count; i++)
+    {
+      if (Columns[i] >= 0)
+      {
+        Addr = DestLine + i * 3;
+        *(PUSHORT)Addr = (USHORT)Row[i];
+        Addr[2] = (BYTE)(Row[i] >> 16);
+      }
+    }
+    break;
+  default:
+    for (i = 0; i < Count; i++)
+    {
+      if (Columns[i] >= 0)
+        ((PULONG)DestLine)[i] = Row[i];
+    }
+    break;
+  }
+}
+
+/* Copy one stretched row between surfaces of the same format */
+static VOID
+DIB_StretchCopyRow(ULONG iFormat, PBYTE DestLine, PBYTE SourceLine,
+                   const LONG *Columns, LONG Count)
+{
+  LONG i;
+  PBYTE Addr;
+
+  switch (iFormat)
+  {
+  case BMF_8BPP:
+    for (i = 0; i < Count; i++)
+    {
+      if (Columns[i] >= 0)
+        DestLine[i] = SourceLine[Columns[i]];
+    }
+    break;
+  case BMF_16BPP:
+    for (i = 0; i < Count; i++)
+    {
+      if (Columns[i] >= 0)
+        ((PUSHORT)DestLine)[i] = ((PUSHORT)SourceLine)[Columns[i]];
+    }
+    break;
+  case BMF_24BPP:
+    for (i = 0; i < Count; i++)
+    {
+      if (Columns[i] >= 0)
+      {
+        Addr = SourceLine + Columns[i] * 3;
+        DestLine[i * 3] = Addr[0];
+        DestLine[i * 3 + 1] = Addr[1];
+        DestLine[i * 3 + 2] = Addr[2];
+      }
+    }
+    break;
+  default:
+    for (i = 0; i < Count; i++)
+    {
+      if (Columns[i] >= 0)
+        ((PULONG)DestLine)[i] = ((PULONG)SourceLine)[Columns[i]];
+    }
+    break;
+  }
+}
+
+static BOOLEAN
+DIB_IsStretchRowFormat(ULONG iFormat)
+{
+  return (iFormat == BMF_8BPP || iFormat == BMF_16BPP ||
+          iFormat == BMF_24BPP || iFormat == BMF_32BPP);
+}
+
+/*
+ * SRCCOPY without a mask between 8, 16, 24 and 32 bpp surfaces.
+ * The source column of every destination column is computed once, then the
+ * blit is done a row at a time. The pixels chosen are the same as in the
+ * generic loop of DIB_XXBPP_StretchBlt. Returns FALSE if the caller must use
+ * the generic loop instead.
+ */
+static BOOLEAN
+DIB_XXBPP_StretchSrcCopy(SURFOBJ *DestSurf, SURFOBJ *SourceSurf,
+                         RECTL *DestRect, RECTL *SourceRect,
+                         XLATEOBJ *ColorTranslation,
+                         BOOLEAN bLeftToRight, BOOLEAN bTopToBottom)
+{
+  LONG DstHeight, DstWidth, SrcHeight, SrcWidth;
+  LONG DesY, sx, sy, PrevSy = -1, i;
+  ULONG DestBpp, cjAlloc;
+  PLONG Columns;
+  PULONG Row, Palette;
+  PBYTE DestLine, PrevDestLine = NULL;
+  BOOLEAN bDirect, bAllColumns = TRUE;
+
+  if (!DIB_IsStretchRowFormat(DestSurf->iBitmapFormat) ||
+      !DIB_IsStretchRowFormat(SourceSurf->iBitmapFormat) ||
+      DestSurf->pvScan0 == SourceSurf->pvScan0)
+  {
+    return FALSE;
+  }
+
+  DstHeight = DestRect->bottom - DestRect->top;
+  DstWidth = DestRect->right - DestRect->left;
+  SrcHeight = SourceRect->bottom - SourceRect->top;
+  SrcWidth = SourceRect->right - SourceRect->left;
+  if (DstWidth <= 0 || DstHeight <= 0)
+    return TRUE;
+
+  bDirect = (DestSurf->iBitmapFormat == SourceSurf->iBitmapFormat &&
+             (ColorTranslation == NULL || (ColorTranslation->flXlate & XO_TRIVIAL)));
+
+  cjAlloc = DstWidth * sizeof(LONG);
+  if (!bDirect)
+    cjAlloc += DstWidth * sizeof(ULONG) + 256 * sizeof(ULONG);
+  Columns = ExAllocatePoolWithTag(NonPagedPool, cjAlloc, TAG_DIB);
+  if (Columns == NULL)
+    return FALSE;
+  Row = (PULONG)(Columns + DstWidth);
+  Palette = Row + DstWidth;
+
+  for (i = 0; i < DstWidth; i++)
+  {
+    if (bLeftToRight)
+      sx = SourceRect->right - i * SrcWidth / DstWidth;  // flips about the y-axis
+    else
+      sx = SourceRect->left + i * SrcWidth / DstWidth;
+
+    if (sx < 0 || sx >= SourceSurf->sizlBitmap.cx)
+    {
+      sx = -1;
+      bAllColumns = FALSE;
+    }
+    Columns[i] = sx;
+  }
+
+  if (!bDirect && SourceSurf->iBitmapFormat == BMF_8BPP)
+  {
+    for (i = 0; i < 256; i++)
+      Palette[i] = XLATEOBJ_iXlate(ColorTranslation, i);
+  }
+
+  DestBpp = BitsPerFormat(DestSurf->iBitmapFormat) >> 3;
+
+  for (DesY = DestRect->top; DesY < DestRect->bottom; DesY++)
+  {
+    if (bTopToBottom)
+      sy = SourceRect->bottom - (DesY - DestRect->top) * SrcHeight / DstHeight;  // flips about the x-axis
+    else
+      sy = SourceRect->top + (DesY - DestRect->top) * SrcHeight / DstHeight;
+
+    /* Rows outside the source are left alone, like the generic loop does */
+    if (sy < 0 || sy >= SourceSurf->sizlBitmap.cy)
+      continue;
+
+    DestLine = (PBYTE)DestSurf->pvScan0 + DesY * DestSurf->lDelta +
+               DestRect->left * DestBpp;
+
+    /* Enlarged rows repeat the previous one */
+    if (sy == PrevSy && bAllColumns)
+    {
+      RtlCopyMemory(DestLine, PrevDestLine, DstWidth * DestBpp);
+      continue;
+    }
+
+    if (bDirect)
+    {
+      DIB_StretchCopyRow(DestSurf->iBitmapFormat, DestLine,
+                         (PBYTE)SourceSurf->pvScan0 + sy * SourceSurf->lDelta,
+                         Columns, DstWidth);
+    }
+    else
+    {
+      DIB_StretchReadRow(SourceSurf->iBitmapFormat,
+                         (PBYTE)SourceSurf->pvScan0 + sy * SourceSurf->lDelta,
+                         Columns, DstWidth, Palette, ColorTranslation, Row);
+      DIB_StretchWriteRow(DestSurf->iBitmapFormat, DestLine, Columns, DstWidth, Row);
+    }
+
+    PrevSy = sy;
+    PrevDestLine = DestLine;
+  }
+
+  ExFreePoolWithTag(Columns, TAG_DIB);
+  return TRUE;
+}
+
+/* Bilinear filter of one 32bpp row, all four channels with 7 bit weights */
+static VOID
+DIB_32BPP_BilinearRow(PULONG Dest, const ULONG *Row0, const ULONG *Row1,
+                      const DIB_BILINEAR_COLUMN *Columns, LONG Count,
+                      LONG WeightY)
+{
+  LONG i, Shift, a, b, c, d, Top, Bottom;
+  ULONG Color;
+
+  for (i = 0; i < Count; i++)
+  {
+    Color = 0;
+    for (Shift = 0; Shift < 32; Shift += 8)
+    {
+      a = (Row0[Columns[i].x0] >> Shift) & 0xFF;
+      b = (Row0[Columns[i].x1] >> Shift) & 0xFF;
+      c = (Row1[Columns[i].x0] >> Shift) & 0xFF;
+      d = (Row1[Columns[i].x1] >> Shift) & 0xFF;
+      Top = a + (((b - a) * Columns[i].Weight) >> 7);
+      Bottom = c + (((d - c) * Columns[i].Weight) >> 7);
+      Color |= (ULONG)(Top + (((Bottom - Top) * WeightY) >> 7)) << Shift;
+    }
+    Dest[i] = Color;
+  }
+}
+
+/* Map a destination position to a source position and 7 bit weight */
+static VOID
+DIB_BilinearPosition(LONG Index, LONG SrcSize, LONG DstSize,
+                     PLONG Pos0, PLONG Pos1, PLONG Weight)
+{
+  LONGLONG Pos;
+
+  /* Pixel centers are aligned: ((Index + 0.5) * Src / Dst - 0.5) * 128 */
+  Pos = ((LONGLONG)(2 * Index + 1) * SrcSize * 128) / (2 * DstSize) - 64;
+  if (Pos < 0)
+    Pos = 0;
+
+  *Pos0 = (LONG)(Pos >> 7);
+  *Weight = (LONG)(Pos & 127);
+  if (*Pos0 >= SrcSize - 1)
+  {
+    *Pos0 = SrcSize - 1;
+    *Weight = 0;
+  }
+  *Pos1 = (*Weight != 0) ? *Pos0 + 1 : *Pos0;
+}
+
+/*
+ * HALFTONE stretching with bilinear filtering. Only unmirrored SRCCOPY
+ * between 32bpp surfaces without color translation is handled here; in all
+ * other cases FALSE is returned and the caller falls back to the nearest
+ * neighbour code. DestRect and SourceRect are the whole, unclipped stretch
+ * so that the filter doesn't depend on the clip region; only the part of
+ * DestRect inside ClipRect is written.
+ */
+BOOLEAN
+DIB_XXBPP_StretchBltBilinear(SURFOBJ *DestSurf, SURFOBJ *SourceSurf,
+                             SURFOBJ *MaskSurf, RECTL *DestRect,
+                             RECTL *SourceRect, RECTL *ClipRect,
+                             XLATEOBJ *ColorTranslation, ROP4 ROP)
+{
+  LONG DstHeight, DstWidth, SrcHeight, SrcWidth, ClipWidth;
+  LONG DesY, i, y0, y1, WeightY;
+  PDIB_BILINEAR_COLUMN Columns;
+  PBYTE SourceBits;
+  RECTL OutputRect;
+#if defined(_M_IX86) || defined(_M_AMD64)
+  KFLOATING_SAVE FloatSave;
+  BOOLEAN bUseSse2 = FALSE;
+#endif
+
+  if (MaskSurf != NULL || ROP != ROP4_SRCCOPY || SourceSurf == NULL ||
+      DestSurf->iBitmapFormat != BMF_32BPP ||
+      SourceSurf->iBitmapFormat != BMF_32BPP ||
+      DestSurf->pvScan0 == SourceSurf->pvScan0 ||
+      (ColorTranslation != NULL && !(ColorTranslation->flXlate & XO_TRIVIAL)))
+  {
+    return FALSE;
+  }
+
+  DstHeight = DestRect->bottom - DestRect->top;
+  DstWidth = DestRect->right - DestRect->left;
+  SrcHeight = SourceRect->bottom - SourceRect->top;
+  SrcWidth = SourceRect->right - SourceRect->left;
+
+  /* Mirroring, sources outside the bitmap and plain copies go the usual way */
+  if (DstWidth <= 0 || DstHeight <= 0 || SrcWidth <= 0 || SrcHeight <= 0 ||
+      SourceRect->left < 0 || SourceRect->top < 0 ||
+      SourceRect->right > SourceSurf->sizlBitmap.cx ||
+      SourceRect->bottom > SourceSurf->sizlBitmap.cy ||
+      (DstWidth == SrcWidth && DstHeight == SrcHeight))
+  {
+    return FALSE;
+  }
+
+  if (!RECTL_bIntersectRect(&OutputRect, DestRect, ClipRect))
+    return TRUE;
+  ClipWidth = OutputRect.right - OutputRect.left;
+
+  Columns = ExAllocatePoolWithTag(NonPagedPool,
+                                  ClipWidth * sizeof(DIB_BILINEAR_COLUMN),
+                                  TAG_DIB);
+  if (Columns == NULL)
+    return FALSE;
+
+  for (i = 0; i < ClipWidth; i++)
+  {
+    DIB_BilinearPosition(i + OutputRect.left - DestRect->left, SrcWidth, DstWidth,
+                         &Columns[i].x0, &Columns[i].x1, &Columns[i].Weight);
+    Columns[i].x0 += SourceRect->left;
+    Columns[i].x1 += SourceRect->left;
+  }
+
+#if defined(_M_IX86) || defined(_M_AMD64)
+  if (ExIsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) &&
+      NT_SUCCESS(KeSaveFloatingPointState(&FloatSave)))
+  {
+    bUseSse2 = TRUE;
+  }
+#endif
+
+  SourceBits = (PBYTE)SourceSurf->pvScan0;
+  for (DesY = OutputRect.top; DesY < OutputRect.bottom; DesY++)
+  {
+    PULONG DestLine = (PULONG)((PBYTE)DestSurf->pvScan0 + DesY * DestSurf->lDelta) +
+                      OutputRect.left;
+    const ULONG *Row0, *Row1;
+
+    DIB_BilinearPosition(DesY - DestRect->top, SrcHeight, DstHeight,
+                         &y0, &y1, &WeightY);
+    Row0 = (const ULONG *)(SourceBits + (SourceRect->top + y0) * SourceSurf->lDelta);
+    Row1 = (const ULONG *)(SourceBits + (SourceRect->top + y1) * SourceSurf->lDelta);
+
+#if defined(_M_IX86) || defined(_M_AMD64)
+    if (bUseSse2)
+    {
+      DIB_32BPP_BilinearRowSse2(DestLine, Row0, Row1, Columns, ClipWidth, WeightY);
+      continue;
+    }
+#endif
+    DIB_32BPP_BilinearRow(DestLine, Row0, Row1, Columns, ClipWidth, WeightY);
+  }
+
+#if defined(_M_IX86) || defined(_M_AMD64)
+  if (bUseSse2)
+    KeRestoreFloatingPointState(&FloatSave);
+#endif
+
+  ExFreePoolWithTag(Columns, TAG_DIB);
+  return TRUE;
+}
+
 BOOLEAN DIB_XXBPP_StretchBlt(SURFOBJ *DestSurf, SURFOBJ *SourceSurf, SURFOBJ *MaskSurf,
                             SURFOBJ *PatternSurface,
                             RECTL *DestRect, RECTL *SourceRect,
@@ -97,6 +527,14 @@ BOOLEAN DIB_XXBPP_StretchBlt(SURFOBJ *DestSurf, SURFOBJ *SourceSurf, SURFOBJ *Ma
   SrcHeight = SourceRect->bottom - SourceRect->top;
   SrcWidth = SourceRect->right - SourceRect->left;
 
+  /* Plain copies are done a row at a time */
+  if (!MaskSurf && ROP == ROP4_SRCCOPY &&
+      DIB_XXBPP_StretchSrcCopy(DestSurf, SourceSurf, DestRect, SourceRect,
+                               ColorTranslation, bLeftToRight, bTopToBottom))
+  {
+    return TRUE;
+  }
+
   /* FIXME: MaskOrigin? */
 
   switch(DestSurf->iBitmapFormat)
@@ -0,0 +1,70 @@
+/*
+ * PROJECT:         ReactOS Win32k subsystem
+ * LICENSE:         See COPYING in the top level directory
+ * FILE:            win32ss/gdi/dib/stretchblt_sse2.c
+ * PURPOSE:         SSE2 row kernel for bilinear StretchBlt
+ */
+
+#include <win32k.h>
+#include <emmintrin.h>
+
+#ifndef __ATTRIBUTE_SSE2__
+#define __ATTRIBUTE_SSE2__ __attribute__((__target__("sse2")))
+#endif
+
+#define NDEBUG
+#include <debug.h>
+
+/*
+ * Same arithmetic as DIB_32BPP_BilinearRow, two pixels at a time. The
+ * caller has checked for SSE2 and saved the floating point state.
+ */
+__ATTRIBUTE_SSE2__
+VOID
+DIB_32BPP_BilinearRowSse2(PULONG Dest, const ULONG *Row0, const ULONG *Row1,
+                          const DIB_BILINEAR_COLUMN *Columns, LONG Count,
+                          LONG WeightY)
+{
+  __m128i Zero = _mm_setzero_si128();
+  __m128i Wy = _mm_set1_epi16((SHORT)WeightY);
+  __m128i a, b, c, d, Wx, Top, Bottom, Result;
+  LONG i;
+
+  for (i = 0; i < Count; i += 2)
+  {
+    const DIB_BILINEAR_COLUMN *C0 = &Columns[i];
+    /* An odd last pixel is simply computed twice */
+    const DIB_BILINEAR_COLUMN *C1 = (i + 1 < Count) ? &Columns[i + 1] : C0;
+
+    a = _mm_unpacklo_epi32(_mm_cvtsi32_si128((int)Row0[C0->x0]),
+                           _mm_cvtsi32_si128((int)Row0[C1->x0]));
+    b = _mm_unpacklo_epi32(_mm_cvtsi32_si128((int)Row0[C0->x1]),
+                           _mm_cvtsi32_si128((int)Row0[C1->x1]));
+    c = _mm_unpacklo_epi32(_mm_cvtsi32_si128((int)Row1[C0->x0]),
+                           _mm_cvtsi32_si128((int)Row1[C1->x0]));
+    d = _mm_unpacklo_epi32(_mm_cvtsi32_si128((int)Row1[C0->x1]),
+                           _mm_cvtsi32_si128((int)Row1[C1->x1]));
+    a = _mm_unpacklo_epi8(a, Zero);
+    b = _mm_unpacklo_epi8(b, Zero);
+    c = _mm_unpacklo_epi8(c, Zero);
+    d = _mm_unpacklo_epi8(d, Zero);
+
+    Wx = _mm_set_epi16((SHORT)C1->Weight, (SHORT)C1->Weight,
+                       (SHORT)C1->Weight, (SHORT)C1->Weight,
+                       (SHORT)C0->Weight, (SHORT)C0->Weight,
+                       (SHORT)C0->Weight, (SHORT)C0->Weight);
+
+    /* (b - a) * w fits in 16 bits for 8 bit channels and 7 bit weights */
+    Top = _mm_add_epi16(a, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(b, a), Wx), 7));
+    Bottom = _mm_add_epi16(c, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(d, c), Wx), 7));
+    Result = _mm_add_epi16(Top, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(Bottom, Top), Wy), 7));
+    Result = _mm_packus_epi16(Result, Result);
+
+    if (i + 1 < Count)
+      _mm_storel_epi64((__m128i *)&Dest[i], Result);
+    else
+      Dest[i] = (ULONG)_mm_cvtsi128_si32(Result);
+  }
+}
+
+/* EOF */
@@ -36,7 +36,10 @@ typedef BOOLEAN (APIENTRY *PSTRETCHRECTFUNC)(SURFOBJ* OutputObj,
                                             POINTL* MaskOrigin,
                                             BRUSHOBJ* pbo,
                                             POINTL* BrushOrigin,
-                                            ROP4 Rop4);
+                                            ROP4 Rop4,
+                                            ULONG Mode,
+                                            RECTL* FullOutputRect,
+                                            RECTL* FullInputRect);
 
 static BOOLEAN APIENTRY
 CallDibStretchBlt(SURFOBJ* psoDest,
@@ -48,7 +51,10 @@ CallDibStretchBlt(SURFOBJ* psoDest,
                   POINTL* MaskOrigin,
                   BRUSHOBJ* pbo,
                   POINTL* BrushOrigin,
-                  ROP4 Rop4)
+                  ROP4 Rop4,
+                  ULONG Mode,
+                  RECTL* FullOutputRect,
+                  RECTL* FullInputRect)
 {
     POINTL RealBrushOrigin;
     SURFOBJ* psoPattern;
@@ -80,6 +86,15 @@ CallDibStretchBlt(SURFOBJ* psoDest,
         psoPattern = NULL;
     }
 
+    /* Use bilinear filtering for HALFTONE when the formats allow it. It is given
+       the whole stretch, OutputRect only clips what it writes */
+    if (Mode == HALFTONE && FullOutputRect != NULL &&
+        DIB_XXBPP_StretchBltBilinear(psoDest, psoSource, Mask, FullOutputRect,
+                                     FullInputRect, OutputRect, ColorTranslation, Rop4))
+    {
+        return TRUE;
+    }
+
     bResult = DibFunctionsForBitmapFormat[psoDest->iBitmapFormat].DIB_StretchBlt(
                psoDest, psoSource, Mask, psoPattern,
                OutputRect, InputRect, MaskOrigin, pbo, &RealBrushOrigin,
@@ -112,6 +127,9 @@ EngStretchBltROP(
 {
     RECTL              InputRect;
     RECTL              OutputRect;
+    RECTL              FullInputRect;
+    RECTL              FullOutputRect;
+    RECTL*             pFullOutputRect;
     POINTL             Translate;
     INTENG_ENTER_LEAVE EnterLeaveSource;
     INTENG_ENTER_LEAVE EnterLeaveDest;
@@ -222,6 +240,10 @@ EngStretchBltROP(
         psoInput = NULL;
     }
 
+    /* Keep the unclipped rectangles for the HALFTONE filter */
+    FullInputRect = InputRect;
+    FullOutputRect = OutputRect;
+
     if (NULL != ClipRegion)
     {
         if (OutputRect.left < ClipRegion->rclBounds.left)
@@ -271,6 +293,14 @@ EngStretchBltROP(
     OutputRect.top += Translate.y;
     OutputRect.bottom += Translate.y;
 
+    FullOutputRect.left += Translate.x;
+    FullOutputRect.right += Translate.x;
+    FullOutputRect.top += Translate.y;
+    FullOutputRect.bottom += Translate.y;
+
+    /* Mirrored stretches are never filtered */
+    pFullOutputRect = (bLeftToRight || bTopToBottom) ? NULL : &FullOutputRect;
+
     if (BrushOrigin)
     {
         AdjustedBrushOrigin.x = BrushOrigin->x + Translate.x;
@@ -312,7 +342,8 @@ EngStretchBltROP(
 
             Ret = (*BltRectFunc)(psoOutput, psoInput, Mask,
                          ColorTranslation, &OutputRect, &InputRect, MaskOrigin,
-                         pbo, &AdjustedBrushOrigin, Rop4);
+                         pbo, &AdjustedBrushOrigin, Rop4, Mode,
+                         pFullOutputRect, &FullInputRect);
             break;
         case DC_RECT:
             // Clip the blt to the clip rectangle
@@ -351,7 +382,10 @@ EngStretchBltROP(
                            MaskOrigin,
                            pbo,
                            &AdjustedBrushOrigin,
-                           Rop4);
+                           Rop4,
+                           Mode,
+                           pFullOutputRect,
+                           &FullInputRect);
             }
             break;
         case DC_COMPLEX:
@@ -414,7 +448,10 @@ EngStretchBltROP(
                            MaskOrigin,
                            pbo,
                            &AdjustedBrushOrigin,
-                           Rop4);
+                           Rop4,
+                           Mode,
+                           pFullOutputRect,
+                           &FullInputRect);
                     }
                 }
             }
@@ -477,7 +514,8 @@ IntEngStretchBlt(SURFOBJ *psoDest,
                  POINTL *pMaskOrigin,
                  BRUSHOBJ *pbo,
                  POINTL *BrushOrigin,
-                 DWORD Rop4)
+                 DWORD Rop4,
+                 ULONG Mode)
 {
     BOOLEAN ret;
     POINTL MaskOrigin = {0, 0};
@@ -844,7 +882,7 @@ IntEngStretchBlt(SURFOBJ *psoDest,
                                &OutputRect,
                                &InputRect,
                                &MaskOrigin,
-                               COLORONCOLOR,
+                               Mode,
                                pbo,
                                Rop4);
     }
@@ -351,6 +351,120 @@ EXLATEOBJ_iXlateBitfieldsToPal(PEXLATEOBJ pexlo, ULONG iColor)
 }
 
 
+/** Span functions ************************************************************/
+
+/*
+ * Each of these translates a whole span with a direct call of the pixel
+ * function, which the compiler can inline. Translations that search a
+ * palette are not listed here; they go through the generic loop below.
+ */
+#define DEFINE_XLATE_SPAN(name)                                    \
+static                                                             \
+VOID                                                               \
+FASTCALL                                                           \
+EXLATEOBJ_vXlateSpan##name(                                        \
+    _In_ PEXLATEOBJ pexlo,                                         \
+    _Out_writes_(cPixels) PULONG pulDest,                          \
+    _In_reads_(cPixels) const ULONG *pulSource,                    \
+    _In_ ULONG cPixels)                                            \
+{                                                                  \
+    ULONG i;                                                       \
+    for (i = 0; i < cPixels; i++)                                  \
+        pulDest[i] = EXLATEOBJ_iXlate##name(pexlo, pulSource[i]);  \
+}
+
+DEFINE_XLATE_SPAN(RGBtoBGR)
+DEFINE_XLATE_SPAN(RGBto555)
+DEFINE_XLATE_SPAN(BGRto555)
+DEFINE_XLATE_SPAN(RGBto565)
+DEFINE_XLATE_SPAN(BGRto565)
+DEFINE_XLATE_SPAN(555toRGB)
+DEFINE_XLATE_SPAN(555toBGR)
+DEFINE_XLATE_SPAN(555to565)
+DEFINE_XLATE_SPAN(565to555)
+DEFINE_XLATE_SPAN(565toRGB)
+DEFINE_XLATE_SPAN(565toBGR)
+DEFINE_XLATE_SPAN(ShiftAndMask)
+
+static
+VOID
+FASTCALL
+EXLATEOBJ_vXlateSpanTable(
+    _In_ PEXLATEOBJ pexlo,
+    _Out_writes_(cPixels) PULONG pulDest,
+    _In_reads_(cPixels) const ULONG *pulSource,
+    _In_ ULONG cPixels)
+{
+    const ULONG *pulXlate = pexlo->xlo.pulXlate;
+    ULONG cEntries = pexlo->xlo.cEntries;
+    ULONG i, iColor;
+
+    for (i = 0; i < cPixels; i++)
+    {
+        iColor = pulSource[i];
+        pulDest[i] = (iColor < cEntries) ? pulXlate[iColor] : 0;
+    }
+}
+
+static
+VOID
+FASTCALL
+EXLATEOBJ_vXlateSpanGeneric(
+    _In_ PEXLATEOBJ pexlo,
+    _Out_writes_(cPixels) PULONG pulDest,
+    _In_reads_(cPixels) const ULONG *pulSource,
+    _In_ ULONG cPixels)
+{
+    PFN_XLATE pfnXlate = pexlo->pfnXlate;
+    ULONG i, iColor, iLastColor, iLastResult;
+
+    if (cPixels == 0)
+        return;
+
+    /* Runs of the same color are common, translate each run only once */
+    iLastColor = pulSource[0];
+    iLastResult = pfnXlate(pexlo, iLastColor);
+    for (i = 0; i < cPixels; i++)
+    {
+        iColor = pulSource[i];
+        if (iColor != iLastColor)
+        {
+            iLastColor = iColor;
+            iLastResult = pfnXlate(pexlo, iColor);
+        }
+        pulDest[i] = iLastResult;
+    }
+}
+
+typedef
+VOID
+(FASTCALL *PFN_XLATE_SPAN)(
+    _In_ PEXLATEOBJ pexlo,
+    _Out_writes_(cPixels) PULONG pulDest,
+    _In_reads_(cPixels) const ULONG *pulSource,
+    _In_ ULONG cPixels);
+
+static const struct
+{
+    PFN_XLATE pfnXlate;
+    PFN_XLATE_SPAN pfnXlateSpan;
+} gaXlateSpans[] =
+{
+    {EXLATEOBJ_iXlateTable, EXLATEOBJ_vXlateSpanTable},
+    {EXLATEOBJ_iXlateRGBtoBGR, EXLATEOBJ_vXlateSpanRGBtoBGR},
+    {EXLATEOBJ_iXlateRGBto555, EXLATEOBJ_vXlateSpanRGBto555},
+    {EXLATEOBJ_iXlateBGRto555, EXLATEOBJ_vXlateSpanBGRto555},
+    {EXLATEOBJ_iXlateRGBto565, EXLATEOBJ_vXlateSpanRGBto565},
+    {EXLATEOBJ_iXlateBGRto565, EXLATEOBJ_vXlateSpanBGRto565},
+    {EXLATEOBJ_iXlate555toRGB, EXLATEOBJ_vXlateSpan555toRGB},
+    {EXLATEOBJ_iXlate555toBGR, EXLATEOBJ_vXlateSpan555toBGR},
+    {EXLATEOBJ_iXlate555to565, EXLATEOBJ_vXlateSpan555to565},
+    {EXLATEOBJ_iXlate565to555, EXLATEOBJ_vXlateSpan565to555},
+    {EXLATEOBJ_iXlate565toRGB, EXLATEOBJ_vXlateSpan565toRGB},
+    {EXLATEOBJ_iXlate565toBGR, EXLATEOBJ_vXlateSpan565toBGR},
+    {EXLATEOBJ_iXlateShiftAndMask, EXLATEOBJ_vXlateSpanShiftAndMask},
+};
+
 /** Private Functions *********************************************************/
 
 VOID
@@ -656,6 +770,35 @@ EXLATEOBJ_vCleanup(
     pexlo->xlo.pulXlate = pexlo->aulXlate;
 }
 
+VOID
+NTAPI
+EXLATEOBJ_vXlateScanline(
+    _In_opt_ PEXLATEOBJ pexlo,
+    _Out_writes_(cPixels) PULONG pulDest,
+    _In_reads_(cPixels) const ULONG *pulSource,
+    _In_ ULONG cPixels)
+{
+    ULONG i;
+
+    if (!pexlo || (pexlo->xlo.flXlate & XO_TRIVIAL))
+    {
+        if (pulDest != pulSource)
+            RtlMoveMemory(pulDest, pulSource, cPixels * sizeof(ULONG));
+        return;
+    }
+
+    for (i = 0; i < RTL_NUMBER_OF(gaXlateSpans); i++)
+    {
+        if (gaXlateSpans[i].pfnXlate == pexlo->pfnXlate)
+        {
+            gaXlateSpans[i].pfnXlateSpan(pexlo, pulDest, pulSource, cPixels);
+            return;
+        }
+    }
+
+    EXLATEOBJ_vXlateSpanGeneric(pexlo, pulDest, pulSource, cPixels);
+}
+
 /** Public DDI Functions ******************************************************/
 
 #undef XLATEOBJ_iXlate
@@ -84,3 +84,10 @@ NTAPI
 EXLATEOBJ_vCleanup(
     _Inout_ PEXLATEOBJ pexlo);
 
+VOID
+NTAPI
+EXLATEOBJ_vXlateScanline(
+    _In_opt_ PEXLATEOBJ pexlo,
+    _Out_writes_(cPixels) PULONG pulDest,
+    _In_reads_(cPixels) const ULONG *pulSource,
+    _In_ ULONG cPixels);
@@ -968,6 +968,7 @@ REGION_RegionOp(
     RECTL *r2BandEnd;                  /* End of current band in r2 */
     ULONG top;                         /* Top of non-overlapping band */
     ULONG bot;                         /* Bottom of non-overlapping band */
+    ULONG cjNeeded;                    /* Buffer size for the new region */
 
     /* Initialization:
      *  set r1, r2, r1End and r2End appropriately, preserve the important
@@ -988,17 +989,30 @@ REGION_RegionOp(
     /* Allocate a reasonable number of rectangles for the new region. The idea
      * is to allocate enough so the individual functions don't need to
      * reallocate and copy the array, which is time consuming, yet we don't
-     * have to worry about using too much memory. I hope to be able to
-     * nuke the Xrealloc() at the end of this function eventually. */
-    newReg->rdh.nRgnSize = max(reg1->rdh.nCount + 1, reg2->rdh.nCount) * 2 * sizeof(RECT);
+     * have to worry about using too much memory. */
+    cjNeeded = max(reg1->rdh.nCount + 1, reg2->rdh.nCount) * 2 * sizeof(RECT);
 
-    newReg->Buffer = ExAllocatePoolWithTag(PagedPool,
-                                           newReg->rdh.nRgnSize,
-                                           TAG_REGION);
-    if (newReg->Buffer == NULL)
+    /* If newReg is not a source of the operation, its current buffer can be
+     * reused when it is large enough. This keeps repeated operations into
+     * the same destination (like building up a visible region) from
+     * allocating and freeing a buffer every time. */
+    if ((newReg != reg1) && (newReg != reg2) &&
+        (oldRects != &newReg->rdh.rcBound) &&
+        (newReg->rdh.nRgnSize >= cjNeeded))
     {
-        newReg->rdh.nRgnSize = 0;
-        return FALSE;
+        oldRects = NULL;
+    }
+    else
+    {
+        newReg->rdh.nRgnSize = cjNeeded;
+        newReg->Buffer = ExAllocatePoolWithTag(PagedPool,
+                                               newReg->rdh.nRgnSize,
+                                               TAG_REGION);
+        if (newReg->Buffer == NULL)
+        {
+            newReg->rdh.nRgnSize = 0;
+            return FALSE;
+        }
     }
 
     /* Initialize ybot and ytop.
@@ -1173,8 +1187,10 @@ REGION_RegionOp(
      * rectangles in the region. This never goes to 0, however...
      *
      * Only do this stuff if the number of rectangles allocated is more than
-     * twice the number of rectangles in the region (a simple optimization...). */
-    if ((newReg->rdh.nRgnSize > (2 * newReg->rdh.nCount * sizeof(RECT))) &&
+     * four times the number of rectangles in the region. The buffer of a
+     * region that is used as a destination again can then usually be
+     * reused as it is (see above). */
+    if ((newReg->rdh.nRgnSize > (4 * newReg->rdh.nCount * sizeof(RECT))) &&
         (newReg->rdh.nCount > 2))
     {
         if (REGION_NOT_EMPTY(newReg))
@@ -1213,7 +1229,7 @@ REGION_RegionOp(
 
     newReg->rdh.iType = RDH_RECTANGLES;
 
-    if (oldRects != &newReg->rdh.rcBound)
+    if ((oldRects != NULL) && (oldRects != &newReg->rdh.rcBound))
         ExFreePoolWithTag(oldRects, TAG_REGION);
     return TRUE;
 }
@@ -2580,6 +2596,39 @@ IntGdiGetRgnBox(
     return ret;
 }
 
+/*!
+ *      Find the first rectangle of the band that contains or follows the
+ *      given y coordinate.
+ *
+ *      The rectangles of a region are sorted by band and all rectangles of
+ *      a band share the same top and bottom, so the bottoms never decrease
+ *      along the buffer and the band can be found with a binary search.
+ *
+ * Results:
+ *      Index of the first rectangle with a bottom greater than y, or
+ *      rdh.nCount if there is none.
+ */
+static
+ULONG
+FASTCALL
+REGION_FindBand(
+    _In_ PREGION prgn,
+    _In_ INT y)
+{
+    ULONG iLow = 0, iHigh = prgn->rdh.nCount, iMiddle;
+
+    while (iLow < iHigh)
+    {
+        iMiddle = iLow + (iHigh - iLow) / 2;
+        if (prgn->Buffer[iMiddle].bottom <= y)
+            iLow = iMiddle + 1;
+        else
+            iHigh = iMiddle;
+    }
+
+    return iLow;
+}
+
 BOOL
 FASTCALL
 REGION_PtInRegion(
@@ -2593,9 +2642,15 @@ REGION_PtInRegion(
     if (prgn->rdh.nCount > 0 && INRECT(prgn->rdh.rcBound, X, Y))
     {
         r =  prgn->Buffer;
-        for (i = 0; i < prgn->rdh.nCount; i++)
+
+        /* Only the band containing Y has to be looked at, and its
+         * rectangles are sorted from left to right */
+        for (i = REGION_FindBand(prgn, Y); i < prgn->rdh.nCount; i++)
         {
-            if (INRECT(r[i], X, Y))
+            if (r[i].top > Y || r[i].left > X)
+                break;
+
+            if (r[i].right > X)
                 return TRUE;
         }
     }
@@ -2639,8 +2694,9 @@ REGION_RectInRegion(
     /* This is (just) a useful optimization */
     if ((Rgn->rdh.nCount > 0) && EXTENTCHECK(&Rgn->rdh.rcBound, &rc))
     {
-        for (pCurRect = Rgn->Buffer, pRectEnd = pCurRect +
-                                                Rgn->rdh.nCount; pCurRect < pRectEnd; pCurRect++)
+        /* Skip the bands above the rectangle */
+        for (pCurRect = Rgn->Buffer + REGION_FindBand(Rgn, rc.top),
+             pRectEnd = Rgn->Buffer + Rgn->rdh.nCount; pCurRect < pRectEnd; pCurRect++)
         {
             if (pCurRect->bottom <= rc.top)
                 continue;             /* Not far enough down yet */
@@ -3078,6 +3134,7 @@ REGION_PtsToRegion(
             ExFreePoolWithTag(reg->Buffer, TAG_REGION);
     }
     reg->Buffer = temp;
+    reg->rdh.nRgnSize = numRects * sizeof(RECT);
 
     reg->rdh.nCount = numRects;
     CurPtBlock = FirstPtBlock;
@@ -1947,7 +1947,8 @@ NoAlpha:
                                NULL,
                                NULL,
                                NULL,
-                               rop4);
+                               rop4,
+                               COLORONCOLOR);
 
         EXLATEOBJ_vCleanup(&exlo);
 
@@ -1977,7 +1978,8 @@ NoAlpha:
                                    NULL,
                                    NULL,
                                    NULL,
-                                   rop4);
+                                   rop4,
+                                   COLORONCOLOR);
 
             EXLATEOBJ_vCleanup(&exlo);
 
@@ -2006,7 +2008,8 @@ NoAlpha:
                                    NULL,
                                    NULL,
                                    NULL,
-                                   rop4);
+                                   rop4,
+                                   COLORONCOLOR);
 
             EXLATEOBJ_vCleanup(&exlo);
 
@@ -9,30 +9,40 @@
 #include <win32k.h>
 DBG_DEFAULT_CHANNEL(UserWinpos);
 
-PREGION FASTCALL
-VIS_ComputeVisibleRegion(
+/*
+ * Computes the visible region of a window. If prclBound is given, only the
+ * part of the region inside that rectangle is computed. Windows that do not
+ * overlap the region built so far can't change it and are skipped without
+ * creating a region for them.
+ */
+static PREGION FASTCALL
+VIS_ComputeVisibleRegionInRect(
    PWND Wnd,
    BOOLEAN ClientArea,
    BOOLEAN ClipChildren,
-   BOOLEAN ClipSiblings)
+   BOOLEAN ClipSiblings,
+   const RECTL *prclBound)
 {
    PREGION VisRgn, ClipRgn;
    PWND PreviousWindow, CurrentWindow, CurrentSibling;
+   RECTL rcVis, rcClip;
 
    if (!Wnd || !(Wnd->style & WS_VISIBLE))
    {
       return NULL;
    }
 
-   VisRgn = NULL;
-
-   if (ClientArea)
+   rcVis = ClientArea ? Wnd->rcClient : Wnd->rcWindow;
+   if (prclBound)
    {
-      VisRgn = IntSysCreateRectpRgnIndirect(&Wnd->rcClient);
+      /* Leaves rcVis empty if they don't intersect */
+      RECTL_bIntersectRect(&rcVis, ClientArea ? &Wnd->rcClient : &Wnd->rcWindow, prclBound);
    }
-   else
+
+   VisRgn = IntSysCreateRectpRgnIndirect(&rcVis);
+   if (!VisRgn)
    {
-      VisRgn = IntSysCreateRectpRgnIndirect(&Wnd->rcWindow);
+      return NULL;
    }
 
    /*
@@ -72,7 +82,8 @@ VIS_ComputeVisibleRegion(
                  CurrentSibling != PreviousWindow )
          {
             if ((CurrentSibling->style & WS_VISIBLE) &&
-                !(CurrentSibling->ExStyle & WS_EX_TRANSPARENT))
+                !(CurrentSibling->ExStyle & WS_EX_TRANSPARENT) &&
+                RECTL_bIntersectRect(&rcClip, &CurrentSibling->rcWindow, &VisRgn->rdh.rcBound))
             {
                ClipRgn = IntSysCreateRectpRgnIndirect(&CurrentSibling->rcWindow);
                /* Combine it with the window region if available */
@@ -104,7 +115,8 @@ VIS_ComputeVisibleRegion(
       while (CurrentWindow)
       {
          if ((CurrentWindow->style & WS_VISIBLE) &&
-             !(CurrentWindow->ExStyle & WS_EX_TRANSPARENT))
+             !(CurrentWindow->ExStyle & WS_EX_TRANSPARENT) &&
+             RECTL_bIntersectRect(&rcClip, &CurrentWindow->rcWindow, &VisRgn->rdh.rcBound))
          {
             ClipRgn = IntSysCreateRectpRgnIndirect(&CurrentWindow->rcWindow);
             /* Combine it with the window region if available */
@@ -141,6 +153,52 @@ VIS_ComputeVisibleRegion(
    return VisRgn;
 }
 
+PREGION FASTCALL
+VIS_ComputeVisibleRegion(
+   PWND Wnd,
+   BOOLEAN ClientArea,
+   BOOLEAN ClipChildren,
+   BOOLEAN ClipSiblings)
+{
+   return VIS_ComputeVisibleRegionInRect(Wnd, ClientArea, ClipChildren, ClipSiblings, NULL);
+}
+
+/*
+ * Updates a previously computed visible region of a window after the
+ * windows in prclChanged (screen coordinates) were moved, shown, hidden or
+ * reordered. Only the part inside prclChanged is recomputed, the rest of
+ * VisRgn is kept. Returns FALSE if the region could not be updated; the
+ * caller must then compute the whole region again.
+ */
+BOOL FASTCALL
+VIS_bUpdateVisibleRegion(
+   PREGION VisRgn,
+   PWND Wnd,
+   BOOLEAN ClientArea,
+   BOOLEAN ClipChildren,
+   BOOLEAN ClipSiblings,
+   const RECTL *prclChanged)
+{
+   PREGION ChangedRgn;
+
+   ChangedRgn = VIS_ComputeVisibleRegionInRect(Wnd, ClientArea, ClipChildren, ClipSiblings, prclChanged);
+   if (!ChangedRgn)
+   {
+      /* The window is hidden now, or we ran out of memory */
+      return FALSE;
+   }
+
+   if (REGION_SubtractRectFromRgn(VisRgn, VisRgn, prclChanged) == ERROR ||
+       IntGdiCombineRgn(VisRgn, VisRgn, ChangedRgn, RGN_OR) == ERROR)
+   {
+      REGION_Delete(ChangedRgn);
+      return FALSE;
+   }
+
+   REGION_Delete(ChangedRgn);
+   return TRUE;
+}
+
 VOID FASTCALL
 co_VIS_WindowLayoutChanged(
    PWND Wnd,
@@ -10,6 +10,7 @@
 #pragma once
 
 PREGION FASTCALL VIS_ComputeVisibleRegion(PWND Window, BOOLEAN ClientArea, BOOLEAN ClipChildren, BOOLEAN ClipSiblings);
+BOOL FASTCALL VIS_bUpdateVisibleRegion(PREGION VisRgn, PWND Window, BOOLEAN ClientArea, BOOLEAN ClipChildren, BOOLEAN ClipSiblings, const RECTL *prclChanged);
 VOID FASTCALL co_VIS_WindowLayoutChanged(PWND Window, PREGION UncoveredRgn);
 
 /* EOF */
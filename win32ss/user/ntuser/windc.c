@@ -812,8 +812,78 @@ DceEmptyCache(VOID)
    }
 }
 
+/*
+ * Updates the visible region of a DCE in place, recomputing only the part
+ * inside prclChanged. Returns FALSE if the whole region has to be recomputed.
+ */
+static BOOL FASTCALL
+DceUpdateVisRgnInRect(DCE *Dce, PWND Window, const RECTL *prclChanged)
+{
+   PREGION RgnVisible;
+   PDC dc;
+   BOOL Ret;
+
+   /* The DCE clip region and parent clipping are applied on top of the
+      visible region of the window, those are not updated incrementally */
+   if (Dce->DCXFlags & (DCX_DCEDIRTY | DCX_PARENTCLIP | DCX_INTERSECTRGN | DCX_EXCLUDERGN))
+   {
+      return FALSE;
+   }
+
+   RgnVisible = IntSysCreateRectpRgn(0, 0, 0, 0);
+   if (!RgnVisible)
+   {
+      return FALSE;
+   }
+
+   dc = DC_LockDc(Dce->hDC);
+   if (!dc)
+   {
+      REGION_Delete(RgnVisible);
+      return FALSE;
+   }
+
+   /* The DC keeps its visible region relative to the DC origin */
+   Ret = REGION_bCopy(RgnVisible, dc->prgnVis) &&
+         REGION_bOffsetRgn(RgnVisible, dc->ptlDCOrig.x, dc->ptlDCOrig.y);
+   DC_UnlockDc(dc);
+
+   if (Ret)
+   {
+      Ret = VIS_bUpdateVisibleRegion(RgnVisible,
+                                     Window,
+                                     0 == (Dce->DCXFlags & DCX_WINDOW),
+                                     0 != (Dce->DCXFlags & DCX_CLIPCHILDREN),
+                                     0 != (Dce->DCXFlags & DCX_CLIPSIBLINGS),
+                                     prclChanged);
+   }
+
+   if (Ret)
+   {
+      GdiSelectVisRgn(Dce->hDC, RgnVisible);
+      /* Tell GDI driver */
+      IntEngWindowChanged(Window, WOC_RGN_CLIENT);
+   }
+
+   REGION_Delete(RgnVisible);
+   return Ret;
+}
+
 VOID FASTCALL
 DceResetActiveDCEs(PWND Window)
+{
+   DceResetActiveDCEsInRect(Window, NULL);
+}
+
+/*
+ * Resets the DCEs after Window was moved, sized, shown, hidden or reordered.
+ * If prclChanged is given, it bounds (in screen coordinates) the area where
+ * windows were covered or uncovered by the change. DCEs of other windows
+ * outside of it keep their visible region and the ones overlapping it only
+ * get that part recomputed.
+ */
+VOID FASTCALL
+DceResetActiveDCEsInRect(PWND Window, const RECTL *prclChanged)
 {
    DCE *pDCE;
    PDC dc;
@@ -821,6 +891,7 @@ DceResetActiveDCEs(PWND Window)
    INT DeltaX;
    INT DeltaY;
    PLIST_ENTRY ListEntry;
+   RECTL rcOverlap;
 
    if (NULL == Window)
    {
@@ -850,6 +921,25 @@ DceResetActiveDCEs(PWND Window)
             }
          }
 
+         if (prclChanged != NULL && CurrentWindow != NULL &&
+             Window != CurrentWindow && !IntIsChildWindow(Window, CurrentWindow))
+         {
+            /* The window did not move, so the visible region only changes
+               where it overlaps the changed area */
+            if (!(pDCE->DCXFlags & DCX_PARENTCLIP) &&
+                !RECTL_bIntersectRect(&rcOverlap, &CurrentWindow->rcWindow, prclChanged))
+            {
+               continue;
+            }
+
+            if (GreIsHandleValid(pDCE->hDC) &&
+                DceUpdateVisRgnInRect(pDCE, CurrentWindow, prclChanged))
+            {
+               IntGdiSetHookFlags(pDCE->hDC, DCHF_VALIDATEVISRGN);
+               continue;
+            }
+         }
+
          if (!GreIsHandleValid(pDCE->hDC) ||
              (dc = DC_LockDc(pDCE->hDC)) == NULL)
          {
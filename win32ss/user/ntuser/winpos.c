@@ -1808,7 +1808,7 @@ co_WinPosSetWindowPos(
    PREGION VisAfter = NULL;
    PREGION CopyRgn = NULL;
    ULONG WvrFlags = 0;
-   RECTL OldWindowRect, OldClientRect;
+   RECTL OldWindowRect, OldClientRect, ChangedRect;
    int RgnType;
    HDC Dc;
    RECTL CopyRect;
@@ -2013,7 +2013,10 @@ co_WinPosSetWindowPos(
                      NewWindowRect.top - OldWindowRect.top);
    }
 
-   DceResetActiveDCEs(Window); // For WS_VISIBLE changes.
+   /* For WS_VISIBLE changes. Other windows can only be covered or uncovered
+      where the window was or is now. */
+   RECTL_bUnionRect(&ChangedRect, &OldWindowRect, &NewWindowRect);
+   DceResetActiveDCEsInRect(Window, &ChangedRect);
 
    // Change or update, set send non-client paint flag.
    if ( Window->style & WS_VISIBLE &&